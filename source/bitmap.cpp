@@ -37,7 +37,7 @@ typedef struct PTCX_BITMAP_INFO_HEADER {
 
 #pragma pack(pop)
 
-bool LoadBitmap(const ::std::string& filename, ::std::vector<float32>* output, uint32 *width, uint32 *height) {
+bool LoadBitmap(const ::std::string& filename, ::std::vector<uint8>* output, uint32 *width, uint32 *height) {
   if (BASE_PARAM_CHECK) {
     if (filename.empty() || !output) {
       return false;
@@ -76,12 +76,12 @@ bool LoadBitmap(const ::std::string& filename, ::std::vector<float32>* output, u
   uint32 scanline_padding =
       greater_multiple(bih.width * 3, 4) - (bih.width * 3);
 
-  ::std::vector<uint8> one_texel_row;
-  one_texel_row.resize(bih.width * 3);
-  uint8* row_ptr = &one_texel_row.at(0);
   uint32 row_stride = bih.width * 3;
 
   for (uint32 i = 0; i < bih.height; i++) {
+    // Rows are read directly into the output buffer, which keeps the texel
+    // data in its compact 8 bit form.
+    uint8* row_ptr = &output->at(i * row_stride);
     if (!input_file.read((char*)row_ptr, row_stride)) {
         return false;
     }
@@ -91,13 +91,11 @@ bool LoadBitmap(const ::std::string& filename, ::std::vector<float32>* output, u
         return false;
     }
 
-    // Convert our integer texel data into float values, and
-    // store the result in our output buffer. Also swap the 
-    // R and B channels (as BMP stores its data in BGR).
+    // Swap the R and B channels (as BMP stores its data in BGR).
     for (uint32 j = 0; j < bih.width; j++) {
-      output->at(i * row_stride + j * 3 + 0) = row_ptr[j * 3 + 2] / 255.0f;
-      output->at(i * row_stride + j * 3 + 1) = row_ptr[j * 3 + 1] / 255.0f;
-      output->at(i * row_stride + j * 3 + 2) = row_ptr[j * 3 + 0] / 255.0f;
+      uint8 temp = row_ptr[j * 3 + 0];
+      row_ptr[j * 3 + 0] = row_ptr[j * 3 + 2];
+      row_ptr[j * 3 + 2] = temp;
     }
   }
 
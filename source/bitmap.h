@@ -38,8 +38,8 @@
 
 namespace base {
 
-// Loads a 24 bit RGB bitmap file into a vector.
-bool LoadBitmap(const ::std::string& filename, ::std::vector<float32> *output, uint32 *width, uint32 *height);
+// Loads a 24 bit RGB bitmap file into a vector of 8 bit RGB texels.
+bool LoadBitmap(const ::std::string& filename, ::std::vector<uint8> *output, uint32 *width, uint32 *height);
 
 }  // namespace base
 
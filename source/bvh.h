@@ -34,6 +34,7 @@
 
 #include <memory>
 #include <vector>
+#include "bvh_inspector.h"
 #include "math/base.h"
 #include "math/intersect.h"
 #include "math/scalar.h"
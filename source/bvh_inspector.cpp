@@ -0,0 +1,186 @@
+#include "bvh_inspector.h"
+#include <cstdio>
+#include <cstring>
+
+namespace base {
+
+namespace {
+
+const char* kLeafHistogramLabels[kBvhLeafHistogramSize] = {
+    "0",     "1",     "2",      "3-4",     "5-8",  "9-16",
+    "17-32", "33-64", "65-128", "129-256", "257+"};
+
+// Returns the extent of bounds along each axis, or zero for empty bounds.
+vector3 GetExtent(const bounds& aabb) {
+  vector3 extent = aabb.bounds_max - aabb.bounds_min;
+  return vector3(max(extent.x, 0.0f), max(extent.y, 0.0f),
+                 max(extent.z, 0.0f));
+}
+
+float64 GetSurfaceArea(const bounds& aabb) {
+  vector3 extent = GetExtent(aabb);
+  return 2.0 * (float64(extent.x) * extent.y + float64(extent.y) * extent.z +
+                float64(extent.z) * extent.x);
+}
+
+float64 GetVolume(const bounds& aabb) {
+  vector3 extent = GetExtent(aabb);
+  return float64(extent.x) * extent.y * extent.z;
+}
+
+// Returns the volume shared by two bounds.
+float64 GetOverlapVolume(const bounds& a, const bounds& b) {
+  bounds overlap;
+  overlap.bounds_min = vector3(max(a.bounds_min.x, b.bounds_min.x),
+                               max(a.bounds_min.y, b.bounds_min.y),
+                               max(a.bounds_min.z, b.bounds_min.z));
+  overlap.bounds_max = vector3(min(a.bounds_max.x, b.bounds_max.x),
+                               min(a.bounds_max.y, b.bounds_max.y),
+                               min(a.bounds_max.z, b.bounds_max.z));
+  return GetVolume(overlap);
+}
+
+uint32 GetHistogramBucket(uint32 primitive_count) {
+  uint32 bucket = 0;
+  uint32 limit = 0;
+  while (bucket < kBvhLeafHistogramSize - 1 && primitive_count > limit) {
+    limit = limit ? limit * 2 : 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+}  // namespace
+
+BvhQualityReport::BvhQualityReport()
+    : primitive_count(0),
+      reference_count(0),
+      interior_count(0),
+      leaf_count(0),
+      empty_leaf_count(0),
+      max_leaf_size(0),
+      sah_cost(0),
+      mean_overlap(0),
+      max_overlap(0) {
+  memset(leaf_histogram, 0, sizeof(leaf_histogram));
+}
+
+BvhInspector::BvhInspector(const ::std::string& name, float64 traversal_cost,
+                           float64 intersection_cost)
+    : traversal_cost_(traversal_cost),
+      intersection_cost_(intersection_cost),
+      root_area_(0),
+      weighted_area_(0),
+      overlap_sum_(0),
+      overlap_count_(0) {
+  report_.name = name;
+}
+
+void BvhInspector::AddNode(const bounds& aabb, uint32 depth, float64 cost,
+                           ::std::vector<uint64>* depth_counts) {
+  if (report_.interior_counts.size() <= depth) {
+    report_.interior_counts.resize(depth + 1, 0);
+    report_.leaf_counts.resize(depth + 1, 0);
+  }
+  depth_counts->at(depth)++;
+
+  // The root is visited first, and rays are assumed to reach it.
+  float64 area = GetSurfaceArea(aabb);
+  if (!report_.interior_count && !report_.leaf_count) {
+    root_area_ = area;
+  }
+  weighted_area_ += area * cost;
+}
+
+void BvhInspector::AddInteriorNode(const bounds& aabb, uint32 depth,
+                                   const bounds* child_bounds,
+                                   uint32 child_count) {
+  AddNode(aabb, depth, traversal_cost_, &report_.interior_counts);
+  report_.interior_count++;
+
+  float64 volume = GetVolume(aabb);
+  if (volume <= 0) {
+    return;
+  }
+
+  float64 overlap = 0;
+  for (uint32 i = 0; i < child_count; i++) {
+    for (uint32 j = i + 1; j < child_count; j++) {
+      overlap += GetOverlapVolume(child_bounds[i], child_bounds[j]);
+    }
+  }
+
+  overlap /= volume;
+  overlap_sum_ += overlap;
+  overlap_count_++;
+  report_.max_overlap = max(report_.max_overlap, overlap);
+}
+
+void BvhInspector::AddLeafNode(const bounds& aabb, uint32 depth,
+                               uint32 primitive_count) {
+  AddNode(aabb, depth, intersection_cost_ * primitive_count,
+          &report_.leaf_counts);
+  report_.leaf_count++;
+  report_.reference_count += primitive_count;
+  report_.max_leaf_size = max(report_.max_leaf_size, primitive_count);
+  report_.leaf_histogram[GetHistogramBucket(primitive_count)]++;
+  if (!primitive_count) {
+    report_.empty_leaf_count++;
+  }
+}
+
+BvhQualityReport BvhInspector::GetReport() const {
+  BvhQualityReport report = report_;
+  if (root_area_ > 0) {
+    report.sah_cost = weighted_area_ / root_area_;
+  }
+  if (overlap_count_) {
+    report.mean_overlap = overlap_sum_ / overlap_count_;
+  }
+  return report;
+}
+
+void PrintBvhQualityReport(const BvhQualityReport& report) {
+  printf("Tree quality for %s:\n", report.name.c_str());
+  if (!report.interior_count && !report.leaf_count) {
+    printf("  Empty tree.\n");
+    return;
+  }
+
+  float64 duplication = 0;
+  if (report.primitive_count) {
+    duplication = float64(report.reference_count) / report.primitive_count;
+  }
+  float64 empty_ratio = 0;
+  if (report.leaf_count) {
+    empty_ratio = float64(report.empty_leaf_count) / report.leaf_count;
+  }
+
+  printf("  %llu primitives, %llu references (duplication %.2fx).\n",
+         static_cast<unsigned long long>(report.primitive_count),
+         static_cast<unsigned long long>(report.reference_count),
+         duplication);
+  printf("  %llu interior nodes, %llu leaves (%.1f%% empty), depth %i.\n",
+         static_cast<unsigned long long>(report.interior_count),
+         static_cast<unsigned long long>(report.leaf_count),
+         empty_ratio * 100.0, (uint32)report.leaf_counts.size() - 1);
+  printf("  SAH cost %.3f, sibling overlap mean %.3f max %.3f.\n",
+         report.sah_cost, report.mean_overlap, report.max_overlap);
+
+  printf("  Nodes per depth:\n");
+  for (uint32 i = 0; i < report.leaf_counts.size(); i++) {
+    printf("    %2i %10llu interior %10llu leaves\n", i,
+           static_cast<unsigned long long>(report.interior_counts[i]),
+           static_cast<unsigned long long>(report.leaf_counts[i]));
+  }
+
+  printf("  Leaf sizes (max %i):\n", report.max_leaf_size);
+  for (uint32 i = 0; i < kBvhLeafHistogramSize; i++) {
+    if (report.leaf_histogram[i]) {
+      printf("    %7s %10llu leaves\n", kLeafHistogramLabels[i],
+             static_cast<unsigned long long>(report.leaf_histogram[i]));
+    }
+  }
+}
+
+}  // namespace base
@@ -0,0 +1,113 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __BVH_INSPECTOR_H__
+#define __BVH_INSPECTOR_H__
+
+#include <string>
+#include <vector>
+#include "math/base.h"
+#include "math/volume.h"
+
+namespace base {
+
+// Leaf occupancy histogram buckets: 0, 1, 2, 3-4, 5-8, ... 129-256, and
+// larger leaves.
+const uint32 kBvhLeafHistogramSize = 11;
+
+// Quality statistics of a built tree, used to compare builder changes.
+typedef struct BvhQualityReport {
+  ::std::string name;
+  // Primitives covered by the tree, and references to them from leaves.
+  // Spatial subdivision duplicates references to primitives that span
+  // several leaves.
+  uint64 primitive_count;
+  uint64 reference_count;
+  uint64 interior_count;
+  uint64 leaf_count;
+  uint64 empty_leaf_count;
+  uint32 max_leaf_size;
+  // Expected cost of tracing a random ray that hits the root bounds,
+  // relative to one primitive test (the surface area heuristic).
+  float64 sah_cost;
+  // Volume shared by the children of an interior node, relative to the
+  // node's own volume. Averaged over interior nodes with volume.
+  float64 mean_overlap;
+  float64 max_overlap;
+  // Node counts indexed by depth.
+  ::std::vector<uint64> interior_counts;
+  ::std::vector<uint64> leaf_counts;
+  uint64 leaf_histogram[kBvhLeafHistogramSize];
+  BvhQualityReport();
+} BvhQualityReport;
+
+// Accumulates the statistics of a tree as its nodes are visited. Trees
+// expose an Inspect method that records every node once, parents before
+// their children, starting with the root.
+class BvhInspector {
+ public:
+  // Costs of testing a ray against a node and against a primitive. The
+  // defaults weigh a node test at an eighth of a primitive test.
+  BvhInspector(const ::std::string& name, float64 traversal_cost = 0.125,
+               float64 intersection_cost = 1.0);
+  // Sets the number of distinct primitives covered by the tree.
+  void SetPrimitiveCount(uint64 count) { report_.primitive_count = count; }
+  // Records an interior node and the bounds of its children.
+  void AddInteriorNode(const bounds& aabb, uint32 depth,
+                       const bounds* child_bounds, uint32 child_count);
+  // Records a leaf that references primitive_count primitives.
+  void AddLeafNode(const bounds& aabb, uint32 depth, uint32 primitive_count);
+  // Returns the statistics of the nodes recorded so far.
+  BvhQualityReport GetReport() const;
+
+ private:
+  // Counts a node at depth, and adds its area to the root area or the
+  // cost sum.
+  void AddNode(const bounds& aabb, uint32 depth, float64 cost,
+               ::std::vector<uint64>* depth_counts);
+  float64 traversal_cost_;
+  float64 intersection_cost_;
+  float64 root_area_;
+  // Sum of node area times node cost, divided by the root area when the
+  // report is taken.
+  float64 weighted_area_;
+  float64 overlap_sum_;
+  uint64 overlap_count_;
+  BvhQualityReport report_;
+};
+
+// Prints a summary of the report on the console.
+void PrintBvhQualityReport(const BvhQualityReport& report);
+
+}  // namespace base
+
+#endif  // __BVH_INSPECTOR_H__
@@ -1,10 +1,16 @@
 
 #include "engine.h"
 #include <thread>
+#include "math/fast_math.h"
 #include "math/intersect.h"
 #include "math/random.h"
+#include "numa.h"
 #include "time.h"
 
+#if defined(BASE_PLATFORM_LINUX)
+#include <sys/time.h>
+#endif
+
 #if _DEBUG
 #define ENABLE_MULTITHREADING (0)
 #else
@@ -15,11 +21,29 @@ namespace base {
 
 const uint32 kMaximumTraceDepth = 8;
 const float32 kTraceStepObjectOffset = 0.03f;
+// Emitter resampling: candidates drawn per pixel, neighbors of the previous
+// pass reused within a radius (in pixels), and the cap on the candidates a
+// reused reservoir may represent, relative to a pixel's own candidates.
+const uint32 kLightCandidateCount = 8;
+const uint32 kSpatialReuseCount = 2;
+const float32 kSpatialReuseRadius = 8.0f;
+const uint32 kReservoirHistoryLimit = 8;
+
+// Position of a path relative to the vertices that gather caustic photons.
+// Emission that a gathering vertex reaches through caustic casters alone is
+// already carried by the photon map, and must not be counted again.
+enum CausticPath {
+  kCausticPathNone,
+  // The previous vertex gathered caustic photons.
+  kCausticPathGather,
+  // Only caustic casters lie between a gathering vertex and this step.
+  kCausticPathCaster,
+};
 
 uint64 GetSystemTime() {
 #if defined(BASE_PLATFORM_WINDOWS)
   return uint64(double(clock()) / CLOCKS_PER_SEC * 1000);
-#elif defined(BASE_PLATFORM_MACOSX)
+#elif defined(BASE_PLATFORM_MACOSX) || defined(BASE_PLATFORM_LINUX)
   timeval time;
   gettimeofday(&time, NULL);
   return (time.tv_sec * 1000) + (time.tv_usec / 1000);
@@ -38,6 +62,11 @@ ImagePlaneCache::ImagePlaneCache(uint32 width, uint32 height) {
   height_ = height;
 }
 
+uint64 ImagePlaneCache::GetMemorySize() const {
+  return collision_cache_.size() * sizeof(ObjectCollision) +
+         invalidation_cache_.size() / 8;
+}
+
 void ImagePlaneCache::Invalidate() {
   for (uint32 i = 0; i < width_ * height_; i++) {
     invalidation_cache_.at(i) = false;
@@ -56,9 +85,386 @@ ObjectCollision* ImagePlaneCache::FetchCollision(uint32 x, uint32 y) {
   return nullptr;
 }
 
+// Returns the density with which an indirect direction is sampled at a
+// vertex: that of the material alone, or its mixture with the guide when
+// guide is not nullptr.
+float32 IndirectPdf(const MaterialParams& material,
+                    const ShadingContext& context,
+                    const DirectionalTree* guide, const vector3& direction) {
+  float32 bsdf_pdf =
+      ShadePdf(material, context.view_dir, context.surface_normal, direction);
+  if (!guide) {
+    return bsdf_pdf;
+  }
+  return kGuideSamplingFraction * guide->Pdf(direction) +
+         (1.0f - kGuideSamplingFraction) * bsdf_pdf;
+}
+
+// Samples the sky directly from a shading point and returns its
+// contribution, weighted against indirect sampling with the power
+// heuristic. guide is the directional tree that indirect sampling mixes
+// with, or nullptr.
+vector3 SampleSkyLight(const Camera& viewer, Scene* scene,
+                       const MaterialParams& material,
+                       const ShadingContext& context,
+                       const DirectionalTree* guide) {
+  vector3 light_dir;
+  float32 light_pdf = 0.0f;
+  if (!scene->SampleSkyDirection(random_float(), random_float(), &light_dir,
+                                 &light_pdf)) {
+    return vector3();
+  }
+
+  vector3 reflectance =
+      ShadeEvaluate(material, context.view_dir, context.surface_normal,
+                    light_dir, context.surface_texcoords);
+  if (reflectance.x <= 0.0f && reflectance.y <= 0.0f &&
+      reflectance.z <= 0.0f) {
+    return vector3();
+  }
+
+  ray shadow_ray(context.sample_pos,
+                 context.sample_pos + light_dir * viewer.z_far);
+  vector3 offset = light_dir * kTraceStepObjectOffset;
+  shadow_ray.start += offset;
+  shadow_ray.dir -= offset;
+
+  // Media along the shadow ray attenuate rather than block the light.
+  ObjectCollision shadow_info;
+  shadow_info.skip_media = true;
+  if (scene->Trace(shadow_ray, &shadow_info)) {
+    return vector3();
+  }
+  float32 transmittance = scene->QueryTransmittance(shadow_ray);
+  if (transmittance <= 0.0f) {
+    return vector3();
+  }
+
+  float32 bsdf_pdf = IndirectPdf(material, context, guide, light_dir);
+  return reflectance * scene->SampleSky(context.depth + 1, light_dir) *
+         (transmittance * ShadePowerHeuristic(light_pdf, bsdf_pdf) /
+          light_pdf);
+}
+
+// Returns the fraction of light that travels from an emitter at distance
+// along direction to origin, or 0 if a surface blocks it.
+float32 QueryEmitterTransmittance(Scene* scene, const vector3& origin,
+                                  const vector3& direction,
+                                  float32 distance) {
+  // Stop the shadow ray just short of the emitter so that only occluders
+  // are reported.
+  if (distance <= 2.0f * kTraceStepObjectOffset) {
+    return 0.0f;
+  }
+  vector3 offset = direction * kTraceStepObjectOffset;
+  ray shadow_ray(origin + offset, origin + direction * distance - offset);
+
+  // Media along the shadow ray attenuate rather than block the light.
+  ObjectCollision shadow_info;
+  shadow_info.skip_media = true;
+  if (scene->Trace(shadow_ray, &shadow_info)) {
+    return 0.0f;
+  }
+  return scene->QueryTransmittance(shadow_ray);
+}
+
+// Samples an emitter from the scene light tree and returns its contribution,
+// weighted against indirect sampling with the power heuristic.
+vector3 SampleEmitterLight(Scene* scene, const MaterialParams& material,
+                           const ShadingContext& context,
+                           const DirectionalTree* guide) {
+  Object* light = nullptr;
+  vector3 light_dir;
+  float32 light_distance = 0.0f;
+  float32 light_pdf = 0.0f;
+  if (!scene->SampleLight(context.sample_pos, context.surface_normal,
+                          random_float(), random_float(), random_float(),
+                          &light, &light_dir, &light_distance, &light_pdf)) {
+    return vector3();
+  }
+
+  vector3 reflectance =
+      ShadeEvaluate(material, context.view_dir, context.surface_normal,
+                    light_dir, context.surface_texcoords);
+  if (reflectance.x <= 0.0f && reflectance.y <= 0.0f &&
+      reflectance.z <= 0.0f) {
+    return vector3();
+  }
+
+  float32 transmittance = QueryEmitterTransmittance(
+      scene, context.sample_pos, light_dir, light_distance);
+  if (transmittance <= 0.0f) {
+    return vector3();
+  }
+
+  ShadingContext light_context;
+  light_context.depth = context.depth + 1;
+  light_context.view_dir = light_dir;
+  vector3 emission =
+      ShadeSample(scene->GetMaterialParams(light->GetMaterial()),
+                  light_context);
+
+  float32 bsdf_pdf = IndirectPdf(material, context, guide, light_dir);
+  return reflectance * emission *
+         (transmittance * ShadePowerHeuristic(light_pdf, bsdf_pdf) /
+          light_pdf);
+}
+
+// Returns the light that sample sends toward the viewer of context, ignoring
+// occlusion. target receives its luminance, the density that light samples
+// are resampled toward.
+vector3 EvaluateLightSample(const MaterialParams& material,
+                            const ShadingContext& context,
+                            const LightSample& sample, float32* target) {
+  *target = 0.0f;
+  vector3 to_light = sample.point - context.sample_pos;
+  float32 distance2 = to_light.dot(to_light);
+  if (distance2 <= BASE_EPSILON) {
+    return vector3();
+  }
+  vector3 light_dir = to_light / sqrtf(distance2);
+  // Points on the far side of a closed emitter are hidden by the emitter.
+  float32 cosine = -sample.normal.dot(light_dir);
+  if (cosine <= 0.0f) {
+    return vector3();
+  }
+  // The geometry term converts the area density of the sample to the
+  // solid angle seen from the shading point.
+  float32 geometry = cosine / distance2;
+  vector3 contribution =
+      ShadeEvaluate(material, context.view_dir, context.surface_normal,
+                    light_dir, context.surface_texcoords) *
+      sample.emission * geometry;
+  *target = max(ShadeLuminance(contribution), 0.0f);
+  return contribution;
+}
+
+// Returns true if a reservoir of the previous pass was built for a surface
+// similar enough to that of context to share its light samples.
+bool IsReservoirReusable(const LightReservoir& reservoir,
+                         const ShadingContext& context, float32 depth) {
+  return reservoir.surface_depth > 0.0f &&
+         reservoir.surface_normal.dot(context.surface_normal) > 0.9f &&
+         fabs(reservoir.surface_depth - depth) < 0.1f * depth;
+}
+
+// Returns a cheap estimate of the density toward which a surface at point
+// with normal resamples sample, ignoring its material. Zero if the surface
+// could not have drawn sample.
+float32 EstimateLightDensity(const vector3& point, const vector3& normal,
+                             const LightSample& sample) {
+  vector3 to_light = sample.point - point;
+  float32 distance2 = to_light.dot(to_light);
+  float32 surface_cosine = normal.dot(to_light);
+  float32 light_cosine = -sample.normal.dot(to_light);
+  if (distance2 <= BASE_EPSILON || surface_cosine <= 0.0f ||
+      light_cosine <= 0.0f) {
+    return 0.0f;
+  }
+  return surface_cosine * light_cosine / (distance2 * distance2);
+}
+
+// Returns the share of sample that belongs to the index-th of the surfaces
+// whose reservoirs are combined (balance heuristic over their candidates).
+float32 GetCombinationWeight(const LightSample& sample, uint32 index,
+                             const vector3* points, const vector3* normals,
+                             const uint32* sample_counts, uint32 count) {
+  float32 own_density = 0.0f;
+  float32 total_density = 0.0f;
+  for (uint32 i = 0; i < count; i++) {
+    float32 density =
+        sample_counts[i] * EstimateLightDensity(points[i], normals[i], sample);
+    total_density += density;
+    if (i == index) {
+      own_density = density;
+    }
+  }
+  return total_density > 0.0f ? own_density / total_density : 0.0f;
+}
+
+// Returns the candidate count a reused reservoir is trusted with, so that
+// a long history does not drown out fresh candidates.
+uint32 GetReusedSampleCount(const LightReservoir& reservoir) {
+  return min(reservoir.sample_count,
+             kReservoirHistoryLimit * kLightCandidateCount);
+}
+
+// Draws an emitter sample from the scene light tree for the surface of
+// context. pdf receives the area density of the sampled point, so that the
+// sample may be evaluated from other surfaces.
+bool SampleLightCandidate(Scene* scene, const ShadingContext& context,
+                          LightSample* sample, float32* pdf) {
+  vector3 light_dir;
+  float32 light_distance = 0.0f;
+  float32 light_pdf = 0.0f;
+  if (!scene->SampleLight(context.sample_pos, context.surface_normal,
+                          random_float(), random_float(), random_float(),
+                          &sample->light, &light_dir, &light_distance,
+                          &light_pdf)) {
+    return false;
+  }
+
+  // The light tree only reports a direction, so find the surface normal by
+  // tracing the emitter alone.
+  ObjectCollision light_info;
+  ray light_ray(context.sample_pos,
+                context.sample_pos + light_dir * (light_distance * 2.0f));
+  if (!sample->light->Trace(light_ray, &light_info)) {
+    return false;
+  }
+  sample->point = light_info.point;
+  sample->normal = light_info.surface_normal;
+  if (sample->normal.dot(light_dir) > 0.0f) {
+    sample->normal = sample->normal * -1.0f;
+  }
+  vector3 to_light = sample->point - context.sample_pos;
+  float32 distance2 = to_light.dot(to_light);
+  float32 cosine = -sample->normal.dot(light_dir);
+  if (distance2 <= BASE_EPSILON || cosine <= BASE_EPSILON) {
+    return false;
+  }
+  *pdf = light_pdf * cosine / distance2;
+
+  ShadingContext light_context;
+  light_context.depth = context.depth + 1;
+  light_context.view_dir = light_dir;
+  sample->emission = ShadeSample(
+      scene->GetMaterialParams(sample->light->GetMaterial()), light_context);
+  return true;
+}
+
+// Estimates the emitter light at a primary hit by resampling. Candidates
+// are drawn from the light tree and resampled toward their unshadowed
+// contribution, then combined with the reservoirs that this and nearby
+// pixels kept in the previous pass. Reusing neighbors shares good samples
+// among pixels, so many-light scenes look clean after a few passes. Reused
+// samples are not retested for visibility at this pixel, which slightly
+// darkens soft shadow edges in exchange for a single shadow ray.
+vector3 SampleEmitterReservoir(Scene* scene, const MaterialParams& material,
+                               const ShadingContext& context,
+                               LightReservoirBuffer* reservoirs, uint32 x,
+                               uint32 y) {
+  float32 depth = context.sample_pos.distance(context.view_pos);
+  LightReservoir initial;
+  for (uint32 i = 0; i < kLightCandidateCount; i++) {
+    initial.sample_count++;
+    LightSample candidate;
+    float32 pdf = 0.0f;
+    if (!SampleLightCandidate(scene, context, &candidate, &pdf)) {
+      continue;
+    }
+    float32 target = 0.0f;
+    EvaluateLightSample(material, context, candidate, &target);
+    initial.Update(candidate, target / pdf, target, random_float());
+  }
+  initial.Finalize(initial.sample_count);
+
+  // Occluded samples are dropped before they are shared with neighbors.
+  if (initial.contribution_weight > 0.0f) {
+    vector3 to_light = initial.sample.point - context.sample_pos;
+    float32 distance = to_light.length();
+    if (QueryEmitterTransmittance(scene, context.sample_pos,
+                                  to_light / distance, distance) <= 0.0f) {
+      initial.contribution_weight = 0.0f;
+    }
+  }
+
+  // This pixel comes first among the reservoirs to combine.
+  const LightReservoir* sources[1 + 1 + kSpatialReuseCount] = {&initial};
+  vector3 points[1 + 1 + kSpatialReuseCount] = {context.sample_pos};
+  vector3 normals[1 + 1 + kSpatialReuseCount] = {context.surface_normal};
+  uint32 sample_counts[1 + 1 + kSpatialReuseCount] = {initial.sample_count};
+  uint32 source_count = 1;
+
+  const LightReservoir* previous = reservoirs->GetPrevious(x, y);
+  const LightReservoir* reused[1 + kSpatialReuseCount] = {previous};
+  for (uint32 i = 0; i <= kSpatialReuseCount; i++) {
+    if (i > 0) {
+      float32 offset_x = kSpatialReuseRadius * (random_float() * 2.0f - 1.0f);
+      float32 offset_y = kSpatialReuseRadius * (random_float() * 2.0f - 1.0f);
+      reused[i] = reservoirs->GetPrevious(int32(x) + int32(offset_x),
+                                          int32(y) + int32(offset_y));
+      if (reused[i] == previous) {
+        continue;
+      }
+    }
+    if (reused[i] && IsReservoirReusable(*reused[i], context, depth)) {
+      sources[source_count] = reused[i];
+      points[source_count] = reused[i]->surface_point;
+      normals[source_count] = reused[i]->surface_normal;
+      sample_counts[source_count] = GetReusedSampleCount(*reused[i]);
+      source_count++;
+    }
+  }
+
+  // Each reservoir contributes its sample weighted by its share of the
+  // candidates that could have drawn it. Normalizing by candidate count
+  // instead would darken pixels that see a part of an emitter hidden from
+  // their neighbors, and let samples at the rim of an emitter, which the
+  // neighbor drew with a tiny density, turn into fireflies.
+  LightReservoir reservoir;
+  for (uint32 i = 0; i < source_count; i++) {
+    const LightReservoir& source = *sources[i];
+    float32 target = source.target;
+    if (i > 0) {
+      EvaluateLightSample(material, context, source.sample, &target);
+    }
+    float32 share = GetCombinationWeight(source.sample, i, points, normals,
+                                         sample_counts, source_count);
+    reservoir.Update(source.sample,
+                     share * target * source.contribution_weight, target,
+                     random_float());
+    reservoir.sample_count += sample_counts[i];
+  }
+  reservoir.Finalize(1);
+
+  vector3 output;
+  if (reservoir.contribution_weight > 0.0f) {
+    float32 target = 0.0f;
+    vector3 contribution =
+        EvaluateLightSample(material, context, reservoir.sample, &target);
+    vector3 to_light = reservoir.sample.point - context.sample_pos;
+    float32 distance = to_light.length();
+    float32 transmittance = QueryEmitterTransmittance(
+        scene, context.sample_pos, to_light / distance, distance);
+    if (transmittance > 0.0f) {
+      output = contribution * (transmittance * reservoir.contribution_weight);
+    } else {
+      reservoir.contribution_weight = 0.0f;
+    }
+  }
+
+  reservoir.surface_point = context.sample_pos;
+  reservoir.surface_normal = context.surface_normal;
+  reservoir.surface_depth = depth;
+  reservoirs->SetCurrent(x, y, reservoir);
+  return output;
+}
+
+// parent is the shading context of the previous path vertex if it sampled
+// lights directly, in which case emission reached by this step is weighted
+// against those direct samples. It is nullptr otherwise.
+//
+// If guide is not nullptr, indirect directions at evaluable surfaces are
+// drawn from a mixture of the material and the guide's learned incident
+// radiance, and the radiance found is recorded back into the guide.
+//
+// If radiance_cache is not nullptr, diffuse vertices record the radiance
+// leaving them, and paths reaching a diffuse vertex of kRadianceCacheDepth
+// or deeper end with the cached radiance when it is available.
+//
+// If photon_map is not nullptr, evaluable surfaces gather caustics from it
+// and caustic_path tracks the paths whose emission it already includes.
+//
+// If reservoirs is not nullptr, emitter light at primary hits is estimated
+// by resampling with reuse across pixels and passes.
 vector3 TraceStep(const Camera& viewer, const ray* trajectory, Scene* scene,
                   vector3* hit_position, uint32 depth, uint32 x, uint32 y,
-                  ImagePlaneCache* cache, TraceResult* result) {
+                  ImagePlaneCache* cache, PathGuide* guide,
+                  RadianceCache* radiance_cache, const PhotonMap* photon_map,
+                  LightReservoirBuffer* reservoirs, TraceResult* result,
+                  const ShadingContext* parent = nullptr,
+                  CausticPath caustic_path = kCausticPathNone) {
   if (depth >= kMaximumTraceDepth) {
     return vector3(0, 0, 0);
   }
@@ -89,8 +495,14 @@ vector3 TraceStep(const Camera& viewer, const ray* trajectory, Scene* scene,
       if (hit_position) {
         (*hit_position) = trajectory->stop;
       }
-      vector3 output = scene->SampleSky(
-          depth, (trajectory->stop - trajectory->start).normalize());
+      vector3 sky_dir = (trajectory->stop - trajectory->start).normalize();
+      vector3 output = scene->SampleSky(depth, sky_dir);
+      if (parent && scene->IsSkySamplingEnabled()) {
+        // The previous vertex also sampled the sky directly, so this path
+        // is weighted against that strategy.
+        output *= ShadePowerHeuristic(parent->light_pdf,
+                                      scene->SkyPdf(sky_dir));
+      }
       if (depth == 0) {
         result->color = output;
         result->normal = trajectory->dir.normalize();
@@ -113,9 +525,54 @@ vector3 TraceStep(const Camera& viewer, const ray* trajectory, Scene* scene,
 
   vector3 view_vector = (collision_info.point - trajectory->start).normalize();
 
-  // From the material we gather the reflection vector to sample indirect light.
-  vector3 reflection_vector = collision_info.surface_material->Reflection(
-      view_vector, collision_info.surface_normal, collision_info.is_internal);
+  // Shading reads the packed material parameters directly, which keeps the
+  // per-hit work free of virtual dispatch.
+  const MaterialParams& material =
+      scene->GetMaterialParams(collision_info.surface_material);
+
+  bool is_cacheable = radiance_cache && !viewer.fast_render_enabled &&
+                      material.type == kMaterialTypeDiffuse;
+  float32 view_distance = collision_info.point.distance(viewer.origin);
+  if (is_cacheable && depth >= kRadianceCacheDepth) {
+    vector3 cached_radiance;
+    if (radiance_cache->Query(collision_info.point,
+                              collision_info.surface_normal, view_distance,
+                              &cached_radiance)) {
+      return cached_radiance;
+    }
+  }
+
+  ShadingContext context;
+  context.view_dir = view_vector;
+  context.surface_normal = collision_info.surface_normal;
+
+  GuideRegion* guide_region = nullptr;
+  const DirectionalTree* guide_tree = nullptr;
+  if (guide && !viewer.fast_render_enabled && ShadeCanEvaluate(material) &&
+      material.type != kMaterialTypeMedium) {
+    guide_region = guide->FindRegion(collision_info.point);
+    if (guide_region->CanSample()) {
+      guide_tree = &guide_region->sampling_tree;
+    }
+  }
+
+  // From the material (or the guide) we gather the reflection vector to
+  // sample indirect light, along with the density it was sampled with.
+  vector3 reflection_vector;
+  if (!guide_tree) {
+    reflection_vector =
+        ShadeReflection(material, view_vector, collision_info.surface_normal,
+                        &context.light_pdf);
+  } else {
+    if (random_float() < kGuideSamplingFraction) {
+      reflection_vector = guide_tree->Sample(random_float(), random_float());
+    } else {
+      reflection_vector =
+          ShadeReflection(material, view_vector, collision_info.surface_normal);
+    }
+    context.light_pdf =
+        IndirectPdf(material, context, guide_tree, reflection_vector);
+  }
 
   ray reflection_ray(collision_info.point,
                      collision_info.point + reflection_vector * viewer.z_far);
@@ -126,32 +583,102 @@ vector3 TraceStep(const Camera& viewer, const ray* trajectory, Scene* scene,
   reflection_ray.start += offset;
   reflection_ray.dir -= offset;
 
-  vector3 indirect_origin;
-  vector3 indirect_contribution;
+  context.depth = depth;
+  context.sample_pos = collision_info.point;
+  context.view_pos = trajectory->start;
+  context.light_dir = reflection_vector;
+  context.surface_texcoords = collision_info.surface_texcoords;
+  context.is_internal = collision_info.is_internal;
+
+  // Sample the sky and emitters directly when the material can evaluate
+  // arbitrary light directions. The indirect ray then carries this context
+  // so that paths reaching a light can be weighted against the direct
+  // samples.
+  vector3 direct_contribution;
+  const ShadingContext* indirect_parent = nullptr;
+  if (!viewer.fast_render_enabled && ShadeCanEvaluate(material)) {
+    if (scene->IsSkySamplingEnabled()) {
+      direct_contribution +=
+          SampleSkyLight(viewer, scene, material, context, guide_tree);
+    }
+    if (scene->IsLightSamplingEnabled()) {
+      if (reservoirs && depth == 0 && material.type != kMaterialTypeMedium) {
+        direct_contribution +=
+            SampleEmitterReservoir(scene, material, context, reservoirs, x, y);
+        context.is_light_resampled = true;
+      } else {
+        direct_contribution +=
+            SampleEmitterLight(scene, material, context, guide_tree);
+      }
+    }
+    indirect_parent = &context;
+  }
+
+  CausticPath indirect_caustic_path = kCausticPathNone;
+  if (photon_map && photon_map->IsValid() && !viewer.fast_render_enabled &&
+      ShadeCanEvaluate(material) && material.type != kMaterialTypeMedium) {
+    direct_contribution += photon_map->Gather(material, context);
+    indirect_caustic_path = kCausticPathGather;
+  } else if (caustic_path != kCausticPathNone &&
+             ShadeIsCausticCaster(material)) {
+    indirect_caustic_path = kCausticPathCaster;
+  }
+
   // Only trace further into the scene if the current material and sampling
   // vectors will actually make use of indirect light.
-  if (collision_info.surface_material->WillUseIndirectLight(
-          reflection_vector, collision_info.surface_normal)) {
-    indirect_contribution =
-        TraceStep(viewer, &reflection_ray, scene, &indirect_origin, depth + 1,
-                  x, y, cache, result);
+  if (ShadeWillUseIndirectLight(material, reflection_vector,
+                                collision_info.surface_normal)) {
+    context.light_color =
+        TraceStep(viewer, &reflection_ray, scene, &context.light_pos,
+                  depth + 1, x, y, cache, guide, radiance_cache, photon_map,
+                  reservoirs, result, indirect_parent, indirect_caustic_path);
+    if (guide_region && context.light_pdf > 0.0f) {
+      float32 radiance =
+          ShadeLuminance(context.light_color) / context.light_pdf;
+      if (radiance >= 0.0f && radiance < BASE_INFINITY) {
+        guide_region->Record(reflection_vector, radiance);
+      }
+    }
   }
 
   // Compute the final material contribution.
-  vector3 output = collision_info.surface_material->Sample(
-      depth, collision_info.point, trajectory->start, view_vector,
-      indirect_origin, reflection_vector, indirect_contribution,
-      collision_info.surface_normal, collision_info.surface_texcoords,
-      collision_info.is_internal);
+  vector3 output = ShadeSample(material, context) + direct_contribution;
+
+  bool is_sampled_light =
+      ShadeIsLight(material) && collision_info.surface_object &&
+      collision_info.surface_object->GetLightIndex() != kInvalidLightIndex;
+  if (caustic_path == kCausticPathCaster && is_sampled_light) {
+    // Photons from this emitter carry the light to the gathering vertex.
+    output = vector3();
+  } else if (parent && parent->is_light_resampled && is_sampled_light) {
+    // The reservoir of the previous vertex carries all of its emitter light.
+    output = vector3();
+  } else if (parent && is_sampled_light) {
+    // The previous vertex may also have sampled this emitter directly.
+    float32 light_pdf = scene->LightPdf(
+        parent->sample_pos, parent->surface_normal,
+        collision_info.surface_object, view_vector,
+        collision_info.point.distance(parent->sample_pos));
+    output *= ShadePowerHeuristic(parent->light_pdf, light_pdf);
+  }
+
+  // Diffuse surfaces reflect the same radiance toward every viewer, so the
+  // estimate is shared with other paths reaching this cell.
+  if (is_cacheable && output.x >= 0.0f && output.y >= 0.0f &&
+      output.z >= 0.0f && ShadeLuminance(output) < BASE_INFINITY) {
+    radiance_cache->Record(collision_info.point,
+                           collision_info.surface_normal, view_distance,
+                           output);
+  }
 
   if (depth == 0) {
     // Check if our output color requires tone mapping into our visible range.
-    if (output.length() > 10.0 && collision_info.surface_material->IsLight()) {
+    if (output.length() > 10.0 && ShadeIsLight(material)) {
       output = output.normalize() * 10.0;
     }
     result->color = output;
     result->normal = collision_info.surface_normal;
-    result->material_id = collision_info.surface_material->GetID();
+    result->material_id = material.id;
     result->depth = collision_info.point.distance(trajectory->start);
   }
 
@@ -159,27 +686,43 @@ vector3 TraceStep(const Camera& viewer, const ray* trajectory, Scene* scene,
 }
 
 void TracePixel(const Camera& viewer, Scene* scene, ray* trajectory, uint32 x,
-                uint32 y, ImagePlaneCache* cache, TraceResult* result) {
-  TraceStep(viewer, trajectory, scene, nullptr, 0, x, y, cache, result);
+                uint32 y, ImagePlaneCache* cache, PathGuide* guide,
+                RadianceCache* radiance_cache, const PhotonMap* photon_map,
+                LightReservoirBuffer* reservoirs, TraceResult* result) {
+  // First hits are stochastic within participating media, so they cannot
+  // be cached.
+  if (scene->HasParticipatingMedia()) {
+    cache = nullptr;
+  }
+  TraceStep(viewer, trajectory, scene, nullptr, 0, x, y, cache, guide,
+            radiance_cache, photon_map, reservoirs, result);
 }
 
+// Renders the band of rows for thread_index. If worker_cpu is not
+// negative, the thread is pinned to that processor and first touches the
+// frame rows it renders, so that they are held on its memory node.
 void TraceThreadFunction(const Camera& viewer, Scene* scene,
                          DisplayFrame* output, ImagePlaneCache* cache,
-                         uint32 thread_index,
+                         PathGuide* guide, RadianceCache* radiance_cache,
+                         const PhotonMap* photon_map,
+                         LightReservoirBuffer* reservoirs, uint32 thread_index,
+                         int32 worker_cpu,
                          ::std::vector<uint32>* thread_ray_count) {
   float32 width = output->GetWidth();
   float32 height = output->GetHeight();
   float32 aspect_ratio = width / height;
 #if ENABLE_MULTITHREADING
-  float32 bin_height = height / ::std::thread::hardware_concurrency();
+  uint32 thread_count = ::std::thread::hardware_concurrency();
 #else
-  float32 bin_height = height;
+  uint32 thread_count = 1;
 #endif
 
   set_seed(GetSystemTime());
 
-  float32 y_start = bin_height * thread_index;
-  float32 y_stop = bin_height * (thread_index + 1);
+  // Bands are split on whole rows so that no two threads write the same
+  // pixel, reservoir or cache entry.
+  uint32 y_start = output->GetHeight() * thread_index / thread_count;
+  uint32 y_stop = output->GetHeight() * (thread_index + 1) / thread_count;
 
   float32 fovy = viewer.fov_y * BASE_PI / 180.0;
   float32 fovx = 2.0 * atan(tan(fovy * 0.5) * aspect_ratio);
@@ -196,13 +739,12 @@ void TraceThreadFunction(const Camera& viewer, Scene* scene,
       calculate_plane(forward_vector * -1.0f,
                       viewer.origin + forward_vector * viewer.focal_depth);
 
-#if ENABLE_MULTITHREADING
-  if (thread_index == ::std::thread::hardware_concurrency() - 1) {
-    y_stop = height;
+  if (worker_cpu >= 0 && PinCurrentThread(worker_cpu)) {
+    output->TouchRows(y_start, y_stop);
   }
-#endif
 
-  for (float32 j = y_start; j < y_stop; j++)
+  for (uint32 y = y_start; y < y_stop; y++) {
+    float32 j = y;
     for (float32 i = 0; i < width; i++) {
       // Basic antialiasing: apply a small jitter (up to half pixel distance) to
       // our ray to help smooth out high frequency object and texel data from
@@ -231,9 +773,11 @@ void TraceThreadFunction(const Camera& viewer, Scene* scene,
           float32 random_angle = random_float() * 2.0 * BASE_PI;
           float32 random_magnitude =
               sqrtf(random_float()) * viewer.aperture_size;
+          float32 sin_angle, cos_angle;
+          fast_sincos(random_angle, &sin_angle, &cos_angle);
           vector3 random_offset =
-              right_vector * cos(random_angle) * random_magnitude +
-              up_vector * sin(random_angle) * random_magnitude;
+              right_vector * cos_angle * random_magnitude +
+              up_vector * sin_angle * random_magnitude;
 
           trajectory.start += random_offset;
           trajectory.stop =
@@ -244,29 +788,49 @@ void TraceThreadFunction(const Camera& viewer, Scene* scene,
       }
 
       TraceResult result;
-      TracePixel(viewer, scene, &trajectory, i, j, cache, &result);
+      TracePixel(viewer, scene, &trajectory, i, j, cache, guide,
+                 radiance_cache, photon_map, reservoirs, &result);
       thread_ray_count->at(thread_index) += result.ray_count;
       output->WritePixel(result, i, j);
     }
+  }
 }
 
 void TraceScene(const Camera& viewer, Scene* scene, DisplayFrame* output,
-                ImagePlaneCache* cache) {
+                ImagePlaneCache* cache, PathGuide* guide,
+                RadianceCache* radiance_cache, PhotonMap* photon_map,
+                LightReservoirBuffer* reservoirs) {
   static uint32 frame_counter = 0;
   uint64 frame_start_time = GetSystemTime();
 
+  // Each pass gathers from fresh photons with a smaller radius.
+  if (photon_map && !viewer.fast_render_enabled) {
+    photon_map->TracePass(scene);
+  }
+
   // fixme: avoid recreating threads each frame. This is fine for now because
   //        we're spending the overwhelming part of the frame elsewhere, but
   //        this should eventually be cleaned up.
 #if ENABLE_MULTITHREADING
+  // Workers are only pinned on machines with several memory nodes, where
+  // the rows of each node's workers are kept in that node's memory.
+  const NumaTopology& topology = NumaTopology::Get();
+  bool is_numa_enabled = topology.GetNodeCount() > 1;
+  ::std::vector<uint32> worker_cpus;
+  ::std::vector<uint32> worker_nodes;
+  topology.PlaceWorkers(::std::thread::hardware_concurrency(), &worker_cpus,
+                        &worker_nodes);
+
   ::std::vector<::std::thread> thread_list;
   ::std::vector<uint32> thread_ray_count;
   thread_ray_count.resize(::std::thread::hardware_concurrency());
   for (uint32 thread_idx = 0;
        thread_idx < ::std::thread::hardware_concurrency(); thread_idx++) {
     thread_ray_count[thread_idx] = 0;
+    int32 worker_cpu = is_numa_enabled ? worker_cpus[thread_idx] : -1;
     thread_list.emplace_back(&TraceThreadFunction, viewer, scene, output, cache,
-                             thread_idx, &thread_ray_count);
+                             guide, radiance_cache, photon_map, reservoirs,
+                             thread_idx, worker_cpu, &thread_ray_count);
   }
 
   for (auto& thread_ : thread_list) {
@@ -276,10 +840,23 @@ void TraceScene(const Camera& viewer, Scene* scene, DisplayFrame* output,
   ::std::vector<uint32> thread_ray_count;
   thread_ray_count.resize(1);
   thread_ray_count[0] = 0;
-  TraceThreadFunction(viewer, scene, max_bounces, output, cache, 0,
+  TraceThreadFunction(viewer, scene, max_bounces, output, cache, guide,
+                      radiance_cache, photon_map, reservoirs, 0, -1,
                       &thread_ray_count);
 #endif
 
+  // The guide, reservoirs and radiance cache are only updated between
+  // passes, while no thread reads them.
+  if (guide && !viewer.fast_render_enabled) {
+    guide->EndPass();
+  }
+  if (radiance_cache && !viewer.fast_render_enabled) {
+    radiance_cache->EndPass();
+  }
+  if (reservoirs && !viewer.fast_render_enabled) {
+    reservoirs->EndPass();
+  }
+
   uint32 frame_elapsed_time = GetElapsedTimeMs(frame_start_time);
   if (!viewer.fast_render_enabled) {
     float32 frame_sec = frame_elapsed_time / 1000.0f;
@@ -290,6 +867,23 @@ void TraceScene(const Camera& viewer, Scene* scene, DisplayFrame* output,
 
     printf("Frame %i render time: %.2f sec. Mrays/sec: %.2f\n", frame_counter++,
            frame_sec, (total_frame_rays) / (1000000.0f * frame_sec));
+
+#if ENABLE_MULTITHREADING
+    if (is_numa_enabled) {
+      for (uint32 node = 0; node < topology.GetNodeCount(); node++) {
+        uint32 node_rays = 0;
+        uint32 node_workers = 0;
+        for (uint32 i = 0; i < thread_ray_count.size(); i++) {
+          if (worker_nodes[i] == node) {
+            node_rays += thread_ray_count[i];
+            node_workers++;
+          }
+        }
+        printf("  Node %i: %i workers, Mrays/sec: %.2f\n", node,
+               node_workers, node_rays / (1000000.0f * frame_sec));
+      }
+    }
+#endif
   }
 
   output->SetFrameCount(frame_counter);
@@ -35,9 +35,13 @@
 #include <string>
 #include "camera.h"
 #include "frame.h"
+#include "light_reservoir.h"
 #include "material.h"
 #include "math/base.h"
 #include "object.h"
+#include "path_guide.h"
+#include "photon_map.h"
+#include "radiance_cache.h"
 #include "scene.h"
 
 namespace base {
@@ -53,6 +57,8 @@ class ImagePlaneCache {
   // Fetches a cached collision at a given pixel. Returns nullptr if
   // the pixel does not have a cached entry.
   ObjectCollision* FetchCollision(uint32 x, uint32 y);
+  // Returns the bytes held by the cache.
+  uint64 GetMemorySize() const;
 
  private:
   // Cache of previously computed per-pixel scene collisions.
@@ -71,8 +77,18 @@ float32 TraceRange(const Camera& viewer, Scene* scene, DisplayFrame* frame,
 // Traces the scene from the perspective of view, and deposits the results
 // in the output frame. This method will never clear the output frame, so
 // it is the responsibility of the caller to coordinate changes of frame.
+// If guide is not nullptr, indirect sampling is guided by and trains it,
+// and each call ends one of its passes. If radiance_cache is not nullptr,
+// diffuse paths are populated into and terminated by it. If photon_map is
+// not nullptr, each call traces a pass of its photons and caustics are
+// gathered from them. If reservoirs is not nullptr, it must match the size
+// of output, and emitter light at primary hits is resampled with reuse
+// across neighboring pixels and passes.
 void TraceScene(const Camera& view, Scene* scene, DisplayFrame* output,
-                ImagePlaneCache* cache = nullptr);
+                ImagePlaneCache* cache = nullptr, PathGuide* guide = nullptr,
+                RadianceCache* radiance_cache = nullptr,
+                PhotonMap* photon_map = nullptr,
+                LightReservoirBuffer* reservoirs = nullptr);
 
 }  // namespace base
 
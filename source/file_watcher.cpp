@@ -0,0 +1,121 @@
+
+#include "file_watcher.h"
+#include <sys/stat.h>
+#include <cstdio>
+
+#if defined(BASE_PLATFORM_LINUX)
+#include <sys/inotify.h>
+#endif
+
+namespace base {
+
+FileWatcher::FileWatcher() : modified_time_(0), file_size_(0) {
+#if defined(BASE_PLATFORM_LINUX)
+  inotify_fd_ = -1;
+  watch_descriptor_ = -1;
+#endif
+}
+
+FileWatcher::~FileWatcher() { Release(); }
+
+void FileWatcher::Release() {
+#if defined(BASE_PLATFORM_LINUX)
+  if (inotify_fd_ >= 0) {
+    // Closing the descriptor also removes its watches.
+    close(inotify_fd_);
+  }
+  inotify_fd_ = -1;
+  watch_descriptor_ = -1;
+#endif
+}
+
+bool FileWatcher::QueryFileStamp(int64* modified_time, int64* size) const {
+  struct stat file_info;
+  if (stat(filename_.c_str(), &file_info) != 0) {
+    return false;
+  }
+  *modified_time = file_info.st_mtime;
+  *size = file_info.st_size;
+  return true;
+}
+
+bool FileWatcher::Watch(const ::std::string& filename) {
+  Release();
+  filename_ = filename;
+  if (!QueryFileStamp(&modified_time_, &file_size_)) {
+    printf("Failed to watch file %s.\n", filename.c_str());
+    return false;
+  }
+
+#if defined(BASE_PLATFORM_LINUX)
+  ::std::string directory = ".";
+  leaf_name_ = filename;
+  size_t separator = filename.find_last_of('/');
+  if (separator != ::std::string::npos) {
+    directory = separator ? filename.substr(0, separator) : "/";
+    leaf_name_ = filename.substr(separator + 1);
+  }
+
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ >= 0) {
+    // Only completed writes and renames are reported, so partially saved
+    // files are never seen.
+    watch_descriptor_ = inotify_add_watch(inotify_fd_, directory.c_str(),
+                                          IN_CLOSE_WRITE | IN_MOVED_TO);
+  }
+  if (watch_descriptor_ < 0) {
+    // Fall back to polling, e.g. when the inotify watch limit is reached.
+    printf("Failed to create inotify watch for %s, polling instead.\n",
+           filename.c_str());
+    Release();
+  }
+#endif
+
+  return true;
+}
+
+bool FileWatcher::HasChanged() {
+  if (filename_.empty()) {
+    return false;
+  }
+
+#if defined(BASE_PLATFORM_LINUX)
+  if (inotify_fd_ >= 0) {
+    // Drain all pending events, noting whether any refer to our file.
+    bool has_changed = false;
+    alignas(struct inotify_event) char buffer[4096];
+    while (true) {
+      ssize_t length = read(inotify_fd_, buffer, sizeof(buffer));
+      if (length <= 0) {
+        break;
+      }
+      for (ssize_t offset = 0; offset < length;) {
+        const struct inotify_event* event =
+            reinterpret_cast<const struct inotify_event*>(buffer + offset);
+        if (event->len && leaf_name_ == event->name) {
+          has_changed = true;
+        }
+        offset += sizeof(struct inotify_event) + event->len;
+      }
+    }
+    if (has_changed) {
+      QueryFileStamp(&modified_time_, &file_size_);
+    }
+    return has_changed;
+  }
+#endif
+
+  int64 modified_time = 0;
+  int64 file_size = 0;
+  if (!QueryFileStamp(&modified_time, &file_size)) {
+    return false;
+  }
+  if (modified_time == modified_time_ && file_size == file_size_) {
+    return false;
+  }
+  modified_time_ = modified_time;
+  file_size_ = file_size;
+  return true;
+}
+
+}  // namespace base
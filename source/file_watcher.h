@@ -0,0 +1,77 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __FILE_WATCHER_H__
+#define __FILE_WATCHER_H__
+
+#include <string>
+#include "math/base.h"
+
+namespace base {
+
+// Reports modifications to a single file without blocking. On Linux the
+// containing directory is watched with inotify, which also catches editors
+// that save by renaming a temporary file over the original. Other platforms
+// fall back to comparing the file's modification time and size on each
+// query.
+class FileWatcher {
+ public:
+  FileWatcher();
+  ~FileWatcher();
+  // Begins watching filename, replacing any previous watch. Returns false
+  // if the file could not be watched.
+  bool Watch(const ::std::string& filename);
+  // Returns true if the file has been modified since the previous call (or
+  // since Watch). Never blocks.
+  bool HasChanged();
+
+ private:
+  // Releases any platform watch resources.
+  void Release();
+  // Reads the file's modification time and size. Returns false if the file
+  // cannot be queried (e.g. mid-save).
+  bool QueryFileStamp(int64* modified_time, int64* size) const;
+  ::std::string filename_;
+  // Last observed stat results, used by the polling fallback.
+  int64 modified_time_;
+  int64 file_size_;
+#if defined(BASE_PLATFORM_LINUX)
+  // Name of the file within its directory, matched against events.
+  ::std::string leaf_name_;
+  int32 inotify_fd_;
+  int32 watch_descriptor_;
+#endif
+};
+
+}  // namespace base
+
+#endif  // __FILE_WATCHER_H__
@@ -1,53 +1,114 @@
 
 #include "frame.h"
+#include <algorithm>
+#include "math/fast_math.h"
+
+#if defined(BASE_PLATFORM_LINUX)
+#include <sys/mman.h>
+#endif
 
 #define GAMMA_CORRECT_FRAME (1)
 
 namespace base {
 
+namespace {
+
+const uint64 kPageSize = 4096;
+
+// Allocates a zeroed buffer of count pixels. On Linux the pages are mapped
+// directly and left untouched, so each is placed on the memory node of the
+// thread that first writes it. Returns nullptr on failure.
+template <class T>
+T* AllocatePixels(uint32 count) {
+#if defined(BASE_PLATFORM_LINUX)
+  void* pixels = mmap(nullptr, uint64(count) * sizeof(T),
+                      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+  return (pixels == MAP_FAILED) ? nullptr : static_cast<T*>(pixels);
+#else
+  return new T[count]();
+#endif
+}
+
+template <class T>
+void FreePixels(T* pixels, uint32 count) {
+  if (!pixels) {
+    return;
+  }
+#if defined(BASE_PLATFORM_LINUX)
+  munmap(pixels, uint64(count) * sizeof(T));
+#else
+  delete[] pixels;
+#endif
+}
+
+// Rewrites one byte of each page in rows [y_start, y_stop) of a buffer.
+template <class T>
+void TouchPixelRows(T* pixels, uint32 row_length, uint32 y_start,
+                    uint32 y_stop) {
+  volatile uint8* bytes = reinterpret_cast<volatile uint8*>(pixels);
+  uint64 begin = uint64(y_start) * row_length * sizeof(T);
+  uint64 end = uint64(y_stop) * row_length * sizeof(T);
+  for (uint64 offset = begin; offset < end;
+       offset = (offset / kPageSize + 1) * kPageSize) {
+    bytes[offset] = bytes[offset];
+  }
+}
+
+}  // namespace
+
 DisplayFrame::DisplayFrame(uint32 width, uint32 height)
     : width_(width), height_(height) {
-  render_target_ = new vector3[width * height];
-  display_buffer_ = new uint8[3 * width * height];
-  count_buffer_ = new uint32[width * height];
-  normal_buffer_ = new vector3[width * height];
-  depth_buffer_ = new float32[width * height];
-  material_id_buffer_ = new uint64[width * height];
-  filtered_render_target_ = new vector3[width * height];
+  render_target_ = AllocatePixels<vector3>(width * height);
+  display_buffer_ = AllocatePixels<uint8>(3 * width * height);
+  count_buffer_ = AllocatePixels<uint32>(width * height);
+  normal_buffer_ = AllocatePixels<vector3>(width * height);
+  depth_buffer_ = AllocatePixels<float32>(width * height);
+  material_id_buffer_ = AllocatePixels<uint64>(width * height);
+  filtered_render_target_ = AllocatePixels<vector3>(width * height);
 
   if (!render_target_ || !display_buffer_ || !count_buffer_ ||
       !normal_buffer_ || !depth_buffer_ || !material_id_buffer_ ||
       !filtered_render_target_) {
-    delete[] render_target_;
-    delete[] display_buffer_;
-    delete[] count_buffer_;
-    delete[] normal_buffer_;
-    delete[] depth_buffer_;
-    delete[] material_id_buffer_;
-    delete[] filtered_render_target_;
+    printf("Failed to allocate a %ix%i frame.\n", width, height);
   }
-
-  Reset();
 }
 
 DisplayFrame::~DisplayFrame() {
-  delete[] render_target_;
-  delete[] display_buffer_;
-  delete[] count_buffer_;
-  delete[] normal_buffer_;
-  delete[] depth_buffer_;
-  delete[] material_id_buffer_;
-  delete[] filtered_render_target_;
+  FreePixels(render_target_, width_ * height_);
+  FreePixels(display_buffer_, 3 * width_ * height_);
+  FreePixels(count_buffer_, width_ * height_);
+  FreePixels(normal_buffer_, width_ * height_);
+  FreePixels(depth_buffer_, width_ * height_);
+  FreePixels(material_id_buffer_, width_ * height_);
+  FreePixels(filtered_render_target_, width_ * height_);
+}
+
+void DisplayFrame::TouchRows(uint32 y_start, uint32 y_stop) {
+  TouchPixelRows(render_target_, width_, y_start, y_stop);
+  TouchPixelRows(display_buffer_, 3 * width_, y_start, y_stop);
+  TouchPixelRows(count_buffer_, width_, y_start, y_stop);
+  TouchPixelRows(normal_buffer_, width_, y_start, y_stop);
+  TouchPixelRows(depth_buffer_, width_, y_start, y_stop);
+  TouchPixelRows(material_id_buffer_, width_, y_start, y_stop);
+  TouchPixelRows(filtered_render_target_, width_, y_start, y_stop);
+}
+
+uint64 DisplayFrame::GetMemorySize() const {
+  uint64 pixel_size = 2 * sizeof(vector3) + 3 * sizeof(uint8) +
+                      sizeof(uint32) + sizeof(vector3) + sizeof(float32) +
+                      sizeof(uint64);
+  return pixel_size * width_ * height_;
 }
 
 void DisplayFrame::Reset() {
-  memset(render_target_, 0, sizeof(vector3) * width_ * height_);
+  ::std::fill_n(render_target_, width_ * height_, vector3());
   memset(count_buffer_, 0, sizeof(uint32) * width_ * height_);
   memset(display_buffer_, 0, 3 * width_ * height_);
-  memset(normal_buffer_, 0, sizeof(vector3) * width_ * height_);
+  ::std::fill_n(normal_buffer_, width_ * height_, vector3());
   memset(depth_buffer_, 0, sizeof(float32) * width_ * height_);
   memset(material_id_buffer_, 0, sizeof(uint64) * width_ * height_);
-  memset(filtered_render_target_, 0, sizeof(vector3) * width_ * height_);
+  ::std::fill_n(filtered_render_target_, width_ * height_, vector3());
 }
 
 void DisplayFrame::WritePixel(const vector3& pixel, uint32 x, uint32 y) {
@@ -64,9 +125,13 @@ void DisplayFrame::WritePixel(const vector3& pixel, uint32 x, uint32 y) {
   // Scale and clamp our floating point values (ranging 0..1) to the
   // integer range of 0..255 for display.
 #if GAMMA_CORRECT_FRAME
-    display_buffer_ptr[0] = 255.0 * pow(saturate(new_pixel.x), 1.0 / 2.2) + 0.5;
-    display_buffer_ptr[1] = 255.0 * pow(saturate(new_pixel.y), 1.0 / 2.2) + 0.5;
-    display_buffer_ptr[2] = 255.0 * pow(saturate(new_pixel.z), 1.0 / 2.2) + 0.5;
+    const float32 kInverseGamma = 1.0f / 2.2f;
+    display_buffer_ptr[0] =
+        255.0f * fast_pow(saturate(new_pixel.x), kInverseGamma) + 0.5f;
+    display_buffer_ptr[1] =
+        255.0f * fast_pow(saturate(new_pixel.y), kInverseGamma) + 0.5f;
+    display_buffer_ptr[2] =
+        255.0f * fast_pow(saturate(new_pixel.z), kInverseGamma) + 0.5f;
 #else
     display_buffer_ptr[0] = 255.0 * saturate(new_pixel.x) + 0.5;
     display_buffer_ptr[1] = 255.0 * saturate(new_pixel.y) + 0.5;
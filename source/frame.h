@@ -68,6 +68,14 @@ class DisplayFrame {
   float32 GetAspectRatio() { return (float32) width_ / height_; }
   // Sets the current frame count.
   void SetFrameCount(uint32 count) { frame_count_ = count; }
+  // Returns the bytes held by all of the frame buffers.
+  uint64 GetMemorySize() const;
+  // Writes to every page that holds rows [y_start, y_stop) of the buffers
+  // without changing their contents. On Linux the buffers are not touched
+  // when they are allocated, so a pinned render thread that calls this
+  // before its first frame places its rows on its own memory node. Later
+  // calls are cheap, and may run concurrently for disjoint rows.
+  void TouchRows(uint32 y_start, uint32 y_stop);
 
  private:
   uint32 frame_count_;
@@ -0,0 +1,274 @@
+
+#include "hdr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace base {
+
+const uint32 kHdrReadChunkSize = 1024 * 1024;
+const uint32 kHdrMinEncodedWidth = 8;
+const uint32 kHdrMaxEncodedWidth = 0x7FFF;
+
+// Reads a file in large chunks, so that scanline decoding never has to go
+// back to the file system for individual bytes.
+class HdrStreamReader {
+ public:
+  HdrStreamReader(const ::std::string& filename)
+      : buffer_(kHdrReadChunkSize), position_(0), size_(0) {
+    file_ = fopen(filename.c_str(), "rb");
+  }
+  ~HdrStreamReader() {
+    if (file_) {
+      fclose(file_);
+    }
+  }
+  bool IsOpen() const { return file_ != nullptr; }
+  // Reads a single byte. Returns -1 at the end of the file.
+  inline int32 ReadByte() {
+    if (position_ == size_ && !Refill()) {
+      return -1;
+    }
+    return buffer_[position_++];
+  }
+  // Reads count bytes into output. Returns false if the file ends first.
+  bool Read(uint8* output, uint32 count) {
+    while (count) {
+      if (position_ == size_ && !Refill()) {
+        return false;
+      }
+      uint32 available = min(count, size_ - position_);
+      memcpy(output, &buffer_[position_], available);
+      position_ += available;
+      output += available;
+      count -= available;
+    }
+    return true;
+  }
+  // Reads a newline terminated line (without the newline).
+  bool ReadLine(::std::string* line) {
+    line->clear();
+    int32 value = 0;
+    while ((value = ReadByte()) >= 0) {
+      if (value == '\n') {
+        return true;
+      }
+      line->push_back((char)value);
+    }
+    return line->size() > 0;
+  }
+
+ private:
+  bool Refill() {
+    size_ = fread(&buffer_[0], 1, buffer_.size(), file_);
+    position_ = 0;
+    return size_ > 0;
+  }
+  FILE* file_;
+  ::std::vector<uint8> buffer_;
+  uint32 position_;
+  uint32 size_;
+};
+
+// Decodes a scanline that uses flat or (legacy) run length encoded texels.
+// The first texel of the scanline has already been read into output.
+static bool DecodeFlatScanline(HdrStreamReader* reader, uint32 width,
+                               uint8* output) {
+  uint32 shift = 0;
+  uint32 x = 1;
+  while (x < width) {
+    uint8* texel = output + x * 4;
+    if (!reader->Read(texel, 4)) {
+      return false;
+    }
+    if (texel[0] == 1 && texel[1] == 1 && texel[2] == 1) {
+      // Legacy run: repeat the previous texel.
+      uint32 count = (uint32)texel[3] << shift;
+      if (x + count > width) {
+        return false;
+      }
+      for (uint32 i = 0; i < count; i++) {
+        memcpy(output + (x + i) * 4, output + (x - 1) * 4, 4);
+      }
+      x += count;
+      shift += 8;
+    } else {
+      x++;
+      shift = 0;
+    }
+  }
+  return true;
+}
+
+// Decodes an adaptively run length encoded scanline. Each of the four
+// channels is stored separately, so runs are expanded into planar buffers
+// with memset/memcpy and then interleaved into RGBE texels.
+static bool DecodeRleScanline(HdrStreamReader* reader, uint32 width,
+                              uint8* planes, uint8* output) {
+  for (uint32 channel = 0; channel < 4; channel++) {
+    uint8* plane = planes + channel * width;
+    uint32 x = 0;
+    while (x < width) {
+      int32 count = reader->ReadByte();
+      if (count <= 0) {
+        return false;
+      }
+      if (count > 128) {
+        count -= 128;
+        int32 value = reader->ReadByte();
+        if (value < 0 || x + count > width) {
+          return false;
+        }
+        memset(plane + x, value, count);
+      } else {
+        if (x + count > width || !reader->Read(plane + x, count)) {
+          return false;
+        }
+      }
+      x += count;
+    }
+  }
+
+  const uint8* red = planes;
+  const uint8* green = planes + width;
+  const uint8* blue = planes + width * 2;
+  const uint8* exponent = planes + width * 3;
+  for (uint32 x = 0; x < width; x++) {
+    output[x * 4 + 0] = red[x];
+    output[x * 4 + 1] = green[x];
+    output[x * 4 + 2] = blue[x];
+    output[x * 4 + 3] = exponent[x];
+  }
+  return true;
+}
+
+// Divides a decoded scanline by the exposure recorded in the file header, so
+// texels come back in the radiance units they were written in.
+static void ApplyHdrExposure(float32 exposure, uint32 width, bool keep_rgbe,
+                             uint8* output) {
+  float32 scale = 1.0f / exposure;
+  if (!keep_rgbe) {
+    float32* texels = reinterpret_cast<float32*>(output);
+    for (uint32 i = 0; i < width * 3; i++) {
+      texels[i] *= scale;
+    }
+    return;
+  }
+
+  for (uint32 x = 0; x < width; x++) {
+    encode_rgbe(decode_rgbe(output + x * 4) * scale, output + x * 4);
+  }
+}
+
+bool LoadHdr(const ::std::string& filename, Texture* output, bool keep_rgbe) {
+  if (BASE_PARAM_CHECK) {
+    if (filename.empty() || !output) {
+      return false;
+    }
+  }
+
+  printf("Loading hdr file: %s.\n", filename.c_str());
+
+  HdrStreamReader reader(filename);
+  if (!reader.IsOpen()) {
+    printf("Failed to open hdr file %s.\n", filename.c_str());
+    return false;
+  }
+
+  ::std::string line;
+  if (!reader.ReadLine(&line) || line.compare(0, 2, "#?") != 0) {
+    printf("Invalid hdr signature in file %s.\n", filename.c_str());
+    return false;
+  }
+
+  // Header lines are terminated by an empty line. Repeated exposure lines
+  // accumulate, as each one records a further scale applied to the pixels.
+  float32 exposure = 1.0f;
+  while (reader.ReadLine(&line) && line.size()) {
+    if (line.compare(0, 7, "FORMAT=") == 0 &&
+        line.compare(7, ::std::string::npos, "32-bit_rle_rgbe") != 0) {
+      printf("Unsupported hdr format %s in file %s.\n", line.c_str(),
+             filename.c_str());
+      return false;
+    }
+    if (line.compare(0, 9, "EXPOSURE=") == 0) {
+      float32 value = strtof(line.c_str() + 9, nullptr);
+      if (!(value > 0.0f)) {
+        printf("Invalid hdr exposure %s in file %s.\n", line.c_str(),
+               filename.c_str());
+        return false;
+      }
+      exposure *= value;
+    }
+  }
+
+  char y_axis[3] = {0};
+  char x_axis[3] = {0};
+  uint32 width = 0;
+  uint32 height = 0;
+  if (!reader.ReadLine(&line) ||
+      sscanf(line.c_str(), "%2s %u %2s %u", y_axis, &height, x_axis, &width) !=
+          4 ||
+      strcmp(x_axis, "+X") != 0 ||
+      (strcmp(y_axis, "-Y") != 0 && strcmp(y_axis, "+Y") != 0) || !width ||
+      !height) {
+    printf("Unsupported hdr resolution in file %s.\n", filename.c_str());
+    return false;
+  }
+
+  // Rows are stored top down in the texture. +Y images are stored bottom up.
+  bool flip_rows = (strcmp(y_axis, "+Y") == 0);
+
+  output->filename = filename;
+  output->Allocate(width, height,
+                   keep_rgbe ? kTextureFormatRgbe : kTextureFormatRgb32f);
+
+  ::std::vector<uint8> planes(width * 4);
+  ::std::vector<uint8> scanline(keep_rgbe ? 0 : width * 4);
+
+  for (uint32 y = 0; y < height; y++) {
+    uint32 row = flip_rows ? height - 1 - y : y;
+    uint8* row_output =
+        keep_rgbe ? &output->buffer[row * width * 4] : &scanline[0];
+
+    if (!reader.Read(row_output, 4)) {
+      printf("Unexpected end of hdr file %s.\n", filename.c_str());
+      return false;
+    }
+
+    bool decoded = false;
+    if (width >= kHdrMinEncodedWidth && width <= kHdrMaxEncodedWidth &&
+        row_output[0] == 2 && row_output[1] == 2 && !(row_output[2] & 0x80)) {
+      if (((uint32)row_output[2] << 8 | row_output[3]) != width) {
+        printf("Invalid hdr scanline width in file %s.\n", filename.c_str());
+        return false;
+      }
+      decoded = DecodeRleScanline(&reader, width, &planes[0], row_output);
+    } else {
+      decoded = DecodeFlatScanline(&reader, width, row_output);
+    }
+
+    if (!decoded) {
+      printf("Failed to decode hdr scanline %i in file %s.\n", y,
+             filename.c_str());
+      return false;
+    }
+
+    if (!keep_rgbe) {
+      row_output = &output->buffer[row * width * 12];
+      decode_rgbe(scanline.data(), width,
+                  reinterpret_cast<float32*>(row_output));
+    }
+
+    if (exposure != 1.0f) {
+      ApplyHdrExposure(exposure, width, keep_rgbe, row_output);
+    }
+  }
+
+  printf("Loaded %s with dims: <%i, %i>.\n", filename.c_str(), width, height);
+
+  return true;
+}
+
+}  // namespace base
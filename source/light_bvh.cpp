@@ -0,0 +1,264 @@
+
+#include "light_bvh.h"
+#include <algorithm>
+#include "math/fast_math.h"
+
+namespace base {
+
+const uint32 kMaxLightBvhDepth = 32;
+
+LightBounds UnionLightBounds(const LightBounds& a, const LightBounds& b) {
+  if (a.power <= 0.0f) {
+    return b;
+  }
+  if (b.power <= 0.0f) {
+    return a;
+  }
+
+  LightBounds output;
+  output.aabb = a.aabb + b.aabb;
+  output.power = a.power + b.power;
+  output.theta_e = max(a.theta_e, b.theta_e);
+
+  // Merge the normal cones, keeping the wider one as the base.
+  const LightBounds& wide = (a.theta_o >= b.theta_o) ? a : b;
+  const LightBounds& narrow = (a.theta_o >= b.theta_o) ? b : a;
+  float32 theta_d = acosf(clip_range(wide.axis.dot(narrow.axis), -1.0f, 1.0f));
+
+  if (min(theta_d + narrow.theta_o, BASE_PI) <= wide.theta_o) {
+    output.axis = wide.axis;
+    output.theta_o = wide.theta_o;
+    return output;
+  }
+
+  float32 theta_o = (wide.theta_o + theta_d + narrow.theta_o) * 0.5f;
+  if (theta_o >= BASE_PI) {
+    output.axis = wide.axis;
+    output.theta_o = BASE_PI;
+    return output;
+  }
+
+  // Rotate the wide axis toward the narrow axis to center the new cone.
+  vector3 rotation_axis = wide.axis.cross(narrow.axis);
+  if (rotation_axis.length() <= BASE_EPSILON) {
+    output.axis = wide.axis;
+    output.theta_o = BASE_PI;
+    return output;
+  }
+  output.axis = wide.axis.rotate(theta_o - wide.theta_o,
+                                 rotation_axis.normalize()).normalize();
+  output.theta_o = theta_o;
+  return output;
+}
+
+float32 EstimateLightImportance(const LightBounds& light_bounds,
+                                const vector3& point, const vector3& normal) {
+  if (light_bounds.power <= 0.0f) {
+    return 0.0f;
+  }
+
+  vector3 center = light_bounds.aabb.query_center();
+  vector3 extent = light_bounds.aabb.bounds_max - light_bounds.aabb.bounds_min;
+  float32 radius = extent.length() * 0.5f;
+  vector3 to_light = center - point;
+  float32 distance2 = to_light.dot(to_light);
+
+  // Points within the bounding sphere may receive light from any direction.
+  if (distance2 <= radius * radius) {
+    return light_bounds.power / max(distance2, radius);
+  }
+
+  float32 distance = sqrtf(distance2);
+  vector3 light_dir = to_light / distance;
+  float32 theta_b = asinf(min(1.0f, radius / distance));
+
+  // Smallest angle between the emitter normals and the shading point.
+  float32 theta_w = fast_acos(light_bounds.axis.dot(light_dir * -1.0f));
+  float32 theta = max(0.0f, theta_w - light_bounds.theta_o - theta_b);
+  if (theta >= light_bounds.theta_e) {
+    return 0.0f;
+  }
+
+  // Clamp the distance to avoid a singularity for nearby clusters.
+  float32 importance =
+      light_bounds.power * fast_cos(theta) / max(distance2, radius);
+
+  if (normal.dot(normal) > 0.0f) {
+    float32 theta_i = fast_acos(normal.dot(light_dir));
+    float32 theta_i_bound = max(0.0f, theta_i - theta_b);
+    if (theta_i_bound >= BASE_PI * 0.5f) {
+      return 0.0f;
+    }
+    importance *= fast_cos(theta_i_bound);
+  }
+
+  return importance;
+}
+
+void LightBvh::Clear() {
+  nodes_.clear();
+  light_trails_.clear();
+}
+
+void LightBvh::Build(const ::std::vector<LightBounds>& lights) {
+  Clear();
+  if (lights.empty()) {
+    return;
+  }
+
+  ::std::vector<uint32> order(lights.size());
+  for (uint32 i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+
+  nodes_.reserve(lights.size() * 2);
+  light_trails_.resize(lights.size());
+  BuildRecursive(lights, &order, 0, order.size(), 0, 0);
+}
+
+uint32 LightBvh::BuildRecursive(const ::std::vector<LightBounds>& lights,
+                                ::std::vector<uint32>* order, uint32 begin,
+                                uint32 end, uint32 trail, uint32 depth) {
+  uint32 node_index = nodes_.size();
+  nodes_.emplace_back();
+
+  if (end - begin == 1 || depth >= kMaxLightBvhDepth - 1) {
+    // Leaves hold a single light. Only pathological inputs (more than 2^31
+    // lights) could reach the depth limit.
+    uint32 light_index = order->at(begin);
+    nodes_[node_index].light_bounds = lights[light_index];
+    nodes_[node_index].child_or_light = light_index;
+    nodes_[node_index].is_leaf = true;
+    light_trails_[light_index] = trail;
+    return node_index;
+  }
+
+  // Split at the median centroid along the longest axis of the centroid
+  // bounds, which keeps the tree balanced.
+  bounds centroid_bounds;
+  for (uint32 i = begin; i < end; i++) {
+    centroid_bounds += lights[order->at(i)].aabb.query_center();
+  }
+  vector3 extent = centroid_bounds.bounds_max - centroid_bounds.bounds_min;
+  uint32 axis = 0;
+  if (extent.y > extent.x) axis = 1;
+  if (extent.z > extent[axis]) axis = 2;
+
+  uint32 middle = begin + (end - begin) / 2;
+  ::std::nth_element(order->begin() + begin, order->begin() + middle,
+                     order->begin() + end, [&](uint32 a, uint32 b) {
+                       return lights[a].aabb.query_center()[axis] <
+                              lights[b].aabb.query_center()[axis];
+                     });
+
+  BuildRecursive(lights, order, begin, middle, trail, depth + 1);
+  uint32 second_child = BuildRecursive(lights, order, middle, end,
+                                       trail | (1u << depth), depth + 1);
+
+  LightBvhNode& node = nodes_[node_index];
+  node.light_bounds = UnionLightBounds(nodes_[node_index + 1].light_bounds,
+                                       nodes_[second_child].light_bounds);
+  node.child_or_light = second_child;
+  node.is_leaf = false;
+  return node_index;
+}
+
+float32 LightBvh::FirstChildProbability(const LightBvhNode& node,
+                                        uint32 node_index,
+                                        const vector3& point,
+                                        const vector3& normal) const {
+  float32 first = EstimateLightImportance(
+      nodes_[node_index + 1].light_bounds, point, normal);
+  float32 second = EstimateLightImportance(
+      nodes_[node.child_or_light].light_bounds, point, normal);
+  if (first + second <= 0.0f) {
+    return -1.0f;
+  }
+  return first / (first + second);
+}
+
+bool LightBvh::Sample(const vector3& point, const vector3& normal, float32 u,
+                      uint32* light_index, float32* pmf) const {
+  if (nodes_.empty()) {
+    return false;
+  }
+
+  uint32 node_index = 0;
+  float32 probability = 1.0f;
+
+  while (!nodes_[node_index].is_leaf) {
+    const LightBvhNode& node = nodes_[node_index];
+    float32 first = FirstChildProbability(node, node_index, point, normal);
+    if (first < 0.0f) {
+      return false;
+    }
+    // Reuse u for the next level by rescaling it into [0, 1).
+    if (u < first) {
+      u = min(u / first, 0.99999994f);
+      probability *= first;
+      node_index = node_index + 1;
+    } else {
+      u = min((u - first) / (1.0f - first), 0.99999994f);
+      probability *= 1.0f - first;
+      node_index = node.child_or_light;
+    }
+  }
+
+  *light_index = nodes_[node_index].child_or_light;
+  *pmf = probability;
+  return probability > 0.0f;
+}
+
+void LightBvh::Inspect(BvhInspector* inspector) const {
+  inspector->SetPrimitiveCount(light_trails_.size());
+
+  // Nodes are stored depth first, so the depth of every node is known by
+  // the time it is visited.
+  ::std::vector<uint32> depths(nodes_.size(), 0);
+  for (uint32 i = 0; i < nodes_.size(); i++) {
+    const LightBvhNode& node = nodes_[i];
+    if (node.is_leaf) {
+      inspector->AddLeafNode(node.light_bounds.aabb, depths[i], 1);
+      continue;
+    }
+
+    bounds child_bounds[2] = {nodes_[i + 1].light_bounds.aabb,
+                              nodes_[node.child_or_light].light_bounds.aabb};
+    depths[i + 1] = depths[i] + 1;
+    depths[node.child_or_light] = depths[i] + 1;
+    inspector->AddInteriorNode(node.light_bounds.aabb, depths[i],
+                               child_bounds, 2);
+  }
+}
+
+float32 LightBvh::Pmf(const vector3& point, const vector3& normal,
+                      uint32 light_index) const {
+  if (light_index >= light_trails_.size()) {
+    return 0.0f;
+  }
+
+  uint32 trail = light_trails_[light_index];
+  uint32 node_index = 0;
+  uint32 depth = 0;
+  float32 probability = 1.0f;
+
+  while (!nodes_[node_index].is_leaf) {
+    const LightBvhNode& node = nodes_[node_index];
+    float32 first = FirstChildProbability(node, node_index, point, normal);
+    if (first < 0.0f) {
+      return 0.0f;
+    }
+    if (trail & (1u << depth)) {
+      probability *= 1.0f - first;
+      node_index = node.child_or_light;
+    } else {
+      probability *= first;
+      node_index = node_index + 1;
+    }
+    depth++;
+  }
+
+  return probability;
+}
+
+}  // namespace base
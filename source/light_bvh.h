@@ -0,0 +1,117 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __LIGHT_BVH_H__
+#define __LIGHT_BVH_H__
+
+#include <vector>
+#include "bvh_inspector.h"
+#include "math/base.h"
+#include "math/vector3.h"
+#include "math/volume.h"
+
+namespace base {
+
+// Conservative bounds on the position, orientation and power of one or more
+// emitters (Conty Estevez and Kulla 2018). Surface normals lie within
+// theta_o of axis, and light leaves each surface within theta_e of its
+// normal.
+typedef struct LightBounds {
+  bounds aabb;
+  vector3 axis;
+  float32 theta_o;
+  float32 theta_e;
+  float32 power;
+  LightBounds() : axis(0, 1, 0), theta_o(BASE_PI), theta_e(BASE_PI * 0.5f),
+                  power(0) {}
+} LightBounds;
+
+typedef struct LightBvhNode {
+  LightBounds light_bounds;
+  // For interior nodes, the index of the second child. The first child
+  // always directly follows its parent. For leaves, the light index.
+  uint32 child_or_light;
+  bool is_leaf;
+} LightBvhNode;
+
+// Returns the union of two light bounds.
+LightBounds UnionLightBounds(const LightBounds& a, const LightBounds& b);
+
+// Returns a conservative estimate of the light that the bounded emitters
+// contribute to a surface at point with the given normal. A zero normal
+// disables the surface orientation term.
+float32 EstimateLightImportance(const LightBounds& light_bounds,
+                                const vector3& point, const vector3& normal);
+
+// Binary hierarchy over the emitters of a scene. Lights are selected by
+// stochastic traversal, descending into each child in proportion to its
+// estimated importance at the shading point, so that the cost and noise
+// of light selection stay roughly constant as the light count grows.
+class LightBvh {
+ public:
+  // Builds the hierarchy. Light indices refer to positions in lights.
+  void Build(const ::std::vector<LightBounds>& lights);
+  // Releases the hierarchy.
+  void Clear();
+  // Returns true if the hierarchy contains no lights.
+  bool IsEmpty() const { return nodes_.empty(); }
+  // Records every node of the hierarchy. Each leaf holds one light.
+  void Inspect(BvhInspector* inspector) const;
+  // Selects a light for the shading point using u in [0, 1). Returns false
+  // if no light can contribute to the point.
+  bool Sample(const vector3& point, const vector3& normal, float32 u,
+              uint32* light_index, float32* pmf) const;
+  // Returns the probability that Sample selects light_index at the shading
+  // point.
+  float32 Pmf(const vector3& point, const vector3& normal,
+              uint32 light_index) const;
+
+ private:
+  // Recursively builds the subtree for lights [begin, end) of the build
+  // list. trail holds the branch bits taken from the root.
+  uint32 BuildRecursive(const ::std::vector<LightBounds>& lights,
+                        ::std::vector<uint32>* order, uint32 begin,
+                        uint32 end, uint32 trail, uint32 depth);
+  // Returns the probability of descending into the first child of node.
+  float32 FirstChildProbability(const LightBvhNode& node, uint32 node_index,
+                                const vector3& point,
+                                const vector3& normal) const;
+  // Flattened nodes in depth first order.
+  ::std::vector<LightBvhNode> nodes_;
+  // Per light branch bits from the root to its leaf (bit i set if the
+  // second child was taken at depth i).
+  ::std::vector<uint32> light_trails_;
+};
+
+}  // namespace base
+
+#endif  // __LIGHT_BVH_H__
@@ -0,0 +1,59 @@
+
+#include "light_reservoir.h"
+
+namespace base {
+
+bool LightReservoir::Update(const LightSample& candidate, float32 weight,
+                            float32 candidate_target, float32 u) {
+  if (!(weight > 0.0f)) {
+    return false;
+  }
+  weight_sum += weight;
+  if (u * weight_sum >= weight) {
+    return false;
+  }
+  sample = candidate;
+  target = candidate_target;
+  return true;
+}
+
+void LightReservoir::Finalize(uint32 count) {
+  contribution_weight = 0.0f;
+  if (target > 0.0f && count) {
+    contribution_weight = weight_sum / (count * target);
+  }
+}
+
+LightReservoirBuffer::LightReservoirBuffer(uint32 width, uint32 height)
+    : width_(width),
+      height_(height),
+      current_(width * height),
+      previous_(width * height) {}
+
+void LightReservoirBuffer::Invalidate() {
+  current_.assign(width_ * height_, LightReservoir());
+  previous_.assign(width_ * height_, LightReservoir());
+}
+
+void LightReservoirBuffer::EndPass() {
+  current_.swap(previous_);
+  current_.assign(width_ * height_, LightReservoir());
+}
+
+const LightReservoir* LightReservoirBuffer::GetPrevious(int32 x,
+                                                        int32 y) const {
+  if (x < 0 || y < 0 || uint32(x) >= width_ || uint32(y) >= height_) {
+    return nullptr;
+  }
+  const LightReservoir& reservoir = previous_[y * width_ + x];
+  return reservoir.sample_count ? &reservoir : nullptr;
+}
+
+void LightReservoirBuffer::SetCurrent(uint32 x, uint32 y,
+                                      const LightReservoir& reservoir) {
+  if (x < width_ && y < height_) {
+    current_[y * width_ + x] = reservoir;
+  }
+}
+
+}  // namespace base
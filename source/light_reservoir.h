@@ -0,0 +1,119 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __LIGHT_RESERVOIR_H__
+#define __LIGHT_RESERVOIR_H__
+
+#include <vector>
+#include "math/base.h"
+#include "math/vector3.h"
+#include "object.h"
+
+namespace base {
+
+// A point on an emitter, stored by position so that it may be evaluated
+// from neighboring pixels. normal faces the surface the point was drawn
+// for.
+typedef struct LightSample {
+  Object* light;
+  vector3 point;
+  vector3 normal;
+  vector3 emission;
+  LightSample() : light(nullptr) {}
+} LightSample;
+
+// Weighted reservoir over light samples (resampled importance sampling with
+// reservoir reuse, Bitterli et al. 2020). The reservoir keeps one sample of
+// the stream of candidates it has seen, chosen in proportion to their
+// weights.
+typedef struct LightReservoir {
+  LightSample sample;
+  // Sum of the weights of all candidates seen.
+  float32 weight_sum;
+  // Target density of sample at the surface the reservoir belongs to.
+  float32 target;
+  // Weight that turns target into an estimate of the light of sample, or 0
+  // if the reservoir holds no usable sample.
+  float32 contribution_weight;
+  // Number of candidates the reservoir represents.
+  uint32 sample_count;
+  // Surface the reservoir was built for, used to reject neighbors that see
+  // different geometry and to tell which neighbors could have drawn a
+  // sample.
+  vector3 surface_point;
+  vector3 surface_normal;
+  float32 surface_depth;
+  LightReservoir()
+      : weight_sum(0),
+        target(0),
+        contribution_weight(0),
+        sample_count(0),
+        surface_depth(0) {}
+  // Streams a candidate into the reservoir using u in [0, 1). Returns true
+  // if the candidate replaced the current sample.
+  bool Update(const LightSample& candidate, float32 weight,
+              float32 candidate_target, float32 u);
+  // Computes contribution_weight from the streamed candidates, normalized
+  // by count of them. A reservoir that combines others counts only those
+  // that could have drawn sample.
+  void Finalize(uint32 count);
+} LightReservoir;
+
+// Per-pixel reservoirs of the current and previous pass. Pixels write only
+// their own reservoir of the current pass and read those of the previous
+// pass, so the threads of a pass need no synchronization.
+class LightReservoirBuffer {
+ public:
+  LightReservoirBuffer(uint32 width, uint32 height);
+  // Discards all reservoirs. Must be called when emitters change.
+  void Invalidate();
+  // Makes the current pass the previous one. Must not be called while
+  // tracing.
+  void EndPass();
+  // Returns the reservoir of the previous pass at (x, y), or nullptr if the
+  // coordinates are outside of the frame or the reservoir is empty.
+  const LightReservoir* GetPrevious(int32 x, int32 y) const;
+  // Stores the reservoir of the current pass at (x, y).
+  void SetCurrent(uint32 x, uint32 y, const LightReservoir& reservoir);
+  uint32 GetWidth() const { return width_; }
+  uint32 GetHeight() const { return height_; }
+
+ private:
+  uint32 width_;
+  uint32 height_;
+  ::std::vector<LightReservoir> current_;
+  ::std::vector<LightReservoir> previous_;
+};
+
+}  // namespace base
+
+#endif  // __LIGHT_RESERVOIR_H__
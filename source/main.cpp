@@ -29,10 +29,13 @@
 //
 */
 
+#include "bvh_inspector.h"
 #include "engine.h"
+#include "file_watcher.h"
 #include "frame.h"
 #include "math/intersect.h"
 #include "math/random.h"
+#include "scene_report.h"
 #include "stdio.h"
 #include "stdlib.h"
 #include "window/base_graphics.h"
@@ -42,6 +45,37 @@ void PrintUsage(const char *programName) {
   printf("  --file [scene filename]  \tSpecifies the scene file to load.\n");
   printf("  --width [integer]  \t\tSets the width of the output frame.\n");
   printf("  --height [integer]  \t\tSets the height of the output frame.\n");
+  printf(
+      "  --report [filename]  \t\tWrites the scene load report as json "
+      "(default: scene filename + .report.json).\n");
+  printf(
+      "  --inspect  \t\t\tPrints the quality of the scene, light and mesh "
+      "trees, then exits.\n");
+  printf(
+      "  --guide  \t\t\tGuides indirect sampling with radiance learned "
+      "while rendering.\n");
+  printf(
+      "  --cache  \t\t\tEnds diffuse paths early into a world-space "
+      "radiance cache.\n");
+  printf(
+      "  --photons  \t\t\tRenders caustics from glass, liquid and mirrors "
+      "with a photon map.\n");
+  printf(
+      "  --lights  \t\t\tResamples direct light with reuse across pixels "
+      "and passes.\n");
+}
+
+// Prints the load report of a scene and writes it as json. Frame buffers
+// are allocated outside of the scene, so they are added here.
+void ReportSceneLoad(const ::base::Scene &scene,
+                     const ::base::DisplayFrame &output_frame,
+                     const ::base::ImagePlaneCache &image_cache,
+                     const ::std::string &report_filename) {
+  ::base::SceneLoadReport report = scene.GetLoadReport();
+  report.frame_bytes =
+      output_frame.GetMemorySize() + image_cache.GetMemorySize();
+  ::base::PrintSceneLoadReport(report);
+  ::base::WriteSceneLoadReport(report, report_filename);
 }
 
 int main(int argc, char **argv) {
@@ -50,6 +84,12 @@ int main(int argc, char **argv) {
       "information visit https://bertolami.com.\n\n");
 
   ::std::string scene_filename;
+  ::std::string report_filename;
+  bool inspect_trees = false;
+  bool guide_paths = false;
+  bool cache_radiance = false;
+  bool map_photons = false;
+  bool resample_lights = false;
   ::base::uint32 window_width = 800;
   ::base::uint32 window_height = 480;
 
@@ -72,6 +112,24 @@ int main(int argc, char **argv) {
       case 'h':
         window_height = atoi(argv[++i]);
         break;
+      case 'r':
+        report_filename = argv[++i];
+        break;
+      case 'i':
+        inspect_trees = true;
+        break;
+      case 'g':
+        guide_paths = true;
+        break;
+      case 'c':
+        cache_radiance = true;
+        break;
+      case 'p':
+        map_photons = true;
+        break;
+      case 'l':
+        resample_lights = true;
+        break;
     }
   }
 
@@ -80,17 +138,35 @@ int main(int argc, char **argv) {
     return 0;
   }
 
+  if (!report_filename.length()) {
+    report_filename = scene_filename + ".report.json";
+  }
+
   printf("Loading scene %s and rendering at %ix%i resolution.\n",
          scene_filename.c_str(), window_width, window_height);
 
-  ::base::Scene scene;
+  ::std::unique_ptr<::base::Scene> scene = ::std::make_unique<::base::Scene>();
   ::base::Camera camera(::base::vector3(-5.80, 7.05, -47.06),
                         ::base::vector3(0.00, 8.94, 0.00));
 
-  if (!scene.LoadScene(scene_filename)) {
+  if (!scene->LoadScene(scene_filename)) {
     return 0;
   }
 
+  if (inspect_trees) {
+    ::std::vector<::base::BvhQualityReport> reports;
+    scene->InspectTrees(&reports);
+    for (const ::base::BvhQualityReport &report : reports) {
+      ::base::PrintBvhQualityReport(report);
+    }
+    return 0;
+  }
+
+  // Edits to the scene file are picked up between passes. Material-only
+  // edits keep all loaded geometry and acceleration structures.
+  ::base::FileWatcher scene_watcher;
+  scene_watcher.Watch(scene_filename);
+
   ::std::unique_ptr<::base::GraphicsWindow> window =
       ::std::make_unique<::base::GraphicsWindow>(
           "Final Stage Path Tracer 2.02", 100, 10, window_width,
@@ -98,11 +174,35 @@ int main(int argc, char **argv) {
   ::std::vector<::base::InputEvent> window_events;
   ::base::ImagePlaneCache image_cache(window_width, window_height);
   ::base::DisplayFrame output_frame(window_width, window_height);
+  ReportSceneLoad(*scene, output_frame, image_cache, report_filename);
 
-  ::base::InitializeMaterials();
+  // The guide, the radiance cache and the photon map are held in world
+  // space. They survive camera moves but restart whenever the scene
+  // changes.
+  ::std::unique_ptr<::base::PathGuide> path_guide;
+  if (guide_paths) {
+    path_guide = ::std::make_unique<::base::PathGuide>();
+    path_guide->Reset(scene->GetBounds());
+  }
+  ::std::unique_ptr<::base::RadianceCache> radiance_cache;
+  if (cache_radiance) {
+    radiance_cache = ::std::make_unique<::base::RadianceCache>();
+  }
+  ::std::unique_ptr<::base::PhotonMap> photon_map;
+  if (map_photons) {
+    photon_map = ::std::make_unique<::base::PhotonMap>();
+    photon_map->Reset(scene.get());
+  }
+  // Light reservoirs are held per pixel and rejected by the surface tests
+  // when the camera moves, so only scene changes discard them.
+  ::std::unique_ptr<::base::LightReservoirBuffer> light_reservoirs;
+  if (resample_lights) {
+    light_reservoirs = ::std::make_unique<::base::LightReservoirBuffer>(
+        window_width, window_height);
+  }
 
-  if (scene.GetCameraCount()) {
-    camera = *scene.GetCamera(0);
+  if (scene->GetCameraCount()) {
+    camera = *scene->GetCamera(0);
   }
 
   bool mouse_down = false;
@@ -144,7 +244,7 @@ int main(int argc, char **argv) {
       } else if (event.switch_index == ::base::kInputMouseRightButtonIndex &&
                  event.is_on) {
         camera.focal_depth = ::base::TraceRange(
-            camera, &scene, &output_frame,
+            camera, scene.get(), &output_frame,
             (event.target_x + 1) * output_frame.GetWidth() * 0.5f,
             (event.target_y + 1) * output_frame.GetHeight() * 0.5f);
 
@@ -154,7 +254,52 @@ int main(int argc, char **argv) {
       }
     }
 
-    ::base::TraceScene(camera, &scene, &output_frame);
+    if (scene_watcher.HasChanged()) {
+      bool requires_rebuild = false;
+      if (scene->ReloadMaterials(scene_filename, &requires_rebuild)) {
+        printf("Reloaded materials from %s.\n", scene_filename.c_str());
+        output_frame.Reset();
+        if (path_guide) {
+          path_guide->Reset(scene->GetBounds());
+        }
+        if (radiance_cache) {
+          radiance_cache->Invalidate();
+        }
+        if (photon_map) {
+          photon_map->Reset(scene.get());
+        }
+        if (light_reservoirs) {
+          light_reservoirs->Invalidate();
+        }
+      } else if (requires_rebuild) {
+        printf("Scene layout changed, reloading %s.\n",
+               scene_filename.c_str());
+        ::std::unique_ptr<::base::Scene> new_scene =
+            ::std::make_unique<::base::Scene>();
+        if (new_scene->LoadScene(scene_filename)) {
+          scene = ::std::move(new_scene);
+          ReportSceneLoad(*scene, output_frame, image_cache, report_filename);
+          output_frame.Reset();
+          image_cache.Invalidate();
+          if (path_guide) {
+            path_guide->Reset(scene->GetBounds());
+          }
+          if (radiance_cache) {
+            radiance_cache->Invalidate();
+          }
+          if (photon_map) {
+            photon_map->Reset(scene.get());
+          }
+          if (light_reservoirs) {
+            light_reservoirs->Invalidate();
+          }
+        }
+      }
+    }
+
+    ::base::TraceScene(camera, scene.get(), &output_frame, nullptr,
+                       path_guide.get(), radiance_cache.get(),
+                       photon_map.get(), light_reservoirs.get());
 
     window->BeginScene();
     glClearColor(0.5f, 0.5f, 0.4f, 1);
@@ -0,0 +1,111 @@
+
+#include "mapped_file.h"
+#include <cstdio>
+
+#if !defined(BASE_PLATFORM_WINDOWS)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace base {
+
+MappedFile::MappedFile() : data_(nullptr), size_(0), is_open_(false) {
+#if defined(BASE_PLATFORM_WINDOWS)
+  file_handle_ = INVALID_HANDLE_VALUE;
+  mapping_handle_ = nullptr;
+#endif
+}
+
+MappedFile::~MappedFile() { Close(); }
+
+bool MappedFile::Open(const ::std::string& filename) {
+  Close();
+
+#if defined(BASE_PLATFORM_WINDOWS)
+  file_handle_ =
+      CreateFileA(filename.c_str(), GENERIC_READ,
+                  FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                  FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file_handle_ == INVALID_HANDLE_VALUE) {
+    printf("Failed to open file %s.\n", filename.c_str());
+    return false;
+  }
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file_handle_, &file_size)) {
+    printf("Failed to query size of file %s.\n", filename.c_str());
+    Close();
+    return false;
+  }
+  size_ = file_size.QuadPart;
+  if (size_) {
+    mapping_handle_ =
+        CreateFileMappingA(file_handle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_handle_) {
+      data_ = static_cast<const char*>(
+          MapViewOfFile(mapping_handle_, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (!data_) {
+      printf("Failed to map file %s.\n", filename.c_str());
+      Close();
+      return false;
+    }
+  }
+#else
+  int32 file_descriptor = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file_descriptor < 0) {
+    printf("Failed to open file %s.\n", filename.c_str());
+    return false;
+  }
+  struct stat file_info;
+  if (fstat(file_descriptor, &file_info) != 0) {
+    printf("Failed to query size of file %s.\n", filename.c_str());
+    close(file_descriptor);
+    return false;
+  }
+  size_ = file_info.st_size;
+  if (size_) {
+    void* mapping =
+        mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+    if (mapping == MAP_FAILED) {
+      printf("Failed to map file %s.\n", filename.c_str());
+      close(file_descriptor);
+      size_ = 0;
+      return false;
+    }
+    // Files are read front to back, so ask for aggressive readahead.
+    madvise(mapping, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const char*>(mapping);
+  }
+  // The mapping holds its own reference to the file.
+  close(file_descriptor);
+#endif
+
+  is_open_ = true;
+  return true;
+}
+
+void MappedFile::Close() {
+#if defined(BASE_PLATFORM_WINDOWS)
+  if (data_) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_handle_) {
+    CloseHandle(mapping_handle_);
+  }
+  if (file_handle_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(file_handle_);
+  }
+  file_handle_ = INVALID_HANDLE_VALUE;
+  mapping_handle_ = nullptr;
+#else
+  if (data_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+#endif
+  data_ = nullptr;
+  size_ = 0;
+  is_open_ = false;
+}
+
+}  // namespace base
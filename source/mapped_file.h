@@ -0,0 +1,75 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <string>
+#include "math/base.h"
+
+namespace base {
+
+// Read-only view of an entire file mapped into the address space. Pages
+// are faulted in by the OS as they are touched, so parsers can walk the
+// contents directly without copying them into stream buffers.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  // Maps filename, replacing any previous mapping. Returns false if the
+  // file cannot be opened or mapped. Empty files open successfully with a
+  // null data pointer.
+  bool Open(const ::std::string& filename);
+  // Unmaps the file.
+  void Close();
+  // Returns the first byte of the mapping.
+  const char* GetData() const { return data_; }
+  // Returns the size of the mapping in bytes.
+  uint64 GetSize() const { return size_; }
+  // Returns true if a file is currently open.
+  bool IsOpen() const { return is_open_; }
+
+ private:
+  const char* data_;
+  uint64 size_;
+  bool is_open_;
+#if defined(BASE_PLATFORM_WINDOWS)
+  HANDLE file_handle_;
+  HANDLE mapping_handle_;
+#endif
+};
+
+}  // namespace base
+
+#endif  // __MAPPED_FILE_H__
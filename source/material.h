@@ -37,297 +37,151 @@
 #include "math/base.h"
 #include "math/plane.h"
 #include "math/vector3.h"
+#include "shading.h"
+#include "texture.h"
 
 namespace base {
 
-typedef struct Texture {
-  // Filename that was used to load the texture
-  ::std::string filename;
-  // Width of the texture, in pixels.
-  uint32 width;
-  // Height of the texture, in pixels.
-  uint32 height;
-  // Image buffer that contains the texel data.
-  ::std::vector<float32> buffer;
-} Texture;
-
+// Materials are thin builders around a MaterialParams block. All shading is
+// performed by the kernels in shading.h, which switch on the type tag, so
+// none of the per-hit entry points below are virtual.
 class Material {
  public:
   virtual ~Material() {}
   // Returns the globally unique id for the material instance.
-  uint32 GetID() { return material_id_; }
+  uint32 GetID() const { return params_.id; }
+  // Returns the shading parameters of the material.
+  const MaterialParams &GetParams() const { return params_; }
+  // Returns the index of the material within its scene material table, or
+  // kInvalidMaterialIndex if the material has not been added to a table.
+  uint32 GetTableIndex() const { return table_index_; }
+  // Sets the index of the material within its scene material table.
+  void SetTableIndex(uint32 index) { table_index_ = index; }
   // Returns true if the material is a light emitting material.
-  virtual bool IsLight() { return false; }
+  bool IsLight() const { return ShadeIsLight(params_); }
   // Returns true if the material can potentially use transmitted light.
   // False otherwise, which indicates a fully opaque / diffuse material.
-  virtual bool WillUseTransmittedLight() const = 0;
+  bool WillUseTransmittedLight() const {
+    return ShadeWillUseTransmittedLight(params_);
+  }
   // Returns true if the material will use indirect light, given the incident
   // light vector and the object surface normal. Returns false otherwise.
   // Indirect includes both refracted and transmitted.
-  virtual bool WillUseIndirectLight(const vector3 &incident_light,
-                                    const vector3 &normal) const = 0;
+  bool WillUseIndirectLight(const vector3 &incident_light,
+                            const vector3 &normal) const {
+    return ShadeWillUseIndirectLight(params_, incident_light, normal);
+  }
   // Returns a reflection vector based on the solid angle of the material.
-  virtual vector3 Reflection(const vector3 &view, const vector3 &normal,
-                             bool is_internal = false) const = 0;
+  vector3 Reflection(const vector3 &view, const vector3 &normal) const {
+    return ShadeReflection(params_, view, normal);
+  }
   // Determines the color of reflected light according to the material
-  // properties and the input parameters.
-  virtual vector3 Sample(float32 depth, const vector3 &sample_pos,
-                         const vector3 &view_pos, const vector3 &view_dir,
-                         const vector3 &light_pos, const vector3 &light_dir,
-                         const vector3 &light_color,
-                         const vector3 &surface_normal,
-                         const vector2 &surface_texcoords = vector2(0, 0),
-                         bool is_internal = false) = 0;
+  // properties and the shading context.
+  vector3 Sample(const ShadingContext &context) const {
+    return ShadeSample(params_, context);
+  }
 
  protected:
   Material();
-  // Unique material id.
-  uint32 material_id_;
+  // Shading parameters, including the type tag and unique material id.
+  MaterialParams params_;
+  // Index into the owning scene's material table.
+  uint32 table_index_;
 };
 
 class DiffuseMaterial : public Material {
  public:
-  DiffuseMaterial() :texture_scale_(0) {}
+  DiffuseMaterial() {}
   DiffuseMaterial(const vector3 &diffuse);
   DiffuseMaterial(const ::std::string &filename, float32 tex_scale = 1.0f);
   virtual ~DiffuseMaterial() {}
-  // Indicates that this material does not support transmitted light.
-  virtual bool WillUseTransmittedLight() const override { return false; }
-  // Loads a texture map into the diffuse channel of the material.
+  // Loads a texture map into the diffuse channel of the material. 8 bit
+  // sources are kept in 8 bit form (decoded as sRGB if is_srgb is set),
+  // Radiance images keep their RGBE texels, and EXR sources are stored as
+  // shared exponent RGB9E5.
   void LoadDiffuseTexture(const ::std::string &filename,
-                          float32 tex_scale = 1.0f);
-  // Returns true if the material will use indirect light, given the incident
-  // light vector and the object surface normal. Returns false otherwise.
-  virtual bool WillUseIndirectLight(const vector3 &incident_light,
-                                    const vector3 &normal) const override;
-  // Returns a reflection vector based on the solid angle of the material.
-  vector3 Reflection(const vector3 &view, const vector3 &normal,
-                     bool is_internal = false) const override;
-  // Determines the color of reflected light according to the material
-  // properties and the input parameters.
-  vector3 Sample(float32 depth, const vector3 &sample_pos,
-                 const vector3 &view_pos, const vector3 &view_dir,
-                 const vector3 &light_pos, const vector3 &light_dir,
-                 const vector3 &light_color, const vector3 &surface_normal,
-                 const vector2 &surface_texcoords = vector2(0, 0),
-                 bool is_internal = false) override;
+                          float32 tex_scale = 1.0f, bool is_srgb = false);
+  // Uses the already decoded texels of source (e.g. from a scene cache) as
+  // the diffuse texture. The texels must outlive the material.
+  void MapDiffuseTexture(const Texture &source, float32 tex_scale = 1.0f,
+                         bool is_srgb = false);
+  // Returns the diffuse texture, or nullptr if the material has none.
+  const Texture *GetDiffuseTexture() const {
+    return params_.diffuse_map ? &diffuse_map_ : nullptr;
+  }
+  // Exchanges shading parameters with another material, along with the
+  // textures if swap_texture is set. Both materials keep their own id and
+  // table index.
+  void SwapParams(DiffuseMaterial *other, bool swap_texture);
 
  protected:
-  // The diffuse component of reflected light.
-  vector3 diffuse_;
-  // Specifies a diffuse texture map to use in place of diffuse.
+  // Specifies a diffuse texture map to use in place of diffuse. Referenced
+  // by params_ while valid.
   Texture diffuse_map_;
-  // Scaling factor applied to texture coordinates during sampling.
-  // Only applied when diffuse_map_ is valid.
-  float32 texture_scale_;
-  // Samples the diffuse map if available. Returns the diffuse color if
-  // no diffuse map has been loaded into the material.
-  vector3 SampleDiffuse(const vector2 &texcoords);
 };
 
 class LightMaterial : public DiffuseMaterial {
  public:
-  LightMaterial() : emissive_(1, 1, 1) { diffuse_ = vector3(1, 1, 1); };
+  LightMaterial() : LightMaterial(vector3(1, 1, 1)) {}
   LightMaterial(const vector3 &emissive);
   virtual ~LightMaterial() {}
-  // Returns true if the material is light emitting.
-  virtual bool IsLight() { return true; }
-  // Indicates that this material does not support transmitted light.
-  virtual bool WillUseTransmittedLight() const override { return false; }
-  // Returns true if the material will use indirect light, given the incident
-  // light vector and the object surface normal. Returns false otherwise.
-  virtual bool WillUseIndirectLight(const vector3 &incident_light,
-                                    const vector3 &normal) const override;
-  // Returns a reflection vector based on the solid angle of the material.
-  virtual vector3 Reflection(const vector3 &view, const vector3 &normal,
-                             bool is_internal = false) const override;
-  // Determines the color of reflected light according to the material
-  // properties and the input parameters.
-  virtual vector3 Sample(float32 depth, const vector3 &sample_pos,
-                         const vector3 &view_pos, const vector3 &view_dir,
-                         const vector3 &light_pos, const vector3 &light_dir,
-                         const vector3 &light_color,
-                         const vector3 &surface_normal,
-                         const vector2 &surface_texcoords = vector2(0, 0),
-                         bool is_internal = false) override;
-
- protected:
-  // The ambient emission from the material (useful for light sources).
-  vector3 emissive_;
 };
 
 class MetalMaterial : public DiffuseMaterial {
  public:
-  MetalMaterial() : roughness_(0.5f) {}
+  MetalMaterial() : MetalMaterial(vector3(), 0.5f) {}
   MetalMaterial(const vector3 &diffuse, float32 roughness);
   MetalMaterial(::std::string &filename, float32 roughness);
-  // Indicates that this material does not support transmitted light.
-  virtual bool WillUseTransmittedLight() const override { return false; }
-  // Returns true if the material will use indirect light, given the incident
-  // light vector and the object surface normal. Returns false otherwise.
-  virtual bool WillUseIndirectLight(const vector3 &incident_light,
-                                    const vector3 &normal) const override;
-  vector3 Reflection(const vector3 &view, const vector3 &normal,
-                     bool is_internal = false) const override;
-  // Determines the color of reflected light according to the material
-  // properties and the input parameters.
-  vector3 Sample(float32 depth, const vector3 &sample_pos,
-                 const vector3 &view_pos, const vector3 &view_dir,
-                 const vector3 &light_pos, const vector3 &light_dir,
-                 const vector3 &light_color, const vector3 &surface_normal,
-                 const vector2 &surface_texcoords = vector2(0, 0),
-                 bool is_internal = false) override;
-
- protected:
-  // Interpolation component between specular and diffuse values.
-  float32 roughness_;
 };
 
 class MirrorMaterial : public DiffuseMaterial {
  public:
-  MirrorMaterial() {}
+  MirrorMaterial() : MirrorMaterial(vector3()) {}
   MirrorMaterial(const vector3 &diffuse);
   virtual ~MirrorMaterial() {}
-  // Indicates that this material does not support transmitted light.
-  virtual bool WillUseTransmittedLight() const override { return false; }
-  // Returns true if the material will use indirect light, given the incident
-  // light vector and the object surface normal. Returns false otherwise.
-  virtual bool WillUseIndirectLight(const vector3 &incident_light,
-                                    const vector3 &normal) const override;
-  vector3 Reflection(const vector3 &view, const vector3 &normal,
-                     bool is_internal = false) const override;
-  // Determines the color of reflected light according to the material
-  // properties and the input parameters.
-  vector3 Sample(float32 depth, const vector3 &sample_pos,
-                 const vector3 &view_pos, const vector3 &view_dir,
-                 const vector3 &light_pos, const vector3 &light_dir,
-                 const vector3 &light_color, const vector3 &surface_normal,
-                 const vector2 &surface_texcoords = vector2(0, 0),
-                 bool is_internal = false) override;
 };
 
 class GlassMaterial : public DiffuseMaterial {
  public:
-  GlassMaterial() {}
+  GlassMaterial() : GlassMaterial(vector3()) {}
   GlassMaterial(const vector3 diffuse, float32 index = 0.75f, float32 reflectivity = 0.1, float32 frost = 0.0f);
   virtual ~GlassMaterial() {}
-  // Indicates that this material does support transmitted light.
-  virtual bool WillUseTransmittedLight() const override { return true; }
-  // Returns true if the material will use indirect light, given the incident
-  // light vector and the object surface normal. Returns false otherwise.
-  virtual bool WillUseIndirectLight(const vector3 &incident_light,
-                                    const vector3 &normal) const override;
-  vector3 Reflection(const vector3 &view, const vector3 &normal,
-                     bool is_internal = false) const override;
-  // Determines the color of reflected light according to the material
-  // properties and the input parameters.
-  vector3 Sample(float32 depth, const vector3 &sample_pos,
-                 const vector3 &view_pos, const vector3 &view_dir,
-                 const vector3 &light_pos, const vector3 &light_dir,
-                 const vector3 &light_color, const vector3 &surface_normal,
-                 const vector2 &surface_texcoords = vector2(0, 0),
-                 bool is_internal = false) override;
-
-protected:
-    float32 index_;
-    float32 frost_;
-    float32 reflectivity_;
 };
 
 class LiquidMaterial : public DiffuseMaterial {
  public:
-  LiquidMaterial() {}
+  LiquidMaterial() : LiquidMaterial(vector3()) {}
   LiquidMaterial(const vector3 diffuse, float32 index = 0.75f, float32 reflectivity = 0.4f);
   virtual ~LiquidMaterial() {}
-  // Indicates that this material does support transmitted light.
-  virtual bool WillUseTransmittedLight() const override { return false; }
-  // Returns true if the material will use indirect light, given the incident
-  // light vector and the object surface normal. Returns false otherwise.
-  virtual bool WillUseIndirectLight(const vector3 &incident_light,
-                                    const vector3 &normal) const override;
-  vector3 Reflection(const vector3 &view, const vector3 &normal,
-                     bool is_internal = false) const override;
-  // Determines the color of reflected light according to the material
-  // properties and the input parameters.
-  vector3 Sample(float32 depth, const vector3 &sample_pos,
-                 const vector3 &view_pos, const vector3 &view_dir,
-                 const vector3 &light_pos, const vector3 &light_dir,
-                 const vector3 &light_color, const vector3 &surface_normal,
-                 const vector2 &surface_texcoords = vector2(0, 0),
-                 bool is_internal = false) override;
-
-protected:
-    float32 index_;
-    float32 reflectivity_;
 };
 
 class CeramicMaterial : public DiffuseMaterial {
  public:
-  CeramicMaterial() : shininess_(0.0f) {}
+  CeramicMaterial() : CeramicMaterial(vector3(), 0.0f) {}
   CeramicMaterial(const vector3 &diffuse, float32 shininess);
-  // Indicates that this material does not support transmitted light.
-  virtual bool WillUseTransmittedLight() const override { return false; }
-  // Returns true if the material will use indirect light, given the incident
-  // light vector and the object surface normal. Returns false otherwise.
-  virtual bool WillUseIndirectLight(const vector3 &incident_light,
-                                    const vector3 &normal) const override;
-  vector3 Reflection(const vector3 &view, const vector3 &normal,
-                     bool is_internal = false) const override;
-  // Determines the color of reflected light according to the material
-  // properties and the input parameters.
-  vector3 Sample(float32 depth, const vector3 &sample_pos,
-                 const vector3 &view_pos, const vector3 &view_dir,
-                 const vector3 &light_pos, const vector3 &light_dir,
-                 const vector3 &light_color, const vector3 &surface_normal,
-                 const vector2 &surface_texcoords = vector2(0, 0),
-                 bool is_internal = false) override;
-
- protected:
-  // Interpolation component between specular and diffuse values.
-  float32 shininess_;
 };
 
 class GlowMaterial : public CeramicMaterial {
  public:
-     GlowMaterial(const vector3 &diffuse, const vector3 &glow, float32 shininess);
-     vector3 Sample(float32 depth, const vector3& sample_pos,
-         const vector3& view_pos, const vector3& view_dir,
-         const vector3& light_pos, const vector3& light_dir,
-         const vector3& light_color, const vector3& surface_normal,
-         const vector2& surface_texcoords = vector2(0, 0),
-         bool is_internal = false) override;
-protected:
-    // A glow color to be emitted from the surface.
-    vector3 glow_;
+  GlowMaterial(const vector3 &diffuse, const vector3 &glow, float32 shininess);
 };
 
 class FogMaterial : public DiffuseMaterial {
  public:
-  FogMaterial() : density_(0) {}
+  FogMaterial() : FogMaterial(vector3(), 0.0f) {}
   FogMaterial(const vector3 diffuse, float32 density);
   virtual ~FogMaterial() {}
-  // Indicates that this material does support transmitted light.
-  virtual bool WillUseTransmittedLight() const override { return true; }
-  // Returns true if the material will use indirect light, given the incident
-  // light vector and the object surface normal. Returns false otherwise.
-  virtual bool WillUseIndirectLight(const vector3 &incident_light,
-                                    const vector3 &normal) const override;
-  vector3 Reflection(const vector3 &view, const vector3 &normal,
-                     bool is_internal = false) const override;
-  // Determines the color of reflected light according to the material
-  // properties and the input parameters.
-  virtual vector3 Sample(float32 depth, const vector3 &sample_pos,
-                 const vector3 &view_pos, const vector3 &view_dir,
-                 const vector3 &light_pos, const vector3 &light_dir,
-                 const vector3 &light_color, const vector3 &surface_normal,
-                 const vector2 &surface_texcoords = vector2(0, 0),
-                 bool is_internal = false) override;
-
- protected:
-  float32 density_;
 };
 
-void InitializeMaterials();
+// Participating medium for volume objects. Density is the extinction
+// coefficient (per world unit) where the volume density grid is 1, and
+// diffuse is the single scattering albedo.
+class MediumMaterial : public DiffuseMaterial {
+ public:
+  MediumMaterial() : MediumMaterial(vector3(1, 1, 1), 1.0f) {}
+  MediumMaterial(const vector3 &albedo, float32 density);
+  virtual ~MediumMaterial() {}
+};
 
 }  // namespace base
 
@@ -46,6 +46,12 @@
 #include "ctype.h"
 #include "sys/types.h"
 #include "unistd.h"
+#elif defined(__linux__)
+#define BASE_PLATFORM_LINUX
+#include "ctype.h"
+#include "stdint.h"
+#include "sys/types.h"
+#include "unistd.h"
 #else
 #error "Unsupported target platform detected."
 #endif
@@ -61,7 +67,7 @@ typedef UINT64 uint64;
 typedef UINT32 uint32;
 typedef UINT16 uint16;
 typedef UINT8 uint8;
-#elif defined(BASE_PLATFORM_MACOS)
+#elif defined(BASE_PLATFORM_MACOS) || defined(BASE_PLATFORM_LINUX)
 typedef int64_t int64;
 typedef int32_t int32;
 typedef int16_t int16;
@@ -0,0 +1,142 @@
+
+#include "distribution.h"
+
+namespace base {
+
+distribution_1d::distribution_1d() : integral_(0.0f) {}
+
+void distribution_1d::initialize(const float32* weights, uint32 count) {
+  if (BASE_PARAM_CHECK) {
+    if (!weights || 0 == count) {
+      return;
+    }
+  }
+
+  function_.assign(weights, weights + count);
+  cdf_.resize(count + 1);
+  cdf_[0] = 0.0f;
+
+  for (uint32 i = 0; i < count; i++) {
+    cdf_[i + 1] = cdf_[i] + function_[i] / count;
+  }
+
+  integral_ = cdf_[count];
+
+  if (integral_ > 0.0f) {
+    for (uint32 i = 1; i <= count; i++) {
+      cdf_[i] /= integral_;
+    }
+  } else {
+    // Degenerate distribution: fall back to uniform.
+    for (uint32 i = 1; i <= count; i++) {
+      cdf_[i] = float32(i) / count;
+    }
+  }
+}
+
+uint32 distribution_1d::find_piece(float32 u) const {
+  // Find the last cdf entry that is <= u.
+  uint32 first = 0;
+  uint32 length = cdf_.size();
+  while (length > 0) {
+    uint32 half = length >> 1;
+    uint32 middle = first + half;
+    if (cdf_[middle] <= u) {
+      first = middle + 1;
+      length -= half + 1;
+    } else {
+      length = half;
+    }
+  }
+  uint32 count = function_.size();
+  return first ? (first - 1 < count ? first - 1 : count - 1) : 0;
+}
+
+float32 distribution_1d::sample_continuous(float32 u, float32* pdf,
+                                           uint32* index) const {
+  uint32 piece = find_piece(u);
+  float32 du = u - cdf_[piece];
+  float32 width = cdf_[piece + 1] - cdf_[piece];
+  if (width > 0.0f) {
+    du /= width;
+  }
+
+  if (pdf) {
+    *pdf = integral_ > 0.0f ? function_[piece] / integral_ : 1.0f;
+  }
+  if (index) {
+    *index = piece;
+  }
+
+  float32 x = (piece + du) / function_.size();
+  return x < 1.0f ? x : 0.99999994f;
+}
+
+uint32 distribution_1d::sample_discrete(float32 u, float32* pmf) const {
+  uint32 piece = find_piece(u);
+  if (pmf) {
+    *pmf = this->pmf(piece);
+  }
+  return piece;
+}
+
+float32 distribution_1d::pdf(float32 x) const {
+  uint32 count = function_.size();
+  if (!count) {
+    return 0.0f;
+  }
+  int32 piece = int32(x * count);
+  piece = piece < 0 ? 0 : (piece >= int32(count) ? count - 1 : piece);
+  return integral_ > 0.0f ? function_[piece] / integral_ : 1.0f;
+}
+
+float32 distribution_1d::pmf(uint32 index) const {
+  if (index >= function_.size()) {
+    return 0.0f;
+  }
+  return cdf_[index + 1] - cdf_[index];
+}
+
+void distribution_2d::initialize(const float32* weights, uint32 width,
+                                 uint32 height) {
+  if (BASE_PARAM_CHECK) {
+    if (!weights || 0 == width || 0 == height) {
+      return;
+    }
+  }
+
+  conditional_.resize(height);
+  ::std::vector<float32> row_integrals(height);
+
+  for (uint32 y = 0; y < height; y++) {
+    conditional_[y].initialize(weights + y * width, width);
+    row_integrals[y] = conditional_[y].integral();
+  }
+
+  marginal_.initialize(&row_integrals[0], height);
+}
+
+vector2 distribution_2d::sample_continuous(float32 u0, float32 u1,
+                                           float32* pdf) const {
+  float32 row_pdf = 0.0f;
+  float32 column_pdf = 0.0f;
+  uint32 row = 0;
+  float32 y = marginal_.sample_continuous(u1, &row_pdf, &row);
+  float32 x = conditional_[row].sample_continuous(u0, &column_pdf, nullptr);
+  if (pdf) {
+    *pdf = row_pdf * column_pdf;
+  }
+  return vector2(x, y);
+}
+
+float32 distribution_2d::pdf(const vector2& point) const {
+  uint32 height = conditional_.size();
+  if (!height) {
+    return 0.0f;
+  }
+  int32 row = int32(point.y * height);
+  row = row < 0 ? 0 : (row >= int32(height) ? height - 1 : row);
+  return marginal_.pdf(point.y) * conditional_[row].pdf(point.x);
+}
+
+}  // namespace base
@@ -0,0 +1,99 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __DISTRIBUTION_H__
+#define __DISTRIBUTION_H__
+
+#include <vector>
+#include "base.h"
+#include "vector2.h"
+
+namespace base {
+
+// Piecewise constant 1D distribution over [0, 1), built from a list of
+// non-negative weights. Sampling inverts the cumulative distribution with a
+// binary search.
+class distribution_1d {
+ public:
+  distribution_1d();
+  // Builds the distribution from count weights.
+  void initialize(const float32* weights, uint32 count);
+  // Returns the number of pieces in the distribution.
+  uint32 count() const { return function_.size(); }
+  // Returns the sum of all weights divided by count.
+  float32 integral() const { return integral_; }
+  // Returns true if the distribution has a non-zero integral.
+  bool is_valid() const { return integral_ > 0.0f; }
+  // Maps u in [0, 1) to a continuous value in [0, 1). pdf receives the
+  // density of the returned value, and index the piece it falls in.
+  float32 sample_continuous(float32 u, float32* pdf, uint32* index) const;
+  // Maps u in [0, 1) to a piece index. pmf receives its probability.
+  uint32 sample_discrete(float32 u, float32* pmf) const;
+  // Returns the density of the continuous value x in [0, 1).
+  float32 pdf(float32 x) const;
+  // Returns the probability of selecting index with sample_discrete.
+  float32 pmf(uint32 index) const;
+
+ private:
+  // Returns the piece containing u, given the cumulative distribution.
+  uint32 find_piece(float32 u) const;
+  // The weights of each piece.
+  ::std::vector<float32> function_;
+  // Normalized cumulative distribution (count + 1 entries).
+  ::std::vector<float32> cdf_;
+  float32 integral_;
+};
+
+// Piecewise constant 2D distribution over [0, 1)^2. Rows are selected with
+// a marginal distribution, and columns with a per-row conditional.
+class distribution_2d {
+ public:
+  // Builds the distribution from a row major width x height weight grid.
+  void initialize(const float32* weights, uint32 width, uint32 height);
+  // Returns true if the distribution has a non-zero integral.
+  bool is_valid() const { return marginal_.is_valid(); }
+  // Maps (u0, u1) in [0, 1)^2 to a point in [0, 1)^2. pdf receives the
+  // density of the returned point.
+  vector2 sample_continuous(float32 u0, float32 u1, float32* pdf) const;
+  // Returns the density of the point in [0, 1)^2.
+  float32 pdf(const vector2& point) const;
+
+ private:
+  // One conditional distribution per row.
+  ::std::vector<distribution_1d> conditional_;
+  // Distribution of the row integrals.
+  distribution_1d marginal_;
+};
+
+}  // namespace base
+
+#endif  // __DISTRIBUTION_H__
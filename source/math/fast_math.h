@@ -0,0 +1,207 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+#ifndef __FAST_MATH_H__
+#define __FAST_MATH_H__
+
+#include <math.h>
+#include <string.h>
+#include "base.h"
+
+// Polynomial approximations of the transcendental functions used by
+// sampling, sky mapping and display. Each function is branch free apart
+// from range reduction, so loops over them can be vectorized. Define
+// BASE_FAST_MATH as 0 to route every call to the C library instead, e.g.
+// to check whether an artifact comes from an approximation.
+#ifndef BASE_FAST_MATH
+#define BASE_FAST_MATH (1)
+#endif
+
+namespace base {
+
+#if BASE_FAST_MATH
+
+inline float32 fast_bits_to_float(uint32 bits) {
+  float32 value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+inline uint32 fast_float_to_bits(float32 value) {
+  uint32 bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+// Arc tangent of y / x in [-pi, pi]. Maximum error 1.0e-5 radians.
+inline float32 fast_atan2(float32 y, float32 x) {
+  float32 abs_x = fabsf(x);
+  float32 abs_y = fabsf(y);
+  float32 larger = fmaxf(abs_x, abs_y);
+  if (larger == 0.0f) {
+    return 0.0f;
+  }
+
+  // Reduce to atan(t) with t in [0, 1], then undo the reflections.
+  float32 t = fminf(abs_x, abs_y) / larger;
+  float32 s = t * t;
+  float32 angle =
+      t * (0.99997726f +
+           s * (-0.33262347f +
+                s * (0.19354346f +
+                     s * (-0.11643287f +
+                          s * (0.05265332f - s * 0.01172120f)))));
+  angle = (abs_y > abs_x) ? 1.57079637f - angle : angle;
+  angle = (x < 0.0f) ? 3.14159274f - angle : angle;
+  return copysignf(angle, y);
+}
+
+// Arc cosine of x in [-1, 1] (Abramowitz and Stegun 4.4.45). Maximum error
+// 7.0e-5 radians.
+inline float32 fast_acos(float32 x) {
+  float32 abs_x = fminf(fabsf(x), 1.0f);
+  float32 angle =
+      sqrtf(1.0f - abs_x) *
+      (1.5707288f + abs_x * (-0.2121144f + abs_x * (0.0742610f -
+                                                    abs_x * 0.0187293f)));
+  return (x < 0.0f) ? 3.14159274f - angle : angle;
+}
+
+// Sine and cosine of angle. The angle is reduced to [-pi/4, pi/4] about
+// the nearest quadrant, so the error stays below 1.0e-6 for angles within
+// a few turns of zero, and grows with the magnitude of larger angles.
+inline void fast_sincos(float32 angle, float32* sine, float32* cosine) {
+  float32 quadrant = floorf(angle * 0.63661977f + 0.5f);
+  // Two part pi / 2, so that the reduction loses little precision.
+  float32 x = (angle - quadrant * 1.5703125f) - quadrant * 4.8382679e-4f;
+  float32 x2 = x * x;
+  float32 s =
+      x * (1.0f + x2 * (-1.6666654e-1f +
+                        x2 * (8.3321608e-3f - x2 * 1.9515296e-4f)));
+  float32 c = 1.0f + x2 * (-0.5f + x2 * (4.1666645e-2f +
+                                         x2 * (-1.3887316e-3f +
+                                               x2 * 2.4433157e-5f)));
+
+  // Rotate the result back to the quadrant of the angle.
+  int32 index = int32(quadrant) & 3;
+  float32 swapped_s = (index & 1) ? c : s;
+  float32 swapped_c = (index & 1) ? s : c;
+  *sine = (index & 2) ? -swapped_s : swapped_s;
+  *cosine = ((index + 1) & 2) ? -swapped_c : swapped_c;
+}
+
+inline float32 fast_sin(float32 angle) {
+  float32 sine, cosine;
+  fast_sincos(angle, &sine, &cosine);
+  return sine;
+}
+
+inline float32 fast_cos(float32 angle) {
+  float32 sine, cosine;
+  fast_sincos(angle, &sine, &cosine);
+  return cosine;
+}
+
+// Base 2 logarithm of x > 0. Maximum error 1.0e-6, plus the float
+// rounding of the exponent.
+inline float32 fast_log2(float32 x) {
+  // Split x into 2^exponent * mantissa, with the mantissa in
+  // [sqrt(0.5), sqrt(2)) so that the series below converges quickly.
+  uint32 bits = fast_float_to_bits(x);
+  int32 exponent = int32((bits >> 23) & 0xFF) - 127;
+  float32 mantissa = fast_bits_to_float((bits & 0x007FFFFF) | 0x3F800000);
+  if (mantissa > 1.41421356f) {
+    mantissa *= 0.5f;
+    exponent++;
+  }
+
+  // log2(m) = 2 / ln(2) * atanh(z), z = (m - 1) / (m + 1), |z| <= 0.172.
+  float32 z = (mantissa - 1.0f) / (mantissa + 1.0f);
+  float32 z2 = z * z;
+  float32 series =
+      z * (2.8853901f +
+           z2 * (0.9617967f + z2 * (0.5770780f + z2 * 0.4121986f)));
+  return float32(exponent) + series;
+}
+
+// 2 raised to x. Relative error below 4.0e-6. Results below 2^-126 are
+// flushed to zero, and x >= 128 returns infinity.
+inline float32 fast_exp2(float32 x) {
+  x = fminf(fmaxf(x, -127.0f), 128.0f);
+  float32 whole = floorf(x);
+  // 2^f for f in [0, 1), expanded about f = 0.5.
+  float32 f = (x - whole) - 0.5f;
+  float32 fraction =
+      1.41421356f *
+      (1.0f +
+       f * (0.69314718f +
+            f * (0.24022651f +
+                 f * (0.05550411f + f * (0.00961813f + f * 0.00133336f)))));
+  int32 exponent = int32(whole) + 127;
+  if (exponent <= 0) {
+    return 0.0f;
+  }
+  return fraction * fast_bits_to_float(uint32(exponent) << 23);
+}
+
+// x raised to y for x >= 0. The relative error is below 4.0e-6 plus
+// 1.0e-6 * |y|, plus 1.0e-7 * |y * log2(x)| from the float rounding of the
+// exponent, for results that are not denormal. Returns 0 for x <= 0.
+inline float32 fast_pow(float32 x, float32 y) {
+  if (x <= 0.0f) {
+    return 0.0f;
+  }
+  return fast_exp2(y * fast_log2(x));
+}
+
+#else
+
+inline float32 fast_atan2(float32 y, float32 x) { return atan2f(y, x); }
+inline float32 fast_acos(float32 x) {
+  return acosf(fminf(fmaxf(x, -1.0f), 1.0f));
+}
+inline void fast_sincos(float32 angle, float32* sine, float32* cosine) {
+  *sine = sinf(angle);
+  *cosine = cosf(angle);
+}
+inline float32 fast_sin(float32 angle) { return sinf(angle); }
+inline float32 fast_cos(float32 angle) { return cosf(angle); }
+inline float32 fast_log2(float32 x) { return log2f(x); }
+inline float32 fast_exp2(float32 x) { return exp2f(x); }
+inline float32 fast_pow(float32 x, float32 y) {
+  return (x <= 0.0f) ? 0.0f : powf(x, y);
+}
+
+#endif  // BASE_FAST_MATH
+
+}  // namespace base
+
+#endif  // __FAST_MATH_H__
@@ -1,5 +1,6 @@
 
 #include "intersect.h"
+#include "fast_math.h"
 
 namespace base {
 
@@ -778,9 +779,18 @@ vector2 planar_map_texcoords(const vector3 &point, const vector3 &normal) {
 }
 
 vector2 sphere_map_texcoords(const vector3 &normal) {
-    float32 u = atan2(normal.x, normal.z) / (2 * BASE_PI) + 0.5;
+    float32 u = fast_atan2(normal.x, normal.z) / (2 * BASE_PI) + 0.5;
     float32 v = normal.y * 0.5 + 0.5;
     return vector2(u, 1.0 - v);
 }
 
+vector3 sphere_map_direction(const vector2 &texcoords) {
+    float32 y = 1.0 - 2.0 * texcoords.y;
+    float32 phi = (texcoords.x - 0.5) * (2 * BASE_PI);
+    float32 radius = sqrtf(fmaxf(0.0f, 1.0f - y * y));
+    float32 sin_phi, cos_phi;
+    fast_sincos(phi, &sin_phi, &cos_phi);
+    return vector3(sin_phi * radius, y, cos_phi * radius);
+}
+
 }  // namespace base
\ No newline at end of file
@@ -100,6 +100,9 @@ const vector3 project_vector_with_inverse(const vector3& src, const matrix4& inv
 
 vector2 planar_map_texcoords(const vector3 &point, const vector3 &normal);
 vector2 sphere_map_texcoords(const vector3 &normal);
+// Inverse of sphere_map_texcoords. The mapping is equal-area (v is linear in
+// y), so a density over texcoords converts to solid angle by dividing by 4pi.
+vector3 sphere_map_direction(const vector2 &texcoords);
 
 }  // namespace base
 
@@ -32,37 +32,17 @@
 #ifndef __NORMAL_H__
 #define __NORMAL_H__
 
-#include <vector>
 #include "base.h"
+#include "fast_math.h"
+#include "scalar.h"
 #include "vector3.h"
 
 namespace base {
 
-class normal_sphere {
- public:
-  normal_sphere();
-  // Initializes the normal sphere with count normals.
-  void initialize(int32 count);
-  // Returns a generic, unconstrained random normal from the unit sphere.
-  vector3 random_normal();
-  // Returns a random reflection normal within the solid angle envelope.
-  vector3 random_reflection(const vector3& incident, const vector3& normal,
-                            float32 solidangle);
-  // Returns a random refraction normal within the solid angle envelope.
-  vector3 random_refraction(const vector3& incident, const vector3& normal,
-                            float32 solidangle, float32 index);
-
- private:
-  // The normal list is allocated and populated during setup,
-  // and should never be reallocated during the frame. Access
-  // into the normal list should be direct.
-  std::vector<vector3> normal_list;
-};
-
 // Generic normal manipulation:
 //   Note that the reflection and refraction interfaces here assume a solid
-//   angle of zero. For non-zero solid angle envelopes, use the random normal
-//   generator above.
+//   angle of zero. For sampled directions about a normal, use the
+//   importance sampling helpers below.
 
 inline vector3 calculate_normal(const vector3& a, const vector3& b,
                                 const vector3& c) {
@@ -107,6 +87,140 @@ inline vector3 calculate_ascent(const vector3& normal) {
   return calculate_planar_projection(inv_gravity_vector, normal);
 }
 
+// Compression:
+//   Unit normals are packed into 32 bits using an octahedral mapping with
+//   16 bits per axis, which keeps the angular error well below 0.01 degrees.
+
+inline uint32 encode_octahedral_normal(const vector3& normal) {
+  float32 length = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+  if (length == 0.0f) {
+    return 0;
+  }
+  float32 u = normal.x / length;
+  float32 v = normal.y / length;
+  if (normal.z < 0.0f) {
+    // Fold the lower hemisphere over the diagonals of the octahedron.
+    float32 folded_u = (1.0f - fabsf(v)) * copysignf(1.0f, u);
+    float32 folded_v = (1.0f - fabsf(u)) * copysignf(1.0f, v);
+    u = folded_u;
+    v = folded_v;
+  }
+  int16 packed_u = (int16)lrintf(clip_range(u, -1.0f, 1.0f) * 32767.0f);
+  int16 packed_v = (int16)lrintf(clip_range(v, -1.0f, 1.0f) * 32767.0f);
+  return (uint32)(uint16)packed_u | ((uint32)(uint16)packed_v << 16);
+}
+
+inline vector3 decode_octahedral_normal(uint32 packed) {
+  float32 u = (int16)(packed & 0xFFFF) / 32767.0f;
+  float32 v = (int16)(packed >> 16) / 32767.0f;
+  vector3 normal(u, v, 1.0f - fabsf(u) - fabsf(v));
+  if (normal.z < 0.0f) {
+    normal.x = (1.0f - fabsf(v)) * copysignf(1.0f, u);
+    normal.y = (1.0f - fabsf(u)) * copysignf(1.0f, v);
+  }
+  return normal.normalize();
+}
+
+// Importance sampling:
+//   The following helpers map a pair of uniform random numbers in [0, 1) to
+//   directions distributed about an axis. The matching pdf functions return
+//   densities with respect to solid angle.
+
+// Builds an orthonormal basis around a unit length axis (Duff et al. 2017).
+inline void build_orthonormal_basis(const vector3& axis, vector3* tangent,
+                                    vector3* bitangent) {
+  float32 sign = copysignf(1.0f, axis.z);
+  float32 a = -1.0f / (sign + axis.z);
+  float32 b = axis.x * axis.y * a;
+  *tangent = vector3(1.0f + sign * axis.x * axis.x * a, sign * b,
+                     -sign * axis.x);
+  *bitangent = vector3(b, sign + axis.y * axis.y * a, -axis.y);
+}
+
+// Returns a direction given in spherical coordinates about axis.
+inline vector3 spherical_direction(const vector3& axis, float32 cos_theta,
+                                   float32 phi) {
+  vector3 tangent, bitangent;
+  build_orthonormal_basis(axis, &tangent, &bitangent);
+  float32 sin_theta = sqrtf(fmaxf(0.0f, 1.0f - cos_theta * cos_theta));
+  float32 sin_phi, cos_phi;
+  fast_sincos(phi, &sin_phi, &cos_phi);
+  return (tangent * (cos_phi * sin_theta) +
+          bitangent * (sin_phi * sin_theta) + axis * cos_theta)
+      .normalize();
+}
+
+// Cosine weighted hemisphere about normal.
+inline vector3 sample_cosine_hemisphere(const vector3& normal, float32 u,
+                                        float32 v) {
+  return spherical_direction(normal, sqrtf(1.0f - u), BASE_2PI * v);
+}
+
+inline float32 cosine_hemisphere_pdf(const vector3& normal,
+                                     const vector3& direction) {
+  return fmaxf(0.0f, normal.dot(direction)) / BASE_PI;
+}
+
+// Normalized Phong lobe cos^exponent about axis.
+inline vector3 sample_phong_lobe(const vector3& axis, float32 exponent,
+                                 float32 u, float32 v) {
+  return spherical_direction(axis,
+                             fast_pow(1.0f - u, 1.0f / (exponent + 1.0f)),
+                             BASE_2PI * v);
+}
+
+inline float32 phong_lobe_pdf(const vector3& axis, float32 exponent,
+                              const vector3& direction) {
+  float32 cos_alpha = axis.dot(direction);
+  if (cos_alpha <= 0.0f) {
+    return 0.0f;
+  }
+  return (exponent + 1.0f) / BASE_2PI * fast_pow(cos_alpha, exponent);
+}
+
+// Uniformly distributed directions over the unit sphere.
+inline vector3 sample_uniform_sphere(float32 u, float32 v) {
+  return spherical_direction(vector3(0, 1, 0), 1.0f - 2.0f * u,
+                             BASE_2PI * v);
+}
+
+inline float32 uniform_sphere_pdf() { return 1.0f / (4.0f * BASE_PI); }
+
+// Converts a roughness in [0, 1] to an approximately equivalent Phong
+// exponent (Walter et al. 2007, with alpha = roughness).
+inline float32 roughness_to_phong_exponent(float32 roughness) {
+  float32 alpha2 = fmaxf(roughness * roughness, 1.0e-4f);
+  return 2.0f / alpha2 - 2.0f;
+}
+
+// GGX (Trowbridge-Reitz) microfacet normals about normal.
+inline vector3 sample_ggx_normal(const vector3& normal, float32 alpha,
+                                 float32 u, float32 v) {
+  float32 tan2_theta = alpha * alpha * u / fmaxf(1.0f - u, BASE_EPSILON);
+  return spherical_direction(normal, 1.0f / sqrtf(1.0f + tan2_theta),
+                             BASE_2PI * v);
+}
+
+// Returns the GGX distribution term D(m).
+inline float32 ggx_distribution(const vector3& normal, float32 alpha,
+                                const vector3& microfacet) {
+  float32 cos_theta = normal.dot(microfacet);
+  if (cos_theta <= 0.0f) {
+    return 0.0f;
+  }
+  float32 alpha2 = alpha * alpha;
+  float32 cos2_theta = cos_theta * cos_theta;
+  float32 denom = cos2_theta * (alpha2 - 1.0f) + 1.0f;
+  return alpha2 / (BASE_PI * denom * denom);
+}
+
+// Density of sampled microfacet normals, D(m) * cos(theta_m).
+inline float32 ggx_normal_pdf(const vector3& normal, float32 alpha,
+                              const vector3& microfacet) {
+  return ggx_distribution(normal, alpha, microfacet) *
+         fmaxf(0.0f, normal.dot(microfacet));
+}
+
 }  // namespace base
 
 #endif  // __NORMAL_H__
@@ -0,0 +1,509 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include "base.h"
+#include "scalar.h"
+#include "vector3.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define BASE_SIMD_SSE2 (1)
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define BASE_SIMD_AVX (1)
+#endif
+
+namespace base {
+
+// A 16 byte aligned vector3 held in one SSE register. The fourth lane is
+// padding and is kept at zero. Hot kernels convert to this type at their
+// boundaries, so scene facing code keeps using vector3.
+typedef struct alignas(16) vector3a {
+ public:
+  union {
+#if BASE_SIMD_SSE2
+    __m128 m;
+#endif
+    struct {
+      float32 x;
+      float32 y;
+      float32 z;
+      float32 w;
+    };
+    float32 v[4];
+  };
+
+ public:
+  inline vector3a();
+  inline vector3a(float32 xj, float32 yj, float32 zj);
+  inline explicit vector3a(const vector3& rhs);
+#if BASE_SIMD_SSE2
+  inline explicit vector3a(__m128 rhs) : m(rhs) {}
+#endif
+
+  inline vector3 to_vector3() const { return vector3(x, y, z); }
+
+  inline vector3a normalize() const;
+  inline vector3a cross(const vector3a& rhs) const;
+  inline float32 dot(const vector3a& rhs) const;
+  inline float32 length() const;
+
+  inline vector3a operator-(const vector3a& rhs) const;
+  inline vector3a operator+(const vector3a& rhs) const;
+  inline vector3a operator*(const vector3a& rhs) const;
+  inline vector3a operator*(float32 rhs) const;
+  inline vector3a operator/(float32 rhs) const;
+  inline const vector3a& operator+=(const vector3a& rhs);
+  inline const vector3a& operator*=(float32 rhs);
+} vector3a;
+
+// Returns the per lane minimum and maximum of two vectors. These are not
+// named min and max, which are macros on Windows.
+inline vector3a lane_min(const vector3a& a, const vector3a& b);
+inline vector3a lane_max(const vector3a& a, const vector3a& b);
+// Returns a * b + c.
+inline vector3a madd(const vector3a& a, const vector3a& b, const vector3a& c);
+
+// Eight floats processed together, in one AVX register, two SSE registers,
+// or a plain array when neither is available.
+typedef struct alignas(32) float32x8 {
+ public:
+  union {
+#if BASE_SIMD_AVX
+    __m256 m;
+#elif BASE_SIMD_SSE2
+    __m128 m[2];
+#endif
+    float32 v[8];
+  };
+
+ public:
+  inline float32x8() {}
+  // Broadcasts value to every lane.
+  inline explicit float32x8(float32 value);
+
+  // Loads and stores 8 floats. The pointers need no alignment.
+  static inline float32x8 load(const float32* input);
+  inline void store(float32* output) const;
+
+  inline float32x8 operator-(const float32x8& rhs) const;
+  inline float32x8 operator+(const float32x8& rhs) const;
+  inline float32x8 operator*(const float32x8& rhs) const;
+  inline float32x8 operator/(const float32x8& rhs) const;
+} float32x8;
+
+inline float32x8 lane_min(const float32x8& a, const float32x8& b);
+inline float32x8 lane_max(const float32x8& a, const float32x8& b);
+inline float32x8 madd(const float32x8& a, const float32x8& b,
+                      const float32x8& c);
+inline float32x8 lane_sqrt(const float32x8& a);
+
+// Eight vector3s in structure of arrays form, so that each operation works
+// on all eight at once (e.g. one ray against eight triangles, or eight
+// shading normals).
+typedef struct vector3x8 {
+ public:
+  float32x8 x;
+  float32x8 y;
+  float32x8 z;
+
+ public:
+  inline vector3x8() {}
+  inline vector3x8(const float32x8& xj, const float32x8& yj,
+                   const float32x8& zj)
+      : x(xj), y(yj), z(zj) {}
+  // Broadcasts value to every lane.
+  inline explicit vector3x8(const vector3& value);
+
+  // Gathers up to 8 vectors from input. Unused lanes are set to zero.
+  static inline vector3x8 load(const vector3* input, uint32 count = 8);
+  // Scatters the first count lanes to output.
+  inline void store(vector3* output, uint32 count = 8) const;
+  // Returns or replaces a single lane.
+  inline vector3 get(uint32 lane) const;
+  inline void set(uint32 lane, const vector3& value);
+
+  inline vector3x8 normalize() const;
+  inline vector3x8 cross(const vector3x8& rhs) const;
+  inline float32x8 dot(const vector3x8& rhs) const;
+  inline float32x8 length() const;
+
+  inline vector3x8 operator-(const vector3x8& rhs) const;
+  inline vector3x8 operator+(const vector3x8& rhs) const;
+  inline vector3x8 operator*(const vector3x8& rhs) const;
+  inline vector3x8 operator*(const float32x8& rhs) const;
+} vector3x8;
+
+inline vector3x8 lane_min(const vector3x8& a, const vector3x8& b);
+inline vector3x8 lane_max(const vector3x8& a, const vector3x8& b);
+inline vector3x8 madd(const vector3x8& a, const float32x8& b,
+                      const vector3x8& c);
+
+//
+// vector3a
+//
+
+inline vector3a::vector3a() {
+#if BASE_SIMD_SSE2
+  m = _mm_setzero_ps();
+#else
+  x = y = z = w = 0;
+#endif
+}
+
+inline vector3a::vector3a(float32 xj, float32 yj, float32 zj) {
+#if BASE_SIMD_SSE2
+  m = _mm_set_ps(0, zj, yj, xj);
+#else
+  x = xj;
+  y = yj;
+  z = zj;
+  w = 0;
+#endif
+}
+
+inline vector3a::vector3a(const vector3& rhs) : vector3a(rhs.x, rhs.y, rhs.z) {}
+
+inline float32 vector3a::dot(const vector3a& rhs) const {
+#if BASE_SIMD_SSE2
+  __m128 product = _mm_mul_ps(m, rhs.m);
+  __m128 shuffled = _mm_shuffle_ps(product, product, _MM_SHUFFLE(2, 3, 0, 1));
+  __m128 sums = _mm_add_ps(product, shuffled);
+  shuffled = _mm_movehl_ps(shuffled, sums);
+  return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+#else
+  return x * rhs.x + y * rhs.y + z * rhs.z;
+#endif
+}
+
+inline float32 vector3a::length() const { return ::sqrt(dot(*this)); }
+
+inline vector3a vector3a::normalize() const {
+  float32 l = length();
+  if (l == 0.0f) l = 1.0f;
+  return *this / l;
+}
+
+inline vector3a vector3a::cross(const vector3a& rhs) const {
+#if BASE_SIMD_SSE2
+  // (y, z, x) * (rhs.z, rhs.x, rhs.y) - (z, x, y) * (rhs.y, rhs.z, rhs.x),
+  // computed with one fewer shuffle by rotating the difference afterwards.
+  __m128 a = _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 b = _mm_shuffle_ps(rhs.m, rhs.m, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 c = _mm_sub_ps(_mm_mul_ps(m, b), _mm_mul_ps(a, rhs.m));
+  return vector3a(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+#else
+  return vector3a(y * rhs.z - z * rhs.y, z * rhs.x - x * rhs.z,
+                  x * rhs.y - y * rhs.x);
+#endif
+}
+
+inline vector3a vector3a::operator-(const vector3a& rhs) const {
+#if BASE_SIMD_SSE2
+  return vector3a(_mm_sub_ps(m, rhs.m));
+#else
+  return vector3a(x - rhs.x, y - rhs.y, z - rhs.z);
+#endif
+}
+
+inline vector3a vector3a::operator+(const vector3a& rhs) const {
+#if BASE_SIMD_SSE2
+  return vector3a(_mm_add_ps(m, rhs.m));
+#else
+  return vector3a(x + rhs.x, y + rhs.y, z + rhs.z);
+#endif
+}
+
+inline vector3a vector3a::operator*(const vector3a& rhs) const {
+#if BASE_SIMD_SSE2
+  return vector3a(_mm_mul_ps(m, rhs.m));
+#else
+  return vector3a(x * rhs.x, y * rhs.y, z * rhs.z);
+#endif
+}
+
+inline vector3a vector3a::operator*(float32 rhs) const {
+#if BASE_SIMD_SSE2
+  return vector3a(_mm_mul_ps(m, _mm_set1_ps(rhs)));
+#else
+  return vector3a(x * rhs, y * rhs, z * rhs);
+#endif
+}
+
+inline vector3a vector3a::operator/(float32 rhs) const {
+#if BASE_SIMD_SSE2
+  return vector3a(_mm_div_ps(m, _mm_set1_ps(rhs)));
+#else
+  return vector3a(x / rhs, y / rhs, z / rhs);
+#endif
+}
+
+inline const vector3a& vector3a::operator+=(const vector3a& rhs) {
+  *this = *this + rhs;
+  return *this;
+}
+
+inline const vector3a& vector3a::operator*=(float32 rhs) {
+  *this = *this * rhs;
+  return *this;
+}
+
+inline vector3a lane_min(const vector3a& a, const vector3a& b) {
+#if BASE_SIMD_SSE2
+  return vector3a(_mm_min_ps(a.m, b.m));
+#else
+  return vector3a(min(a.x, b.x), min(a.y, b.y), min(a.z, b.z));
+#endif
+}
+
+inline vector3a lane_max(const vector3a& a, const vector3a& b) {
+#if BASE_SIMD_SSE2
+  return vector3a(_mm_max_ps(a.m, b.m));
+#else
+  return vector3a(max(a.x, b.x), max(a.y, b.y), max(a.z, b.z));
+#endif
+}
+
+inline vector3a madd(const vector3a& a, const vector3a& b,
+                     const vector3a& c) {
+#if defined(__FMA__)
+  return vector3a(_mm_fmadd_ps(a.m, b.m, c.m));
+#else
+  return a * b + c;
+#endif
+}
+
+//
+// float32x8
+//
+
+inline float32x8::float32x8(float32 value) {
+#if BASE_SIMD_AVX
+  m = _mm256_set1_ps(value);
+#elif BASE_SIMD_SSE2
+  m[0] = m[1] = _mm_set1_ps(value);
+#else
+  for (uint32 i = 0; i < 8; i++) v[i] = value;
+#endif
+}
+
+inline float32x8 float32x8::load(const float32* input) {
+  float32x8 output;
+#if BASE_SIMD_AVX
+  output.m = _mm256_loadu_ps(input);
+#elif BASE_SIMD_SSE2
+  output.m[0] = _mm_loadu_ps(input);
+  output.m[1] = _mm_loadu_ps(input + 4);
+#else
+  for (uint32 i = 0; i < 8; i++) output.v[i] = input[i];
+#endif
+  return output;
+}
+
+inline void float32x8::store(float32* output) const {
+#if BASE_SIMD_AVX
+  _mm256_storeu_ps(output, m);
+#elif BASE_SIMD_SSE2
+  _mm_storeu_ps(output, m[0]);
+  _mm_storeu_ps(output + 4, m[1]);
+#else
+  for (uint32 i = 0; i < 8; i++) output[i] = v[i];
+#endif
+}
+
+// Expands to the body of a lane wise binary operation on a and b.
+#if BASE_SIMD_AVX
+#define BASE_FLOAT32X8_BINARY(avx_op, sse_op, scalar_expr) \
+  float32x8 output;                                        \
+  output.m = avx_op(a.m, b.m);                             \
+  return output;
+#elif BASE_SIMD_SSE2
+#define BASE_FLOAT32X8_BINARY(avx_op, sse_op, scalar_expr) \
+  float32x8 output;                                        \
+  output.m[0] = sse_op(a.m[0], b.m[0]);                    \
+  output.m[1] = sse_op(a.m[1], b.m[1]);                    \
+  return output;
+#else
+#define BASE_FLOAT32X8_BINARY(avx_op, sse_op, scalar_expr) \
+  float32x8 output;                                        \
+  for (uint32 i = 0; i < 8; i++) {                         \
+    float32 lhs = a.v[i];                                  \
+    float32 rhs = b.v[i];                                  \
+    output.v[i] = (scalar_expr);                           \
+  }                                                        \
+  return output;
+#endif
+
+inline float32x8 float32x8::operator-(const float32x8& b) const {
+  const float32x8& a = *this;
+  BASE_FLOAT32X8_BINARY(_mm256_sub_ps, _mm_sub_ps, lhs - rhs)
+}
+
+inline float32x8 float32x8::operator+(const float32x8& b) const {
+  const float32x8& a = *this;
+  BASE_FLOAT32X8_BINARY(_mm256_add_ps, _mm_add_ps, lhs + rhs)
+}
+
+inline float32x8 float32x8::operator*(const float32x8& b) const {
+  const float32x8& a = *this;
+  BASE_FLOAT32X8_BINARY(_mm256_mul_ps, _mm_mul_ps, lhs * rhs)
+}
+
+inline float32x8 float32x8::operator/(const float32x8& b) const {
+  const float32x8& a = *this;
+  BASE_FLOAT32X8_BINARY(_mm256_div_ps, _mm_div_ps, lhs / rhs)
+}
+
+inline float32x8 lane_min(const float32x8& a, const float32x8& b) {
+  BASE_FLOAT32X8_BINARY(_mm256_min_ps, _mm_min_ps, min(lhs, rhs))
+}
+
+inline float32x8 lane_max(const float32x8& a, const float32x8& b) {
+  BASE_FLOAT32X8_BINARY(_mm256_max_ps, _mm_max_ps, max(lhs, rhs))
+}
+
+#undef BASE_FLOAT32X8_BINARY
+
+inline float32x8 madd(const float32x8& a, const float32x8& b,
+                      const float32x8& c) {
+#if BASE_SIMD_AVX && defined(__FMA__)
+  float32x8 output;
+  output.m = _mm256_fmadd_ps(a.m, b.m, c.m);
+  return output;
+#else
+  return a * b + c;
+#endif
+}
+
+inline float32x8 lane_sqrt(const float32x8& a) {
+  float32x8 output;
+#if BASE_SIMD_AVX
+  output.m = _mm256_sqrt_ps(a.m);
+#elif BASE_SIMD_SSE2
+  output.m[0] = _mm_sqrt_ps(a.m[0]);
+  output.m[1] = _mm_sqrt_ps(a.m[1]);
+#else
+  for (uint32 i = 0; i < 8; i++) output.v[i] = ::sqrt(a.v[i]);
+#endif
+  return output;
+}
+
+//
+// vector3x8
+//
+
+inline vector3x8::vector3x8(const vector3& value)
+    : x(value.x), y(value.y), z(value.z) {}
+
+inline vector3x8 vector3x8::load(const vector3* input, uint32 count) {
+  vector3x8 output(vector3(0, 0, 0));
+  for (uint32 i = 0; i < count && i < 8; i++) {
+    output.set(i, input[i]);
+  }
+  return output;
+}
+
+inline void vector3x8::store(vector3* output, uint32 count) const {
+  for (uint32 i = 0; i < count && i < 8; i++) {
+    output[i] = get(i);
+  }
+}
+
+inline vector3 vector3x8::get(uint32 lane) const {
+  return vector3(x.v[lane], y.v[lane], z.v[lane]);
+}
+
+inline void vector3x8::set(uint32 lane, const vector3& value) {
+  x.v[lane] = value.x;
+  y.v[lane] = value.y;
+  z.v[lane] = value.z;
+}
+
+inline float32x8 vector3x8::dot(const vector3x8& rhs) const {
+  return madd(x, rhs.x, madd(y, rhs.y, z * rhs.z));
+}
+
+inline float32x8 vector3x8::length() const { return lane_sqrt(dot(*this)); }
+
+inline vector3x8 vector3x8::normalize() const {
+  // Zero length lanes are left unchanged, matching vector3::normalize.
+  float32x8 l = length();
+  float32x8 one(1.0f);
+  for (uint32 i = 0; i < 8; i++) {
+    if (l.v[i] == 0.0f) l.v[i] = 1.0f;
+  }
+  return *this * (one / l);
+}
+
+inline vector3x8 vector3x8::cross(const vector3x8& rhs) const {
+  return vector3x8(y * rhs.z - z * rhs.y, z * rhs.x - x * rhs.z,
+                   x * rhs.y - y * rhs.x);
+}
+
+inline vector3x8 vector3x8::operator-(const vector3x8& rhs) const {
+  return vector3x8(x - rhs.x, y - rhs.y, z - rhs.z);
+}
+
+inline vector3x8 vector3x8::operator+(const vector3x8& rhs) const {
+  return vector3x8(x + rhs.x, y + rhs.y, z + rhs.z);
+}
+
+inline vector3x8 vector3x8::operator*(const vector3x8& rhs) const {
+  return vector3x8(x * rhs.x, y * rhs.y, z * rhs.z);
+}
+
+inline vector3x8 vector3x8::operator*(const float32x8& rhs) const {
+  return vector3x8(x * rhs, y * rhs, z * rhs);
+}
+
+inline vector3x8 lane_min(const vector3x8& a, const vector3x8& b) {
+  return vector3x8(lane_min(a.x, b.x), lane_min(a.y, b.y),
+                   lane_min(a.z, b.z));
+}
+
+inline vector3x8 lane_max(const vector3x8& a, const vector3x8& b) {
+  return vector3x8(lane_max(a.x, b.x), lane_max(a.y, b.y),
+                   lane_max(a.z, b.z));
+}
+
+inline vector3x8 madd(const vector3x8& a, const float32x8& b,
+                      const vector3x8& c) {
+  return vector3x8(madd(a.x, b, c.x), madd(a.y, b, c.y), madd(a.z, b, c.z));
+}
+
+}  // namespace base
+
+#endif  // __SIMD_H__
@@ -59,11 +59,11 @@ typedef struct vector3 {
   };
 
  public:
-  vector3();
+  inline vector3();
   vector3(const vector2& rhs);
-  vector3(const vector3& rhs);
-  vector3(float32 xj, float32 yj, float32 zj);
-  ~vector3();
+  inline vector3(const vector3& rhs);
+  inline vector3(float32 xj, float32 yj, float32 zj);
+  inline ~vector3();
 
   operator vector2();
 
@@ -130,6 +130,26 @@ const vector3 BASE_X_AXIS(1.0, 0.0, 0.0);
 const vector3 BASE_Y_AXIS(0.0, 1.0, 0.0);
 const vector3 BASE_Z_AXIS(0.0, 0.0, -1.0);
 
+inline vector3::vector3() {
+  x = 0;
+  y = 0;
+  z = 0;
+}
+
+inline vector3::vector3(const vector3& rhs) {
+  x = rhs.x;
+  y = rhs.y;
+  z = rhs.z;
+}
+
+inline vector3::vector3(float32 xj, float32 yj, float32 zj) {
+  x = xj;
+  y = yj;
+  z = zj;
+}
+
+inline vector3::~vector3() {}
+
 inline const vector3& vector3::set(const vector3& rhs) { return (*this) = rhs; }
 
 inline const vector3& vector3::set(float32 xj, float32 yj, float32 zj) {
@@ -1,33 +1,112 @@
 #include "mesh.h"
 
 #include <math.h>
+#include <chrono>
 #include "math/intersect.h"
 #include "math/random.h"
+#include "mesh_stream.h"
+#include "obj_loader.h"
 #include "object.h"
-
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "third_party/tiny_obj_loader.h"
-
-using namespace tinyobj;
+#include "ply_loader.h"
+#include "scene_cache.h"
 
 namespace base {
 
 static const uint32 kMaxFaceCountPerNode = 16;
 static const uint32 kMaxSubdivisionDepth = 4;
+static const uint32 kInvalidWeldIndex = 0xFFFFFFFF;
+
+// Returns true if filename has a ply extension.
+static bool IsPlyFile(const ::std::string& filename) {
+  return filename.size() >= 4 &&
+         (filename.compare(filename.size() - 4, 4, ".ply") == 0 ||
+          filename.compare(filename.size() - 4, 4, ".PLY") == 0);
+}
+
+// Computes the plane of each face that lacks plane info.
+static void ComputeFacePlanes(const vector3* vertices, MeshFace* faces,
+                              uint32 face_count) {
+  for (uint32 i = 0; i < face_count; i++) {
+    MeshFace* mesh_face = &faces[i];
+    plane* face_plane = &mesh_face->face_plane;
+    if (face_plane->x == 0 && face_plane->y == 0 && face_plane->z == 0 &&
+        face_plane->w == 0) {
+      vector3 p0 = vertices[mesh_face->vertex_indices[0]];
+      vector3 p1 = vertices[mesh_face->vertex_indices[1]];
+      vector3 p2 = vertices[mesh_face->vertex_indices[2]];
+      vector3 normal = calculate_normal(p0, p1, p2);
+      *face_plane = calculate_plane(normal, p0);
+    }
+  }
+}
+
+// Packs a texcoord into two 16 bit fractions of the given range.
+static uint32 PackTexcoord(const vector2& texcoord, const vector2& origin,
+                           const vector2& extent) {
+  float32 u = extent.x > 0.0f ? (texcoord.x - origin.x) / extent.x : 0.0f;
+  float32 v = extent.y > 0.0f ? (texcoord.y - origin.y) / extent.y : 0.0f;
+  uint32 packed_u = (uint32)lrintf(clip_range(u, 0.0f, 1.0f) * 65535.0f);
+  uint32 packed_v = (uint32)lrintf(clip_range(v, 0.0f, 1.0f) * 65535.0f);
+  return packed_u | (packed_v << 16);
+}
 
 MeshCollision::MeshCollision() : param(2.0), face_index(-1) {}
 
+bool CheckMeshFaces(const MeshView& view, uint32* face_index) {
+  for (uint32 i = 0; i < view.face_count; i++) {
+    const MeshFace& face = view.faces[i];
+    for (uint32 j = 0; j < 3; j++) {
+      if (face.vertex_indices[j] >= view.vertex_count ||
+          (view.normal_count && face.normal_indices[j] >= view.normal_count) ||
+          (view.texcoord_count &&
+           face.texcoord_indices[j] >= view.texcoord_count)) {
+        *face_index = i;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+MeshWelder::MeshWelder(uint32 vertex_count)
+    : first_welded_(vertex_count, kInvalidWeldIndex) {}
+
+uint32 MeshWelder::Weld(uint32 position, uint32 normal, uint32 texcoord) {
+  uint32 welded = first_welded_[position];
+  while (welded != kInvalidWeldIndex &&
+         (normals_[welded] != normal || texcoords_[welded] != texcoord)) {
+    welded = next_welded_[welded];
+  }
+  if (welded == kInvalidWeldIndex) {
+    welded = positions_.size();
+    positions_.push_back(position);
+    normals_.push_back(normal);
+    texcoords_.push_back(texcoord);
+    next_welded_.push_back(first_welded_[position]);
+    first_welded_[position] = welded;
+  }
+  return welded;
+}
+
+void MeshWelder::Reset() {
+  for (uint32 position : positions_) {
+    first_welded_[position] = kInvalidWeldIndex;
+  }
+  next_welded_.clear();
+  positions_.clear();
+  normals_.clear();
+  texcoords_.clear();
+}
+
 MeshBvhNode::MeshBvhNode(const MeshBvhDataSource& data_source) {
-  tree_vertices_ = data_source.vertices;
-  tree_faces_ = data_source.faces;
+  tree_data_ = data_source;
 }
 
 MeshBvhNode::MeshBvhNode(MeshBvhNode* parent_node) {
   depth_ = parent_node->depth_ + 1;
   parent_ = parent_node;
   is_leaf_node_ = true;
-  tree_vertices_ = parent_node->tree_vertices_;
-  tree_faces_ = parent_node->tree_faces_;
+  tree_data_ = parent_node->tree_data_;
 }
 
 void MeshBvhNode::AllocateChild(int32 index) {
@@ -50,10 +129,11 @@ void MeshBvhNode::Subdivide() {
     // created child. Add faces to the child that intersect it.
     for (uint32 j = 0; j < face_indices_.size(); j++) {
       uint32 face_index = face_indices_.at(j);
-      const MeshFace& face = tree_faces_->at(face_index);
-      const vector3& v0 = tree_vertices_->at(face.vertex_indices[0]);
-      const vector3& v1 = tree_vertices_->at(face.vertex_indices[1]);
-      const vector3& v2 = tree_vertices_->at(face.vertex_indices[2]);
+      uint32 vertex_indices[3];
+      tree_data_.GetVertexIndices(face_index, vertex_indices);
+      const vector3& v0 = tree_data_.vertices[vertex_indices[0]];
+      const vector3& v1 = tree_data_.vertices[vertex_indices[1]];
+      const vector3& v2 = tree_data_.vertices[vertex_indices[2]];
       for (uint32 i = 0; i < 8; i++) {
         if (triangle_intersect_bounds(v0, v1, v2, children_[i]->GetBounds())) {
           MeshBvhNode* node = static_cast<MeshBvhNode*>(children_[i].get());
@@ -91,13 +171,22 @@ bool MeshBvhNode::Trace(const ray& trajectory, MeshCollision* hit_info) const {
       vector2 temp_bary_coords;
       uint32 face_index = face_indices_.at(i);
 
-      const MeshFace& face = tree_faces_->at(face_index);
-      const vector3& v0 = tree_vertices_->at(face.vertex_indices[0]);
-      const vector3& v1 = tree_vertices_->at(face.vertex_indices[1]);
-      const vector3& v2 = tree_vertices_->at(face.vertex_indices[2]);
-
-      if (ray_intersect_triangle(v0, v1, v2, face.face_plane, trajectory, &temp_hit,
-                                 &temp_bary_coords)) {
+      uint32 vertex_indices[3];
+      tree_data_.GetVertexIndices(face_index, vertex_indices);
+      const vector3& v0 = tree_data_.vertices[vertex_indices[0]];
+      const vector3& v1 = tree_data_.vertices[vertex_indices[1]];
+      const vector3& v2 = tree_data_.vertices[vertex_indices[2]];
+
+      bool is_hit;
+      if (tree_data_.faces) {
+        const plane& face_plane = tree_data_.faces[face_index].face_plane;
+        is_hit = ray_intersect_triangle(v0, v1, v2, face_plane, trajectory,
+                                        &temp_hit, &temp_bary_coords);
+      } else {
+        is_hit = ray_intersect_triangle(v0, v1, v2, trajectory, &temp_hit,
+                                        &temp_bary_coords);
+      }
+      if (is_hit) {
         if (temp_hit.param < hit_info->param) {
           hit_info->param = temp_hit.param;
           hit_info->point = temp_hit.point;
@@ -114,194 +203,661 @@ bool MeshBvhNode::Trace(const ray& trajectory, MeshCollision* hit_info) const {
   return trace_result;
 }
 
-void MeshBvh::BuildBvh(::std::vector<vector3>* vertices,
-                       ::std::vector<MeshFace>* faces) {
-  if (!vertices->size() || !faces->size()) {
+MeshBvh::MeshBvh()
+    : nodes_(nullptr),
+      node_count_(0),
+      face_indices_(nullptr),
+      face_index_count_(0) {}
+
+void MeshBvh::BuildBvh(const MeshBvhDataSource& data, uint32 vertex_count,
+                       uint32 triangle_count) {
+  if (!vertex_count || !triangle_count) {
     return;
   }
 
-  MeshBvhDataSource data = {vertices, faces};
-
-  tree_vertices_ = vertices;
-  tree_faces_ = faces;
-  root_node_.reset(new MeshBvhNode(data));
+  ::std::unique_ptr<MeshBvhNode> root_node(new MeshBvhNode(data));
 
   bounds root_bounds;
-  for (uint32 i = 0; i < vertices->size(); i++) {
-    root_bounds += vertices->at(i);
+  for (uint32 i = 0; i < vertex_count; i++) {
+    root_bounds += data.vertices[i];
   }
-  root_node_->SetBounds(root_bounds);
+  root_node->SetBounds(root_bounds);
 
-  for (uint32 i = 0; i < faces->size(); i++) {
-    MeshFace* mesh_face = &faces->at(i);
-    plane* face_plane = &mesh_face->face_plane;
-    if (face_plane->x == 0 && face_plane->y == 0 && face_plane->z == 0 &&
-        face_plane->w == 0) {
-      vector3 p0 = vertices->at(mesh_face->vertex_indices[0]);
-      vector3 p1 = vertices->at(mesh_face->vertex_indices[1]);
-      vector3 p2 = vertices->at(mesh_face->vertex_indices[2]);
-      // Compute face plane from normals, for any faces that lack plane info.
-      vector3 normal = calculate_normal(p0, p1, p2);
-      *face_plane = calculate_plane(normal, p0);
+  for (uint32 i = 0; i < triangle_count; i++) {
+    root_node->AddFace(i);
+  }
+
+  root_node->Subdivide();
+
+  // The pointer based tree is only needed during construction.
+  PackTree(root_node.get());
+  data_ = data;
+}
+
+void MeshBvh::PackTree(MeshBvhNode* root_node) {
+  // Nodes are packed breadth first, so that siblings are contiguous.
+  ::std::vector<MeshBvhNode*> pending_nodes(1, root_node);
+  node_storage_.clear();
+  face_index_storage_.clear();
+
+  for (uint32 i = 0; i < pending_nodes.size(); i++) {
+    MeshBvhNode* node = pending_nodes[i];
+    MeshBvhPackedNode packed_node;
+    packed_node.aabb = node->aabb_;
+    packed_node.is_leaf = node->IsLeafNode();
+    packed_node.face_count = 0;
+
+    if (packed_node.is_leaf) {
+      packed_node.first = face_index_storage_.size();
+      packed_node.face_count = node->face_indices_.size();
+      face_index_storage_.insert(face_index_storage_.end(),
+                                 node->face_indices_.begin(),
+                                 node->face_indices_.end());
+    } else {
+      packed_node.first = pending_nodes.size();
+      for (uint32 j = 0; j < 8; j++) {
+        pending_nodes.push_back(
+            static_cast<MeshBvhNode*>(node->children_[j].get()));
+      }
+    }
+    node_storage_.push_back(packed_node);
+  }
+
+  nodes_ = node_storage_.data();
+  node_count_ = node_storage_.size();
+  face_indices_ = face_index_storage_.data();
+  face_index_count_ = face_index_storage_.size();
+}
+
+void MeshBvh::SetPackedTree(const MeshBvhDataSource& data,
+                            const MeshBvhPackedNode* nodes, uint32 node_count,
+                            const uint32* face_indices,
+                            uint32 face_index_count) {
+  node_storage_.clear();
+  face_index_storage_.clear();
+  data_ = data;
+  nodes_ = nodes;
+  node_count_ = node_count;
+  face_indices_ = face_indices;
+  face_index_count_ = face_index_count;
+}
+
+bool MeshBvh::TraceNode(uint32 node_index, const ray& trajectory,
+                        MeshCollision* hit_info) const {
+  const MeshBvhPackedNode& node = nodes_[node_index];
+  collision node_hit;
+  if (!ray_intersect_bounds(node.aabb, trajectory, &node_hit) ||
+      node_hit.param > hit_info->param) {
+    return false;
+  }
+
+  if (!node.is_leaf) {
+    return TraceChildren(node, node_hit, trajectory, hit_info);
+  }
+
+  // Traverse faces and return closest hit (if any)
+  bool trace_result = false;
+  for (uint32 i = 0; i < node.face_count; i++) {
+    collision temp_hit;
+    vector2 temp_bary_coords;
+    uint32 face_index = face_indices_[node.first + i];
+
+    uint32 vertex_indices[3];
+    data_.GetVertexIndices(face_index, vertex_indices);
+    const vector3& v0 = data_.vertices[vertex_indices[0]];
+    const vector3& v1 = data_.vertices[vertex_indices[1]];
+    const vector3& v2 = data_.vertices[vertex_indices[2]];
+
+    bool is_hit;
+    if (data_.faces) {
+      const plane& face_plane = data_.faces[face_index].face_plane;
+      is_hit = ray_intersect_triangle(v0, v1, v2, face_plane, trajectory,
+                                      &temp_hit, &temp_bary_coords);
+    } else {
+      // Compact meshes carry no planes, so they are derived per test.
+      is_hit = ray_intersect_triangle(v0, v1, v2, trajectory, &temp_hit,
+                                      &temp_bary_coords);
+    }
+    if (is_hit) {
+      if (temp_hit.param < hit_info->param) {
+        hit_info->param = temp_hit.param;
+        hit_info->point = temp_hit.point;
+        hit_info->normal = temp_hit.normal;
+        hit_info->face_index = face_index;
+        hit_info->bary_coords = temp_bary_coords;
+        trace_result = true;
+      }
+    }
+  }
+  return trace_result;
+}
+
+bool MeshBvh::TraceChildren(const MeshBvhPackedNode& node,
+                            const collision& node_hit, const ray& trajectory,
+                            MeshCollision* hit_info) const {
+  bool trace_result = false;
+  bool x_hit, y_hit, z_hit;
+  ray internal_trajectory = trajectory;
+  collision x_plane_info, y_plane_info, z_plane_info;
+
+  // Split planes pass through the node center, as in ConfigureChildren.
+  vector3 center = node.aabb.query_center();
+  plane split_planes[3] = {calculate_plane(vector3(1, 0, 0), center),
+                           calculate_plane(vector3(0, 1, 0), center),
+                           calculate_plane(vector3(0, 0, 1), center)};
+  vector3 start = trajectory.start;
+  bool is_start_inside = point_in_bounds(node.aabb, trajectory.start);
+
+  if (!is_start_inside) {
+    internal_trajectory.start = node_hit.point;
+    start = node_hit.point;
+    x_hit = ray_intersect_plane(split_planes[0], internal_trajectory,
+                                &x_plane_info);
+    y_hit = ray_intersect_plane(split_planes[1], internal_trajectory,
+                                &y_plane_info);
+    z_hit = ray_intersect_plane(split_planes[2], internal_trajectory,
+                                &z_plane_info);
+  } else {
+    x_hit = ray_intersect_plane(split_planes[0], trajectory, &x_plane_info);
+    y_hit = ray_intersect_plane(split_planes[1], trajectory, &y_plane_info);
+    z_hit = ray_intersect_plane(split_planes[2], trajectory, &z_plane_info);
+  }
+
+  vector3 trace_dir = start - center;
+  uint8 closest_node = (trace_dir.x >= 0.0f) | ((trace_dir.z >= 0.0f) << 1) |
+                       ((trace_dir.y >= 0.0f) << 2);
+
+  // If we didn't hit any of the planes then we're tracing out of the node
+  // and we only need to check our current node for collisions.
+  if (is_start_inside && !x_hit && !y_hit && !z_hit) {
+    return TraceNode(node.first + closest_node, trajectory, hit_info);
+  }
+
+  for (uint32 i = 0; i < 4; i++) {
+    uint32 child_index = node.first + closest_node;
+    if (TraceNode(child_index, trajectory, hit_info)) {
+      trace_result = true;
+      if (point_in_bounds(nodes_[child_index].aabb, hit_info->point)) {
+        break;
+      }
+    }
+
+    if (x_hit && x_plane_info.param < y_plane_info.param &&
+        x_plane_info.param < z_plane_info.param) {
+      // x is the closest plane. we search the other x node.
+      closest_node ^= 0x1;
+      x_hit = false;
+      internal_trajectory.start = x_plane_info.point;
+      x_plane_info.param = BASE_INFINITY;
+    } else if (y_hit && y_plane_info.param < z_plane_info.param &&
+               y_plane_info.param < x_plane_info.param) {
+      // y is the closest plane. we search the adjacent y node.
+      closest_node ^= 0x4;
+      y_hit = false;
+      internal_trajectory.start = y_plane_info.point;
+      y_plane_info.param = BASE_INFINITY;
+    } else if (z_hit && z_plane_info.param < y_plane_info.param &&
+               z_plane_info.param < x_plane_info.param) {
+      // z is the closest plane. we search the adjacent z node.
+      closest_node ^= 0x2;
+      z_hit = false;
+      internal_trajectory.start = z_plane_info.point;
+      z_plane_info.param = BASE_INFINITY;
+    } else {
+      break;
     }
 
-    root_node_->AddFace(i);
+    // if the new ray start isn't in our node's bounding box, return false
+    if (!point_in_bounds(node.aabb, internal_trajectory.start)) {
+      break;
+    }
   }
 
-  root_node_->Subdivide();
+  return trace_result;
 }
 
 bool MeshBvh::Trace(const ray& trajectory, MeshCollision* hit_info) const {
-  if (root_node_.get()) {
-    return root_node_->Trace(trajectory, hit_info);
+  if (node_count_) {
+    return TraceNode(0, trajectory, hit_info);
   }
   return false;
 }
 
+void MeshBvh::Inspect(BvhInspector* inspector) const {
+  // Children are packed after their parents, so the depth of every node is
+  // known by the time it is visited.
+  ::std::vector<uint32> depths(node_count_, 0);
+  for (uint32 i = 0; i < node_count_; i++) {
+    const MeshBvhPackedNode& node = nodes_[i];
+    if (node.is_leaf) {
+      inspector->AddLeafNode(node.aabb, depths[i], node.face_count);
+      continue;
+    }
+
+    bounds child_bounds[8];
+    for (uint32 j = 0; j < 8; j++) {
+      child_bounds[j] = nodes_[node.first + j].aabb;
+      depths[node.first + j] = depths[i] + 1;
+    }
+    inspector->AddInteriorNode(node.aabb, depths[i], child_bounds, 8);
+  }
+}
+
 const vector3 MeshBvh::GetCenter() const {
-  if (root_node_.get()) {
-    return root_node_->aabb_.query_center();
+  if (node_count_) {
+    return nodes_[0].aabb.query_center();
   }
   return vector3();
 }
 
 MeshObject::MeshObject(const ::std::string& filename, bool invert_normals,
                        const vector3& translation, const vector3& scale,
-    const vector4& rotation) {
-  // Load the object and initialize the shapes (including materials)
-  ::std::string errors;
-  attrib_t attributes;
-  ::std::vector<shape_t> shapes;
-  ::std::vector<material_t> materials;
-
-  if (!LoadObj(&attributes, &shapes, &materials, &errors, filename.c_str(),
-               nullptr, true)) {
-    printf("Error loading obj file %s: %s.\n", filename.c_str(),
-           errors.c_str());
-    return;
-  }
-
-  if (!errors.empty()) {
-    printf("Errors loading model: %s\n", errors.c_str());
+                       const vector4& rotation, MeshStorage storage,
+                       MeshClusterCache* cluster_cache,
+                       uint32 load_thread_count)
+    : bvh_build_seconds_(0),
+      vertex_data_(nullptr),
+      vertex_count_(0),
+      normal_data_(nullptr),
+      normal_count_(0),
+      texcoord_data_(nullptr),
+      texcoord_count_(0),
+      face_data_(nullptr),
+      face_count_(0),
+      short_index_data_(nullptr),
+      short_index_count_(0),
+      index_data_(nullptr),
+      index_count_(0),
+      packed_normal_data_(nullptr),
+      packed_normal_count_(0),
+      packed_texcoord_data_(nullptr),
+      packed_texcoord_count_(0) {
+  // Streamed meshes are read from a cluster file beside the source mesh,
+  // which is written from the loaded mesh when it is missing or stale.
+  ::std::string cluster_filename = filename + ".clusters";
+  uint64 cluster_key = 0;
+  if (storage == kMeshStorageStreamed) {
+    if (!cluster_cache ||
+        !SceneCache::ComputeMeshKey(filename, invert_normals, translation,
+                                    scale, rotation, storage, &cluster_key)) {
+      storage = kMeshStorageFull;
+    } else if (OpenClusterStream(cluster_filename, cluster_key,
+                                 cluster_cache)) {
+      return;
+    }
   }
 
-  bool transform_needed = false;
   matrix4 translation_mtx, scale_mtx, rotation_mtx;
   translation_mtx.identity();
   scale_mtx.identity();
   rotation_mtx.identity();
 
   if (translation.x || translation.y || translation.z) {
-    transform_needed = true;
     translation_mtx = translation_mtx.translation(translation.x, translation.y,
                                                   translation.z);
   }
 
   if (scale.x || scale.y || scale.z) {
-    transform_needed = true;
     scale_mtx = scale_mtx.scale(scale.x, scale.y, scale.z);
   }
 
   if (rotation.x || rotation.y || rotation.z) {
-    transform_needed = true;
     rotation_mtx = rotation_mtx.rotation(
         rotation.w, vector3(rotation.x, rotation.y, rotation.z));
   }
 
-  if (transform_needed) {
-    matrix4 transform_mtx = translation_mtx * rotation_mtx * scale_mtx;
-    for (uint32 i = 0; i < attributes.vertices.size(); i += 3) {
-      vector3 temp_vertex = vector3(attributes.vertices[i + 0],
-                                    attributes.vertices[i + 1],
-                                    attributes.vertices[i + 2]);
-      temp_vertex = vector3(transform_mtx * temp_vertex);
-      aabb_ += temp_vertex;
-      vertices_.emplace_back(temp_vertex);
+  // The loaders write straight into the mesh arrays, transforming vertices
+  // as they are parsed.
+  matrix4 transform_mtx = translation_mtx * rotation_mtx * scale_mtx;
+  if (IsPlyFile(filename)) {
+    if (!LoadPlyMesh(filename, transform_mtx, invert_normals, &mesh_file_,
+                     &vertex_data_, &vertex_count_, &vertices_, &normals_,
+                     &texcoords_, &face_list, &aabb_)) {
+      printf("Error loading ply file %s.\n", filename.c_str());
+      return;
+    }
+  } else {
+    if (!LoadObjMesh(filename, transform_mtx, invert_normals, &vertices_,
+                     &normals_, &texcoords_, &face_list, &aabb_,
+                     load_thread_count)) {
+      printf("Error loading obj file %s.\n", filename.c_str());
+      return;
+    }
+    vertex_data_ = vertices_.data();
+    vertex_count_ = vertices_.size();
+  }
+
+  normal_data_ = normals_.data();
+  normal_count_ = normals_.size();
+  texcoord_data_ = texcoords_.data();
+  texcoord_count_ = texcoords_.size();
+  face_data_ = face_list.data();
+  face_count_ = face_list.size();
+
+  if (storage == kMeshStorageStreamed) {
+    if (WriteMeshClusters(cluster_filename, cluster_key, GetView()) &&
+        OpenClusterStream(cluster_filename, cluster_key, cluster_cache)) {
+      // Release the full arrays, including any mapped source file.
+      ::std::vector<MeshFace>().swap(face_list);
+      ::std::vector<vector3>().swap(vertices_);
+      ::std::vector<vector3>().swap(normals_);
+      ::std::vector<vector2>().swap(texcoords_);
+      mesh_file_.Close();
+      vertex_data_ = nullptr;
+      vertex_count_ = 0;
+      normal_data_ = nullptr;
+      normal_count_ = 0;
+      texcoord_data_ = nullptr;
+      texcoord_count_ = 0;
+      face_data_ = nullptr;
+      face_count_ = 0;
+      return;
     }
+    printf("Failed to stream mesh %s, using full storage.\n",
+           filename.c_str());
+    storage = kMeshStorageFull;
   }
 
-  for (uint32 i = 0; i < attributes.normals.size(); i += 3) {
-    vector3 temp_normal =
-        vector3(attributes.normals[i + 0], attributes.normals[i + 1],
-                attributes.normals[i + 2])
-            .normalize();
+  if (storage == kMeshStorageFull ||
+      !Compact(storage == kMeshStorageQuantized)) {
+    ComputeFacePlanes(vertex_data_, face_list.data(), face_list.size());
+  }
+
+  auto build_start = ::std::chrono::steady_clock::now();
+  shape_tree.BuildBvh(GetTriangles(), vertex_count_, GetTriangleCount());
+  bvh_build_seconds_ = ::std::chrono::duration<float64>(
+                           ::std::chrono::steady_clock::now() - build_start)
+                           .count();
+}
+
+bool MeshObject::Compact(bool quantize) {
+  // Every corner must reference valid attributes, or the welded vertices
+  // would have nothing to hold.
+  uint32 incomplete_face = 0;
+  if (!CheckMeshFaces(GetView(), &incomplete_face)) {
+    printf("Mesh face %i lacks vertex attributes, using full storage.\n",
+           incomplete_face);
+    return false;
+  }
 
-    if (invert_normals) {
-      temp_normal *= -1.0;
+  MeshWelder welder(vertex_count_);
+  ::std::vector<uint32> corners(3 * face_count_);
+  for (uint32 i = 0; i < face_count_; i++) {
+    const MeshFace& face = face_data_[i];
+    for (uint32 j = 0; j < 3; j++) {
+      corners[3 * i + j] =
+          welder.Weld(face.vertex_indices[j],
+                      normal_count_ ? face.normal_indices[j] : 0,
+                      texcoord_count_ ? face.texcoord_indices[j] : 0);
     }
+  }
 
-    normals_.emplace_back(temp_normal);
+  const ::std::vector<uint32>& welded_positions = welder.GetPositions();
+  const ::std::vector<uint32>& welded_normals = welder.GetNormals();
+  const ::std::vector<uint32>& welded_texcoords = welder.GetTexcoords();
+  uint32 welded_count = welded_positions.size();
+  ::std::vector<vector3> positions(welded_count);
+  for (uint32 i = 0; i < welded_count; i++) {
+    positions[i] = vertex_data_[welded_positions[i]];
   }
 
-  for (uint32 i = 0; i < attributes.texcoords.size(); i += 2) {
-    texcoords_.emplace_back(attributes.texcoords[i + 0],
-                            attributes.texcoords[i + 1]);
+  ::std::vector<vector3> normals;
+  if (normal_count_) {
+    if (quantize) {
+      packed_normals_.resize(welded_count);
+      for (uint32 i = 0; i < welded_count; i++) {
+        packed_normals_[i] =
+            encode_octahedral_normal(normal_data_[welded_normals[i]]);
+      }
+    } else {
+      normals.resize(welded_count);
+      for (uint32 i = 0; i < welded_count; i++) {
+        normals[i] = normal_data_[welded_normals[i]];
+      }
+    }
   }
 
-  // Condense all of the meshes from the obj file into a single shape.
-  for (uint32 i = 0; i < shapes.size(); i++) {
-    mesh_t* pMesh = &(shapes[i].mesh);
+  ::std::vector<vector2> texcoords;
+  texcoord_origin_ = vector2(0, 0);
+  texcoord_extent_ = vector2(0, 0);
+  if (texcoord_count_) {
+    if (quantize) {
+      // Texcoords are stored relative to the range the mesh actually uses.
+      vector2 low = texcoord_data_[welded_texcoords[0]];
+      vector2 high = low;
+      for (uint32 i = 1; i < welded_count; i++) {
+        const vector2& texcoord = texcoord_data_[welded_texcoords[i]];
+        low = vector2(min(low.x, texcoord.x), min(low.y, texcoord.y));
+        high = vector2(max(high.x, texcoord.x), max(high.y, texcoord.y));
+      }
+      texcoord_origin_ = low;
+      texcoord_extent_ = high - low;
+      packed_texcoords_.resize(welded_count);
+      for (uint32 i = 0; i < welded_count; i++) {
+        packed_texcoords_[i] =
+            PackTexcoord(texcoord_data_[welded_texcoords[i]], texcoord_origin_,
+                         texcoord_extent_);
+      }
+    } else {
+      texcoords.resize(welded_count);
+      for (uint32 i = 0; i < welded_count; i++) {
+        texcoords[i] = texcoord_data_[welded_texcoords[i]];
+      }
+    }
+  }
 
-    uint32 j = 0;
-    uint32 face_index = 0;
-    while (j < pMesh->indices.size()) {
-      MeshFace shape_face;
+  // A single welded vertex space lets 16 bit indices cover most meshes.
+  if (welded_count <= 0x10000) {
+    short_indices_.assign(corners.begin(), corners.end());
+  } else {
+    indices_.swap(corners);
+  }
 
-      shape_face.vertex_indices[0] = pMesh->indices[j + 2].vertex_index;
-      shape_face.vertex_indices[1] = pMesh->indices[j + 1].vertex_index;
-      shape_face.vertex_indices[2] = pMesh->indices[j + 0].vertex_index;
+  // Release the full arrays, including any mapped source file.
+  ::std::vector<MeshFace>().swap(face_list);
+  vertices_.swap(positions);
+  normals_.swap(normals);
+  texcoords_.swap(texcoords);
+  mesh_file_.Close();
+
+  vertex_data_ = vertices_.data();
+  vertex_count_ = vertices_.size();
+  normal_data_ = normals_.data();
+  normal_count_ = normals_.size();
+  texcoord_data_ = texcoords_.data();
+  texcoord_count_ = texcoords_.size();
+  face_data_ = nullptr;
+  face_count_ = 0;
+  short_index_data_ = short_indices_.data();
+  short_index_count_ = short_indices_.size();
+  index_data_ = indices_.data();
+  index_count_ = indices_.size();
+  packed_normal_data_ = packed_normals_.data();
+  packed_normal_count_ = packed_normals_.size();
+  packed_texcoord_data_ = packed_texcoords_.data();
+  packed_texcoord_count_ = packed_texcoords_.size();
+  return true;
+}
 
-      shape_face.normal_indices[0] = pMesh->indices[j + 2].normal_index;
-      shape_face.normal_indices[1] = pMesh->indices[j + 1].normal_index;
-      shape_face.normal_indices[2] = pMesh->indices[j + 0].normal_index;
+bool MeshObject::OpenClusterStream(const ::std::string& filename, uint64 key,
+                                   MeshClusterCache* cluster_cache) {
+  ::std::unique_ptr<MeshClusterStream> stream(
+      new MeshClusterStream(cluster_cache));
+  if (!stream->Open(filename, key)) {
+    return false;
+  }
+  aabb_ = stream->GetBounds();
+  cluster_stream_ = ::std::move(stream);
+  return true;
+}
 
-      shape_face.texcoord_indices[0] = pMesh->indices[j + 2].texcoord_index;
-      shape_face.texcoord_indices[1] = pMesh->indices[j + 1].texcoord_index;
-      shape_face.texcoord_indices[2] = pMesh->indices[j + 0].texcoord_index;
+MeshBvhDataSource MeshObject::GetTriangles() const {
+  MeshBvhDataSource data;
+  data.vertices = vertex_data_;
+  data.faces = face_count_ ? face_data_ : nullptr;
+  data.short_indices = short_index_count_ ? short_index_data_ : nullptr;
+  data.indices = index_count_ ? index_data_ : nullptr;
+  return data;
+}
 
-      if (pMesh->material_ids.size() > face_index) {
-        shape_face.material = pMesh->material_ids.at(face_index);
-      } else {
-        shape_face.material = -1;
-      }
+uint32 MeshObject::GetTriangleCount() const {
+  if (face_count_) {
+    return face_count_;
+  }
+  return (short_index_count_ + index_count_) / 3;
+}
 
-      face_list.push_back(shape_face);
-      j += pMesh->num_face_vertices.at(face_index);
-      face_index++;
-    }
+vector3 MeshObject::GetNormal(uint32 index) const {
+  if (packed_normal_count_) {
+    return decode_octahedral_normal(packed_normal_data_[index]);
   }
+  return normal_data_[index];
+}
 
-  shape_tree.BuildBvh(&vertices_, &face_list);
+vector2 MeshObject::GetTexcoord(uint32 index) const {
+  if (packed_texcoord_count_) {
+    uint32 packed = packed_texcoord_data_[index];
+    return vector2(
+        texcoord_origin_.x + texcoord_extent_.x * (packed & 0xFFFF) / 65535.0f,
+        texcoord_origin_.y + texcoord_extent_.y * (packed >> 16) / 65535.0f);
+  }
+  return texcoord_data_[index];
+}
+
+MeshObject::MeshObject(const MeshView& view) : bvh_build_seconds_(0) {
+  aabb_ = view.aabb;
+  vertex_data_ = view.vertices;
+  vertex_count_ = view.vertex_count;
+  normal_data_ = view.normals;
+  normal_count_ = view.normal_count;
+  texcoord_data_ = view.texcoords;
+  texcoord_count_ = view.texcoord_count;
+  face_data_ = view.faces;
+  face_count_ = view.face_count;
+  short_index_data_ = view.short_indices;
+  short_index_count_ = view.short_index_count;
+  index_data_ = view.indices;
+  index_count_ = view.index_count;
+  packed_normal_data_ = view.packed_normals;
+  packed_normal_count_ = view.packed_normal_count;
+  packed_texcoord_data_ = view.packed_texcoords;
+  packed_texcoord_count_ = view.packed_texcoord_count;
+  texcoord_origin_ = view.texcoord_origin;
+  texcoord_extent_ = view.texcoord_extent;
+  shape_tree.SetPackedTree(GetTriangles(), view.nodes, view.node_count,
+                           view.face_indices, view.face_index_count);
+}
+
+MeshObject::~MeshObject() {}
+
+MeshView MeshObject::GetView() const {
+  MeshView view;
+  view.aabb = aabb_;
+  view.vertices = vertex_data_;
+  view.vertex_count = vertex_count_;
+  view.normals = normal_data_;
+  view.normal_count = normal_count_;
+  view.texcoords = texcoord_data_;
+  view.texcoord_count = texcoord_count_;
+  view.faces = face_data_;
+  view.face_count = face_count_;
+  view.short_indices = short_index_data_;
+  view.short_index_count = short_index_count_;
+  view.indices = index_data_;
+  view.index_count = index_count_;
+  view.packed_normals = packed_normal_data_;
+  view.packed_normal_count = packed_normal_count_;
+  view.packed_texcoords = packed_texcoord_data_;
+  view.packed_texcoord_count = packed_texcoord_count_;
+  view.texcoord_origin = texcoord_origin_;
+  view.texcoord_extent = texcoord_extent_;
+  view.nodes = shape_tree.GetNodes();
+  view.node_count = shape_tree.GetNodeCount();
+  view.face_indices = shape_tree.GetFaceIndices();
+  view.face_index_count = shape_tree.GetFaceIndexCount();
+  return view;
+}
+
+const vector3 MeshObject::GetCenter() const {
+  if (cluster_stream_) {
+    return aabb_.query_center() + offset_;
+  }
+  return shape_tree.GetCenter() + offset_;
+}
+
+void MeshObject::InspectBvh(BvhInspector* inspector) const {
+  if (cluster_stream_) {
+    cluster_stream_->Inspect(inspector);
+    return;
+  }
+
+  inspector->SetPrimitiveCount(GetTriangleCount());
+  shape_tree.Inspect(inspector);
+}
+
+const bounds MeshObject::GetBounds() const {
+  bounds translated_bounds = aabb_;
+  translated_bounds.translate(offset_);
+  return translated_bounds;
 }
 
 bool MeshObject::Trace(const ray& trajectory, ObjectCollision* hit_info) {
+  // The ray is moved into the space of the mesh arrays. Its direction is
+  // kept as is, so hit params are unaffected.
+  ray local_trajectory = trajectory;
+  local_trajectory.start -= offset_;
+  local_trajectory.stop -= offset_;
+
+  if (cluster_stream_) {
+    if (!cluster_stream_->Trace(local_trajectory, hit_info)) {
+      return false;
+    }
+    hit_info->point += offset_;
+    hit_info->surface_material = material_.get();
+    hit_info->surface_object = this;
+    return true;
+  }
+
   MeshCollision temp_collision;
   temp_collision.param = hit_info->param;
-  if (shape_tree.Trace(trajectory, &temp_collision)) {
+  if (shape_tree.Trace(local_trajectory, &temp_collision)) {
     if (temp_collision.param <= hit_info->param) {
       hit_info->param = temp_collision.param;
-      hit_info->point = temp_collision.point;
+      hit_info->point = temp_collision.point + offset_;
       hit_info->surface_normal = temp_collision.normal;
       hit_info->surface_material = material_.get();
+      hit_info->surface_object = this;
+
+      // Compact meshes index every attribute with the vertex indices.
+      const MeshFace* face = nullptr;
+      uint32 vertex_indices[3];
+      const uint32* normal_indices = vertex_indices;
+      const uint32* texcoord_indices = vertex_indices;
+      if (face_count_) {
+        face = &face_data_[temp_collision.face_index];
+        normal_indices = face->normal_indices;
+        texcoord_indices = face->texcoord_indices;
+      } else {
+        GetTriangles().GetVertexIndices(temp_collision.face_index,
+                                        vertex_indices);
+      }
 
-      const MeshFace& face = face_list.at(temp_collision.face_index);
-
-      if (normals_.size()) {
+      if (normal_count_ || packed_normal_count_) {
         // The mesh has normals so we use an interpolated vertex normal
         // for the collision normal, instead of an imprecise face normal.
-        const vector3& n0 = normals_.at(face.normal_indices[0]);
-        const vector3& n1 = normals_.at(face.normal_indices[1]);
-        const vector3& n2 = normals_.at(face.normal_indices[2]);
+        const vector3 n0 = GetNormal(normal_indices[0]);
+        const vector3 n1 = GetNormal(normal_indices[1]);
+        const vector3 n2 = GetNormal(normal_indices[2]);
         triangle_interpolate_barycentric_coeff(
             n0, n1, n2, temp_collision.bary_coords.x,
             temp_collision.bary_coords.y, &hit_info->surface_normal);
       }
 
-      if (texcoords_.size()) {
+      if (texcoord_count_ || packed_texcoord_count_) {
         // The mesh has texcoords so we use them.
-        const vector3& t0 = texcoords_.at(face.texcoord_indices[0]);
-        const vector3& t1 = texcoords_.at(face.texcoord_indices[1]);
-        const vector3& t2 = texcoords_.at(face.texcoord_indices[2]);
+        const vector3 t0 = GetTexcoord(texcoord_indices[0]);
+        const vector3 t1 = GetTexcoord(texcoord_indices[1]);
+        const vector3 t2 = GetTexcoord(texcoord_indices[2]);
         vector3 output_texcoords;
         triangle_interpolate_barycentric_coeff(
             t0, t1, t2, temp_collision.bary_coords.x,
@@ -312,8 +868,8 @@ bool MeshObject::Trace(const ray& trajectory, ObjectCollision* hit_info) {
 
       // If materials_ has non-zero size, and we have a valid
       // material index for the face, then set the material.
-      if (materials_.size() && face.material != -1) {
-        hit_info->surface_material = materials_.at(face.material).get();
+      if (materials_.size() && face && face->material != -1) {
+        hit_info->surface_material = materials_.at(face->material).get();
       }
       return true;
     }
@@ -32,9 +32,12 @@
 #ifndef __MESH_H__
 #define __MESH_H__
 
+#include <string.h>
+#include <memory>
 #include <string>
 #include <vector>
 #include "bvh.h"
+#include "mapped_file.h"
 #include "material.h"
 #include "math/base.h"
 #include "math/plane.h"
@@ -73,11 +76,45 @@ typedef struct MeshFace {
   uint32 material;
 } MeshFace;
 
+// Storage layouts for mesh triangles and attributes.
+typedef enum MeshStorage {
+  // MeshFace records with separate vertex, normal and texcoord indices and
+  // a precomputed plane per triangle.
+  kMeshStorageFull = 0,
+  // Vertices are welded so that a single 16 or 32 bit index stream
+  // addresses positions and attributes alike. Triangle planes are computed
+  // during traversal.
+  kMeshStorageCompact,
+  // Compact storage with octahedral normals and 16 bit texcoords.
+  kMeshStorageQuantized,
+  // Clusters of compact triangles read on demand from a cluster file, for
+  // meshes that do not fit in memory.
+  kMeshStorageStreamed,
+} MeshStorage;
+
+// Triangles referenced by a mesh bvh. Full meshes supply faces, and compact
+// meshes supply three entries per triangle in either short_indices or
+// indices.
 typedef struct MeshBvhDataSource {
-  // External vertex list for the mesh.
-  ::std::vector<vector3>* vertices;
-  // External face list for the mesh.
-  ::std::vector<MeshFace>* faces;
+  // External vertex array for the mesh.
+  const vector3* vertices;
+  // External face array for full meshes.
+  const MeshFace* faces;
+  // External index streams for compact meshes.
+  const uint16* short_indices;
+  const uint32* indices;
+  // Returns the vertex indices of a triangle.
+  void GetVertexIndices(uint32 triangle, uint32 output[3]) const {
+    if (faces) {
+      memcpy(output, faces[triangle].vertex_indices, 3 * sizeof(uint32));
+    } else if (short_indices) {
+      output[0] = short_indices[3 * triangle + 0];
+      output[1] = short_indices[3 * triangle + 1];
+      output[2] = short_indices[3 * triangle + 2];
+    } else {
+      memcpy(output, indices + 3 * triangle, 3 * sizeof(uint32));
+    }
+  }
 } MeshBvhDataSource;
 
 class MeshBvhNode : public BaseBvhNode<MeshBvhDataSource, MeshCollision> {
@@ -98,43 +135,214 @@ class MeshBvhNode : public BaseBvhNode<MeshBvhDataSource, MeshCollision> {
   // Called to allocate a node at children_[index] with type according to a
   // derived class.
   virtual void AllocateChild(int32 index) override;
-  // External list of vertices referenced by this node.
-  ::std::vector<vector3>* tree_vertices_;
-  // External list of faces referenced by this node.
-  ::std::vector<MeshFace>* tree_faces_;
+  // External triangles referenced by this node.
+  MeshBvhDataSource tree_data_;
   // Face indices directly managed by this node.
   ::std::vector<uint32> face_indices_;
 };
 
-class MeshBvh {
-  // Root node of the tree.
-  ::std::unique_ptr<MeshBvhNode> root_node_;
-  // External list of vertices referenced by this bvh.
-  ::std::vector<vector3>* tree_vertices_;
-  // External list of faces referenced by this bvh.
-  ::std::vector<MeshFace>* tree_faces_;
+// Flattened mesh bvh node. The children of an interior node are stored as
+// eight consecutive nodes, and leaves reference a range of the bvh face
+// index list. Packed nodes contain no pointers, so a tree can be used
+// directly from a mapped scene cache.
+typedef struct MeshBvhPackedNode {
+  bounds aabb;
+  // Index of the first child node for interior nodes, or the first face
+  // index for leaves.
+  uint32 first;
+  // Number of faces referenced by a leaf.
+  uint32 face_count;
+  // Non-zero if the node has no children.
+  uint32 is_leaf;
+} MeshBvhPackedNode;
 
+class MeshBvh {
  public:
+  MeshBvh();
   const vector3 GetCenter() const;
-  void BuildBvh(::std::vector<vector3>* vertices,
-                ::std::vector<MeshFace>* faces);
+  // Builds the tree over triangles and packs it into storage owned by the
+  // bvh. Faces of full meshes must have their planes computed. The source
+  // arrays must outlive the bvh.
+  void BuildBvh(const MeshBvhDataSource& data, uint32 vertex_count,
+                uint32 triangle_count);
+  // Uses a prebuilt packed tree held elsewhere (e.g. in a scene cache).
+  // All arrays must outlive the bvh.
+  void SetPackedTree(const MeshBvhDataSource& data,
+                     const MeshBvhPackedNode* nodes, uint32 node_count,
+                     const uint32* face_indices, uint32 face_index_count);
   bool Trace(const ray& trajectory, MeshCollision* hit_info) const;
+  const MeshBvhPackedNode* GetNodes() const { return nodes_; }
+  uint32 GetNodeCount() const { return node_count_; }
+  const uint32* GetFaceIndices() const { return face_indices_; }
+  uint32 GetFaceIndexCount() const { return face_index_count_; }
+  // Records every node of the tree.
+  void Inspect(BvhInspector* inspector) const;
+
+ private:
+  // Flattens a subdivided tree into node_storage_ and face_index_storage_.
+  void PackTree(MeshBvhNode* root_node);
+  // Traces a ray through a packed node and its descendants.
+  bool TraceNode(uint32 node_index, const ray& trajectory,
+                 MeshCollision* hit_info) const;
+  // Visits the children of an interior node in ray order. Mirrors
+  // BaseBvhNode::TraceInternal.
+  bool TraceChildren(const MeshBvhPackedNode& node, const collision& node_hit,
+                     const ray& trajectory, MeshCollision* hit_info) const;
+  // Triangles referenced by the tree.
+  MeshBvhDataSource data_;
+  // Packed tree, either in the storage below or in external memory.
+  const MeshBvhPackedNode* nodes_;
+  uint32 node_count_;
+  const uint32* face_indices_;
+  uint32 face_index_count_;
+  ::std::vector<MeshBvhPackedNode> node_storage_;
+  ::std::vector<uint32> face_index_storage_;
 };
 
+// Read-only view of all of the arrays that make up a loaded mesh. Used to
+// write meshes to, and construct meshes from, a scene cache.
+typedef struct MeshView {
+  bounds aabb;
+  const vector3* vertices;
+  uint32 vertex_count;
+  const vector3* normals;
+  uint32 normal_count;
+  const vector2* texcoords;
+  uint32 texcoord_count;
+  const MeshFace* faces;
+  uint32 face_count;
+  const MeshBvhPackedNode* nodes;
+  uint32 node_count;
+  const uint32* face_indices;
+  uint32 face_index_count;
+  // Compact storage. Faces are absent, and the triangles are instead held
+  // in one of the index streams.
+  const uint16* short_indices;
+  uint32 short_index_count;
+  const uint32* indices;
+  uint32 index_count;
+  // Quantized storage replaces normals and texcoords with packed forms.
+  // Texcoords are 16 bit fractions of the range starting at texcoord_origin.
+  const uint32* packed_normals;
+  uint32 packed_normal_count;
+  const uint32* packed_texcoords;
+  uint32 packed_texcoord_count;
+  vector2 texcoord_origin;
+  vector2 texcoord_extent;
+} MeshView;
+
+// Returns true if every corner of the faces of a view references valid
+// attributes. Otherwise stores the first incomplete face in face_index.
+bool CheckMeshFaces(const MeshView& view, uint32* face_index);
+
+// Welds mesh corners that share a position, normal and texcoord, so that a
+// single index addresses every attribute of a vertex.
+class MeshWelder {
+ public:
+  explicit MeshWelder(uint32 vertex_count);
+  // Returns the welded vertex for a corner, adding one if no earlier corner
+  // shares its attributes.
+  uint32 Weld(uint32 position, uint32 normal, uint32 texcoord);
+  // Forgets all welded vertices, in time proportional to their number.
+  void Reset();
+  uint32 GetVertexCount() const { return positions_.size(); }
+  // Source attribute indices of each welded vertex.
+  const ::std::vector<uint32>& GetPositions() const { return positions_; }
+  const ::std::vector<uint32>& GetNormals() const { return normals_; }
+  const ::std::vector<uint32>& GetTexcoords() const { return texcoords_; }
+
+ private:
+  // Welded vertices sharing a position are chained from first_welded_
+  // through next_welded_.
+  ::std::vector<uint32> first_welded_;
+  ::std::vector<uint32> next_welded_;
+  ::std::vector<uint32> positions_;
+  ::std::vector<uint32> normals_;
+  ::std::vector<uint32> texcoords_;
+};
+
+class MeshClusterCache;
+class MeshClusterStream;
+
 class MeshObject : public Object {
  public:
+  // Loads a Wavefront (.obj) or binary Stanford (.ply) mesh, chosen by the
+  // file extension, and converts it to the requested storage layout.
+  // Streamed meshes read their clusters through cluster_cache, and fall
+  // back to full storage without one. Obj files are parsed with up to
+  // load_thread_count threads, or one per hardware thread if it is zero.
   MeshObject(const ::std::string& filename, bool invert_normals = false,
              const vector3& translation = vector3(0, 0, 0),
              const vector3& scale = vector3(1, 1, 1),
-             const vector4& rotation = vector4(0, 0, 0, 0));
-  const vector3 GetCenter() const override { return shape_tree.GetCenter(); }
-  const bounds GetBounds() const override { return aabb_; }
+             const vector4& rotation = vector4(0, 0, 0, 0),
+             MeshStorage storage = kMeshStorageFull,
+             MeshClusterCache* cluster_cache = nullptr,
+             uint32 load_thread_count = 0);
+  // Creates a mesh that uses arrays held elsewhere, typically in a mapped
+  // scene cache. The arrays must outlive the object.
+  explicit MeshObject(const MeshView& view);
+  ~MeshObject();
+  // Returns a view of the untranslated mesh arrays, valid for the life of
+  // the object.
+  MeshView GetView() const;
+  const vector3 GetCenter() const override;
+  const bounds GetBounds() const override;
   bool Trace(const ray& trajectory, ObjectCollision* hit_info) override;
+  // Translations are applied to rays rather than to the mesh arrays, which
+  // may be shared with a scene cache.
+  void Translate(const vector3& offset) override { offset_ += offset; }
+  // Returns the cluster stream of a streamed mesh, or nullptr.
+  const MeshClusterStream* GetClusterStream() const {
+    return cluster_stream_.get();
+  }
+  // Returns the seconds spent building the bvh when the mesh was loaded.
+  float64 GetBvhBuildSeconds() const { return bvh_build_seconds_; }
+  // Records the nodes of the bvh, or of the cluster hierarchy of a streamed
+  // mesh.
+  void InspectBvh(BvhInspector* inspector) const;
 
  private:
+  // Welds the loaded faces into a compact index stream and releases the
+  // full arrays, optionally quantizing the attributes. Returns false (and
+  // leaves the mesh unchanged) if a face lacks a normal or texcoord index.
+  bool Compact(bool quantize);
+  // Opens the cluster file of a streamed mesh. Returns false if it is
+  // missing or stale.
+  bool OpenClusterStream(const ::std::string& filename, uint64 key,
+                         MeshClusterCache* cluster_cache);
+  // Returns the triangle source for the bvh.
+  MeshBvhDataSource GetTriangles() const;
+  uint32 GetTriangleCount() const;
+  // Returns a vertex attribute, decoding it if it is quantized.
+  vector3 GetNormal(uint32 index) const;
+  vector2 GetTexcoord(uint32 index) const;
   bounds aabb_;
+  // Offset of the mesh from its arrays, applied by Translate.
+  vector3 offset_;
+  // Time spent building shape_tree, for load reports.
+  float64 bvh_build_seconds_;
   // The acceleration structure for the shape. Used to speed up traces.
   MeshBvh shape_tree;
+  // Arrays used for tracing. These point either into the lists below or
+  // into external memory.
+  const vector3* vertex_data_;
+  uint32 vertex_count_;
+  const vector3* normal_data_;
+  uint32 normal_count_;
+  const vector2* texcoord_data_;
+  uint32 texcoord_count_;
+  const MeshFace* face_data_;
+  uint32 face_count_;
+  const uint16* short_index_data_;
+  uint32 short_index_count_;
+  const uint32* index_data_;
+  uint32 index_count_;
+  const uint32* packed_normal_data_;
+  uint32 packed_normal_count_;
+  const uint32* packed_texcoord_data_;
+  uint32 packed_texcoord_count_;
+  vector2 texcoord_origin_;
+  vector2 texcoord_extent_;
   // The face list of the shape. References vertices in the parent mesh.
   ::std::vector<MeshFace> face_list;
   // The following lists are shared between all shapes.
@@ -143,6 +351,16 @@ class MeshObject : public Object {
   ::std::vector<vector3> normals_;
   // The per-vertex texcoords for the mesh.
   ::std::vector<vector2> texcoords_;
+  // Index streams and packed attributes of compact meshes.
+  ::std::vector<uint16> short_indices_;
+  ::std::vector<uint32> indices_;
+  ::std::vector<uint32> packed_normals_;
+  ::std::vector<uint32> packed_texcoords_;
+  // Source file for meshes whose vertices are used in place (e.g. packed
+  // ply positions).
+  MappedFile mesh_file_;
+  // Clusters of streamed meshes, which hold no arrays of their own.
+  ::std::unique_ptr<MeshClusterStream> cluster_stream_;
   // If materials_ is empty, or any shape does not reference a material,
   // then the default Object-provided material will be used.
   ::std::vector<::std::unique_ptr<Material>> materials_;
@@ -0,0 +1,766 @@
+#include "mesh_stream.h"
+#include <algorithm>
+#include <cstring>
+#include "math/intersect.h"
+
+namespace base {
+
+namespace {
+
+const char kMeshClusterMagic[4] = {'F', 'S', 'M', 'C'};
+const uint32 kMeshClusterVersion = 1;
+// Triangles per cluster. Cluster vertices must fit 16 bit indices, and a
+// miss should not read much more than the rays need.
+const uint32 kMaxClusterTriangles = 8192;
+// Payloads start on cache line boundaries, and arrays within them on 16
+// byte boundaries.
+const uint64 kPayloadAlignment = 64;
+const uint64 kArrayAlignment = 16;
+// Bound on the traversal stack. Median splits keep the cluster hierarchy
+// within log2 of the cluster count.
+const uint32 kMaxClusterStackSize = 64;
+// Cache keys are the stream id in the high 32 bits and the cluster index
+// in the low 32 bits. Stream ids never reach this one.
+const uint64 kInvalidClusterKey = ~0ull;
+// Eviction frees this fraction of the cache budget beyond what is needed.
+const uint64 kEvictionMarginDivisor = 16;
+
+typedef struct MeshClusterHeader {
+  char magic[4];
+  uint32 version;
+  // Sizes of the stored structures, which guard against files written by
+  // builds with a different layout.
+  uint32 info_size;
+  uint32 node_size;
+  // Key of the source mesh, as computed by SceneCache::ComputeMeshKey.
+  uint64 key;
+  uint32 cluster_count;
+  uint32 reserved;
+  // The cluster table follows the payloads.
+  uint64 table_offset;
+} MeshClusterHeader;
+
+// Cluster payload arrays, in file order.
+enum ClusterArray : uint32 {
+  kClusterArrayVertices = 0,
+  kClusterArrayNormals,
+  kClusterArrayTexcoords,
+  kClusterArrayIndices,
+  kClusterArrayNodes,
+  kClusterArrayFaceIndices,
+  kClusterArrayCount,
+};
+
+uint64 AlignOffset(uint64 offset, uint64 alignment) {
+  return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// Computes the payload offset and size of each array of a cluster, and
+// returns the payload size.
+uint64 LayoutCluster(const MeshClusterInfo& info,
+                     uint64 offsets[kClusterArrayCount],
+                     uint64 sizes[kClusterArrayCount]) {
+  sizes[kClusterArrayVertices] = uint64(info.vertex_count) * sizeof(vector3);
+  sizes[kClusterArrayNormals] = uint64(info.normal_count) * sizeof(vector3);
+  sizes[kClusterArrayTexcoords] =
+      uint64(info.texcoord_count) * sizeof(vector2);
+  sizes[kClusterArrayIndices] =
+      uint64(info.triangle_count) * 3 * sizeof(uint16);
+  sizes[kClusterArrayNodes] =
+      uint64(info.node_count) * sizeof(MeshBvhPackedNode);
+  sizes[kClusterArrayFaceIndices] =
+      uint64(info.face_index_count) * sizeof(uint32);
+  uint64 position = 0;
+  for (uint32 i = 0; i < kClusterArrayCount; i++) {
+    position = AlignOffset(position, kArrayAlignment);
+    offsets[i] = position;
+    position += sizes[i];
+  }
+  return position;
+}
+
+bool SeekFile(FILE* file, uint64 offset) {
+#if defined(BASE_PLATFORM_WINDOWS)
+  return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+  return fseeko(file, offset, SEEK_SET) == 0;
+#endif
+}
+
+// Writes zeros until position is a multiple of alignment.
+bool WritePadding(FILE* output, uint64 alignment, uint64* position) {
+  static const uint8 kZeros[kPayloadAlignment] = {0};
+  uint64 padding = AlignOffset(*position, alignment) - *position;
+  *position += padding;
+  return fwrite(kZeros, 1, padding, output) == padding;
+}
+
+bool WriteBytes(FILE* output, const void* data, uint64 size,
+                uint64* position) {
+  *position += size;
+  return !size || fwrite(data, 1, size, output) == size;
+}
+
+// Spreads the low 10 bits of value to every third bit.
+uint32 SpreadBits(uint32 value) {
+  value &= 0x3FF;
+  value = (value | (value << 16)) & 0x030000FF;
+  value = (value | (value << 8)) & 0x0300F00F;
+  value = (value | (value << 4)) & 0x030C30C3;
+  value = (value | (value << 2)) & 0x09249249;
+  return value;
+}
+
+// Maps a coordinate within [0, extent] to 10 bits.
+uint32 QuantizeCoordinate(float32 value, float32 extent) {
+  if (extent <= 0.0f) {
+    return 0;
+  }
+  return uint32(clip_range(value / extent * 1023.0f, 0.0f, 1023.0f));
+}
+
+// Returns the 30 bit Morton code of a point within aabb.
+uint32 ComputeMortonCode(const vector3& point, const bounds& aabb) {
+  vector3 extent = aabb.bounds_max - aabb.bounds_min;
+  vector3 relative = point - aabb.bounds_min;
+  return (SpreadBits(QuantizeCoordinate(relative.x, extent.x)) << 2) |
+         (SpreadBits(QuantizeCoordinate(relative.y, extent.y)) << 1) |
+         SpreadBits(QuantizeCoordinate(relative.z, extent.z));
+}
+
+}  // namespace
+
+MeshClusterCache::MeshClusterCache()
+    : capacity_(kDefaultClusterCacheSize),
+      read_ahead_(kDefaultClusterReadAhead),
+      next_stream_id_(0),
+      clock_(0),
+      resident_size_(0),
+      read_count_(0) {}
+
+void MeshClusterCache::Configure(uint64 capacity, uint32 read_ahead) {
+  ::std::lock_guard<::std::mutex> lock(mutex_);
+  capacity_ = capacity;
+  read_ahead_ = read_ahead;
+  Evict(kInvalidClusterKey);
+}
+
+uint32 MeshClusterCache::RegisterStream() {
+  ::std::lock_guard<::std::mutex> lock(mutex_);
+  return next_stream_id_++;
+}
+
+void MeshClusterCache::ReleaseStream(uint32 stream_id) {
+  ::std::lock_guard<::std::mutex> lock(mutex_);
+  for (CacheShard& shard : shards_) {
+    ::std::lock_guard<::std::mutex> shard_lock(shard.mutex);
+    for (auto entry = shard.entries.begin(); entry != shard.entries.end();) {
+      if ((entry->first >> 32) == stream_id) {
+        resident_size_ -= entry->second.size;
+        entry = shard.entries.erase(entry);
+      } else {
+        ++entry;
+      }
+    }
+  }
+}
+
+MeshClusterCache::CacheShard& MeshClusterCache::GetShard(uint64 key) {
+  // Neighbouring clusters of a stream land in different shards.
+  return shards_[(key * 0x9E3779B97F4A7C15ull) >> 60];
+}
+
+::std::shared_ptr<const MeshCluster> MeshClusterCache::Find(uint64 key) {
+  CacheShard& shard = GetShard(key);
+  ::std::lock_guard<::std::mutex> lock(shard.mutex);
+  auto entry = shard.entries.find(key);
+  if (entry == shard.entries.end()) {
+    return nullptr;
+  }
+  entry->second.last_use = clock_.load(::std::memory_order_relaxed);
+  return entry->second.cluster;
+}
+
+::std::shared_ptr<const MeshCluster> MeshClusterCache::Acquire(
+    const MeshClusterStream& stream, uint32 cluster_index) {
+  uint64 stream_key = uint64(stream.GetStreamId()) << 32;
+  ::std::shared_ptr<const MeshCluster> result =
+      Find(stream_key | cluster_index);
+  if (result) {
+    return result;
+  }
+
+  // Read ahead through the clusters that follow and are not resident.
+  uint32 read_count = 1;
+  {
+    ::std::lock_guard<::std::mutex> lock(mutex_);
+    while (read_count <= read_ahead_ &&
+           cluster_index + read_count < stream.GetClusterCount()) {
+      uint64 key = stream_key | (cluster_index + read_count);
+      CacheShard& shard = GetShard(key);
+      ::std::lock_guard<::std::mutex> shard_lock(shard.mutex);
+      if (shard.entries.count(key)) {
+        break;
+      }
+      read_count++;
+    }
+  }
+
+  // The read happens outside of the lock so that resident clusters remain
+  // available to other threads. Threads that miss on the same cluster at
+  // once each read it, and the first one to finish is kept.
+  ::std::vector<::std::shared_ptr<MeshCluster>> clusters;
+  if (!stream.ReadClusters(cluster_index, read_count, &clusters)) {
+    return nullptr;
+  }
+
+  ::std::lock_guard<::std::mutex> lock(mutex_);
+  read_count_ += clusters.size();
+  result = clusters[0];
+  // Read ahead clusters are stamped as used before the requested one.
+  for (uint32 i = clusters.size(); i-- > 0;) {
+    uint64 key = stream_key | (cluster_index + i);
+    uint64 now = ++clock_;
+    CacheShard& shard = GetShard(key);
+    ::std::lock_guard<::std::mutex> shard_lock(shard.mutex);
+    auto entry = shard.entries.find(key);
+    if (entry != shard.entries.end()) {
+      if (!i) {
+        entry->second.last_use = now;
+        result = entry->second.cluster;
+      }
+      continue;
+    }
+    CacheEntry& new_entry = shard.entries[key];
+    new_entry.size = stream.GetClusterSize(cluster_index + i);
+    new_entry.last_use = now;
+    new_entry.cluster = clusters[i];
+    resident_size_ += new_entry.size;
+  }
+  Evict(stream_key | cluster_index);
+  return result;
+}
+
+uint64 MeshClusterCache::GetResidentSize() const { return resident_size_; }
+
+uint64 MeshClusterCache::GetReadCount() const { return read_count_; }
+
+uint64 MeshClusterCache::GetCapacity() const {
+  ::std::lock_guard<::std::mutex> lock(mutex_);
+  return capacity_;
+}
+
+void MeshClusterCache::Evict(uint64 keep_key) {
+  if (resident_size_ <= capacity_) {
+    return;
+  }
+
+  // Orders a snapshot of every entry by last use. Eviction goes below the
+  // budget by a margin, so that this scan is amortized over many misses.
+  typedef struct EvictionCandidate {
+    uint64 last_use;
+    uint64 key;
+  } EvictionCandidate;
+  ::std::vector<EvictionCandidate> candidates;
+  for (CacheShard& shard : shards_) {
+    ::std::lock_guard<::std::mutex> shard_lock(shard.mutex);
+    for (const auto& entry : shard.entries) {
+      candidates.push_back({entry.second.last_use, entry.first});
+    }
+  }
+  ::std::sort(candidates.begin(), candidates.end(),
+              [](const EvictionCandidate& a, const EvictionCandidate& b) {
+                return a.last_use < b.last_use;
+              });
+
+  uint64 target = capacity_ - capacity_ / kEvictionMarginDivisor;
+  for (const EvictionCandidate& candidate : candidates) {
+    if (resident_size_ <= target) {
+      break;
+    }
+    if (candidate.key == keep_key) {
+      continue;
+    }
+    CacheShard& shard = GetShard(candidate.key);
+    ::std::lock_guard<::std::mutex> shard_lock(shard.mutex);
+    auto entry = shard.entries.find(candidate.key);
+    // Entries hit since the snapshot are kept.
+    if (entry == shard.entries.end() ||
+        entry->second.last_use != candidate.last_use) {
+      continue;
+    }
+    resident_size_ -= entry->second.size;
+    shard.entries.erase(entry);
+  }
+}
+
+MeshClusterStream::MeshClusterStream(MeshClusterCache* cache)
+    : cache_(cache), stream_id_(0), file_(nullptr) {}
+
+MeshClusterStream::~MeshClusterStream() {
+  if (file_) {
+    cache_->ReleaseStream(stream_id_);
+    fclose(file_);
+  }
+}
+
+bool MeshClusterStream::Open(const ::std::string& filename, uint64 key) {
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+
+  MeshClusterHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, kMeshClusterMagic, sizeof(header.magic)) != 0 ||
+      header.version != kMeshClusterVersion ||
+      header.info_size != sizeof(MeshClusterInfo) ||
+      header.node_size != sizeof(MeshBvhPackedNode) || header.key != key ||
+      !header.cluster_count) {
+    fclose(file);
+    return false;
+  }
+
+  ::std::vector<MeshClusterInfo> cluster_infos(header.cluster_count);
+  if (!SeekFile(file, header.table_offset) ||
+      fread(cluster_infos.data(), sizeof(MeshClusterInfo),
+            cluster_infos.size(), file) != cluster_infos.size()) {
+    printf("Cluster file %s is damaged.\n", filename.c_str());
+    fclose(file);
+    return false;
+  }
+
+  // Every payload must lie before the table and hold its arrays, and every
+  // cluster must be addressable with 16 bit indices.
+  for (const MeshClusterInfo& info : cluster_infos) {
+    uint64 offsets[kClusterArrayCount];
+    uint64 sizes[kClusterArrayCount];
+    if (info.offset > header.table_offset ||
+        info.size > header.table_offset - info.offset ||
+        LayoutCluster(info, offsets, sizes) > info.size ||
+        info.vertex_count > 0x10000 || !info.triangle_count ||
+        (info.normal_count && info.normal_count != info.vertex_count) ||
+        (info.texcoord_count && info.texcoord_count != info.vertex_count)) {
+      printf("Cluster file %s is damaged.\n", filename.c_str());
+      fclose(file);
+      return false;
+    }
+  }
+
+  file_ = file;
+  cluster_infos_.swap(cluster_infos);
+  ::std::vector<uint32> order(cluster_infos_.size());
+  for (uint32 i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  nodes_.clear();
+  nodes_.reserve(2 * order.size() - 1);
+  BuildRecursive(&order, 0, order.size());
+  aabb_ = nodes_[0].aabb;
+  stream_id_ = cache_->RegisterStream();
+  return true;
+}
+
+uint64 MeshClusterStream::GetTriangleCount() const {
+  uint64 triangle_count = 0;
+  for (const MeshClusterInfo& info : cluster_infos_) {
+    triangle_count += info.triangle_count;
+  }
+  return triangle_count;
+}
+
+void MeshClusterStream::Inspect(BvhInspector* inspector) const {
+  inspector->SetPrimitiveCount(GetTriangleCount());
+
+  // The first child directly follows its parent and the second is stored
+  // later, so the depth of every node is known by the time it is visited.
+  ::std::vector<uint32> depths(nodes_.size(), 0);
+  for (uint32 i = 0; i < nodes_.size(); i++) {
+    const MeshClusterNode& node = nodes_[i];
+    if (node.is_leaf) {
+      const MeshClusterInfo& info = cluster_infos_[node.child_or_cluster];
+      inspector->AddLeafNode(node.aabb, depths[i], info.triangle_count);
+      continue;
+    }
+
+    bounds child_bounds[2] = {nodes_[i + 1].aabb,
+                              nodes_[node.child_or_cluster].aabb};
+    depths[i + 1] = depths[i] + 1;
+    depths[node.child_or_cluster] = depths[i] + 1;
+    inspector->AddInteriorNode(node.aabb, depths[i], child_bounds, 2);
+  }
+}
+
+uint64 MeshClusterStream::GetVertexCount() const {
+  uint64 vertex_count = 0;
+  for (const MeshClusterInfo& info : cluster_infos_) {
+    vertex_count += info.vertex_count;
+  }
+  return vertex_count;
+}
+
+uint64 MeshClusterStream::GetResidentSize() const {
+  return cluster_infos_.size() * sizeof(MeshClusterInfo) +
+         nodes_.size() * sizeof(MeshClusterNode);
+}
+
+uint32 MeshClusterStream::BuildRecursive(::std::vector<uint32>* order,
+                                         uint32 begin, uint32 end) {
+  uint32 node_index = nodes_.size();
+  nodes_.emplace_back();
+
+  if (end - begin == 1) {
+    nodes_[node_index].aabb = cluster_infos_[(*order)[begin]].aabb;
+    nodes_[node_index].child_or_cluster = (*order)[begin];
+    nodes_[node_index].is_leaf = true;
+    return node_index;
+  }
+
+  // Split at the median along the longest axis of the cluster centers.
+  bounds center_bounds;
+  for (uint32 i = begin; i < end; i++) {
+    center_bounds += cluster_infos_[(*order)[i]].aabb.query_center();
+  }
+  vector3 extent = center_bounds.bounds_max - center_bounds.bounds_min;
+  uint32 axis = 0;
+  if (extent.y > extent.x && extent.y >= extent.z) {
+    axis = 1;
+  } else if (extent.z > extent.x && extent.z > extent.y) {
+    axis = 2;
+  }
+
+  uint32 middle = begin + (end - begin) / 2;
+  ::std::nth_element(order->begin() + begin, order->begin() + middle,
+                     order->begin() + end, [&](uint32 lhs, uint32 rhs) {
+                       return cluster_infos_[lhs].aabb.query_center()[axis] <
+                              cluster_infos_[rhs].aabb.query_center()[axis];
+                     });
+
+  uint32 first_child = BuildRecursive(order, begin, middle);
+  uint32 second_child = BuildRecursive(order, middle, end);
+  nodes_[node_index].aabb = nodes_[first_child].aabb;
+  nodes_[node_index].aabb += nodes_[second_child].aabb;
+  nodes_[node_index].child_or_cluster = second_child;
+  nodes_[node_index].is_leaf = false;
+  return node_index;
+}
+
+bool MeshClusterStream::Trace(const ray& trajectory,
+                              ObjectCollision* hit_info) const {
+  collision root_hit;
+  if (nodes_.empty() ||
+      !ray_intersect_bounds(nodes_[0].aabb, trajectory, &root_hit)) {
+    return false;
+  }
+
+  // Nodes are visited nearest first, so that far clusters are skipped
+  // (and never read) once a closer hit is found.
+  typedef struct PendingNode {
+    uint32 index;
+    float32 param;
+  } PendingNode;
+  PendingNode stack[kMaxClusterStackSize];
+  uint32 stack_size = 1;
+  stack[0].index = 0;
+  stack[0].param = root_hit.param;
+
+  bool trace_result = false;
+  while (stack_size) {
+    PendingNode pending = stack[--stack_size];
+    if (pending.param > hit_info->param) {
+      continue;
+    }
+
+    const MeshClusterNode& node = nodes_[pending.index];
+    if (node.is_leaf) {
+      if (TraceCluster(node.child_or_cluster, trajectory, hit_info)) {
+        trace_result = true;
+      }
+      continue;
+    }
+
+    uint32 children[2] = {pending.index + 1, node.child_or_cluster};
+    collision child_hits[2];
+    bool is_hit[2];
+    for (uint32 i = 0; i < 2; i++) {
+      is_hit[i] = ray_intersect_bounds(nodes_[children[i]].aabb, trajectory,
+                                       &child_hits[i]);
+    }
+
+    // The farther child is pushed first so that the nearer one is popped
+    // first.
+    uint32 near_child = 0;
+    if (is_hit[1] &&
+        (!is_hit[0] || child_hits[1].param < child_hits[0].param)) {
+      near_child = 1;
+    }
+    uint32 far_child = 1 - near_child;
+    if (is_hit[far_child]) {
+      stack[stack_size].index = children[far_child];
+      stack[stack_size].param = child_hits[far_child].param;
+      stack_size++;
+    }
+    if (is_hit[near_child]) {
+      stack[stack_size].index = children[near_child];
+      stack[stack_size].param = child_hits[near_child].param;
+      stack_size++;
+    }
+  }
+  return trace_result;
+}
+
+bool MeshClusterStream::TraceCluster(uint32 cluster_index,
+                                     const ray& trajectory,
+                                     ObjectCollision* hit_info) const {
+  // The cluster stays resident while we hold it, even if it is evicted.
+  ::std::shared_ptr<const MeshCluster> cluster =
+      cache_->Acquire(*this, cluster_index);
+  if (!cluster) {
+    return false;
+  }
+
+  MeshCollision cluster_hit;
+  cluster_hit.param = hit_info->param;
+  if (!cluster->tree.Trace(trajectory, &cluster_hit) ||
+      cluster_hit.param > hit_info->param) {
+    return false;
+  }
+
+  hit_info->param = cluster_hit.param;
+  hit_info->point = cluster_hit.point;
+  hit_info->surface_normal = cluster_hit.normal;
+
+  const uint16* indices = cluster->indices + 3 * cluster_hit.face_index;
+  if (cluster->normal_count) {
+    triangle_interpolate_barycentric_coeff(
+        cluster->normals[indices[0]], cluster->normals[indices[1]],
+        cluster->normals[indices[2]], cluster_hit.bary_coords.x,
+        cluster_hit.bary_coords.y, &hit_info->surface_normal);
+  }
+
+  if (cluster->texcoord_count) {
+    const vector3 t0 = cluster->texcoords[indices[0]];
+    const vector3 t1 = cluster->texcoords[indices[1]];
+    const vector3 t2 = cluster->texcoords[indices[2]];
+    vector3 output_texcoords;
+    triangle_interpolate_barycentric_coeff(
+        t0, t1, t2, cluster_hit.bary_coords.x, cluster_hit.bary_coords.y,
+        &output_texcoords);
+    hit_info->surface_texcoords =
+        vector2(output_texcoords.x, output_texcoords.y);
+  }
+  return true;
+}
+
+bool MeshClusterStream::ReadClusters(
+    uint32 first, uint32 count,
+    ::std::vector<::std::shared_ptr<MeshCluster>>* clusters) const {
+  if (!file_ || first >= cluster_infos_.size()) {
+    return false;
+  }
+  count = min(count, uint32(cluster_infos_.size()) - first);
+
+  // Clusters are stored back to back, so a run of them is one read.
+  const MeshClusterInfo& last_info = cluster_infos_[first + count - 1];
+  uint64 begin = cluster_infos_[first].offset;
+  uint64 end = last_info.offset + last_info.size;
+  if (end < begin) {
+    return false;
+  }
+  ::std::vector<uint8> buffer(end - begin);
+  {
+    ::std::lock_guard<::std::mutex> lock(file_mutex_);
+    if (!SeekFile(file_, begin) ||
+        fread(buffer.data(), 1, buffer.size(), file_) != buffer.size()) {
+      printf("Failed to read mesh clusters %i-%i.\n", first,
+             first + count - 1);
+      return false;
+    }
+  }
+
+  clusters->clear();
+  for (uint32 i = first; i < first + count; i++) {
+    const MeshClusterInfo& info = cluster_infos_[i];
+    if (info.offset < begin || info.offset + info.size > end) {
+      return false;
+    }
+    ::std::shared_ptr<MeshCluster> cluster(new MeshCluster);
+    cluster->storage.resize((info.size + 7) / 8);
+    memcpy(cluster->storage.data(), buffer.data() + (info.offset - begin),
+           info.size);
+
+    uint64 offsets[kClusterArrayCount];
+    uint64 sizes[kClusterArrayCount];
+    LayoutCluster(info, offsets, sizes);
+    const uint8* payload =
+        reinterpret_cast<const uint8*>(cluster->storage.data());
+    cluster->vertices = reinterpret_cast<const vector3*>(
+        payload + offsets[kClusterArrayVertices]);
+    cluster->normals = reinterpret_cast<const vector3*>(
+        payload + offsets[kClusterArrayNormals]);
+    cluster->texcoords = reinterpret_cast<const vector2*>(
+        payload + offsets[kClusterArrayTexcoords]);
+    cluster->indices = reinterpret_cast<const uint16*>(
+        payload + offsets[kClusterArrayIndices]);
+    cluster->normal_count = info.normal_count;
+    cluster->texcoord_count = info.texcoord_count;
+
+    MeshBvhDataSource data;
+    data.vertices = cluster->vertices;
+    data.faces = nullptr;
+    data.short_indices = cluster->indices;
+    data.indices = nullptr;
+    cluster->tree.SetPackedTree(
+        data,
+        reinterpret_cast<const MeshBvhPackedNode*>(
+            payload + offsets[kClusterArrayNodes]),
+        info.node_count,
+        reinterpret_cast<const uint32*>(payload +
+                                        offsets[kClusterArrayFaceIndices]),
+        info.face_index_count);
+    clusters->push_back(cluster);
+  }
+  return true;
+}
+
+bool WriteMeshClusters(const ::std::string& filename, uint64 key,
+                       const MeshView& view) {
+  uint32 incomplete_face = 0;
+  if (!view.faces || !view.face_count ||
+      !CheckMeshFaces(view, &incomplete_face)) {
+    return false;
+  }
+
+  // Triangles are ordered along a Morton curve through their centroids, so
+  // that consecutive runs of them make compact clusters. The face index is
+  // kept in the low bits of each sort key.
+  ::std::vector<uint64> order(view.face_count);
+  for (uint32 i = 0; i < view.face_count; i++) {
+    const MeshFace& face = view.faces[i];
+    vector3 centroid = (view.vertices[face.vertex_indices[0]] +
+                        view.vertices[face.vertex_indices[1]] +
+                        view.vertices[face.vertex_indices[2]]) /
+                       3.0f;
+    order[i] = (uint64(ComputeMortonCode(centroid, view.aabb)) << 32) | i;
+  }
+  ::std::sort(order.begin(), order.end());
+
+  // The file is written beside its final name and then moved over it, so
+  // that an interrupted write never leaves a partial cluster file.
+  ::std::string temp_filename = filename + ".tmp";
+  FILE* output = fopen(temp_filename.c_str(), "wb");
+  if (!output) {
+    printf("Failed to write cluster file %s.\n", filename.c_str());
+    return false;
+  }
+
+  MeshClusterHeader header;
+  memset(&header, 0, sizeof(header));
+  uint64 position = 0;
+  bool result = WriteBytes(output, &header, sizeof(header), &position);
+
+  MeshWelder welder(view.vertex_count);
+  ::std::vector<MeshClusterInfo> cluster_infos;
+  ::std::vector<vector3> vertices;
+  ::std::vector<vector3> normals;
+  ::std::vector<vector2> texcoords;
+  ::std::vector<uint16> indices;
+  for (uint32 begin = 0; result && begin < view.face_count;
+       begin += kMaxClusterTriangles) {
+    uint32 end = min(begin + kMaxClusterTriangles, view.face_count);
+
+    // Cluster vertices are welded independently, so every cluster is self
+    // contained.
+    welder.Reset();
+    indices.clear();
+    for (uint32 i = begin; i < end; i++) {
+      const MeshFace& face = view.faces[order[i] & 0xFFFFFFFF];
+      for (uint32 j = 0; j < 3; j++) {
+        indices.push_back(
+            welder.Weld(face.vertex_indices[j],
+                        view.normal_count ? face.normal_indices[j] : 0,
+                        view.texcoord_count ? face.texcoord_indices[j] : 0));
+      }
+    }
+
+    uint32 welded_count = welder.GetVertexCount();
+    vertices.resize(welded_count);
+    normals.resize(view.normal_count ? welded_count : 0);
+    texcoords.resize(view.texcoord_count ? welded_count : 0);
+    // Value initialization also zeroes padding, which is written to disk.
+    MeshClusterInfo info = MeshClusterInfo();
+    for (uint32 i = 0; i < welded_count; i++) {
+      vertices[i] = view.vertices[welder.GetPositions()[i]];
+      info.aabb += vertices[i];
+    }
+    for (uint32 i = 0; i < normals.size(); i++) {
+      normals[i] = view.normals[welder.GetNormals()[i]];
+    }
+    for (uint32 i = 0; i < texcoords.size(); i++) {
+      texcoords[i] = view.texcoords[welder.GetTexcoords()[i]];
+    }
+
+    MeshBvhDataSource data;
+    data.vertices = vertices.data();
+    data.faces = nullptr;
+    data.short_indices = indices.data();
+    data.indices = nullptr;
+    MeshBvh tree;
+    tree.BuildBvh(data, welded_count, end - begin);
+
+    info.vertex_count = welded_count;
+    info.normal_count = normals.size();
+    info.texcoord_count = texcoords.size();
+    info.triangle_count = end - begin;
+    info.node_count = tree.GetNodeCount();
+    info.face_index_count = tree.GetFaceIndexCount();
+
+    const void* arrays[kClusterArrayCount] = {
+        vertices.data(), normals.data(),   texcoords.data(),
+        indices.data(),  tree.GetNodes(), tree.GetFaceIndices()};
+    uint64 offsets[kClusterArrayCount];
+    uint64 sizes[kClusterArrayCount];
+    info.size = LayoutCluster(info, offsets, sizes);
+    result = WritePadding(output, kPayloadAlignment, &position);
+    info.offset = position;
+    for (uint32 i = 0; result && i < kClusterArrayCount; i++) {
+      result = WritePadding(output, kArrayAlignment, &position) &&
+               WriteBytes(output, arrays[i], sizes[i], &position);
+    }
+    cluster_infos.push_back(info);
+  }
+
+  result = result && WritePadding(output, kPayloadAlignment, &position);
+  memcpy(header.magic, kMeshClusterMagic, sizeof(header.magic));
+  header.version = kMeshClusterVersion;
+  header.info_size = sizeof(MeshClusterInfo);
+  header.node_size = sizeof(MeshBvhPackedNode);
+  header.key = key;
+  header.cluster_count = cluster_infos.size();
+  header.table_offset = position;
+  result = result &&
+           WriteBytes(output, cluster_infos.data(),
+                      cluster_infos.size() * sizeof(MeshClusterInfo),
+                      &position) &&
+           SeekFile(output, 0) &&
+           fwrite(&header, sizeof(header), 1, output) == 1;
+  result = (fclose(output) == 0) && result;
+
+#if defined(BASE_PLATFORM_WINDOWS)
+  result = result && MoveFileExA(temp_filename.c_str(), filename.c_str(),
+                                 MOVEFILE_REPLACE_EXISTING);
+#else
+  result = result && rename(temp_filename.c_str(), filename.c_str()) == 0;
+#endif
+
+  if (!result) {
+    remove(temp_filename.c_str());
+    printf("Failed to write cluster file %s.\n", filename.c_str());
+    return false;
+  }
+  printf("Wrote %i mesh clusters to %s.\n", header.cluster_count,
+         filename.c_str());
+  return true;
+}
+
+}  // namespace base
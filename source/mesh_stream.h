@@ -0,0 +1,233 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __MESH_STREAM_H__
+#define __MESH_STREAM_H__
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "math/base.h"
+#include "math/trace.h"
+#include "math/vector3.h"
+#include "math/volume.h"
+#include "mesh.h"
+#include "object.h"
+
+namespace base {
+
+// Out-of-core meshes are split into clusters of spatially adjacent
+// triangles, stored in a cluster file next to the source mesh. Only the
+// cluster table and a hierarchy over cluster bounds stay resident, and the
+// triangles of each cluster are read on demand into a shared cache.
+
+// Default budget of a cluster cache, and the number of clusters read ahead
+// on a miss.
+const uint64 kDefaultClusterCacheSize = 1ull << 30;
+const uint32 kDefaultClusterReadAhead = 2;
+// Number of independently locked shards of a cluster cache.
+const uint32 kClusterCacheShardCount = 16;
+
+// Describes a cluster within a cluster file.
+typedef struct MeshClusterInfo {
+  bounds aabb;
+  // Location of the cluster payload within the file.
+  uint64 offset;
+  uint32 size;
+  // Array counts. Normals and texcoords are either absent or per vertex.
+  uint32 vertex_count;
+  uint32 normal_count;
+  uint32 texcoord_count;
+  uint32 triangle_count;
+  uint32 node_count;
+  uint32 face_index_count;
+  uint32 reserved;
+} MeshClusterInfo;
+
+// A resident cluster. Vertices are welded within the cluster, so every
+// attribute is addressed by the same 16 bit indices.
+typedef struct MeshCluster {
+  // Payload as read from the file. The arrays below point into it.
+  ::std::vector<uint64> storage;
+  const vector3* vertices;
+  const vector3* normals;
+  const vector2* texcoords;
+  const uint16* indices;
+  uint32 normal_count;
+  uint32 texcoord_count;
+  // The cluster bvh, referencing the arrays above.
+  MeshBvh tree;
+} MeshCluster;
+
+// Node of the resident hierarchy over cluster bounds.
+typedef struct MeshClusterNode {
+  bounds aabb;
+  // For interior nodes, the index of the second child. The first child
+  // always directly follows its parent. For leaves, the cluster index.
+  uint32 child_or_cluster;
+  bool is_leaf;
+} MeshClusterNode;
+
+class MeshClusterStream;
+
+// Least recently used cache of clusters, shared by all streamed meshes of
+// a scene. The cache stays within its budget except for clusters that are
+// still being traced, which are released once the last trace using them
+// completes. Thread safe.
+//
+// Entries are spread over shards with their own locks, so that hits from
+// many threads do not contend. A hit only stamps its entry with the
+// current clock, which advances on misses, and eviction orders entries by
+// their stamps. Misses, eviction and configuration are serialized by a
+// single mutex.
+class MeshClusterCache {
+ public:
+  MeshClusterCache();
+  // Sets the budget for resident clusters in bytes, and the number of
+  // clusters that follow a missed cluster in the file to read along with
+  // it. Clusters are stored in spatial order, so these are likely to be
+  // needed soon.
+  void Configure(uint64 capacity, uint32 read_ahead);
+  // Returns a new id for a stream's entries.
+  uint32 RegisterStream();
+  // Drops every cluster of a stream.
+  void ReleaseStream(uint32 stream_id);
+  // Returns a cluster, reading it from the stream if it is not resident.
+  // Returns nullptr if the cluster cannot be read.
+  ::std::shared_ptr<const MeshCluster> Acquire(const MeshClusterStream& stream,
+                                               uint32 cluster_index);
+  // Returns the number of bytes held by resident clusters.
+  uint64 GetResidentSize() const;
+  // Returns the number of clusters read from disk so far.
+  uint64 GetReadCount() const;
+  // Returns the budget for resident clusters in bytes.
+  uint64 GetCapacity() const;
+
+ private:
+  typedef struct CacheEntry {
+    uint64 size;
+    // Clock value at the last use.
+    uint64 last_use;
+    ::std::shared_ptr<const MeshCluster> cluster;
+  } CacheEntry;
+  typedef struct CacheShard {
+    ::std::mutex mutex;
+    ::std::unordered_map<uint64, CacheEntry> entries;
+  } CacheShard;
+  CacheShard& GetShard(uint64 key);
+  // Returns the cluster of key and stamps its entry, or nullptr if the
+  // cluster is not resident.
+  ::std::shared_ptr<const MeshCluster> Find(uint64 key);
+  // Evicts least recently used entries until the cache fits its budget,
+  // never evicting keep_key. Requires mutex_.
+  void Evict(uint64 keep_key);
+  // Serializes misses, eviction and configuration. Taken before any shard
+  // lock.
+  mutable ::std::mutex mutex_;
+  uint64 capacity_;
+  uint32 read_ahead_;
+  uint32 next_stream_id_;
+  ::std::atomic<uint64> clock_;
+  ::std::atomic<uint64> resident_size_;
+  ::std::atomic<uint64> read_count_;
+  CacheShard shards_[kClusterCacheShardCount];
+};
+
+// Streams a mesh from a cluster file.
+class MeshClusterStream {
+ public:
+  explicit MeshClusterStream(MeshClusterCache* cache);
+  ~MeshClusterStream();
+  MeshClusterStream(const MeshClusterStream&) = delete;
+  MeshClusterStream& operator=(const MeshClusterStream&) = delete;
+  // Opens a cluster file written for the source mesh identified by key.
+  // Returns false if the file is missing, damaged or written for a
+  // different source.
+  bool Open(const ::std::string& filename, uint64 key);
+  // Returns the bounds of the whole mesh.
+  const bounds& GetBounds() const { return aabb_; }
+  // Returns the number of clusters.
+  uint32 GetClusterCount() const { return cluster_infos_.size(); }
+  // Returns the totals over all clusters. Vertices are counted once per
+  // cluster that uses them.
+  uint64 GetTriangleCount() const;
+  uint64 GetVertexCount() const;
+  // Returns the bytes held by the cluster table and hierarchy, which stay
+  // resident while the stream is open.
+  uint64 GetResidentSize() const;
+  // Records the nodes of the cluster hierarchy. Each cluster is a leaf
+  // holding its triangles. The trees within clusters are not visited, as
+  // they are only resident while the cluster is cached.
+  void Inspect(BvhInspector* inspector) const;
+  // Traces the mesh, filling the point, normal and texcoords of hit_info
+  // if a hit closer than hit_info->param is found.
+  bool Trace(const ray& trajectory, ObjectCollision* hit_info) const;
+  // Reads up to count clusters starting at first with a single file read.
+  // Used by the cache.
+  bool ReadClusters(uint32 first, uint32 count,
+                    ::std::vector<::std::shared_ptr<MeshCluster>>* clusters)
+      const;
+  uint32 GetStreamId() const { return stream_id_; }
+  uint64 GetClusterSize(uint32 index) const {
+    return cluster_infos_[index].size;
+  }
+
+ private:
+  // Builds the resident hierarchy over clusters [begin, end) of order.
+  uint32 BuildRecursive(::std::vector<uint32>* order, uint32 begin,
+                        uint32 end);
+  // Traces a single cluster.
+  bool TraceCluster(uint32 cluster_index, const ray& trajectory,
+                    ObjectCollision* hit_info) const;
+  MeshClusterCache* cache_;
+  uint32 stream_id_;
+  FILE* file_;
+  // Serializes reads from file_.
+  mutable ::std::mutex file_mutex_;
+  bounds aabb_;
+  ::std::vector<MeshClusterInfo> cluster_infos_;
+  ::std::vector<MeshClusterNode> nodes_;
+};
+
+// Splits a mesh into clusters and writes them to a cluster file for the
+// source mesh identified by key. The view must use full storage. Returns
+// false if the file cannot be written.
+bool WriteMeshClusters(const ::std::string& filename, uint64 key,
+                       const MeshView& view);
+
+}  // namespace base
+
+#endif  // __MESH_STREAM_H__
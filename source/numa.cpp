@@ -0,0 +1,133 @@
+#include "numa.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#if defined(BASE_PLATFORM_LINUX)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace base {
+
+namespace {
+
+// Parses a sysfs list such as "0-3,8-11" into its values. Returns false
+// if the text is malformed.
+bool ParseCpuList(const char* text, ::std::vector<uint32>* values) {
+  const char* cursor = text;
+  while (*cursor && *cursor != '\n') {
+    char* end = nullptr;
+    uint32 first = strtoul(cursor, &end, 10);
+    if (end == cursor) {
+      return false;
+    }
+    uint32 last = first;
+    cursor = end;
+    if (*cursor == '-') {
+      last = strtoul(cursor + 1, &end, 10);
+      if (end == cursor + 1 || last < first) {
+        return false;
+      }
+      cursor = end;
+    }
+    for (uint32 i = first; i <= last; i++) {
+      values->push_back(i);
+    }
+    if (*cursor == ',') {
+      cursor++;
+    }
+  }
+  return true;
+}
+
+// Reads a sysfs list file. Returns false if it cannot be read or parsed.
+bool ReadCpuList(const ::std::string& filename,
+                 ::std::vector<uint32>* values) {
+  FILE* input = fopen(filename.c_str(), "r");
+  if (!input) {
+    return false;
+  }
+  char text[4096];
+  bool is_valid = fgets(text, sizeof(text), input) != nullptr;
+  fclose(input);
+  return is_valid && ParseCpuList(text, values);
+}
+
+}  // namespace
+
+const NumaTopology& NumaTopology::Get() {
+  static NumaTopology topology;
+  return topology;
+}
+
+NumaTopology::NumaTopology() {
+  if (!ReadNodes()) {
+    node_cpus_.clear();
+    node_cpus_.resize(1);
+    uint32 cpu_count = max(1u, ::std::thread::hardware_concurrency());
+    for (uint32 i = 0; i < cpu_count; i++) {
+      node_cpus_[0].push_back(i);
+    }
+  }
+}
+
+bool NumaTopology::ReadNodes() {
+#if defined(BASE_PLATFORM_LINUX)
+  const ::std::string node_path = "/sys/devices/system/node/";
+  ::std::vector<uint32> nodes;
+  if (!ReadCpuList(node_path + "online", &nodes)) {
+    return false;
+  }
+
+  for (uint32 node : nodes) {
+    ::std::vector<uint32> cpus;
+    if (!ReadCpuList(node_path + "node" + ::std::to_string(node) + "/cpulist",
+                     &cpus)) {
+      return false;
+    }
+    // Memory only nodes have no processors to place workers on.
+    if (cpus.size()) {
+      node_cpus_.push_back(cpus);
+    }
+  }
+  return node_cpus_.size() > 0;
+#else
+  return false;
+#endif
+}
+
+void NumaTopology::PlaceWorkers(uint32 worker_count,
+                                ::std::vector<uint32>* worker_cpus,
+                                ::std::vector<uint32>* worker_nodes) const {
+  ::std::vector<uint32> cpus;
+  ::std::vector<uint32> nodes;
+  for (uint32 i = 0; i < node_cpus_.size(); i++) {
+    cpus.insert(cpus.end(), node_cpus_[i].begin(), node_cpus_[i].end());
+    nodes.insert(nodes.end(), node_cpus_[i].size(), i);
+  }
+
+  worker_cpus->resize(worker_count);
+  worker_nodes->resize(worker_count);
+  for (uint32 i = 0; i < worker_count; i++) {
+    worker_cpus->at(i) = cpus[i % cpus.size()];
+    worker_nodes->at(i) = nodes[i % nodes.size()];
+  }
+}
+
+bool PinCurrentThread(uint32 cpu) {
+#if defined(BASE_PLATFORM_LINUX)
+  if (cpu >= CPU_SETSIZE) {
+    return false;
+  }
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  return !pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+#else
+  return false;
+#endif
+}
+
+}  // namespace base
@@ -0,0 +1,72 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include <vector>
+#include "math/base.h"
+
+namespace base {
+
+// Processors of the machine grouped by memory node. On Linux the layout is
+// read from sysfs. Other platforms, and machines without NUMA, report a
+// single node that holds every processor.
+class NumaTopology {
+ public:
+  // Returns the topology of this machine, read on first use.
+  static const NumaTopology& Get();
+  uint32 GetNodeCount() const { return node_cpus_.size(); }
+  // Returns the processors of a node.
+  const ::std::vector<uint32>& GetNodeCpus(uint32 node) const {
+    return node_cpus_[node];
+  }
+  // Assigns workers to processors, filling each node in turn, so that
+  // consecutive workers (and the consecutive rows they render) share a
+  // node. Workers beyond the processor count wrap around.
+  void PlaceWorkers(uint32 worker_count, ::std::vector<uint32>* worker_cpus,
+                    ::std::vector<uint32>* worker_nodes) const;
+
+ private:
+  NumaTopology();
+  // Reads the node layout from sysfs. Returns false if it is unavailable.
+  bool ReadNodes();
+  ::std::vector<::std::vector<uint32>> node_cpus_;
+};
+
+// Restricts the calling thread to a single processor. Returns false if
+// pinning is unsupported or fails.
+bool PinCurrentThread(uint32 cpu);
+
+}  // namespace base
+
+#endif  // __NUMA_H__
@@ -0,0 +1,433 @@
+
+#include "obj_loader.h"
+
+#include <charconv>
+#include <cstring>
+#include <thread>
+#include "mapped_file.h"
+
+namespace base {
+
+namespace {
+
+// Files are only split into chunks of at least this many bytes, so that
+// small meshes (which may already be loading alongside other assets) are
+// parsed inline.
+const uint64 kMinChunkSize = 4 << 20;
+// Index stored for face elements that omit a texcoord or normal.
+const uint32 kInvalidObjIndex = 0xFFFFFFFF;
+
+typedef enum ObjLineType {
+  kObjLineIgnored = 0,
+  kObjLineVertex,
+  kObjLineNormal,
+  kObjLineTexcoord,
+  kObjLineFace,
+} ObjLineType;
+
+typedef struct ObjChunk {
+  // Byte range of the chunk. Chunks always begin at the start of a line.
+  const char* begin;
+  const char* end;
+  // Element counts, filled in by the counting pass.
+  uint32 line_count;
+  uint32 vertex_count;
+  uint32 normal_count;
+  uint32 texcoord_count;
+  uint32 face_count;
+  // Position of the chunk's first element within the whole file.
+  uint32 first_line;
+  uint32 first_vertex;
+  uint32 first_normal;
+  uint32 first_texcoord;
+  uint32 first_face;
+  // Bounds of the chunk's transformed vertices.
+  bounds aabb;
+  // First error found while parsing the chunk, if any.
+  const char* error;
+  uint32 error_line;
+} ObjChunk;
+
+bool IsObjSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+void SkipObjSpace(const char** cursor, const char* end) {
+  while (*cursor < end && IsObjSpace(**cursor)) {
+    (*cursor)++;
+  }
+}
+
+// Identifies the element on a line and moves body past its keyword.
+ObjLineType ClassifyObjLine(const char* line, const char* end,
+                            const char** body) {
+  SkipObjSpace(&line, end);
+  if (end - line < 2) {
+    return kObjLineIgnored;
+  }
+
+  ObjLineType type = kObjLineIgnored;
+  const char* keyword_end = line + 1;
+  if (line[0] == 'f') {
+    type = kObjLineFace;
+  } else if (line[0] == 'v') {
+    type = kObjLineVertex;
+    if (line[1] == 'n') {
+      type = kObjLineNormal;
+      keyword_end++;
+    } else if (line[1] == 't') {
+      type = kObjLineTexcoord;
+      keyword_end++;
+    }
+  }
+
+  if (keyword_end >= end || !IsObjSpace(*keyword_end)) {
+    return kObjLineIgnored;
+  }
+  *body = keyword_end;
+  return type;
+}
+
+// Returns the number of index groups (e.g. 1/2/3) on a face line.
+uint32 CountObjFaceElements(const char* cursor, const char* end) {
+  uint32 count = 0;
+  while (true) {
+    SkipObjSpace(&cursor, end);
+    if (cursor >= end || *cursor == '#') {
+      return count;
+    }
+    count++;
+    while (cursor < end && !IsObjSpace(*cursor)) {
+      cursor++;
+    }
+  }
+}
+
+bool ReadObjFloat(const char** cursor, const char* end, float32* value) {
+  SkipObjSpace(cursor, end);
+  // from_chars rejects an explicit plus sign, which the obj format allows.
+  if (*cursor < end && **cursor == '+') {
+    (*cursor)++;
+  }
+  auto result = ::std::from_chars(*cursor, end, *value);
+  if (result.ec != ::std::errc()) {
+    return false;
+  }
+  *cursor = result.ptr;
+  return true;
+}
+
+// Reads a one based (or negative, relative) index and converts it to a zero
+// based index into an array of total_count elements.
+bool ReadObjIndex(const char** cursor, const char* end, uint32 defined_count,
+                  uint32 total_count, uint32* index) {
+  int64 value = 0;
+  auto result = ::std::from_chars(*cursor, end, value);
+  if (result.ec != ::std::errc() || value == 0) {
+    return false;
+  }
+  *cursor = result.ptr;
+
+  // Negative indices count back from the most recently defined element.
+  int64 resolved = value > 0 ? value - 1 : (int64)defined_count + value;
+  if (resolved < 0 || resolved >= (int64)total_count) {
+    return false;
+  }
+  *index = (uint32)resolved;
+  return true;
+}
+
+// Splits data into up to chunk_count chunks that begin on line starts.
+void SplitObjChunks(const char* data, uint64 size, uint64 chunk_count,
+                    ::std::vector<ObjChunk>* chunks) {
+  const char* end = data + size;
+  const char* chunk_begin = data;
+  for (uint64 i = 0; i < chunk_count; i++) {
+    const char* chunk_end = end;
+    if (i + 1 < chunk_count) {
+      chunk_end = data + size * (i + 1) / chunk_count;
+      if (chunk_end < chunk_begin) {
+        chunk_end = chunk_begin;
+      }
+      const char* line_end =
+          (const char*)memchr(chunk_end, '\n', end - chunk_end);
+      chunk_end = line_end ? line_end + 1 : end;
+    }
+
+    ObjChunk chunk = {};
+    chunk.begin = chunk_begin;
+    chunk.end = chunk_end;
+    chunks->push_back(chunk);
+    chunk_begin = chunk_end;
+  }
+}
+
+// First pass over a chunk. Counts lines and the elements that each line
+// will produce.
+void CountObjChunk(ObjChunk* chunk) {
+  const char* line = chunk->begin;
+  while (line < chunk->end) {
+    const char* line_end =
+        (const char*)memchr(line, '\n', chunk->end - line);
+    if (!line_end) {
+      line_end = chunk->end;
+    }
+
+    const char* body = nullptr;
+    switch (ClassifyObjLine(line, line_end, &body)) {
+      case kObjLineVertex:
+        chunk->vertex_count++;
+        break;
+      case kObjLineNormal:
+        chunk->normal_count++;
+        break;
+      case kObjLineTexcoord:
+        chunk->texcoord_count++;
+        break;
+      case kObjLineFace: {
+        uint32 element_count = CountObjFaceElements(body, line_end);
+        if (element_count >= 3) {
+          chunk->face_count += element_count - 2;
+        }
+        break;
+      }
+      default:
+        break;
+    }
+
+    chunk->line_count++;
+    line = line_end + 1;
+  }
+}
+
+// Reads one face element (v, v/vt, v//vn or v/vt/vn). The vertex, texcoord
+// and normal indices are stored in that order in indices, and counts are
+// ordered the same way.
+bool ReadObjFaceElement(const char** cursor, const char* end,
+                        const uint32 defined_counts[3],
+                        const uint32 total_counts[3], uint32 indices[3]) {
+  indices[1] = kInvalidObjIndex;
+  indices[2] = kInvalidObjIndex;
+  if (!ReadObjIndex(cursor, end, defined_counts[0], total_counts[0],
+                    &indices[0])) {
+    return false;
+  }
+  for (uint32 i = 1; i < 3; i++) {
+    if (*cursor >= end || **cursor != '/') {
+      break;
+    }
+    (*cursor)++;
+    if (*cursor < end && **cursor == '/') {
+      continue;
+    }
+    if (!ReadObjIndex(cursor, end, defined_counts[i], total_counts[i],
+                      &indices[i])) {
+      return false;
+    }
+  }
+  return *cursor >= end || IsObjSpace(**cursor);
+}
+
+// Second pass over a chunk. Parses every element into its final slot in
+// the output arrays.
+void ParseObjChunk(const matrix4& transform, bool invert_normals,
+                   ::std::vector<vector3>* vertices,
+                   ::std::vector<vector3>* normals,
+                   ::std::vector<vector2>* texcoords,
+                   ::std::vector<MeshFace>* faces, ObjChunk* chunk) {
+  const uint32 total_counts[3] = {(uint32)vertices->size(),
+                                  (uint32)texcoords->size(),
+                                  (uint32)normals->size()};
+  uint32 defined_counts[3] = {chunk->first_vertex, chunk->first_texcoord,
+                              chunk->first_normal};
+  uint32 face_index = chunk->first_face;
+  uint32 line_number = chunk->first_line;
+
+  const char* line = chunk->begin;
+  while (line < chunk->end) {
+    const char* line_end =
+        (const char*)memchr(line, '\n', chunk->end - line);
+    if (!line_end) {
+      line_end = chunk->end;
+    }
+
+    const char* cursor = nullptr;
+    switch (ClassifyObjLine(line, line_end, &cursor)) {
+      case kObjLineVertex: {
+        vector3 vertex;
+        if (!ReadObjFloat(&cursor, line_end, &vertex.x) ||
+            !ReadObjFloat(&cursor, line_end, &vertex.y) ||
+            !ReadObjFloat(&cursor, line_end, &vertex.z)) {
+          chunk->error = "invalid vertex";
+          chunk->error_line = line_number;
+          return;
+        }
+        vertex = vector3(transform * vertex);
+        chunk->aabb += vertex;
+        (*vertices)[defined_counts[0]++] = vertex;
+        break;
+      }
+
+      case kObjLineNormal: {
+        vector3 normal;
+        if (!ReadObjFloat(&cursor, line_end, &normal.x) ||
+            !ReadObjFloat(&cursor, line_end, &normal.y) ||
+            !ReadObjFloat(&cursor, line_end, &normal.z)) {
+          chunk->error = "invalid normal";
+          chunk->error_line = line_number;
+          return;
+        }
+        normal = normal.normalize();
+        if (invert_normals) {
+          normal *= -1.0;
+        }
+        (*normals)[defined_counts[2]++] = normal;
+        break;
+      }
+
+      case kObjLineTexcoord: {
+        // The v coordinate is optional and defaults to zero.
+        vector2 texcoord(0, 0);
+        if (!ReadObjFloat(&cursor, line_end, &texcoord.x)) {
+          chunk->error = "invalid texcoord";
+          chunk->error_line = line_number;
+          return;
+        }
+        ReadObjFloat(&cursor, line_end, &texcoord.y);
+        (*texcoords)[defined_counts[1]++] = texcoord;
+        break;
+      }
+
+      case kObjLineFace: {
+        // Polygons are emitted as a fan around their first element.
+        uint32 first[3], previous[3], current[3];
+        uint32 element_count = 0;
+        while (true) {
+          SkipObjSpace(&cursor, line_end);
+          if (cursor >= line_end || *cursor == '#') {
+            break;
+          }
+          if (!ReadObjFaceElement(&cursor, line_end, defined_counts,
+                                  total_counts, current)) {
+            chunk->error = "invalid face element";
+            chunk->error_line = line_number;
+            return;
+          }
+
+          if (element_count >= 2) {
+            MeshFace* face = &(*faces)[face_index++];
+            face->vertex_indices[0] = current[0];
+            face->vertex_indices[1] = previous[0];
+            face->vertex_indices[2] = first[0];
+            face->texcoord_indices[0] = current[1];
+            face->texcoord_indices[1] = previous[1];
+            face->texcoord_indices[2] = first[1];
+            face->normal_indices[0] = current[2];
+            face->normal_indices[1] = previous[2];
+            face->normal_indices[2] = first[2];
+            face->face_plane = plane();
+            face->material = -1;
+          } else if (element_count == 0) {
+            memcpy(first, current, sizeof(first));
+          }
+          memcpy(previous, current, sizeof(previous));
+          element_count++;
+        }
+        break;
+      }
+
+      default:
+        break;
+    }
+
+    line_number++;
+    line = line_end + 1;
+  }
+}
+
+// Runs function(i) for every chunk, each on its own thread. The calling
+// thread parses the first chunk.
+template <class Function>
+void ForEachObjChunk(uint32 chunk_count, const Function& function) {
+  ::std::vector<::std::thread> thread_list;
+  for (uint32 i = 1; i < chunk_count; i++) {
+    thread_list.emplace_back(function, i);
+  }
+  function(0);
+  for (auto& chunk_thread : thread_list) {
+    chunk_thread.join();
+  }
+}
+
+}  // namespace
+
+bool LoadObjMesh(const ::std::string& filename, const matrix4& transform,
+                 bool invert_normals, ::std::vector<vector3>* vertices,
+                 ::std::vector<vector3>* normals,
+                 ::std::vector<vector2>* texcoords,
+                 ::std::vector<MeshFace>* faces, bounds* aabb,
+                 uint32 thread_count) {
+  MappedFile file;
+  if (!file.Open(filename)) {
+    return false;
+  }
+
+  uint64 size = file.GetSize();
+  uint64 chunk_count =
+      thread_count ? thread_count : ::std::thread::hardware_concurrency();
+  if (chunk_count > size / kMinChunkSize) {
+    chunk_count = size / kMinChunkSize;
+  }
+  if (!chunk_count) {
+    chunk_count = 1;
+  }
+
+  ::std::vector<ObjChunk> chunks;
+  SplitObjChunks(file.GetData(), size, chunk_count, &chunks);
+  ForEachObjChunk(chunk_count, [&](uint32 i) { CountObjChunk(&chunks[i]); });
+
+  // Each chunk's elements start where the previous chunk's end.
+  uint64 totals[5] = {};
+  for (auto& chunk : chunks) {
+    chunk.first_line = totals[0] + 1;
+    chunk.first_vertex = totals[1];
+    chunk.first_normal = totals[2];
+    chunk.first_texcoord = totals[3];
+    chunk.first_face = totals[4];
+    totals[0] += chunk.line_count;
+    totals[1] += chunk.vertex_count;
+    totals[2] += chunk.normal_count;
+    totals[3] += chunk.texcoord_count;
+    totals[4] += chunk.face_count;
+  }
+  if (totals[1] >= kInvalidObjIndex || totals[2] >= kInvalidObjIndex ||
+      totals[3] >= kInvalidObjIndex || totals[4] >= kInvalidObjIndex) {
+    printf("Obj file %s has too many elements.\n", filename.c_str());
+    return false;
+  }
+
+  vertices->resize(totals[1]);
+  normals->resize(totals[2]);
+  texcoords->resize(totals[3]);
+  faces->resize(totals[4]);
+  ForEachObjChunk(chunk_count, [&](uint32 i) {
+    ParseObjChunk(transform, invert_normals, vertices, normals, texcoords,
+                  faces, &chunks[i]);
+  });
+
+  for (auto& chunk : chunks) {
+    if (chunk.error) {
+      printf("%s:%u: error: %s.\n", filename.c_str(), chunk.error_line,
+             chunk.error);
+      vertices->clear();
+      normals->clear();
+      texcoords->clear();
+      faces->clear();
+      return false;
+    }
+    if (chunk.vertex_count) {
+      *aabb += chunk.aabb;
+    }
+  }
+  return true;
+}
+
+}  // namespace base
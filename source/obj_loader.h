@@ -0,0 +1,69 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __OBJ_LOADER_H__
+#define __OBJ_LOADER_H__
+
+#include <string>
+#include <vector>
+#include "math/base.h"
+#include "math/matrix4.h"
+#include "math/vector2.h"
+#include "math/vector3.h"
+#include "math/volume.h"
+#include "mesh.h"
+
+namespace base {
+
+// Loads a Wavefront (.obj) file directly into mesh arrays. The file is
+// mapped and split into chunks at line boundaries that are parsed in
+// parallel. A first pass counts the elements in each chunk, which fixes
+// where each chunk writes into the output arrays, and a second pass parses
+// the elements in place, so the output matches a sequential parse.
+//
+// Vertices are multiplied by transform and accumulated into aabb. Normals
+// are normalized, and flipped if invert_normals is set. Polygons are fan
+// triangulated and faces are emitted with reversed winding. Materials and
+// groups are ignored, so every face has an invalid material index.
+//
+// At most thread_count threads parse the file, including the calling
+// thread. Zero uses one thread per hardware thread.
+bool LoadObjMesh(const ::std::string& filename, const matrix4& transform,
+                 bool invert_normals, ::std::vector<vector3>* vertices,
+                 ::std::vector<vector3>* normals,
+                 ::std::vector<vector2>* texcoords,
+                 ::std::vector<MeshFace>* faces, bounds* aabb,
+                 uint32 thread_count = 0);
+
+}  // namespace base
+
+#endif  // __OBJ_LOADER_H__
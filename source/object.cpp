@@ -6,13 +6,17 @@
 namespace base {
 
 ObjectCollision::ObjectCollision()
-    : param(2.0), surface_material(nullptr), is_internal(false) {}
+    : param(2.0),
+      surface_material(nullptr),
+      surface_object(nullptr),
+      is_internal(false),
+      skip_media(false) {}
 
 void Object::SetMaterial(::std::shared_ptr<Material> material) {
   material_ = material;
 }
 
-Object::Object() {}
+Object::Object() : light_index_(kInvalidLightIndex) {}
 
 SphericalObject::SphericalObject(const vector3 &origin, float32 radius)
     : origin_(origin), radius_(radius) {
@@ -28,6 +32,7 @@ bool SphericalObject::Trace(const ray &trajectory, ObjectCollision *hit_info) {
       hit_info->point = temp_collision.point;
       hit_info->surface_normal = temp_collision.normal;
       hit_info->surface_material = material_.get();
+      hit_info->surface_object = this;
       hit_info->surface_texcoords = sphere_map_texcoords(temp_collision.normal);
       return true;
     }
@@ -35,6 +40,75 @@ bool SphericalObject::Trace(const ray &trajectory, ObjectCollision *hit_info) {
   return false;
 }
 
+void SphericalObject::Translate(const vector3 &offset) {
+  origin_ += offset;
+  aabb_.translate(offset);
+}
+
+float32 SphericalObject::GetSurfaceArea() const {
+  return 4.0f * BASE_PI * radius_ * radius_;
+}
+
+bool SphericalObject::SampleDirection(const vector3 &origin, float32 u0,
+                                      float32 u1, vector3 *direction,
+                                      float32 *distance, float32 *pdf) const {
+  vector3 to_center = origin_ - origin;
+  float32 center_distance2 = to_center.dot(to_center);
+  if (center_distance2 <= radius_ * radius_) {
+    // Points inside the sphere are not lit by it.
+    return false;
+  }
+
+  // Uniformly sample the cone subtended by the sphere.
+  float32 center_distance = sqrtf(center_distance2);
+  float32 sin2_theta_max = radius_ * radius_ / center_distance2;
+  float32 cos_theta_max = sqrtf(fmaxf(0.0f, 1.0f - sin2_theta_max));
+  // 1 - cos(theta_max), in a form that stays accurate for distant spheres.
+  float32 cone_height = sin2_theta_max / (1.0f + cos_theta_max);
+  float32 cos_theta = 1.0f - u0 * cone_height;
+  *direction = spherical_direction(to_center / center_distance, cos_theta,
+                                   BASE_2PI * u1);
+
+  // Distance to the near side of the sphere along the sampled direction.
+  float32 sin2_theta = fmaxf(0.0f, 1.0f - cos_theta * cos_theta);
+  *distance = center_distance * cos_theta -
+              sqrtf(fmaxf(0.0f, radius_ * radius_ -
+                                    center_distance2 * sin2_theta));
+  *pdf = 1.0f / (BASE_2PI * cone_height);
+  return true;
+}
+
+float32 SphericalObject::DirectionPdf(const vector3 &origin,
+                                      const vector3 &direction,
+                                      float32 distance) const {
+  vector3 to_center = origin_ - origin;
+  float32 center_distance2 = to_center.dot(to_center);
+  if (center_distance2 <= radius_ * radius_) {
+    return 0.0f;
+  }
+  float32 sin2_theta_max = radius_ * radius_ / center_distance2;
+  float32 cos_theta_max = sqrtf(fmaxf(0.0f, 1.0f - sin2_theta_max));
+  return 1.0f / (BASE_2PI * sin2_theta_max / (1.0f + cos_theta_max));
+}
+
+bool SphericalObject::SampleSurface(float32 u0, float32 u1, vector3 *point,
+                                    vector3 *normal) const {
+  *normal = sample_uniform_sphere(u0, u1);
+  *point = origin_ + *normal * radius_;
+  return radius_ > 0.0f;
+}
+
+// Converts an area density at a sampled surface point to a solid angle
+// density as seen from the sampling origin.
+float32 area_to_solid_angle_pdf(float32 area, const vector3 &normal,
+                                const vector3 &direction, float32 distance) {
+  float32 cos_theta = fabs(normal.dot(direction));
+  if (area <= 0.0f || cos_theta <= BASE_EPSILON) {
+    return 0.0f;
+  }
+  return (distance * distance) / (area * cos_theta);
+}
+
 PlanarObject::PlanarObject(const plane &data) : plane_(data) {
   vector3 normal(data[0], data[1], data[2]);
   vector3 up(0, 1, 0);
@@ -64,6 +138,7 @@ bool PlanarObject::Trace(const ray &trajectory, ObjectCollision *hit_info) {
       hit_info->point = temp_collision.point;
       hit_info->surface_normal = temp_collision.normal;
       hit_info->surface_material = material_.get();
+      hit_info->surface_object = this;
       hit_info->surface_texcoords =
           planar_map_texcoords(temp_collision.point, temp_collision.normal);
       return true;
@@ -72,6 +147,12 @@ bool PlanarObject::Trace(const ray &trajectory, ObjectCollision *hit_info) {
   return false;
 }
 
+void PlanarObject::Translate(const vector3 &offset) {
+  plane_[3] -= plane_[0] * offset.x + plane_[1] * offset.y +
+               plane_[2] * offset.z;
+  aabb_.translate(offset);
+}
+
 DiscObject::DiscObject(const vector3 &origin, const vector3 &normal,
                        float32 radius) {
   origin_ = origin;
@@ -103,6 +184,7 @@ bool DiscObject::Trace(const ray &trajectory, ObjectCollision *hit_info) {
         hit_info->point = temp_collision.point;
         hit_info->surface_normal = temp_collision.normal;
         hit_info->surface_material = material_.get();
+        hit_info->surface_object = this;
         hit_info->surface_texcoords =
             planar_map_texcoords(temp_collision.point, temp_collision.normal);
         return true;
@@ -112,6 +194,58 @@ bool DiscObject::Trace(const ray &trajectory, ObjectCollision *hit_info) {
   return false;
 }
 
+void DiscObject::Translate(const vector3 &offset) {
+  origin_ += offset;
+  plane_ = calculate_plane(vector3(plane_.x, plane_.y, plane_.z), origin_);
+  aabb_.translate(offset);
+}
+
+float32 DiscObject::GetSurfaceArea() const {
+  return BASE_PI * radius_ * radius_;
+}
+
+bool DiscObject::SampleDirection(const vector3 &origin, float32 u0, float32 u1,
+                                 vector3 *direction, float32 *distance,
+                                 float32 *pdf) const {
+  vector3 normal = vector3(plane_[0], plane_[1], plane_[2]).normalize();
+  vector3 tangent, bitangent;
+  build_orthonormal_basis(normal, &tangent, &bitangent);
+
+  float32 r = radius_ * sqrtf(u0);
+  float32 phi = BASE_2PI * u1;
+  vector3 point =
+      origin_ + tangent * (r * cosf(phi)) + bitangent * (r * sinf(phi));
+  vector3 to_point = point - origin;
+  *distance = to_point.length();
+  if (*distance <= BASE_EPSILON) {
+    return false;
+  }
+  *direction = to_point / *distance;
+  *pdf = area_to_solid_angle_pdf(GetSurfaceArea(), normal, *direction,
+                                 *distance);
+  return *pdf > 0.0f;
+}
+
+float32 DiscObject::DirectionPdf(const vector3 &origin,
+                                 const vector3 &direction,
+                                 float32 distance) const {
+  vector3 normal = vector3(plane_[0], plane_[1], plane_[2]).normalize();
+  return area_to_solid_angle_pdf(GetSurfaceArea(), normal, direction,
+                                 distance);
+}
+
+bool DiscObject::SampleSurface(float32 u0, float32 u1, vector3 *point,
+                               vector3 *normal) const {
+  *normal = vector3(plane_[0], plane_[1], plane_[2]).normalize();
+  vector3 tangent, bitangent;
+  build_orthonormal_basis(*normal, &tangent, &bitangent);
+
+  float32 r = radius_ * sqrtf(u0);
+  float32 phi = BASE_2PI * u1;
+  *point = origin_ + tangent * (r * cosf(phi)) + bitangent * (r * sinf(phi));
+  return radius_ > 0.0f;
+}
+
 CuboidObject::CuboidObject(const vector3 &origin, float32 width, float32 height,
                            float32 depth) {
   bounds temp_aabb;
@@ -154,6 +288,7 @@ bool CuboidObject::Trace(const ray &trajectory, ObjectCollision *hit_info) {
           hit_info->point = plane_hit.point;
           hit_info->surface_normal = plane_hit.normal;
           hit_info->surface_material = material_.get();
+          hit_info->surface_object = this;
           hit_info->surface_texcoords =
               planar_map_texcoords(plane_hit.point, plane_hit.normal) * 0.1f;
         }
@@ -164,6 +299,10 @@ bool CuboidObject::Trace(const ray &trajectory, ObjectCollision *hit_info) {
   return collision_detected;
 }
 
+void CuboidObject::Translate(const vector3 &offset) {
+  cube_data_.translate(offset);
+}
+
 QuadObject::QuadObject(const vector3 &origin, const vector3 &normal,
                        float32 width, float32 height) {
   vector3 normalized = normal.normalize();
@@ -228,6 +367,7 @@ bool QuadObject::Trace(const ray &trajectory, ObjectCollision *hit_info) {
       hit_info->point = temp_collision.point;
       hit_info->surface_normal = temp_collision.normal;
       hit_info->surface_material = material_.get();
+      hit_info->surface_object = this;
       hit_info->surface_texcoords =
           planar_map_texcoords(temp_collision.point, temp_collision.normal);
       return true;
@@ -236,4 +376,71 @@ bool QuadObject::Trace(const ray &trajectory, ObjectCollision *hit_info) {
   return false;
 }
 
-}  // namespace base
\ No newline at end of file
+bool QuadObject::QueryHalfEdges(vector3 *half_u, vector3 *half_v) const {
+  // Trace bounds projections onto the (possibly unnormalized) tangent
+  // frame, so each edge is scaled by the inverse squared frame length.
+  float32 u_length2 = bitangent_.dot(bitangent_);
+  float32 v_length2 = tangent_.dot(tangent_);
+  if (u_length2 <= BASE_EPSILON || v_length2 <= BASE_EPSILON) {
+    return false;
+  }
+  *half_u = bitangent_ * (half_width_ / u_length2);
+  *half_v = tangent_ * (half_height_ / v_length2);
+  return true;
+}
+
+void QuadObject::Translate(const vector3 &offset) {
+  origin_ += offset;
+  plane_ = calculate_plane(vector3(plane_.x, plane_.y, plane_.z), origin_);
+  aabb_.translate(offset);
+}
+
+float32 QuadObject::GetSurfaceArea() const {
+  vector3 half_u, half_v;
+  if (!QueryHalfEdges(&half_u, &half_v)) {
+    return 0.0f;
+  }
+  return 4.0f * half_u.cross(half_v).length();
+}
+
+bool QuadObject::SampleDirection(const vector3 &origin, float32 u0, float32 u1,
+                                 vector3 *direction, float32 *distance,
+                                 float32 *pdf) const {
+  vector3 half_u, half_v;
+  if (!QueryHalfEdges(&half_u, &half_v)) {
+    return false;
+  }
+  vector3 point = origin_ + half_u * (u0 * 2.0f - 1.0f) +
+                  half_v * (u1 * 2.0f - 1.0f);
+  vector3 to_point = point - origin;
+  *distance = to_point.length();
+  if (*distance <= BASE_EPSILON) {
+    return false;
+  }
+  *direction = to_point / *distance;
+  *pdf = area_to_solid_angle_pdf(GetSurfaceArea(),
+                                 vector3(plane_[0], plane_[1], plane_[2]),
+                                 *direction, *distance);
+  return *pdf > 0.0f;
+}
+
+float32 QuadObject::DirectionPdf(const vector3 &origin,
+                                 const vector3 &direction,
+                                 float32 distance) const {
+  return area_to_solid_angle_pdf(GetSurfaceArea(),
+                                 vector3(plane_[0], plane_[1], plane_[2]),
+                                 direction, distance);
+}
+
+bool QuadObject::SampleSurface(float32 u0, float32 u1, vector3 *point,
+                               vector3 *normal) const {
+  vector3 half_u, half_v;
+  if (!QueryHalfEdges(&half_u, &half_v)) {
+    return false;
+  }
+  *point = origin_ + half_u * (u0 * 2.0f - 1.0f) + half_v * (u1 * 2.0f - 1.0f);
+  *normal = vector3(plane_[0], plane_[1], plane_[2]).normalize();
+  return true;
+}
+
+}  // namespace base
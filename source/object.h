@@ -44,6 +44,10 @@
 
 namespace base {
 
+const uint32 kInvalidLightIndex = 0xFFFFFFFF;
+
+class Object;
+
 typedef struct ObjectCollision {
   // The portion along the ray that the collision occurred.
   float32 param;
@@ -55,13 +59,19 @@ typedef struct ObjectCollision {
   vector2 surface_texcoords;
   // The material at the surface that was struck.
   Material *surface_material;
+  // The object that was struck.
+  Object *surface_object;
   // True if the colliding ray originated inside the object.
   bool is_internal;
+  // Set by the caller to pass through participating media without sampling
+  // scattering events (e.g. for shadow rays that apply transmittance).
+  bool skip_media;
   ObjectCollision();
 } ObjectCollision;
 
 class Object {
  public:
+  virtual ~Object() {}
   // Returns the center point of the object.
   virtual const vector3 GetCenter() const = 0;
   // Returns an axis aligned bounding box for the object's bounds.
@@ -74,11 +84,44 @@ class Object {
   // false otherwise. If a collision is detected, hit_info will contain
   // information about the collision point.
   virtual bool Trace(const ray &trajectory, ObjectCollision *hit_info) = 0;
+  // Moves the object by offset.
+  virtual void Translate(const vector3 &offset) = 0;
+  // Returns the surface area of the object. Objects that report a zero area
+  // cannot be sampled as lights.
+  virtual float32 GetSurfaceArea() const { return 0.0f; }
+  // Samples a direction from origin toward the surface of the object. On
+  // success, returns the direction, the distance to the surface along it,
+  // and the solid angle pdf of the direction.
+  virtual bool SampleDirection(const vector3 &origin, float32 u0, float32 u1,
+                               vector3 *direction, float32 *distance,
+                               float32 *pdf) const {
+    return false;
+  }
+  // Returns the solid angle pdf with which SampleDirection would produce
+  // direction, given that direction hits the object at distance.
+  virtual float32 DirectionPdf(const vector3 &origin, const vector3 &direction,
+                               float32 distance) const {
+    return 0.0f;
+  }
+  // Samples a point uniformly by area on the surface of the object, along
+  // with the surface normal there. Returns false for objects that cannot be
+  // sampled as lights.
+  virtual bool SampleSurface(float32 u0, float32 u1, vector3 *point,
+                             vector3 *normal) const {
+    return false;
+  }
+  // Returns the index of the object in the scene light list, or
+  // kInvalidLightIndex if the object is not sampled as a light.
+  uint32 GetLightIndex() const { return light_index_; }
+  // Sets the index of the object in the scene light list.
+  void SetLightIndex(uint32 index) { light_index_ = index; }
 
   Object();
 
  protected:
   ::std::shared_ptr<Material> material_;
+  // Index into the scene light list.
+  uint32 light_index_;
 };
 
 class SphericalObject : public Object {
@@ -87,6 +130,16 @@ class SphericalObject : public Object {
   const vector3 GetCenter() const override { return origin_; }
   const bounds GetBounds() const override { return aabb_; }
   bool Trace(const ray &trajectory, ObjectCollision *hit_info) override;
+  void Translate(const vector3 &offset) override;
+  float32 GetSurfaceArea() const override;
+  // Samples the cone of directions subtended by the sphere.
+  bool SampleDirection(const vector3 &origin, float32 u0, float32 u1,
+                       vector3 *direction, float32 *distance,
+                       float32 *pdf) const override;
+  float32 DirectionPdf(const vector3 &origin, const vector3 &direction,
+                       float32 distance) const override;
+  bool SampleSurface(float32 u0, float32 u1, vector3 *point,
+                     vector3 *normal) const override;
 
  private:
   bounds aabb_;
@@ -100,6 +153,7 @@ class PlanarObject : public Object {
   const vector3 GetCenter() const override { return vector3(); }
   const bounds GetBounds() const override { return aabb_; }
   bool Trace(const ray &trajectory, ObjectCollision *hit_info) override;
+  void Translate(const vector3 &offset) override;
 
  private:
   bounds aabb_;
@@ -112,6 +166,16 @@ class DiscObject : public Object {
   const vector3 GetCenter() const override { return origin_; }
   const bounds GetBounds() const override { return aabb_; }
   bool Trace(const ray &trajectory, ObjectCollision *hit_info) override;
+  void Translate(const vector3 &offset) override;
+  float32 GetSurfaceArea() const override;
+  // Samples the disc uniformly by area.
+  bool SampleDirection(const vector3 &origin, float32 u0, float32 u1,
+                       vector3 *direction, float32 *distance,
+                       float32 *pdf) const override;
+  float32 DirectionPdf(const vector3 &origin, const vector3 &direction,
+                       float32 distance) const override;
+  bool SampleSurface(float32 u0, float32 u1, vector3 *point,
+                     vector3 *normal) const override;
 
  private:
   bounds aabb_;
@@ -128,6 +192,7 @@ class CuboidObject : public Object {
   const bounds GetBounds() const override { return cube_data_.query_bounds(); }
   void Rotate(const vector3 &axis, float32 angle);
   bool Trace(const ray &trajectory, ObjectCollision *hit_info) override;
+  void Translate(const vector3 &offset) override;
 
  private:
   cube cube_data_;
@@ -140,8 +205,21 @@ public:
     const vector3 GetCenter() const override { return vector3(); }
     const bounds GetBounds() const override { return aabb_; }
     bool Trace(const ray& trajectory, ObjectCollision* hit_info) override;
+    void Translate(const vector3& offset) override;
+    float32 GetSurfaceArea() const override;
+    // Samples the quad uniformly by area.
+    bool SampleDirection(const vector3& origin, float32 u0, float32 u1,
+                         vector3* direction, float32* distance,
+                         float32* pdf) const override;
+    float32 DirectionPdf(const vector3& origin, const vector3& direction,
+                         float32 distance) const override;
+    bool SampleSurface(float32 u0, float32 u1, vector3* point,
+                       vector3* normal) const override;
 
 private:
+    // Returns the half edge vectors of the region accepted by Trace, or
+    // false if the quad is degenerate.
+    bool QueryHalfEdges(vector3* half_u, vector3* half_v) const;
     bounds aabb_;
     plane plane_;
     float32 half_width_;
@@ -0,0 +1,364 @@
+
+#include "path_guide.h"
+#include <stdio.h>
+#include <math.h>
+#include "math/fast_math.h"
+
+namespace base {
+
+// Fraction of a directional tree's radiance above which a quadrant is
+// subdivided during refinement.
+const float32 kDirectionalSplitThreshold = 0.01f;
+const uint32 kMaxDirectionalDepth = 20;
+// A region is split once it receives more than this many samples, scaled
+// by the square root of the passes in the iteration.
+const float32 kSpatialSplitSamples = 12000.0f;
+const uint32 kMaxSpatialDepth = 48;
+
+namespace {
+
+void AtomicAdd(::std::atomic<float32>* target, float32 value) {
+  float32 current = target->load(::std::memory_order_relaxed);
+  while (!target->compare_exchange_weak(current, current + value,
+                                        ::std::memory_order_relaxed)) {
+  }
+}
+
+// Maps a unit direction to the unit square, preserving area.
+void DirectionToSquare(const vector3& direction, float32* u, float32* v) {
+  float32 cos_theta = direction.y < -1.0f  ? -1.0f
+                      : direction.y > 1.0f ? 1.0f
+                                           : direction.y;
+  float32 phi = fast_atan2(direction.z, direction.x) / (2.0f * BASE_PI);
+  if (phi < 0.0f) {
+    phi += 1.0f;
+  }
+  // Keep both coordinates strictly inside the square so that quadrant
+  // selection never steps past the last cell.
+  const float32 kLimit = 1.0f - 1.0e-6f;
+  *u = min((cos_theta + 1.0f) * 0.5f, kLimit);
+  *v = min(max(phi, 0.0f), kLimit);
+}
+
+vector3 SquareToDirection(float32 u, float32 v) {
+  float32 cos_theta = 2.0f * u - 1.0f;
+  float32 sin_theta = sqrtf(max(0.0f, 1.0f - cos_theta * cos_theta));
+  float32 sin_phi = 0.0f;
+  float32 cos_phi = 0.0f;
+  fast_sincos(2.0f * BASE_PI * v, &sin_phi, &cos_phi);
+  return vector3(sin_theta * cos_phi, cos_theta, sin_theta * sin_phi);
+}
+
+// Returns the quadrant of (u, v) and rescales both to that quadrant.
+uint32 SelectQuadrant(float32* u, float32* v) {
+  uint32 quadrant = 0;
+  *u *= 2.0f;
+  *v *= 2.0f;
+  if (*u >= 1.0f) {
+    quadrant |= 1;
+    *u -= 1.0f;
+  }
+  if (*v >= 1.0f) {
+    quadrant |= 2;
+    *v -= 1.0f;
+  }
+  return quadrant;
+}
+
+}  // namespace
+
+DirectionalTree::DirectionalNode::DirectionalNode() {
+  for (uint32 i = 0; i < 4; i++) {
+    sums[i].store(0.0f, ::std::memory_order_relaxed);
+    children[i] = 0;
+  }
+}
+
+DirectionalTree::DirectionalNode::DirectionalNode(
+    const DirectionalNode& other) {
+  *this = other;
+}
+
+DirectionalTree::DirectionalNode& DirectionalTree::DirectionalNode::operator=(
+    const DirectionalNode& other) {
+  for (uint32 i = 0; i < 4; i++) {
+    sums[i].store(other.sums[i].load(::std::memory_order_relaxed),
+                  ::std::memory_order_relaxed);
+    children[i] = other.children[i];
+  }
+  return *this;
+}
+
+DirectionalTree::DirectionalTree() : nodes_(1) {}
+
+DirectionalTree::DirectionalTree(const DirectionalTree& other)
+    : nodes_(other.nodes_) {}
+
+DirectionalTree& DirectionalTree::operator=(const DirectionalTree& other) {
+  nodes_ = other.nodes_;
+  return *this;
+}
+
+void DirectionalTree::Record(const vector3& direction, float32 radiance) {
+  float32 u = 0.0f;
+  float32 v = 0.0f;
+  DirectionToSquare(direction, &u, &v);
+  uint32 node = 0;
+  while (true) {
+    uint32 quadrant = SelectQuadrant(&u, &v);
+    AtomicAdd(&nodes_[node].sums[quadrant], radiance);
+    node = nodes_[node].children[quadrant];
+    if (!node) {
+      break;
+    }
+  }
+}
+
+float32 DirectionalTree::GetTotal() const {
+  float32 total = 0.0f;
+  for (uint32 i = 0; i < 4; i++) {
+    total += nodes_[0].sums[i].load(::std::memory_order_relaxed);
+  }
+  return total;
+}
+
+vector3 DirectionalTree::Sample(float32 u0, float32 u1) const {
+  float32 origin_u = 0.0f;
+  float32 origin_v = 0.0f;
+  float32 size = 1.0f;
+  uint32 node = 0;
+  while (true) {
+    float32 sums[4];
+    float32 total = 0.0f;
+    for (uint32 i = 0; i < 4; i++) {
+      sums[i] = nodes_[node].sums[i].load(::std::memory_order_relaxed);
+      total += sums[i];
+    }
+    // Choose a quadrant in proportion to its radiance, then reuse the
+    // remainder of u0 as a fresh uniform number.
+    uint32 quadrant = 3;
+    float32 target = u0 * total;
+    for (uint32 i = 0; i < 3; i++) {
+      if (target < sums[i]) {
+        quadrant = i;
+        break;
+      }
+      target -= sums[i];
+    }
+    if (total <= 0.0f) {
+      quadrant = min(uint32(u0 * 4.0f), 3u);
+      u0 = u0 * 4.0f - quadrant;
+    } else {
+      u0 = sums[quadrant] > 0.0f ? target / sums[quadrant] : 0.0f;
+    }
+    u0 = min(max(u0, 0.0f), 1.0f - 1.0e-6f);
+    size *= 0.5f;
+    origin_u += (quadrant & 1) ? size : 0.0f;
+    origin_v += (quadrant & 2) ? size : 0.0f;
+    node = nodes_[node].children[quadrant];
+    if (!node) {
+      break;
+    }
+  }
+  return SquareToDirection(origin_u + u0 * size, origin_v + u1 * size);
+}
+
+float32 DirectionalTree::Pdf(const vector3& direction) const {
+  float32 u = 0.0f;
+  float32 v = 0.0f;
+  DirectionToSquare(direction, &u, &v);
+  float32 pdf = 1.0f;
+  uint32 node = 0;
+  while (true) {
+    float32 total = 0.0f;
+    for (uint32 i = 0; i < 4; i++) {
+      total += nodes_[node].sums[i].load(::std::memory_order_relaxed);
+    }
+    if (total <= 0.0f) {
+      return 0.0f;
+    }
+    uint32 quadrant = SelectQuadrant(&u, &v);
+    pdf *= 4.0f *
+           nodes_[node].sums[quadrant].load(::std::memory_order_relaxed) /
+           total;
+    node = nodes_[node].children[quadrant];
+    if (!node) {
+      break;
+    }
+  }
+  // The square covers the 4 pi steradians of the sphere with equal area.
+  return pdf / (4.0f * BASE_PI);
+}
+
+void DirectionalTree::Refine(const DirectionalTree& source,
+                             float32 threshold) {
+  float32 total = source.GetTotal();
+  if (total <= 0.0f) {
+    nodes_ = source.nodes_;
+    for (auto& node : nodes_) {
+      for (uint32 i = 0; i < 4; i++) {
+        node.sums[i].store(0.0f, ::std::memory_order_relaxed);
+      }
+    }
+    return;
+  }
+
+  nodes_.clear();
+  nodes_.emplace_back();
+  const DirectionalNode& root = source.nodes_[0];
+  for (uint32 i = 0; i < 4; i++) {
+    float32 fraction = root.sums[i].load(::std::memory_order_relaxed) / total;
+    uint32 child =
+        RefineQuadrant(source, root.children[i], fraction, threshold, 1);
+    nodes_[0].children[i] = child;
+  }
+}
+
+uint32 DirectionalTree::RefineQuadrant(const DirectionalTree& source,
+                                       uint32 source_node, float32 fraction,
+                                       float32 threshold, uint32 depth) {
+  if (fraction <= threshold || depth >= kMaxDirectionalDepth) {
+    return 0;
+  }
+
+  uint32 index = nodes_.size();
+  nodes_.emplace_back();
+  float32 total = 0.0f;
+  if (source_node) {
+    for (uint32 i = 0; i < 4; i++) {
+      total += source.nodes_[source_node].sums[i].load(
+          ::std::memory_order_relaxed);
+    }
+  }
+
+  for (uint32 i = 0; i < 4; i++) {
+    // Radiance within a source leaf is assumed to be uniform.
+    float32 child_fraction = fraction * 0.25f;
+    uint32 child_source = 0;
+    if (source_node && total > 0.0f) {
+      child_fraction = fraction *
+                       source.nodes_[source_node].sums[i].load(
+                           ::std::memory_order_relaxed) /
+                       total;
+      child_source = source.nodes_[source_node].children[i];
+    }
+    // Appending may reallocate nodes_, so the child index is stored
+    // through index rather than a reference.
+    uint32 child = RefineQuadrant(source, child_source, child_fraction,
+                                  threshold, depth + 1);
+    nodes_[index].children[i] = child;
+  }
+  return index;
+}
+
+PathGuide::PathGuide() : iteration_(0), pass_count_(0) {}
+
+void PathGuide::Reset(const bounds& scene_bounds) {
+  // Use a slightly enlarged cube so that regions keep a reasonable aspect
+  // ratio as they are split along alternating axes.
+  vector3 center = (scene_bounds.bounds_min + scene_bounds.bounds_max) * 0.5f;
+  vector3 extent = scene_bounds.bounds_max - scene_bounds.bounds_min;
+  float32 half_size =
+      max(max(extent.x, extent.y), max(extent.z, 1.0e-3f)) * 0.505f;
+  bounds_.clear();
+  bounds_.set_min(center - vector3(half_size, half_size, half_size));
+  bounds_.set_max(center + vector3(half_size, half_size, half_size));
+
+  SpatialNode root;
+  root.children[0] = root.children[1] = 0;
+  root.axis = 0;
+  root.region = 0;
+  nodes_.clear();
+  nodes_.push_back(root);
+  regions_.clear();
+  regions_.emplace_back(new GuideRegion());
+  iteration_ = 0;
+  pass_count_ = 0;
+}
+
+GuideRegion* PathGuide::FindRegion(const vector3& position) {
+  vector3 lower = bounds_.bounds_min;
+  vector3 upper = bounds_.bounds_max;
+  uint32 node = 0;
+  while (nodes_[node].children[0]) {
+    uint32 axis = nodes_[node].axis;
+    float32 middle = (lower[axis] + upper[axis]) * 0.5f;
+    if (position[axis] < middle) {
+      upper[axis] = middle;
+      node = nodes_[node].children[0];
+    } else {
+      lower[axis] = middle;
+      node = nodes_[node].children[1];
+    }
+  }
+  return regions_[nodes_[node].region].get();
+}
+
+void PathGuide::EndPass() {
+  if (!IsValid()) {
+    return;
+  }
+  pass_count_++;
+  if (pass_count_ >= (1u << min(iteration_, 30u))) {
+    Refine();
+  }
+}
+
+void PathGuide::Refine() {
+  uint32 threshold = kSpatialSplitSamples * sqrtf(float32(1u << iteration_));
+  uint32 node_count = nodes_.size();
+  for (uint32 i = 0; i < node_count; i++) {
+    if (!nodes_[i].children[0]) {
+      uint32 sample_count = regions_[nodes_[i].region]->sample_count.load();
+      SplitNode(i, sample_count, threshold, 0);
+    }
+  }
+
+  uint32 directional_node_count = 0;
+  for (auto& region : regions_) {
+    region->sampling_tree = region->building_tree;
+    region->building_tree.Refine(region->sampling_tree,
+                                 kDirectionalSplitThreshold);
+    region->sample_count = 0;
+    directional_node_count += region->building_tree.GetNodeCount();
+  }
+
+  iteration_++;
+  pass_count_ = 0;
+  printf("Path guide iteration %u: %u regions, %u directional nodes.\n",
+         iteration_, uint32(regions_.size()), directional_node_count);
+}
+
+void PathGuide::SplitNode(uint32 node_index, uint32 sample_count,
+                          uint32 threshold, uint32 depth) {
+  if (sample_count <= threshold || depth >= kMaxSpatialDepth) {
+    return;
+  }
+
+  // The first child keeps the region of the parent while the second starts
+  // from a copy, so both begin with everything learned so far.
+  const GuideRegion& parent = *regions_[nodes_[node_index].region];
+  GuideRegion* region = new GuideRegion();
+  region->sampling_tree = parent.sampling_tree;
+  region->building_tree = parent.building_tree;
+  regions_.emplace_back(region);
+
+  uint32 child_axis = (nodes_[node_index].axis + 1) % 3;
+  SpatialNode child;
+  child.children[0] = child.children[1] = 0;
+  child.axis = child_axis;
+  child.region = nodes_[node_index].region;
+  nodes_.push_back(child);
+  child.region = regions_.size() - 1;
+  nodes_.push_back(child);
+  nodes_[node_index].children[0] = nodes_.size() - 2;
+  nodes_[node_index].children[1] = nodes_.size() - 1;
+
+  // Samples are assumed to divide evenly between the children.
+  uint32 first = nodes_[node_index].children[0];
+  uint32 second = nodes_[node_index].children[1];
+  SplitNode(first, sample_count / 2, threshold, depth + 1);
+  SplitNode(second, sample_count / 2, threshold, depth + 1);
+}
+
+}  // namespace base
@@ -0,0 +1,163 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __PATH_GUIDE_H__
+#define __PATH_GUIDE_H__
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "math/base.h"
+#include "math/vector3.h"
+#include "math/volume.h"
+
+namespace base {
+
+// Probability that a guided vertex samples its indirect direction from the
+// guide rather than from its BSDF.
+const float32 kGuideSamplingFraction = 0.5f;
+
+// Quadtree over the sphere of directions, holding the radiance that arrives
+// at a region of the scene. Directions are mapped to the unit square by
+// cylindrical coordinates (cos theta about the y axis, and phi), which
+// preserve area, so the tree's density converts to solid angle density by
+// a constant.
+class DirectionalTree {
+ public:
+  DirectionalTree();
+  DirectionalTree(const DirectionalTree& other);
+  DirectionalTree& operator=(const DirectionalTree& other);
+  // Adds a radiance estimate for direction. Thread safe.
+  void Record(const vector3& direction, float32 radiance);
+  // Returns the total radiance recorded.
+  float32 GetTotal() const;
+  // Returns the number of nodes in the tree.
+  uint32 GetNodeCount() const { return nodes_.size(); }
+  // Samples a direction in proportion to the recorded radiance using
+  // (u0, u1) in [0, 1). The tree must have a non-zero total.
+  vector3 Sample(float32 u0, float32 u1) const;
+  // Returns the solid angle density with which Sample produces direction.
+  float32 Pdf(const vector3& direction) const;
+  // Rebuilds this tree with the recorded radiance cleared, splitting the
+  // quadrants of source that hold more than threshold of its total and
+  // merging the rest. Trees without radiance keep their structure.
+  void Refine(const DirectionalTree& source, float32 threshold);
+
+ private:
+  typedef struct DirectionalNode {
+    // Radiance recorded in each quadrant.
+    ::std::atomic<float32> sums[4];
+    // Index of the node that subdivides each quadrant, or 0 if the quadrant
+    // is a leaf. The root is never a child.
+    uint32 children[4];
+    DirectionalNode();
+    DirectionalNode(const DirectionalNode& other);
+    DirectionalNode& operator=(const DirectionalNode& other);
+  } DirectionalNode;
+
+  // Appends the refined copy of a source quadrant with the given fraction
+  // of the total radiance. source_node is 0 if the quadrant is a leaf.
+  // Returns the index of the new node, or 0 to leave the quadrant a leaf.
+  uint32 RefineQuadrant(const DirectionalTree& source, uint32 source_node,
+                        float32 fraction, float32 threshold, uint32 depth);
+  ::std::vector<DirectionalNode> nodes_;
+};
+
+// A leaf of the spatial tree. Sampling uses the radiance learned in the
+// previous iteration, while the current iteration records into a separate
+// tree.
+typedef struct GuideRegion {
+  DirectionalTree sampling_tree;
+  DirectionalTree building_tree;
+  ::std::atomic<uint32> sample_count;
+  GuideRegion() : sample_count(0) {}
+  // Returns true if sampling_tree can be sampled.
+  bool CanSample() const { return sampling_tree.GetTotal() > 0.0f; }
+  // Adds a radiance estimate for direction. Thread safe.
+  void Record(const vector3& direction, float32 radiance) {
+    building_tree.Record(direction, radiance);
+    sample_count++;
+  }
+} GuideRegion;
+
+// Spatial-directional estimate of incident radiance, learned online from
+// path contributions and used to importance sample indirect directions
+// (practical path guiding, Muller et al. 2017). Space is split by a binary
+// tree whose leaves each hold a directional quadtree.
+//
+// Training proceeds in iterations that each double the number of passes of
+// the previous one. When an iteration ends, the recorded trees become the
+// sampling trees of the next, regions that received many samples are split,
+// and each directional tree is refined toward where radiance was found.
+class PathGuide {
+ public:
+  PathGuide();
+  // Discards all learned radiance and restarts training over scene_bounds.
+  void Reset(const bounds& scene_bounds);
+  // Returns true once Reset has been called.
+  bool IsValid() const { return nodes_.size() > 0; }
+  // Returns the region holding position. Positions outside of the bounds
+  // map to the nearest region. Regions stay valid until the next EndPass.
+  GuideRegion* FindRegion(const vector3& position);
+  // Ends a rendering pass. Must not be called while tracing. Refines the
+  // guide when the passes of the current iteration are complete.
+  void EndPass();
+  // Returns the number of completed training iterations.
+  uint32 GetIteration() const { return iteration_; }
+
+ private:
+  typedef struct SpatialNode {
+    // Child indices, both 0 for leaves.
+    uint32 children[2];
+    // Split axis of interior nodes.
+    uint32 axis;
+    // Index of the region of a leaf.
+    uint32 region;
+  } SpatialNode;
+
+  // Ends the current iteration.
+  void Refine();
+  // Splits the leaf at node_index until its share of sample_count falls
+  // below threshold.
+  void SplitNode(uint32 node_index, uint32 sample_count, uint32 threshold,
+                 uint32 depth);
+  bounds bounds_;
+  ::std::vector<SpatialNode> nodes_;
+  ::std::vector<::std::unique_ptr<GuideRegion>> regions_;
+  uint32 iteration_;
+  // Passes rendered in the current iteration.
+  uint32 pass_count_;
+};
+
+}  // namespace base
+
+#endif  // __PATH_GUIDE_H__
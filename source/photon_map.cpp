@@ -0,0 +1,331 @@
+
+#include "photon_map.h"
+#include <math.h>
+#include <algorithm>
+#include <thread>
+#include "math/normal.h"
+#include "math/random.h"
+
+namespace base {
+
+// Rate at which the gather radius shrinks. Lower values shrink it faster,
+// trading noise for bias.
+const float32 kPhotonRadiusAlpha = 2.0f / 3.0f;
+// Initial gather radius relative to the bounding radius of the smallest
+// caster.
+const float32 kPhotonRadiusScale = 0.03f;
+const uint32 kMaxPhotonDepth = 8;
+const float32 kPhotonTraceOffset = 0.03f;
+
+namespace {
+
+// Returns the density of uniformly sampling direction from the cone that
+// origin sees a sphere in, or from all directions if origin is inside it.
+float32 SphereConePdf(const vector3& origin, const vector3& center,
+                      float32 radius, const vector3& direction) {
+  vector3 to_center = center - origin;
+  float32 center_distance2 = to_center.dot(to_center);
+  if (center_distance2 <= radius * radius) {
+    return uniform_sphere_pdf();
+  }
+  float32 sin2_theta_max = radius * radius / center_distance2;
+  float32 cos_theta_max = sqrtf(max(0.0f, 1.0f - sin2_theta_max));
+  if (direction.dot(to_center) < cos_theta_max * sqrtf(center_distance2)) {
+    return 0.0f;
+  }
+  return 1.0f / (BASE_2PI * sin2_theta_max / (1.0f + cos_theta_max));
+}
+
+}  // namespace
+
+PhotonMap::PhotonMap(uint32 photons_per_pass)
+    : photons_per_pass_(photons_per_pass),
+      emitted_count_(0),
+      pass_count_(0),
+      radius2_(0.0f),
+      trace_distance_(0.0f),
+      cell_size_(1.0f),
+      cell_mask_(0) {}
+
+void PhotonMap::Reset(Scene* scene) {
+  photons_.clear();
+  cell_starts_.clear();
+  casters_.clear();
+  lights_.clear();
+  light_cdf_.clear();
+  emitted_count_ = 0;
+  pass_count_ = 0;
+
+  float32 min_radius = BASE_INFINITY;
+  for (uint32 i = 0; i < scene->GetObjectCount(); i++) {
+    Object* object = scene->GetSceneObject(i);
+    if (!object->GetMaterial() ||
+        !ShadeIsCausticCaster(scene->GetMaterialParams(object->GetMaterial()))) {
+      continue;
+    }
+    bounds aabb = object->GetBounds();
+    PhotonCaster caster;
+    caster.center = (aabb.bounds_min + aabb.bounds_max) * 0.5f;
+    caster.radius = (aabb.bounds_max - aabb.bounds_min).length() * 0.5f;
+    if (caster.radius > 0.0f) {
+      casters_.push_back(caster);
+      min_radius = min(min_radius, caster.radius);
+    }
+  }
+
+  float32 total_power = 0.0f;
+  for (uint32 i = 0; i < scene->GetLightCount(); i++) {
+    Object* light = scene->GetLight(i);
+    const MaterialParams& params =
+        scene->GetMaterialParams(light->GetMaterial());
+    float32 power = ShadeLuminance(params.emissive) * light->GetSurfaceArea();
+    if (power <= 0.0f) {
+      continue;
+    }
+    total_power += power;
+    lights_.push_back(light);
+    light_cdf_.push_back(total_power);
+  }
+
+  bounds scene_bounds = scene->GetBounds();
+  trace_distance_ =
+      (scene_bounds.bounds_max - scene_bounds.bounds_min).length() * 2.0f +
+      1.0f;
+  float32 radius = casters_.empty() ? 1.0f : min_radius * kPhotonRadiusScale;
+  radius2_ = radius * radius;
+}
+
+void PhotonMap::TracePass(Scene* scene) {
+  if (!IsValid()) {
+    return;
+  }
+  if (pass_count_) {
+    radius2_ *= (pass_count_ + kPhotonRadiusAlpha) / (pass_count_ + 1);
+  }
+  pass_count_++;
+
+  uint32 thread_count = max(::std::thread::hardware_concurrency(), 1u);
+  ::std::vector<::std::vector<Photon>> thread_photons(thread_count);
+  ::std::vector<::std::thread> thread_list;
+  for (uint32 i = 0; i < thread_count; i++) {
+    uint32 photon_count = photons_per_pass_ / thread_count;
+    if (i == thread_count - 1) {
+      photon_count = photons_per_pass_ - photon_count * (thread_count - 1);
+    }
+    uint64 seed = (uint64(pass_count_) << 32) + i + 1;
+    thread_list.emplace_back(&PhotonMap::TracePhotons, this, scene,
+                             photon_count, seed, &thread_photons[i]);
+  }
+  for (auto& thread_ : thread_list) {
+    thread_.join();
+  }
+
+  photons_.clear();
+  for (auto& photons : thread_photons) {
+    photons_.insert(photons_.end(), photons.begin(), photons.end());
+  }
+  emitted_count_ = photons_per_pass_;
+  BuildGrid();
+}
+
+void PhotonMap::TracePhotons(Scene* scene, uint32 photon_count, uint64 seed,
+                             ::std::vector<Photon>* photons) const {
+  set_seed(seed);
+  float32 total_power = light_cdf_.back();
+  for (uint32 i = 0; i < photon_count; i++) {
+    // Select an emitter in proportion to its power.
+    float32 target = random_float() * total_power;
+    uint32 light_index =
+        ::std::upper_bound(light_cdf_.begin(), light_cdf_.end(), target) -
+        light_cdf_.begin();
+    light_index = min(light_index, uint32(lights_.size() - 1));
+    float32 light_pmf =
+        (light_cdf_[light_index] -
+         (light_index ? light_cdf_[light_index - 1] : 0.0f)) /
+        total_power;
+    Object* light = lights_[light_index];
+
+    vector3 point, normal, direction;
+    float32 direction_pdf = 0.0f;
+    if (!light->SampleSurface(random_float(), random_float(), &point,
+                              &normal) ||
+        !SampleCasterDirection(point, random_float(), random_float(),
+                               random_float(), &direction, &direction_pdf)) {
+      continue;
+    }
+
+    // Emitters are two sided. Photons sent into a closed emitter strike it
+    // and are lost, which leaves the flux of its outer side.
+    float32 cos_theta = fabs(normal.dot(direction));
+    const MaterialParams& light_params =
+        scene->GetMaterialParams(light->GetMaterial());
+    vector3 power = light_params.emissive *
+                    (cos_theta * light->GetSurfaceArea() /
+                     (light_pmf * direction_pdf));
+
+    uint32 caster_count = 0;
+    for (uint32 depth = 0; depth < kMaxPhotonDepth; depth++) {
+      ray trajectory(point + direction * kPhotonTraceOffset,
+                     point + direction * trace_distance_);
+      ObjectCollision hit_info;
+      hit_info.skip_media = true;
+      if (!scene->Trace(trajectory, &hit_info)) {
+        break;
+      }
+      const MaterialParams& material =
+          scene->GetMaterialParams(hit_info.surface_material);
+      if (ShadeIsCausticCaster(material)) {
+        // Camera paths refract by the same index in both directions and
+        // keep their radiance, so photons retrace them by refracting with
+        // the inverse index, scaling their power by the change in solid
+        // angle.
+        MaterialParams reverse_material = material;
+        if (reverse_material.index > 0.0f) {
+          reverse_material.index = 1.0f / reverse_material.index;
+        }
+        direction = ShadeReflection(reverse_material, direction,
+                                    hit_info.surface_normal);
+        if (direction.dot(direction) <= 0.0f) {
+          break;
+        }
+        direction = direction.normalize();
+        power = power * material.diffuse;
+        if (direction.dot(hit_info.surface_normal) < 0.0f) {
+          power *= reverse_material.index * reverse_material.index;
+        }
+        point = hit_info.point;
+        caster_count++;
+        continue;
+      }
+      // Only photons that passed through a caster form caustics. Light
+      // arriving directly is left to the path tracer.
+      if (caster_count && ShadeCanEvaluate(material) &&
+          material.type != kMaterialTypeMedium) {
+        Photon photon;
+        photon.position = hit_info.point;
+        photon.direction = direction;
+        photon.power = power;
+        photons->push_back(photon);
+      }
+      break;
+    }
+  }
+}
+
+bool PhotonMap::SampleCasterDirection(const vector3& origin, float32 u0,
+                                      float32 u1, float32 u2,
+                                      vector3* direction,
+                                      float32* pdf) const {
+  uint32 caster_count = casters_.size();
+  const PhotonCaster& caster =
+      casters_[min(uint32(u0 * caster_count), caster_count - 1)];
+  vector3 to_center = caster.center - origin;
+  float32 center_distance2 = to_center.dot(to_center);
+  if (center_distance2 <= caster.radius * caster.radius) {
+    *direction = sample_uniform_sphere(u1, u2);
+  } else {
+    float32 center_distance = sqrtf(center_distance2);
+    float32 sin2_theta_max = caster.radius * caster.radius / center_distance2;
+    float32 cos_theta_max = sqrtf(max(0.0f, 1.0f - sin2_theta_max));
+    float32 cone_height = sin2_theta_max / (1.0f + cos_theta_max);
+    *direction = spherical_direction(to_center / center_distance,
+                                     1.0f - u1 * cone_height, BASE_2PI * u2);
+  }
+
+  // Cones of several casters may overlap, so the density of the direction
+  // sums over all of them.
+  *pdf = 0.0f;
+  for (const PhotonCaster& other : casters_) {
+    *pdf += SphereConePdf(origin, other.center, other.radius, *direction);
+  }
+  *pdf /= caster_count;
+  return *pdf > 0.0f;
+}
+
+uint32 PhotonMap::HashCell(int32 x, int32 y, int32 z) const {
+  return ((uint32(x) * 73856093u) ^ (uint32(y) * 19349663u) ^
+          (uint32(z) * 83492791u)) &
+         cell_mask_;
+}
+
+void PhotonMap::BuildGrid() {
+  // A cell spans the gather diameter, so every gather touches at most two
+  // cells along each axis.
+  cell_size_ = 2.0f * sqrtf(radius2_);
+  float32 inverse_size = 1.0f / cell_size_;
+  uint32 table_size = 1;
+  while (table_size < photons_.size()) {
+    table_size <<= 1;
+  }
+  cell_mask_ = table_size - 1;
+
+  ::std::vector<uint32> photon_cells(photons_.size());
+  cell_starts_.assign(table_size + 1, 0);
+  for (uint32 i = 0; i < photons_.size(); i++) {
+    const vector3& position = photons_[i].position;
+    photon_cells[i] = HashCell(int32(floorf(position.x * inverse_size)),
+                               int32(floorf(position.y * inverse_size)),
+                               int32(floorf(position.z * inverse_size)));
+    cell_starts_[photon_cells[i] + 1]++;
+  }
+  for (uint32 i = 0; i < table_size; i++) {
+    cell_starts_[i + 1] += cell_starts_[i];
+  }
+
+  ::std::vector<uint32> cell_offsets(cell_starts_.begin(),
+                                     cell_starts_.end() - 1);
+  ::std::vector<Photon> sorted_photons(photons_.size());
+  for (uint32 i = 0; i < photons_.size(); i++) {
+    sorted_photons[cell_offsets[photon_cells[i]]++] = photons_[i];
+  }
+  photons_.swap(sorted_photons);
+}
+
+vector3 PhotonMap::Gather(const MaterialParams& material,
+                          const ShadingContext& context) const {
+  vector3 output;
+  if (photons_.empty()) {
+    return output;
+  }
+
+  float32 inverse_size = 1.0f / cell_size_;
+  const vector3& position = context.sample_pos;
+  int32 base_x = int32(floorf(position.x * inverse_size - 0.5f));
+  int32 base_y = int32(floorf(position.y * inverse_size - 0.5f));
+  int32 base_z = int32(floorf(position.z * inverse_size - 0.5f));
+
+  // Distinct cells may share a table entry, which must be visited once.
+  uint32 visited[8];
+  uint32 visited_count = 0;
+  for (uint32 i = 0; i < 8; i++) {
+    uint32 cell = HashCell(base_x + (i & 1), base_y + ((i >> 1) & 1),
+                           base_z + ((i >> 2) & 1));
+    if (::std::find(visited, visited + visited_count, cell) !=
+        visited + visited_count) {
+      continue;
+    }
+    visited[visited_count++] = cell;
+
+    for (uint32 j = cell_starts_[cell]; j < cell_starts_[cell + 1]; j++) {
+      const Photon& photon = photons_[j];
+      vector3 offset = photon.position - position;
+      if (offset.dot(offset) > radius2_) {
+        continue;
+      }
+      vector3 light_dir = photon.direction * -1.0f;
+      float32 cos_theta = context.surface_normal.dot(light_dir);
+      if (cos_theta <= 0.0f) {
+        continue;
+      }
+      // ShadeEvaluate includes the cosine term, which the photon density
+      // already accounts for.
+      output += ShadeEvaluate(material, context.view_dir,
+                              context.surface_normal, light_dir,
+                              context.surface_texcoords) *
+                photon.power / cos_theta;
+    }
+  }
+  return output / (BASE_PI * radius2_ * emitted_count_);
+}
+
+}  // namespace base
@@ -0,0 +1,120 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __PHOTON_MAP_H__
+#define __PHOTON_MAP_H__
+
+#include <vector>
+#include "math/base.h"
+#include "math/vector3.h"
+#include "object.h"
+#include "scene.h"
+#include "shading.h"
+
+namespace base {
+
+// Progressive caustic photon map. Each pass traces photons from the scene
+// emitters through glass, liquid and mirror objects (the caustic casters)
+// and stores them where they land on a diffuse surface. Path vertices then
+// gather the photons within a radius that shrinks from pass to pass, so the
+// average of the passes converges (probabilistic progressive photon
+// mapping, Knaus and Zwicker 2011).
+//
+// Photons are aimed at the bounding spheres of the casters, since only
+// photons that reach a caster contribute to caustics.
+class PhotonMap {
+ public:
+  explicit PhotonMap(uint32 photons_per_pass = 200000);
+  // Collects the emitters and casters of scene and restarts the radius
+  // sequence. Must be called again whenever the scene changes.
+  void Reset(Scene* scene);
+  // Returns true if the scene has both emitters and casters.
+  bool IsValid() const { return !casters_.empty() && !light_cdf_.empty(); }
+  // Traces the photons of a new pass over several threads, replacing those
+  // of the previous pass. Must not be called while tracing.
+  void TracePass(Scene* scene);
+  // Returns the caustic radiance leaving the shading point of context
+  // toward its viewer.
+  vector3 Gather(const MaterialParams& material,
+                 const ShadingContext& context) const;
+  // Returns the number of photons stored by the last pass.
+  uint32 GetPhotonCount() const { return photons_.size(); }
+
+ private:
+  typedef struct Photon {
+    vector3 position;
+    // Direction of travel when the photon landed.
+    vector3 direction;
+    vector3 power;
+  } Photon;
+
+  typedef struct PhotonCaster {
+    vector3 center;
+    float32 radius;
+  } PhotonCaster;
+
+  // Traces photon_count photons into photons, seeding the random number
+  // generator of the calling thread with seed.
+  void TracePhotons(Scene* scene, uint32 photon_count, uint64 seed,
+                    ::std::vector<Photon>* photons) const;
+  // Samples a direction from origin toward one of the casters, returning
+  // the solid angle density of the choice over all casters.
+  bool SampleCasterDirection(const vector3& origin, float32 u0, float32 u1,
+                             float32 u2, vector3* direction,
+                             float32* pdf) const;
+  // Sorts photons_ by grid cell and rebuilds cell_starts_.
+  void BuildGrid();
+  // Returns the table index of the grid cell at integer coordinates.
+  uint32 HashCell(int32 x, int32 y, int32 z) const;
+
+  uint32 photons_per_pass_;
+  // Photons emitted by the last pass, including those that were lost.
+  uint32 emitted_count_;
+  uint32 pass_count_;
+  float32 radius2_;
+  // Length of the photon rays, covering the scene bounds.
+  float32 trace_distance_;
+  ::std::vector<PhotonCaster> casters_;
+  // Emitters and the cumulative distribution of their power.
+  ::std::vector<Object*> lights_;
+  ::std::vector<float32> light_cdf_;
+  // Photons grouped by grid cell. The photons of table entry i are
+  // photons_[cell_starts_[i]] to photons_[cell_starts_[i + 1] - 1].
+  ::std::vector<Photon> photons_;
+  ::std::vector<uint32> cell_starts_;
+  float32 cell_size_;
+  uint32 cell_mask_;
+};
+
+}  // namespace base
+
+#endif  // __PHOTON_MAP_H__
@@ -0,0 +1,580 @@
+
+#include "ply_loader.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace base {
+
+namespace {
+
+// Index stored for faces of meshes without normals or texcoords.
+const uint32 kInvalidPlyIndex = 0xFFFFFFFF;
+
+typedef enum PlyType {
+  kPlyTypeInvalid = 0,
+  kPlyTypeInt8,
+  kPlyTypeUint8,
+  kPlyTypeInt16,
+  kPlyTypeUint16,
+  kPlyTypeInt32,
+  kPlyTypeUint32,
+  kPlyTypeFloat32,
+  kPlyTypeFloat64,
+} PlyType;
+
+typedef struct PlyProperty {
+  ::std::string name;
+  PlyType type;
+  // Type of the element count for list properties, or kPlyTypeInvalid for
+  // scalar properties.
+  PlyType count_type;
+  // Byte offset of the property within a record, for fixed size records.
+  uint32 offset;
+} PlyProperty;
+
+typedef struct PlyElement {
+  ::std::string name;
+  uint64 count;
+  ::std::vector<PlyProperty> properties;
+  // Size of each record in bytes, or zero if the records contain lists.
+  uint32 stride;
+  // First record of the element within the mapped file.
+  const char* records;
+} PlyElement;
+
+typedef struct PlyHeader {
+  // True if the file byte order differs from the host byte order.
+  bool swap_bytes;
+  ::std::vector<PlyElement> elements;
+  // Offset of the first record, just past the end_header line.
+  uint64 data_offset;
+} PlyHeader;
+
+uint32 GetPlyTypeSize(PlyType type) {
+  switch (type) {
+    case kPlyTypeInt8:
+    case kPlyTypeUint8:
+      return 1;
+    case kPlyTypeInt16:
+    case kPlyTypeUint16:
+      return 2;
+    case kPlyTypeInt32:
+    case kPlyTypeUint32:
+    case kPlyTypeFloat32:
+      return 4;
+    case kPlyTypeFloat64:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+PlyType ParsePlyType(::std::string_view name) {
+  if (name == "char" || name == "int8") return kPlyTypeInt8;
+  if (name == "uchar" || name == "uint8") return kPlyTypeUint8;
+  if (name == "short" || name == "int16") return kPlyTypeInt16;
+  if (name == "ushort" || name == "uint16") return kPlyTypeUint16;
+  if (name == "int" || name == "int32") return kPlyTypeInt32;
+  if (name == "uint" || name == "uint32") return kPlyTypeUint32;
+  if (name == "float" || name == "float32") return kPlyTypeFloat32;
+  if (name == "double" || name == "float64") return kPlyTypeFloat64;
+  return kPlyTypeInvalid;
+}
+
+bool IsHostLittleEndian() {
+  uint16 probe = 1;
+  uint8 first_byte = 0;
+  memcpy(&first_byte, &probe, 1);
+  return first_byte == 1;
+}
+
+// Reads a value of the given type, converting it from the file byte order.
+float64 ReadPlyValue(const char* data, PlyType type, bool swap_bytes) {
+  uint8 bytes[8];
+  uint32 size = GetPlyTypeSize(type);
+  memcpy(bytes, data, size);
+  if (swap_bytes) {
+    ::std::reverse(bytes, bytes + size);
+  }
+
+  switch (type) {
+    case kPlyTypeInt8: {
+      int8 value;
+      memcpy(&value, bytes, sizeof(value));
+      return value;
+    }
+    case kPlyTypeUint8:
+      return bytes[0];
+    case kPlyTypeInt16: {
+      int16 value;
+      memcpy(&value, bytes, sizeof(value));
+      return value;
+    }
+    case kPlyTypeUint16: {
+      uint16 value;
+      memcpy(&value, bytes, sizeof(value));
+      return value;
+    }
+    case kPlyTypeInt32: {
+      int32 value;
+      memcpy(&value, bytes, sizeof(value));
+      return value;
+    }
+    case kPlyTypeUint32: {
+      uint32 value;
+      memcpy(&value, bytes, sizeof(value));
+      return value;
+    }
+    case kPlyTypeFloat32: {
+      float32 value;
+      memcpy(&value, bytes, sizeof(value));
+      return value;
+    }
+    case kPlyTypeFloat64: {
+      float64 value;
+      memcpy(&value, bytes, sizeof(value));
+      return value;
+    }
+    default:
+      return 0;
+  }
+}
+
+float32 ReadPlyFloat(const char* data, PlyType type, bool swap_bytes) {
+  if (type == kPlyTypeFloat32 && !swap_bytes) {
+    float32 value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+  }
+  return (float32)ReadPlyValue(data, type, swap_bytes);
+}
+
+// Splits a header line into whitespace separated words.
+void SplitPlyLine(::std::string_view line,
+                  ::std::vector<::std::string_view>* words) {
+  words->clear();
+  uint64 start = 0;
+  while (start < line.size()) {
+    while (start < line.size() && (line[start] == ' ' || line[start] == '\t' ||
+                                   line[start] == '\r')) {
+      start++;
+    }
+    uint64 stop = start;
+    while (stop < line.size() && line[stop] != ' ' && line[stop] != '\t' &&
+           line[stop] != '\r') {
+      stop++;
+    }
+    if (stop > start) {
+      words->push_back(line.substr(start, stop - start));
+    }
+    start = stop;
+  }
+}
+
+bool ParsePlyHeader(const char* data, uint64 size, PlyHeader* header) {
+  ::std::string_view text(data, size);
+  ::std::vector<::std::string_view> words;
+  bool has_format = false;
+  uint64 line_start = 0;
+
+  for (uint32 line_index = 0;; line_index++) {
+    uint64 line_end = text.find('\n', line_start);
+    if (line_end == ::std::string_view::npos) {
+      return false;
+    }
+    SplitPlyLine(text.substr(line_start, line_end - line_start), &words);
+    line_start = line_end + 1;
+
+    if (line_index == 0) {
+      if (words.size() != 1 || words[0] != "ply") {
+        return false;
+      }
+      continue;
+    }
+    if (words.empty() || words[0] == "comment" || words[0] == "obj_info") {
+      continue;
+    }
+
+    if (words[0] == "format" && words.size() >= 2) {
+      // Ascii files are not supported.
+      if (words[1] == "binary_little_endian") {
+        header->swap_bytes = !IsHostLittleEndian();
+      } else if (words[1] == "binary_big_endian") {
+        header->swap_bytes = IsHostLittleEndian();
+      } else {
+        return false;
+      }
+      has_format = true;
+    } else if (words[0] == "element" && words.size() == 3) {
+      PlyElement element;
+      element.name = ::std::string(words[1]);
+      auto result = ::std::from_chars(
+          words[2].data(), words[2].data() + words[2].size(), element.count);
+      if (result.ec != ::std::errc()) {
+        return false;
+      }
+      element.stride = 0;
+      element.records = nullptr;
+      header->elements.push_back(element);
+    } else if (words[0] == "property" && !header->elements.empty()) {
+      PlyProperty property;
+      property.offset = 0;
+      if (words.size() == 5 && words[1] == "list") {
+        property.count_type = ParsePlyType(words[2]);
+        property.type = ParsePlyType(words[3]);
+        property.name = ::std::string(words[4]);
+        if (property.count_type == kPlyTypeInvalid) {
+          return false;
+        }
+      } else if (words.size() == 3) {
+        property.count_type = kPlyTypeInvalid;
+        property.type = ParsePlyType(words[1]);
+        property.name = ::std::string(words[2]);
+      } else {
+        return false;
+      }
+      if (property.type == kPlyTypeInvalid) {
+        return false;
+      }
+      header->elements.back().properties.push_back(property);
+    } else if (words[0] == "end_header") {
+      header->data_offset = line_start;
+      break;
+    } else {
+      return false;
+    }
+  }
+
+  // Records without lists have a fixed layout.
+  for (auto& element : header->elements) {
+    uint32 offset = 0;
+    for (auto& property : element.properties) {
+      if (property.count_type != kPlyTypeInvalid) {
+        offset = 0;
+        break;
+      }
+      property.offset = offset;
+      offset += GetPlyTypeSize(property.type);
+    }
+    element.stride = offset;
+  }
+  return has_format;
+}
+
+// Moves cursor past every record of an element, recording where the
+// records begin. Returns false if the file ends first.
+bool SkipPlyElement(bool swap_bytes, const char* end, const char** cursor,
+                    PlyElement* element) {
+  element->records = *cursor;
+  if (element->stride) {
+    if (element->count > (uint64)(end - *cursor) / element->stride) {
+      return false;
+    }
+    *cursor += element->count * element->stride;
+    return true;
+  }
+
+  for (uint64 i = 0; i < element->count; i++) {
+    for (auto& property : element->properties) {
+      uint64 value_count = 1;
+      if (property.count_type != kPlyTypeInvalid) {
+        uint32 count_size = GetPlyTypeSize(property.count_type);
+        if ((uint64)(end - *cursor) < count_size) {
+          return false;
+        }
+        value_count =
+            (uint64)ReadPlyValue(*cursor, property.count_type, swap_bytes);
+        *cursor += count_size;
+      }
+      uint64 value_size = value_count * GetPlyTypeSize(property.type);
+      if ((uint64)(end - *cursor) < value_size) {
+        return false;
+      }
+      *cursor += value_size;
+    }
+  }
+  return true;
+}
+
+// Returns the named property of an element, or nullptr if it is absent.
+const PlyProperty* FindPlyProperty(const PlyElement& element,
+                                   const char* name,
+                                   const char* alternate_name = nullptr) {
+  for (auto& property : element.properties) {
+    if (property.name == name ||
+        (alternate_name && property.name == alternate_name)) {
+      return &property;
+    }
+  }
+  return nullptr;
+}
+
+bool ReadPlyVertices(const PlyElement& element, bool swap_bytes,
+                     const matrix4& transform, bool invert_normals,
+                     const vector3** vertex_data,
+                     ::std::vector<vector3>* vertices,
+                     ::std::vector<vector3>* normals,
+                     ::std::vector<vector2>* texcoords) {
+  const PlyProperty* position[3] = {FindPlyProperty(element, "x"),
+                                    FindPlyProperty(element, "y"),
+                                    FindPlyProperty(element, "z")};
+  const PlyProperty* normal[3] = {FindPlyProperty(element, "nx"),
+                                  FindPlyProperty(element, "ny"),
+                                  FindPlyProperty(element, "nz")};
+  const PlyProperty* texcoord[2] = {FindPlyProperty(element, "u", "s"),
+                                    FindPlyProperty(element, "v", "t")};
+  if (!element.stride || !position[0] || !position[1] || !position[2]) {
+    return false;
+  }
+  bool has_normals = normal[0] && normal[1] && normal[2];
+  bool has_texcoords = texcoord[0] && texcoord[1];
+
+  matrix4 identity;
+  identity.identity();
+  bool is_packed = element.stride == sizeof(vector3) &&
+                   position[0]->offset == 0 && position[1]->offset == 4 &&
+                   position[2]->offset == 8 &&
+                   position[0]->type == kPlyTypeFloat32 &&
+                   position[1]->type == kPlyTypeFloat32 &&
+                   position[2]->type == kPlyTypeFloat32;
+  if (is_packed && !swap_bytes && transform == identity &&
+      (uintptr_t)element.records % alignof(vector3) == 0) {
+    *vertex_data = reinterpret_cast<const vector3*>(element.records);
+    return true;
+  }
+
+  vertices->resize(element.count);
+  if (has_normals) {
+    normals->resize(element.count);
+  }
+  if (has_texcoords) {
+    texcoords->resize(element.count);
+  }
+
+  const char* record = element.records;
+  for (uint64 i = 0; i < element.count; i++, record += element.stride) {
+    vector3 vertex;
+    for (uint32 j = 0; j < 3; j++) {
+      vertex[j] = ReadPlyFloat(record + position[j]->offset, position[j]->type,
+                               swap_bytes);
+    }
+    (*vertices)[i] = vector3(transform * vertex);
+
+    if (has_normals) {
+      vector3 vertex_normal;
+      for (uint32 j = 0; j < 3; j++) {
+        vertex_normal[j] = ReadPlyFloat(record + normal[j]->offset,
+                                        normal[j]->type, swap_bytes);
+      }
+      vertex_normal = vertex_normal.normalize();
+      if (invert_normals) {
+        vertex_normal *= -1.0;
+      }
+      (*normals)[i] = vertex_normal;
+    }
+
+    if (has_texcoords) {
+      (*texcoords)[i] = vector2(
+          ReadPlyFloat(record + texcoord[0]->offset, texcoord[0]->type,
+                       swap_bytes),
+          ReadPlyFloat(record + texcoord[1]->offset, texcoord[1]->type,
+                       swap_bytes));
+    }
+  }
+  *vertex_data = vertices->data();
+  return true;
+}
+
+// Reads a face element made up of only triangles with uint8 counts and 32
+// bit indices. Returns false if any face is not a triangle, or if an index
+// is out of range.
+bool ReadPlyTriangles(const PlyElement& element, uint32 vertex_count,
+                      const MeshFace& face_template, bool has_normals,
+                      bool has_texcoords, ::std::vector<MeshFace>* faces) {
+  const uint32 kRecordSize = 1 + 3 * sizeof(uint32);
+  faces->resize(element.count, face_template);
+  const char* record = element.records;
+  for (uint64 i = 0; i < element.count; i++, record += kRecordSize) {
+    uint32 indices[3];
+    memcpy(indices, record + 1, sizeof(indices));
+    if (record[0] != 3 || indices[0] >= vertex_count ||
+        indices[1] >= vertex_count || indices[2] >= vertex_count) {
+      return false;
+    }
+
+    MeshFace* face = &(*faces)[i];
+    face->vertex_indices[0] = indices[2];
+    face->vertex_indices[1] = indices[1];
+    face->vertex_indices[2] = indices[0];
+    if (has_normals) {
+      memcpy(face->normal_indices, face->vertex_indices,
+             sizeof(face->normal_indices));
+    }
+    if (has_texcoords) {
+      memcpy(face->texcoord_indices, face->vertex_indices,
+             sizeof(face->texcoord_indices));
+    }
+  }
+  return true;
+}
+
+// Reads the vertex index lists of the face element. Records were bounds
+// checked by SkipPlyElement.
+bool ReadPlyFaces(const PlyElement& element, bool swap_bytes,
+                  uint32 vertex_count, bool has_normals, bool has_texcoords,
+                  ::std::vector<MeshFace>* faces) {
+  const PlyProperty* index_list =
+      FindPlyProperty(element, "vertex_indices", "vertex_index");
+  if (!index_list || index_list->count_type == kPlyTypeInvalid) {
+    return false;
+  }
+
+  MeshFace face;
+  face.face_plane = plane();
+  face.material = -1;
+  for (uint32 i = 0; i < 3; i++) {
+    face.normal_indices[i] = kInvalidPlyIndex;
+    face.texcoord_indices[i] = kInvalidPlyIndex;
+  }
+
+  // Triangle lists in the layout written by most scanners (a uchar count
+  // followed by 32 bit indices) are read with fixed size records.
+  uint32 index_size = GetPlyTypeSize(index_list->type);
+  if (element.properties.size() == 1 && !swap_bytes &&
+      index_list->count_type == kPlyTypeUint8 && index_size == 4 &&
+      ReadPlyTriangles(element, vertex_count, face, has_normals,
+                       has_texcoords, faces)) {
+    return true;
+  }
+
+  faces->clear();
+  faces->reserve(element.count);
+  const char* cursor = element.records;
+  for (uint64 i = 0; i < element.count; i++) {
+    for (auto& property : element.properties) {
+      uint32 value_size = GetPlyTypeSize(property.type);
+      if (property.count_type == kPlyTypeInvalid) {
+        cursor += value_size;
+        continue;
+      }
+      uint64 value_count =
+          (uint64)ReadPlyValue(cursor, property.count_type, swap_bytes);
+      cursor += GetPlyTypeSize(property.count_type);
+      if (&property != index_list) {
+        cursor += value_count * value_size;
+        continue;
+      }
+
+      // Polygons are emitted as a fan around their first vertex.
+      uint32 first = 0;
+      uint32 previous = 0;
+      for (uint64 j = 0; j < value_count; j++, cursor += value_size) {
+        float64 value = ReadPlyValue(cursor, property.type, swap_bytes);
+        if (value < 0 || value >= vertex_count) {
+          return false;
+        }
+        uint32 current = (uint32)value;
+        if (j >= 2) {
+          face.vertex_indices[0] = current;
+          face.vertex_indices[1] = previous;
+          face.vertex_indices[2] = first;
+          // Ply attributes are per vertex, so they share the vertex indices.
+          if (has_normals) {
+            memcpy(face.normal_indices, face.vertex_indices,
+                   sizeof(face.normal_indices));
+          }
+          if (has_texcoords) {
+            memcpy(face.texcoord_indices, face.vertex_indices,
+                   sizeof(face.texcoord_indices));
+          }
+          faces->push_back(face);
+        } else if (j == 0) {
+          first = current;
+        }
+        previous = current;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool LoadPlyMesh(const ::std::string& filename, const matrix4& transform,
+                 bool invert_normals, MappedFile* file,
+                 const vector3** vertex_data, uint32* vertex_count,
+                 ::std::vector<vector3>* vertices,
+                 ::std::vector<vector3>* normals,
+                 ::std::vector<vector2>* texcoords,
+                 ::std::vector<MeshFace>* faces, bounds* aabb) {
+  if (!file->Open(filename)) {
+    return false;
+  }
+
+  PlyHeader header;
+  header.swap_bytes = false;
+  header.data_offset = 0;
+  if (!ParsePlyHeader(file->GetData(), file->GetSize(), &header)) {
+    printf("Invalid or unsupported ply header in file %s.\n",
+           filename.c_str());
+    file->Close();
+    return false;
+  }
+
+  // Locate the records of every element up to the vertices and faces.
+  const char* cursor = file->GetData() + header.data_offset;
+  const char* end = file->GetData() + file->GetSize();
+  PlyElement* vertex_element = nullptr;
+  PlyElement* face_element = nullptr;
+  for (auto& element : header.elements) {
+    if (vertex_element && face_element) {
+      break;
+    }
+    if (!SkipPlyElement(header.swap_bytes, end, &cursor, &element)) {
+      printf("Truncated ply file %s.\n", filename.c_str());
+      file->Close();
+      return false;
+    }
+    if (element.name == "vertex") {
+      vertex_element = &element;
+    } else if (element.name == "face") {
+      face_element = &element;
+    }
+  }
+
+  if (!vertex_element || !face_element ||
+      vertex_element->count >= kInvalidPlyIndex) {
+    printf("Ply file %s has no usable vertex or face element.\n",
+           filename.c_str());
+    file->Close();
+    return false;
+  }
+
+  const vector3* positions = nullptr;
+  if (!ReadPlyVertices(*vertex_element, header.swap_bytes, transform,
+                       invert_normals, &positions, vertices, normals,
+                       texcoords) ||
+      !ReadPlyFaces(*face_element, header.swap_bytes, vertex_element->count,
+                    !normals->empty(), !texcoords->empty(), faces)) {
+    printf("Invalid vertex or face data in ply file %s.\n", filename.c_str());
+    vertices->clear();
+    normals->clear();
+    texcoords->clear();
+    faces->clear();
+    file->Close();
+    return false;
+  }
+
+  for (uint64 i = 0; i < vertex_element->count; i++) {
+    *aabb += positions[i];
+  }
+  *vertex_data = positions;
+  *vertex_count = vertex_element->count;
+  return true;
+}
+
+}  // namespace base
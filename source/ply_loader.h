@@ -0,0 +1,69 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __PLY_LOADER_H__
+#define __PLY_LOADER_H__
+
+#include <string>
+#include <vector>
+#include "mapped_file.h"
+#include "math/base.h"
+#include "math/matrix4.h"
+#include "math/vector2.h"
+#include "math/vector3.h"
+#include "math/volume.h"
+#include "mesh.h"
+
+namespace base {
+
+// Loads a binary (little or big endian) Stanford (.ply) mesh. Positions,
+// normals (nx, ny, nz) and texcoords (u, v or s, t) are read from the
+// vertex element, and faces from the vertex_indices list of the face
+// element. Other elements and properties are skipped. Polygons are fan
+// triangulated with the same winding as LoadObjMesh.
+//
+// The file remains mapped in file. If the vertex element holds only
+// float32 positions in host byte order and transform is the identity, the
+// positions are used in place and *vertex_data points into the mapping.
+// Otherwise they are converted into vertices, and *vertex_data points at
+// that array.
+bool LoadPlyMesh(const ::std::string& filename, const matrix4& transform,
+                 bool invert_normals, MappedFile* file,
+                 const vector3** vertex_data, uint32* vertex_count,
+                 ::std::vector<vector3>* vertices,
+                 ::std::vector<vector3>* normals,
+                 ::std::vector<vector2>* texcoords,
+                 ::std::vector<MeshFace>* faces, bounds* aabb);
+
+}  // namespace base
+
+#endif  // __PLY_LOADER_H__
@@ -0,0 +1,177 @@
+
+#include "radiance_cache.h"
+#include <math.h>
+
+namespace base {
+
+// Edge length of a cell relative to its distance from the viewer.
+const float32 kRadianceCellSpread = 0.02f;
+const float32 kMinRadianceCellSize = 1.0e-3f;
+// Cells are not used until they hold this many samples.
+const uint32 kMinRadianceCellSamples = 8;
+// Number of cells inspected before a record or query gives up.
+const uint32 kMaxRadianceCacheProbes = 8;
+
+namespace {
+
+void AtomicAdd(::std::atomic<float32>* target, float32 value) {
+  float32 current = target->load(::std::memory_order_relaxed);
+  while (!target->compare_exchange_weak(current, current + value,
+                                        ::std::memory_order_relaxed)) {
+  }
+}
+
+// Finalizer of splitmix64, used to scatter the packed cell coordinates.
+uint64 MixBits(uint64 value) {
+  value ^= value >> 30;
+  value *= 0xBF58476D1CE4E5B9ull;
+  value ^= value >> 27;
+  value *= 0x94D049BB133111EBull;
+  value ^= value >> 31;
+  return value;
+}
+
+uint64 HashCombine(uint64 hash, int64 value) {
+  return MixBits(hash ^ (uint64(value) + 0x9E3779B97F4A7C15ull));
+}
+
+}  // namespace
+
+RadianceCache::RadianceCache(uint32 log2_cell_count)
+    : cells_(new RadianceCell[uint64(1) << log2_cell_count]),
+      cell_mask_((uint64(1) << log2_cell_count) - 1),
+      pass_(0) {
+  Invalidate();
+}
+
+void RadianceCache::Invalidate() {
+  for (uint64 i = 0; i <= cell_mask_; i++) {
+    cells_[i].key.store(0, ::std::memory_order_relaxed);
+    for (uint32 j = 0; j < 3; j++) {
+      cells_[i].radiance[j].store(0.0f, ::std::memory_order_relaxed);
+    }
+    cells_[i].count.store(0, ::std::memory_order_relaxed);
+    cells_[i].pass.store(0, ::std::memory_order_relaxed);
+  }
+  pass_ = 0;
+}
+
+void RadianceCache::Touch(RadianceCell* cell) const {
+  // Cells are read far more often than their pass changes, so the store is
+  // skipped when it would not change anything.
+  if (cell->pass.load(::std::memory_order_relaxed) != pass_) {
+    cell->pass.store(pass_, ::std::memory_order_relaxed);
+  }
+}
+
+uint64 RadianceCache::ComputeKey(const vector3& position,
+                                 const vector3& normal, float32 distance) {
+  // Cell sizes are rounded to powers of two so that nearby vertices seen
+  // from slightly different distances still share cells.
+  float32 size = max(distance * kRadianceCellSpread, kMinRadianceCellSize);
+  int32 level = int32(ceilf(log2f(size)));
+  float32 inverse_size = 1.0f / ldexpf(1.0f, level);
+
+  uint64 hash = HashCombine(0, level);
+  for (uint32 i = 0; i < 3; i++) {
+    hash = HashCombine(hash, int64(floorf(position[i] * inverse_size)));
+  }
+  // Normals are quantized to five steps per axis, which keeps the two sides
+  // of thin surfaces and the faces of a corner apart.
+  for (uint32 i = 0; i < 3; i++) {
+    hash = HashCombine(hash, int64(floorf(normal[i] * 2.0f + 0.5f)));
+  }
+  return hash ? hash : 1;
+}
+
+void RadianceCache::Record(const vector3& position, const vector3& normal,
+                           float32 distance, const vector3& radiance) {
+  uint64 key = ComputeKey(position, normal, distance);
+  RadianceCell* oldest = nullptr;
+  uint32 oldest_age = 0;
+  for (uint32 i = 0; i < kMaxRadianceCacheProbes; i++) {
+    RadianceCell& cell = cells_[(key + i) & cell_mask_];
+    uint64 cell_key = cell.key.load(::std::memory_order_relaxed);
+    if (!cell_key &&
+        cell.key.compare_exchange_strong(cell_key, key,
+                                         ::std::memory_order_relaxed)) {
+      cell_key = key;
+    }
+    if (cell_key == key) {
+      for (uint32 j = 0; j < 3; j++) {
+        AtomicAdd(&cell.radiance[j], radiance[j]);
+      }
+      cell.count.fetch_add(1, ::std::memory_order_relaxed);
+      Touch(&cell);
+      return;
+    }
+    uint32 age = pass_ - cell.pass.load(::std::memory_order_relaxed);
+    if (age > oldest_age) {
+      oldest = &cell;
+      oldest_age = age;
+    }
+  }
+
+  // Every probed cell holds another key. The least recently used one is
+  // taken over, so that cells left behind by earlier views make room for
+  // the current one. A record racing with the takeover may add one sample
+  // of the old cell, or lose one of the new, which only perturbs the
+  // estimate slightly.
+  if (!oldest) {
+    return;
+  }
+  uint64 oldest_key = oldest->key.load(::std::memory_order_relaxed);
+  if (!oldest->key.compare_exchange_strong(oldest_key, key,
+                                           ::std::memory_order_relaxed)) {
+    return;
+  }
+  oldest->count.store(1, ::std::memory_order_relaxed);
+  for (uint32 j = 0; j < 3; j++) {
+    oldest->radiance[j].store(radiance[j], ::std::memory_order_relaxed);
+  }
+  Touch(oldest);
+}
+
+bool RadianceCache::Query(const vector3& position, const vector3& normal,
+                          float32 distance, vector3* radiance) const {
+  uint64 key = ComputeKey(position, normal, distance);
+  for (uint32 i = 0; i < kMaxRadianceCacheProbes; i++) {
+    RadianceCell& cell = cells_[(key + i) & cell_mask_];
+    uint64 cell_key = cell.key.load(::std::memory_order_relaxed);
+    if (!cell_key) {
+      return false;
+    }
+    if (cell_key == key) {
+      Touch(&cell);
+      // The count may lag the sums of a concurrent record, which only
+      // perturbs the estimate slightly.
+      uint32 count = cell.count.load(::std::memory_order_relaxed);
+      if (count < kMinRadianceCellSamples) {
+        return false;
+      }
+      float32 inverse_count = 1.0f / count;
+      radiance->x =
+          cell.radiance[0].load(::std::memory_order_relaxed) * inverse_count;
+      radiance->y =
+          cell.radiance[1].load(::std::memory_order_relaxed) * inverse_count;
+      radiance->z =
+          cell.radiance[2].load(::std::memory_order_relaxed) * inverse_count;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32 RadianceCache::GetOccupiedCount() const {
+  uint32 count = 0;
+  for (uint64 i = 0; i <= cell_mask_; i++) {
+    count += cells_[i].key.load(::std::memory_order_relaxed) ? 1 : 0;
+  }
+  return count;
+}
+
+uint64 RadianceCache::GetMemorySize() const {
+  return (cell_mask_ + 1) * sizeof(RadianceCell);
+}
+
+}  // namespace base
@@ -0,0 +1,101 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __RADIANCE_CACHE_H__
+#define __RADIANCE_CACHE_H__
+
+#include <atomic>
+#include <memory>
+#include "math/base.h"
+#include "math/vector3.h"
+
+namespace base {
+
+// Paths are terminated into the cache at vertices of at least this depth.
+const uint32 kRadianceCacheDepth = 2;
+
+// Hashed world-space cache of the radiance leaving diffuse surfaces. Cells
+// are keyed by position and surface normal, and grow with the distance from
+// the viewer so that each covers a similar footprint on the image. Records
+// and queries are lock-free and may run from any number of threads.
+//
+// Cells accumulate the radiance of every vertex recorded into them, so the
+// cache is a biased estimate that improves as passes are rendered. Cells
+// left unused as the viewer moves are replaced by the cells of the new view.
+class RadianceCache {
+ public:
+  // Allocates 2^log2_cell_count cells.
+  explicit RadianceCache(uint32 log2_cell_count = 20);
+  // Discards all cached radiance.
+  void Invalidate();
+  // Adds the radiance leaving a surface at position with the given normal,
+  // seen from distance. If the cells it may use are all taken, the least
+  // recently used one is replaced, unless all were used in this pass, in
+  // which case the record is dropped.
+  void Record(const vector3& position, const vector3& normal,
+              float32 distance, const vector3& radiance);
+  // Fetches the cached radiance of the cell holding position, and marks the
+  // cell as used. Returns false if the cell does not have enough samples to
+  // be used.
+  bool Query(const vector3& position, const vector3& normal,
+             float32 distance, vector3* radiance) const;
+  // Ends a rendering pass. Must not be called while tracing.
+  void EndPass() { pass_++; }
+  // Returns the number of occupied cells.
+  uint32 GetOccupiedCount() const;
+  // Returns the bytes held by the cache.
+  uint64 GetMemorySize() const;
+
+ private:
+  typedef struct RadianceCell {
+    // Hash of the cell coordinates, or 0 for an empty cell.
+    ::std::atomic<uint64> key;
+    ::std::atomic<float32> radiance[3];
+    ::std::atomic<uint32> count;
+    // The last pass that recorded into or queried the cell.
+    ::std::atomic<uint32> pass;
+  } RadianceCell;
+
+  // Returns the key of the cell holding position.
+  static uint64 ComputeKey(const vector3& position, const vector3& normal,
+                           float32 distance);
+  // Stamps cell as used in the current pass.
+  void Touch(RadianceCell* cell) const;
+  ::std::unique_ptr<RadianceCell[]> cells_;
+  uint64 cell_mask_;
+  // Index of the pass being rendered.
+  uint32 pass_;
+};
+
+}  // namespace base
+
+#endif  // __RADIANCE_CACHE_H__
@@ -1,14 +1,47 @@
 
 #include "scene.h"
 
+#include <sys/stat.h>
 #include <algorithm>
-#include <fstream>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <set>
+#include <thread>
+#include "mapped_file.h"
 #include "math/intersect.h"
 #include "math/random.h"
 
 namespace base {
 
 const uint32 kMaxObjectCountPerNode = 2;
+const uint32 kMaxUnboundedObjectCount = 32;
+const float32 kRootBoundsMargin = 1.25f;
+const uint32 kMaxSkyDistributionWidth = 1024;
+const uint32 kMaxSkyDistributionHeight = 512;
+
+namespace {
+
+// Returns the size of a file in bytes, or zero if it cannot be found.
+uint64 QueryFileSize(const ::std::string& filename) {
+  struct stat file_info;
+  if (stat(filename.c_str(), &file_info) != 0) {
+    return 0;
+  }
+  return file_info.st_size;
+}
+
+// Returns the span of texels that ShadeDiffuse can fetch along one axis of a
+// map for texcoords in [start, stop], limited to a single wrap of the map.
+void QueryTexelSpan(float32 start, float32 stop, float32 texture_scale,
+                    uint32 size, uint32* first, uint32* count) {
+  float32 first_texel = max(0.0f, start * texture_scale * size - 0.5f);
+  float32 last_texel = max(0.0f, stop * texture_scale * size - 0.5f);
+  *first = uint32(first_texel);
+  *count = min(uint32(last_texel) - *first + 1, size);
+}
+
+}  // namespace
 
 SceneBvhNode::SceneBvhNode(
     ::std::vector<::std::unique_ptr<Object>>* data_source,
@@ -22,6 +55,7 @@ SceneBvhNode::SceneBvhNode(SceneBvhNode* parent_node) {
   parent_ = parent_node;
   is_leaf_node_ = true;
   tree_objects_ = parent_node->tree_objects_;
+  max_tree_depth_ = parent_node->max_tree_depth_;
 }
 
 void SceneBvhNode::AllocateChild(int32 index) {
@@ -30,6 +64,38 @@ void SceneBvhNode::AllocateChild(int32 index) {
 
 void SceneBvhNode::AddObject(uint32 index) { object_indices_.push_back(index); }
 
+void SceneBvhNode::InsertObject(uint32 index, const bounds& object_bounds) {
+  if (IsLeafNode()) {
+    AddObject(index);
+    Subdivide();
+    return;
+  }
+
+  for (uint32 i = 0; i < 8; i++) {
+    if (bounds_intersect_bounds(object_bounds, children_[i]->GetBounds())) {
+      SceneBvhNode* node = static_cast<SceneBvhNode*>(children_[i].get());
+      node->InsertObject(index, object_bounds);
+    }
+  }
+}
+
+void SceneBvhNode::RemoveObject(uint32 index, const bounds& object_bounds) {
+  if (IsLeafNode()) {
+    object_indices_.erase(
+        ::std::remove(object_indices_.begin(), object_indices_.end(), index),
+        object_indices_.end());
+    return;
+  }
+
+  // Emptied children are kept, since their bounds are fixed by the parent.
+  for (uint32 i = 0; i < 8; i++) {
+    if (bounds_intersect_bounds(object_bounds, children_[i]->GetBounds())) {
+      SceneBvhNode* node = static_cast<SceneBvhNode*>(children_[i].get());
+      node->RemoveObject(index, object_bounds);
+    }
+  }
+}
+
 void SceneBvhNode::Subdivide() {
   if (depth_ >= max_tree_depth_) {
     return;
@@ -73,6 +139,23 @@ void SceneBvhNode::Subdivide() {
   }
 }
 
+void SceneBvhNode::Inspect(BvhInspector* inspector) const {
+  if (IsLeafNode()) {
+    inspector->AddLeafNode(aabb_, depth_, object_indices_.size());
+    return;
+  }
+
+  bounds child_bounds[8];
+  for (uint32 i = 0; i < 8; i++) {
+    child_bounds[i] = children_[i]->GetBounds();
+  }
+  inspector->AddInteriorNode(aabb_, depth_, child_bounds, 8);
+
+  for (uint32 i = 0; i < 8; i++) {
+    static_cast<const SceneBvhNode*>(children_[i].get())->Inspect(inspector);
+  }
+}
+
 bool SceneBvhNode::Trace(const ray& trajectory,
                          ObjectCollision* hit_info) const {
   collision node_hit;
@@ -85,6 +168,7 @@ bool SceneBvhNode::Trace(const ray& trajectory,
 
   if (IsLeafNode()) {
     ObjectCollision temp_obj_hit;
+    temp_obj_hit.skip_media = hit_info->skip_media;
     // Traverse objects and return closest hit (if any)
     for (uint32 i = 0; i < object_indices_.size(); i++) {
       uint32 object_index = object_indices_.at(i);
@@ -102,6 +186,10 @@ bool SceneBvhNode::Trace(const ray& trajectory,
   return trace_result;
 }
 
+int32 SceneBvh::GetIdealDepth(uint32 object_count) {
+  return (log(object_count) / log(8) + 0.5) - 2;
+}
+
 void SceneBvh::BuildBvh(::std::vector<::std::unique_ptr<Object>>* data_source,
                         uint32 max_tree_depth) {
   if (!data_source->size()) {
@@ -109,27 +197,117 @@ void SceneBvh::BuildBvh(::std::vector<::std::unique_ptr<Object>>* data_source,
   }
 
   tree_objects_ = data_source;
-  max_tree_depth_ = max_tree_depth;
-  root_node_.reset(new SceneBvhNode(data_source));
-
   bounds root_bounds;
+  object_bounds_.resize(data_source->size());
   for (uint32 i = 0; i < data_source->size(); i++) {
-    root_bounds += data_source->at(i)->GetBounds();
+    object_bounds_[i] = data_source->at(i)->GetBounds();
+    root_bounds += object_bounds_[i];
   }
+  BuildNodes(root_bounds, max_tree_depth);
+}
+
+void SceneBvh::BuildNodes(const bounds& root_bounds, uint32 max_tree_depth) {
+  max_tree_depth_ = max_tree_depth;
+  root_node_.reset(new SceneBvhNode(tree_objects_, max_tree_depth));
   root_node_->SetBounds(root_bounds);
+  unbounded_indices_.clear();
 
-  for (uint32 i = 0; i < data_source->size(); i++) {
+  for (uint32 i = 0; i < tree_objects_->size(); i++) {
     root_node_->AddObject(i);
   }
 
   root_node_->Subdivide();
 }
 
+void SceneBvh::Rebuild() {
+  bounds object_extents;
+  for (uint32 i = 0; i < tree_objects_->size(); i++) {
+    object_extents += object_bounds_[i];
+  }
+
+  // The new root leaves a margin around the objects' extents, so that the
+  // scene can keep growing for a while before the next rebuild.
+  vector3 center = object_extents.query_center();
+  vector3 half_size = object_extents.bounds_max - center;
+  bounds root_bounds;
+  root_bounds += center + half_size * kRootBoundsMargin;
+  root_bounds += center - half_size * kRootBoundsMargin;
+
+  uint32 tree_depth = max(GetIdealDepth(tree_objects_->size()), 1);
+  BuildNodes(root_bounds, max(tree_depth, max_tree_depth_));
+}
+
+void SceneBvh::InsertObject(uint32 index) {
+  if (!root_node_.get()) {
+    return;
+  }
+
+  object_bounds_.resize(tree_objects_->size());
+  object_bounds_[index] = tree_objects_->at(index)->GetBounds();
+
+  // Leaves cannot split past the depth limit, so a tree that was built for
+  // far fewer objects is rebuilt rather than left with crowded leaves.
+  if (GetIdealDepth(tree_objects_->size()) > int32(max_tree_depth_)) {
+    Rebuild();
+    return;
+  }
+
+  // Objects that reach past the root bounds cannot be placed in the octree.
+  // They are traced individually, so only a few are allowed to build up.
+  const bounds& root_bounds = root_node_->GetBounds();
+  if (point_in_bounds(root_bounds, object_bounds_[index].bounds_min) &&
+      point_in_bounds(root_bounds, object_bounds_[index].bounds_max)) {
+    root_node_->InsertObject(index, object_bounds_[index]);
+  } else {
+    unbounded_indices_.push_back(index);
+    if (unbounded_indices_.size() > kMaxUnboundedObjectCount) {
+      Rebuild();
+    }
+  }
+}
+
+void SceneBvh::RemoveObject(uint32 index) {
+  if (!root_node_.get()) {
+    return;
+  }
+
+  auto unbounded = ::std::find(unbounded_indices_.begin(),
+                               unbounded_indices_.end(), index);
+  if (unbounded != unbounded_indices_.end()) {
+    unbounded_indices_.erase(unbounded);
+    return;
+  }
+  root_node_->RemoveObject(index, object_bounds_[index]);
+}
+
 bool SceneBvh::Trace(const ray& trajectory, ObjectCollision* hit_info) const {
+  bool trace_result = false;
   if (root_node_.get()) {
-    return root_node_->Trace(trajectory, hit_info);
+    trace_result = root_node_->Trace(trajectory, hit_info);
   }
-  return false;
+
+  ObjectCollision temp_obj_hit;
+  temp_obj_hit.skip_media = hit_info->skip_media;
+  for (uint32 i = 0; i < unbounded_indices_.size(); i++) {
+    Object* obj = tree_objects_->at(unbounded_indices_[i]).get();
+    if (obj->Trace(trajectory, &temp_obj_hit)) {
+      if (temp_obj_hit.param < hit_info->param) {
+        *hit_info = temp_obj_hit;
+        trace_result = true;
+      }
+    }
+  }
+  return trace_result;
+}
+
+void SceneBvh::Inspect(BvhInspector* inspector) const {
+  if (!root_node_.get()) {
+    return;
+  }
+
+  inspector->SetPrimitiveCount(tree_objects_->size() -
+                               unbounded_indices_.size());
+  root_node_->Inspect(inspector);
 }
 
 const vector3 SceneBvh::GetCenter() const {
@@ -139,7 +317,7 @@ const vector3 SceneBvh::GetCenter() const {
   return vector3();
 }
 
-Scene::Scene() : is_tree_valid_(false) {
+Scene::Scene() : is_tree_valid_(false), scene_layout_hash_(0) {
   sky_material_.reset(new LightMaterial(vector3(0, 0, 0)));
 }
 
@@ -150,80 +328,549 @@ Camera* Scene::GetCamera(uint32 index) {
   return &camera_list_[index];
 }
 
+void Scene::InspectTrees(::std::vector<BvhQualityReport>* reports) const {
+  if (is_tree_valid_) {
+    BvhInspector inspector("scene");
+    object_tree_.Inspect(&inspector);
+    reports->push_back(inspector.GetReport());
+  }
+
+  if (!light_tree_.IsEmpty()) {
+    BvhInspector inspector("lights");
+    light_tree_.Inspect(&inspector);
+    reports->push_back(inspector.GetReport());
+  }
+
+  for (uint32 i = 0; i < object_list_.size(); i++) {
+    const MeshObject* mesh =
+        dynamic_cast<const MeshObject*>(object_list_[i].get());
+    if (!mesh) {
+      continue;
+    }
+
+    BvhInspector inspector(mesh->GetClusterStream()
+                               ? "mesh " + ::std::to_string(i) + " clusters"
+                               : "mesh " + ::std::to_string(i));
+    mesh->InspectBvh(&inspector);
+    reports->push_back(inspector.GetReport());
+  }
+}
+
 void Scene::SetSkyMaterial(::std::shared_ptr<LightMaterial> material) {
   sky_material_ = material;
+  BuildSkyDistribution();
+}
+
+void Scene::BuildSkyDistribution() {
+  const MaterialParams& sky = sky_material_->GetParams();
+  uint32 width = 1;
+  uint32 height = 1;
+  if (sky.diffuse_map) {
+    width = min(sky.diffuse_map->width, kMaxSkyDistributionWidth);
+    height = min(sky.diffuse_map->height, kMaxSkyDistributionHeight);
+  }
+
+  // Each cell stores the brightest texel that lookups within it can return,
+  // so that small bright features (e.g. a sun one or two texels wide) keep a
+  // non-zero weight however many texels a cell covers.
+  ::std::vector<float32> weights(width * height);
+  const Texture* map = sky.diffuse_map;
+  if (!map) {
+    weights[0] = ShadeLuminance(ShadeSample(sky, ShadingContext()));
+    sky_distribution_.initialize(&weights[0], width, height);
+    return;
+  }
+
+  ::std::vector<uint32> column_first(width);
+  ::std::vector<uint32> column_count(width);
+  for (uint32 x = 0; x < width; x++) {
+    QueryTexelSpan(float32(x) / width, float32(x + 1) / width,
+                   sky.texture_scale, map->width, &column_first[x],
+                   &column_count[x]);
+  }
+
+  for (uint32 y = 0; y < height; y++) {
+    uint32 row_first = 0;
+    uint32 row_count = 0;
+    QueryTexelSpan(float32(y) / height, float32(y + 1) / height,
+                   sky.texture_scale, map->height, &row_first, &row_count);
+    for (uint32 j = 0; j < row_count; j++) {
+      uint32 texel_y = (row_first + j) % map->height;
+      for (uint32 x = 0; x < width; x++) {
+        float32 weight = weights[y * width + x];
+        for (uint32 i = 0; i < column_count[x]; i++) {
+          uint32 texel_x = (column_first[x] + i) % map->width;
+          weight = max(weight, ShadeLuminance(map->Fetch(texel_x, texel_y)));
+        }
+        weights[y * width + x] = weight;
+      }
+    }
+  }
+
+  sky_distribution_.initialize(&weights[0], width, height);
+}
+
+bool Scene::SampleSkyDirection(float32 u0, float32 u1, vector3* direction,
+                               float32* pdf) const {
+  if (!sky_distribution_.is_valid()) {
+    return false;
+  }
+  float32 texcoords_pdf = 0.0f;
+  vector2 texcoords = sky_distribution_.sample_continuous(u0, u1,
+                                                          &texcoords_pdf);
+  // The sky mapping is equal-area: d(omega) = 4pi du dv.
+  *direction = sphere_map_direction(texcoords);
+  *pdf = texcoords_pdf / (4.0f * BASE_PI);
+  return *pdf > 0.0f;
+}
+
+float32 Scene::SkyPdf(const vector3& direction) const {
+  if (!sky_distribution_.is_valid()) {
+    return 0.0f;
+  }
+  return sky_distribution_.pdf(sphere_map_texcoords(direction)) /
+         (4.0f * BASE_PI);
 }
 
 const vector3 Scene::SampleSky(uint32 depth, const vector3& view) {
-  vector2 tex_coords = sphere_map_texcoords(view);
-  return sky_material_->Sample(depth, vector3(), vector3(), view, vector3(),
-                               vector3(), vector3(), vector3(), tex_coords) *
-         3.0;
+  ShadingContext context;
+  context.depth = depth;
+  context.view_dir = view;
+  context.surface_texcoords = sphere_map_texcoords(view);
+  return ShadeSample(GetMaterialParams(sky_material_.get()), context) * 3.0;
 }
 
 MeshObject* Scene::AddMeshObject(const ::std::string& filename,
                                  bool invert_normals,
                                  const vector3& translation,
                                  const vector3& scale,
-                                 const vector4& rotation) {
+                                 const vector4& rotation,
+                                 MeshStorage storage) {
+  MeshLoadTask task;
+  task.filename = filename;
+  task.invert_normals = invert_normals;
+  task.translation = translation;
+  task.scale = scale;
+  task.rotation = rotation;
+  task.storage = storage;
+  RunMeshLoad(&task, 0);
+
+  MeshObject* mesh_object = task.object.get();
+  if (task.has_cache_key) {
+    scene_cache_.AddMesh(task.cache_key, mesh_object->GetView());
+  }
+  ReportMeshLoad(task, &load_report_);
+  object_list_.emplace_back(::std::move(task.object));
+  InsertTreeObject(object_list_.size() - 1);
+  return mesh_object;
+}
+
+void Scene::QueueMeshLoad(const ::std::string& filename,
+                          const vector3& translation, const vector3& scale,
+                          const vector4& rotation, MeshStorage storage,
+                          ::std::shared_ptr<DiffuseMaterial> material) {
   is_tree_valid_ = false;
-  object_list_.emplace_back(
-      new MeshObject(filename, invert_normals, translation, scale, rotation));
-  return reinterpret_cast<MeshObject*>(object_list_.back().get());
+
+  // The object's slot is reserved now so that the object order matches
+  // the scene file, regardless of which load finishes first.
+  mesh_load_tasks_.emplace_back();
+  MeshLoadTask* task = &mesh_load_tasks_.back();
+  task->object_index = object_list_.size();
+  task->filename = filename;
+  task->translation = translation;
+  task->scale = scale;
+  task->rotation = rotation;
+  task->storage = storage;
+  task->material = material;
+  object_list_.emplace_back(nullptr);
+}
+
+void Scene::RunMeshLoad(MeshLoadTask* task, uint32 thread_count) {
+  auto load_start = ::std::chrono::steady_clock::now();
+  // Meshes found in the scene cache use its arrays and bvh in place.
+  // Streamed meshes keep their own cluster files instead.
+  MeshView cached_view;
+  task->has_cache_key =
+      task->storage != kMeshStorageStreamed &&
+      SceneCache::ComputeMeshKey(task->filename, task->invert_normals,
+                                 task->translation, task->scale,
+                                 task->rotation, task->storage,
+                                 &task->cache_key);
+  if (task->has_cache_key &&
+      scene_cache_.FindMesh(task->cache_key, &cached_view)) {
+    task->object.reset(new MeshObject(cached_view));
+    task->is_cached = true;
+  } else {
+    task->object.reset(new MeshObject(task->filename, task->invert_normals,
+                                      task->translation, task->scale,
+                                      task->rotation, task->storage,
+                                      &cluster_cache_, thread_count));
+  }
+  task->load_seconds = GetElapsedSeconds(load_start);
+}
+
+void Scene::ReportMeshLoad(const MeshLoadTask& task,
+                           SceneLoadReport* report) {
+  MeshLoadReport mesh_report;
+  mesh_report.filename = task.filename;
+  mesh_report.storage = task.storage;
+  mesh_report.is_cached = task.is_cached;
+  mesh_report.load_seconds = task.load_seconds;
+  FillMeshLoadReport(*task.object, &mesh_report);
+  report->meshes.push_back(mesh_report);
+}
+
+void Scene::RunLoadTasks(SceneLoadReport* report) {
+  auto load_start = ::std::chrono::steady_clock::now();
+  typedef struct LoadTask {
+    uint64 size;
+    uint32 index;
+    bool is_mesh;
+  } LoadTask;
+
+  // Larger assets are started first, which keeps the tail of the load
+  // short when there are more tasks than cores.
+  ::std::vector<LoadTask> tasks;
+  for (uint32 i = 0; i < mesh_load_tasks_.size(); i++) {
+    LoadTask task = {QueryFileSize(mesh_load_tasks_[i].filename), i, true};
+    tasks.push_back(task);
+  }
+  for (uint32 i = 0; i < texture_load_tasks_.size(); i++) {
+    LoadTask task = {QueryFileSize(texture_load_tasks_[i].filename), i, false};
+    tasks.push_back(task);
+  }
+  ::std::stable_sort(tasks.begin(), tasks.end(),
+                     [](const LoadTask& lhs, const LoadTask& rhs) {
+                       return lhs.size > rhs.size;
+                     });
+
+  // Each worker claims the next unstarted task until none remain. Tasks
+  // only read shared scene state, and write to their own task record.
+  // Hardware threads are divided among the workers, so that meshes that
+  // parse in parallel do not oversubscribe the machine.
+  uint32 hardware_thread_count = max(::std::thread::hardware_concurrency(), 1u);
+  uint32 thread_count = min(hardware_thread_count, (uint32)tasks.size());
+  uint32 mesh_thread_count = max(hardware_thread_count / max(thread_count, 1u),
+                                 1u);
+  ::std::atomic<uint32> next_task(0);
+  auto load_worker = [&]() {
+    for (uint32 i = next_task++; i < tasks.size(); i = next_task++) {
+      if (tasks[i].is_mesh) {
+        RunMeshLoad(&mesh_load_tasks_[tasks[i].index], mesh_thread_count);
+      } else {
+        TextureLoadTask* texture = &texture_load_tasks_[tasks[i].index];
+        auto load_start = ::std::chrono::steady_clock::now();
+        LoadMaterialTexture(texture->material.get(), texture->filename,
+                            texture->tex_scale, texture->is_srgb);
+        texture->load_seconds = GetElapsedSeconds(load_start);
+      }
+    }
+  };
+
+  if (thread_count <= 1) {
+    load_worker();
+  } else {
+    ::std::vector<::std::thread> thread_list;
+    for (uint32 i = 0; i < thread_count; i++) {
+      thread_list.emplace_back(load_worker);
+    }
+    for (auto& load_thread : thread_list) {
+      load_thread.join();
+    }
+  }
+
+  for (auto& task : mesh_load_tasks_) {
+    MeshObject* mesh_object = task.object.get();
+    if (task.material) {
+      mesh_object->SetMaterial(task.material);
+    }
+    if (task.has_cache_key) {
+      scene_cache_.AddMesh(task.cache_key, mesh_object->GetView());
+    }
+    if (report) {
+      ReportMeshLoad(task, report);
+    }
+    object_list_[task.object_index] = ::std::move(task.object);
+  }
+
+  for (uint32 i = 0; report && i < texture_load_tasks_.size(); i++) {
+    const TextureLoadTask& task = texture_load_tasks_[i];
+    const Texture* texture = task.material->GetDiffuseTexture();
+    if (texture) {
+      TextureLoadReport texture_report;
+      FillTextureLoadReport(*texture, &texture_report);
+      texture_report.filename = task.filename;
+      texture_report.load_seconds = task.load_seconds;
+      report->textures.push_back(texture_report);
+    }
+  }
+  if (report) {
+    report->asset_seconds = GetElapsedSeconds(load_start);
+  }
+  mesh_load_tasks_.clear();
+  texture_load_tasks_.clear();
 }
 
 SphericalObject* Scene::AddSphericalObject(const vector3& origin,
                                            float32 radius) {
-  is_tree_valid_ = false;
   object_list_.emplace_back(new SphericalObject(origin, radius));
+  InsertTreeObject(object_list_.size() - 1);
   return reinterpret_cast<SphericalObject*>(object_list_.back().get());
 }
 
 PlanarObject* Scene::AddPlanarObject(const plane& data) {
-  is_tree_valid_ = false;
   object_list_.emplace_back(new PlanarObject(data));
+  InsertTreeObject(object_list_.size() - 1);
   return reinterpret_cast<PlanarObject*>(object_list_.back().get());
 }
 
 DiscObject* Scene::AddDiscObject(const vector3& origin, const vector3& normal,
                                  float32 radius) {
-  is_tree_valid_ = false;
   object_list_.emplace_back(new DiscObject(origin, normal, radius));
+  InsertTreeObject(object_list_.size() - 1);
   return reinterpret_cast<DiscObject*>(object_list_.back().get());
 }
 
 CuboidObject* Scene::AddCuboidObject(const vector3& origin, float32 width,
                                      float32 height, float32 depth) {
-  is_tree_valid_ = false;
   object_list_.emplace_back(new CuboidObject(origin, width, height, depth));
+  InsertTreeObject(object_list_.size() - 1);
   return reinterpret_cast<CuboidObject*>(object_list_.back().get());
 }
 
 QuadObject* Scene::AddQuadObject(const vector3& origin, const vector3& normal,
                                  float32 width, float32 height) {
-  is_tree_valid_ = false;
   object_list_.emplace_back(new QuadObject(origin, normal, width, height));
+  InsertTreeObject(object_list_.size() - 1);
   return reinterpret_cast<QuadObject*>(object_list_.back().get());
 }
 
 QuadObject* Scene::AddQuadObject(const vector3& position, const vector3& u,
                                  const vector3& v) {
-  is_tree_valid_ = false;
   object_list_.emplace_back(new QuadObject(position, u, v));
+  InsertTreeObject(object_list_.size() - 1);
   return reinterpret_cast<QuadObject*>(object_list_.back().get());
 }
 
+VolumeObject* Scene::AddVolumeObject(const vector3& origin,
+                                     const vector3& size) {
+  object_list_.emplace_back(new VolumeObject(origin, size));
+  InsertTreeObject(object_list_.size() - 1);
+  media_list_.push_back(
+      reinterpret_cast<VolumeObject*>(object_list_.back().get()));
+  return media_list_.back();
+}
+
+float32 Scene::QueryTransmittance(const ray& segment) const {
+  float32 transmittance = 1.0f;
+  for (auto& volume : media_list_) {
+    transmittance *= volume->QueryTransmittance(segment);
+    if (transmittance <= 0.0f) {
+      break;
+    }
+  }
+  return transmittance;
+}
+
+void Scene::BuildMaterialTable() {
+  material_table_.clear();
+  auto add_material = [this](Material* material) {
+    if (!material) {
+      return;
+    }
+    uint32 index = material->GetTableIndex();
+    if (index < material_table_.size() &&
+        material_table_[index].id == material->GetID()) {
+      // Already present (shared between objects).
+      return;
+    }
+    material->SetTableIndex(material_table_.size());
+    material_table_.push_back(material->GetParams());
+  };
+
+  add_material(sky_material_.get());
+  for (auto& object : object_list_) {
+    add_material(object->GetMaterial());
+  }
+}
+
+void Scene::BuildLightTree() {
+  for (auto& object : object_list_) {
+    object->SetLightIndex(kInvalidLightIndex);
+  }
+  light_list_.clear();
+
+  // Textured emitters are left to BSDF sampling, since their power varies
+  // across the surface. All current emitters are two sided, so their normal
+  // cones cover the full sphere.
+  ::std::vector<LightBounds> lights;
+  for (auto& object : object_list_) {
+    Material* material = object->GetMaterial();
+    if (!material) {
+      continue;
+    }
+    const MaterialParams& params = GetMaterialParams(material);
+    float32 area = object->GetSurfaceArea();
+    if (!ShadeIsLight(params) || params.diffuse_map || area <= 0.0f) {
+      continue;
+    }
+    LightBounds light_bounds;
+    light_bounds.aabb = object->GetBounds();
+    light_bounds.power = ShadeLuminance(params.emissive) * area;
+    if (light_bounds.power <= 0.0f) {
+      continue;
+    }
+    object->SetLightIndex(light_list_.size());
+    light_list_.push_back(object.get());
+    lights.push_back(light_bounds);
+  }
+
+  light_tree_.Build(lights);
+}
+
+bool Scene::SampleLight(const vector3& point, const vector3& normal,
+                        float32 u0, float32 u1, float32 u2, Object** light,
+                        vector3* direction, float32* distance,
+                        float32* pdf) const {
+  uint32 light_index = kInvalidLightIndex;
+  float32 pmf = 0.0f;
+  if (!light_tree_.Sample(point, normal, u0, &light_index, &pmf)) {
+    return false;
+  }
+  Object* object = light_list_[light_index];
+  float32 direction_pdf = 0.0f;
+  if (!object->SampleDirection(point, u1, u2, direction, distance,
+                               &direction_pdf)) {
+    return false;
+  }
+  *light = object;
+  *pdf = pmf * direction_pdf;
+  return *pdf > 0.0f;
+}
+
+float32 Scene::LightPdf(const vector3& point, const vector3& normal,
+                        const Object* light, const vector3& direction,
+                        float32 distance) const {
+  uint32 light_index = light->GetLightIndex();
+  if (light_index >= light_list_.size() ||
+      light_list_[light_index] != light) {
+    return 0.0f;
+  }
+  return light_tree_.Pmf(point, normal, light_index) *
+         light->DirectionPdf(point, direction, distance);
+}
+
 void Scene::Optimize() {
+  BuildMaterialTable();
+  BuildLightTree();
   is_tree_valid_ = false;
   // Compute the ideal maximum depth based on the scene object count.
   // If this is non-zero, move forward with scene tree construction.
-  int32 ideal_depth = (log(object_list_.size()) / log(8) + 0.5) - 2;
+  int32 ideal_depth = SceneBvh::GetIdealDepth(object_list_.size());
   if (ideal_depth > 0) {
     object_tree_.BuildBvh(&object_list_, ideal_depth);
     is_tree_valid_ = true;
   }
 }
 
+uint32 Scene::FindObjectIndex(const Object* object) const {
+  for (uint32 i = 0; i < object_list_.size(); i++) {
+    if (object_list_[i].get() == object) {
+      return i;
+    }
+  }
+  return object_list_.size();
+}
+
+void Scene::InsertTreeObject(uint32 index) {
+  if (is_tree_valid_) {
+    object_tree_.InsertObject(index);
+  }
+}
+
+void Scene::RefreshLightTree(Object* object, bool was_light) {
+  Material* material = object->GetMaterial();
+  if (was_light ||
+      (material && ShadeIsLight(GetMaterialParams(material)))) {
+    BuildLightTree();
+  }
+}
+
+bool Scene::RemoveObject(Object* object) {
+  uint32 index = FindObjectIndex(object);
+  if (index == object_list_.size()) {
+    return false;
+  }
+
+  bool was_light = object->GetLightIndex() != kInvalidLightIndex;
+  media_list_.erase(
+      ::std::remove(media_list_.begin(), media_list_.end(), object),
+      media_list_.end());
+
+  // The last object is moved into the vacated slot, so only it and the
+  // removed object need to be touched in the tree.
+  uint32 last_index = object_list_.size() - 1;
+  if (is_tree_valid_) {
+    object_tree_.RemoveObject(index);
+    if (index != last_index) {
+      object_tree_.RemoveObject(last_index);
+    }
+  }
+  if (index != last_index) {
+    object_list_[index] = ::std::move(object_list_.back());
+  }
+  object_list_.pop_back();
+  if (index != last_index) {
+    InsertTreeObject(index);
+  }
+
+  if (was_light) {
+    BuildLightTree();
+  }
+  return true;
+}
+
+bool Scene::TranslateObject(Object* object, const vector3& offset) {
+  uint32 index = FindObjectIndex(object);
+  if (index == object_list_.size()) {
+    return false;
+  }
+
+  bool was_light = object->GetLightIndex() != kInvalidLightIndex;
+  if (is_tree_valid_) {
+    object_tree_.RemoveObject(index);
+  }
+  object->Translate(offset);
+  InsertTreeObject(index);
+  RefreshLightTree(object, was_light);
+  return true;
+}
+
+bool Scene::UpdateObject(Object* object) {
+  uint32 index = FindObjectIndex(object);
+  if (index == object_list_.size()) {
+    return false;
+  }
+
+  bool was_light = object->GetLightIndex() != kInvalidLightIndex;
+  if (is_tree_valid_) {
+    object_tree_.RemoveObject(index);
+  }
+  InsertTreeObject(index);
+  RefreshLightTree(object, was_light);
+  return true;
+}
+
+bounds Scene::GetBounds() const {
+  bounds output;
+  for (auto& object : object_list_) {
+    if (object) {
+      output += object->GetBounds();
+    }
+  }
+  return output;
+}
+
 bool Scene::Trace(const ray& trajectory, ObjectCollision* hit_info) {
   bool collision_detected = false;
 
@@ -248,8 +895,54 @@ bool Scene::Trace(const ray& trajectory, ObjectCollision* hit_info) {
   return collision_detected;
 }
 
-void Scene::ParseMaterial(
-    const char* material_name, ::std::ifstream* input_file,
+namespace {
+
+// Reads a material reference within a block and resolves it against the
+// materials defined so far. Undefined materials are reported but are not
+// fatal, in which case the object keeps its default material.
+bool ReadMaterialReference(
+    SceneTokenizer* tokens,
+    const ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
+        material_list,
+    ::std::shared_ptr<DiffuseMaterial>* material) {
+  ::std::string material_name;
+  if (!tokens->ReadString(&material_name)) {
+    return false;
+  }
+  auto entry = material_list->find(material_name);
+  if (entry == material_list->end()) {
+    tokens->ReportWarning("undefined material");
+    material->reset();
+  } else {
+    *material = entry->second;
+  }
+  return true;
+}
+
+// Unknown properties are skipped so that newer scene files still load.
+void SkipUnknownProperty(SceneTokenizer* tokens) {
+  tokens->ReportWarning("unknown property");
+  tokens->SkipLine();
+}
+
+}  // namespace
+
+void Scene::LoadMaterialTexture(DiffuseMaterial* material,
+                                const ::std::string& filename,
+                                float32 tex_scale, bool is_srgb) const {
+  uint64 key = 0;
+  Texture cached_texture;
+  if (SceneCache::ComputeTextureKey(filename, &key) &&
+      scene_cache_.FindTexture(key, &cached_texture)) {
+    cached_texture.filename = filename;
+    material->MapDiffuseTexture(cached_texture, tex_scale, is_srgb);
+  } else {
+    material->LoadDiffuseTexture(filename, tex_scale, is_srgb);
+  }
+}
+
+bool Scene::ParseMaterial(
+    const ::std::string& material_name, SceneTokenizer* tokens,
     ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
         material_list) {
   vector3 color;
@@ -261,23 +954,42 @@ void Scene::ParseMaterial(
   int32 brdf = 0;
   float32 frostiness = 0.0;
   float32 reflectivity = 0.1;
-  char texture_name[MAX_PATH] = {0};
-  ::std::string input_line;
-
-  while (getline(*input_file, input_line)) {
-    if (strchr(input_line.c_str(), '}')) break;
-
-    sscanf(input_line.c_str(), " color %f %f %f", &color.x, &color.y, &color.z);
-    sscanf(input_line.c_str(), " emission %f %f %f", &emission.x, &emission.y,
-           &emission.z);
-    sscanf(input_line.c_str(), " metallic %f", &metallic);
-    sscanf(input_line.c_str(), " roughness %f", &roughness);
-    sscanf(input_line.c_str(), " index %f", &refraction_index);
-    sscanf_s(input_line.c_str(), " texture %s", texture_name, MAX_PATH);
-    sscanf(input_line.c_str(), " texture_scale %f", &texture_scale);
-    sscanf(input_line.c_str(), " brdf %i", &brdf);
-    sscanf(input_line.c_str(), " frostiness %f", &frostiness);
-    sscanf(input_line.c_str(), " reflectivity %f", &reflectivity);
+  float32 density = 1.0;
+  int32 texture_srgb = 0;
+  ::std::string texture_name;
+  ::std::string_view key;
+
+  while (tokens->NextProperty(&key)) {
+    if (key == "color") {
+      tokens->ReadVector3(&color);
+    } else if (key == "emission") {
+      tokens->ReadVector3(&emission);
+    } else if (key == "metallic") {
+      tokens->ReadFloat(&metallic);
+    } else if (key == "roughness") {
+      tokens->ReadFloat(&roughness);
+    } else if (key == "index") {
+      tokens->ReadFloat(&refraction_index);
+    } else if (key == "texture") {
+      tokens->ReadString(&texture_name);
+    } else if (key == "texture_scale") {
+      tokens->ReadFloat(&texture_scale);
+    } else if (key == "texture_srgb") {
+      tokens->ReadInt(&texture_srgb);
+    } else if (key == "brdf") {
+      tokens->ReadInt(&brdf);
+    } else if (key == "frostiness") {
+      tokens->ReadFloat(&frostiness);
+    } else if (key == "reflectivity") {
+      tokens->ReadFloat(&reflectivity);
+    } else if (key == "density") {
+      tokens->ReadFloat(&density);
+    } else {
+      SkipUnknownProperty(tokens);
+    }
+  }
+  if (tokens->HasError()) {
+    return false;
   }
 
   ::std::shared_ptr<DiffuseMaterial> material;
@@ -298,63 +1010,80 @@ void Scene::ParseMaterial(
   } else if (brdf == 2) {
     material = ::std::make_shared<::base::GlassMaterial>(
         color, refraction_index, reflectivity, frostiness);
+  } else if (brdf == 3) {
+    material = ::std::make_shared<::base::MediumMaterial>(color, density);
   } else {
     material = ::std::make_shared<::base::DiffuseMaterial>(color);
   }
 
-  if (strlen(texture_name) && strcmp(texture_name, "None") != 0) {
-    material->LoadDiffuseTexture(texture_name, texture_scale);
+  if (texture_name.length() && texture_name != "None") {
+    TextureLoadTask task = {material, texture_name, texture_scale,
+                            texture_srgb != 0, 0.0, material_name};
+    texture_load_tasks_.push_back(task);
   }
 
-  (*material_list)[::std::string(material_name)] = material;
+  (*material_list)[material_name] = material;
+  return true;
 }
 
-void Scene::ParseSphere(
-    ::std::ifstream* input_file,
+bool Scene::ParseSphere(
+    SceneTokenizer* tokens,
     ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
         material_list) {
-  float32 radius;
+  float32 radius = 0;
   vector3 position;
-  ::std::string input_line;
-  char material_name[MAX_PATH] = {0};
-
-  while (getline(*input_file, input_line)) {
-    if (strchr(input_line.c_str(), '}')) break;
-    sscanf_s(input_line.c_str(), " material %s", material_name, MAX_PATH);
-    sscanf(input_line.c_str(), " position %f %f %f", &position.x, &position.y,
-           &position.z);
-    sscanf(input_line.c_str(), " radius %f", &radius);
+  ::std::shared_ptr<DiffuseMaterial> material;
+  ::std::string_view key;
+
+  while (tokens->NextProperty(&key)) {
+    if (key == "material") {
+      ReadMaterialReference(tokens, material_list, &material);
+    } else if (key == "position") {
+      tokens->ReadVector3(&position);
+    } else if (key == "radius") {
+      tokens->ReadFloat(&radius);
+    } else {
+      SkipUnknownProperty(tokens);
+    }
+  }
+  if (tokens->HasError()) {
+    return false;
   }
 
-  ::std::string object_material(material_name);
   ::base::Object* sphere_object = AddSphericalObject(position, radius);
 
-  if (sphere_object) {
-    if (object_material.length() && material_list->count(object_material)) {
-      sphere_object->SetMaterial((*material_list)[object_material]);
-    }
+  if (sphere_object && material) {
+    sphere_object->SetMaterial(material);
   }
+  return true;
 }
 
-void Scene::ParseCamera(::std::ifstream* input_file) {
+bool Scene::ParseCamera(SceneTokenizer* tokens) {
   Camera scene_camera;
   vector3 position = scene_camera.origin;
   vector3 target = scene_camera.target;
   float32 fov = scene_camera.fov_y;
   float32 aperture = scene_camera.aperture_size;
   float32 focal_depth = scene_camera.focal_depth;
-  ::std::string input_line;
-
-  while (getline(*input_file, input_line)) {
-    if (strchr(input_line.c_str(), '}')) break;
-
-    sscanf(input_line.c_str(), " position %f %f %f", &position.x, &position.y,
-           &position.z);
-    sscanf(input_line.c_str(), " target %f %f %f", &target.x, &target.y,
-           &target.z);
-    sscanf(input_line.c_str(), " fov %f", &fov);
-    sscanf(input_line.c_str(), " aperture %f", &aperture);
-    sscanf(input_line.c_str(), " focal_depth %f", &focal_depth);
+  ::std::string_view key;
+
+  while (tokens->NextProperty(&key)) {
+    if (key == "position") {
+      tokens->ReadVector3(&position);
+    } else if (key == "target") {
+      tokens->ReadVector3(&target);
+    } else if (key == "fov") {
+      tokens->ReadFloat(&fov);
+    } else if (key == "aperture") {
+      tokens->ReadFloat(&aperture);
+    } else if (key == "focal_depth") {
+      tokens->ReadFloat(&focal_depth);
+    } else {
+      SkipUnknownProperty(tokens);
+    }
+  }
+  if (tokens->HasError()) {
+    return false;
   }
 
   scene_camera.origin = position;
@@ -363,138 +1092,243 @@ void Scene::ParseCamera(::std::ifstream* input_file) {
   scene_camera.aperture_size = aperture;
   scene_camera.focal_depth = focal_depth;
   camera_list_.push_back(scene_camera);
+  return true;
 }
 
-void Scene::ParseSky(
-    ::std::ifstream* input_file,
+bool Scene::ParseSky(
+    SceneTokenizer* tokens,
     ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
         material_list) {
-  ::std::string input_line;
-  char material_name[MAX_PATH] = {0};
+  ::std::shared_ptr<DiffuseMaterial> material;
+  ::std::string_view key;
 
-  while (getline(*input_file, input_line)) {
-    if (strchr(input_line.c_str(), '}')) break;
-    sscanf_s(input_line.c_str(), " material %s", material_name, MAX_PATH);
+  while (tokens->NextProperty(&key)) {
+    if (key == "material") {
+      ReadMaterialReference(tokens, material_list, &material);
+    } else {
+      SkipUnknownProperty(tokens);
+    }
+  }
+  if (tokens->HasError()) {
+    return false;
   }
 
-  ::std::string object_material(material_name);
-
-  if (object_material.length() && material_list->count(object_material)) {
-    SetSkyMaterial(std::static_pointer_cast<LightMaterial>(
-        (*material_list)[object_material]));
+  if (material) {
+    SetSkyMaterial(std::static_pointer_cast<LightMaterial>(material));
   }
+  return true;
 }
 
-void Scene::ParseQuad(
-    ::std::ifstream* input_file,
+bool Scene::ParseQuad(
+    SceneTokenizer* tokens,
     ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
         material_list) {
   vector3 position;
   vector3 normal;
-  float32 width;
-  float32 height;
-  ::std::string input_line;
-  char quad_material[MAX_PATH] = {0};
-
-  while (getline(*input_file, input_line)) {
-    if (strchr(input_line.c_str(), '}')) break;
-    sscanf_s(input_line.c_str(), " material %s", quad_material, MAX_PATH);
-    sscanf(input_line.c_str(), " position %f %f %f", &position.x, &position.y,
-           &position.z);
-    sscanf(input_line.c_str(), " normal %f %f %f", &normal.x, &normal.y,
-           &normal.z);
-    sscanf(input_line.c_str(), " width %f", &width);
-    sscanf(input_line.c_str(), " height %f", &height);
-  }
-
-  ::std::string object_material(quad_material);
+  float32 width = 0;
+  float32 height = 0;
+  ::std::shared_ptr<DiffuseMaterial> material;
+  ::std::string_view key;
+
+  while (tokens->NextProperty(&key)) {
+    if (key == "material") {
+      ReadMaterialReference(tokens, material_list, &material);
+    } else if (key == "position") {
+      tokens->ReadVector3(&position);
+    } else if (key == "normal") {
+      tokens->ReadVector3(&normal);
+    } else if (key == "width") {
+      tokens->ReadFloat(&width);
+    } else if (key == "height") {
+      tokens->ReadFloat(&height);
+    } else {
+      SkipUnknownProperty(tokens);
+    }
+  }
+  if (tokens->HasError()) {
+    return false;
+  }
+
   ::base::Object* quad_object = AddQuadObject(position, normal, width, height);
 
-  if (quad_object) {
-    if (object_material.length() && material_list->count(object_material)) {
-      quad_object->SetMaterial((*material_list)[object_material]);
-    }
+  if (quad_object && material) {
+    quad_object->SetMaterial(material);
   }
+  return true;
 }
 
-void Scene::ParseCuboid(
-    ::std::ifstream* input_file,
+bool Scene::ParseCuboid(
+    SceneTokenizer* tokens,
     ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
         material_list) {
   vector3 position;
-  float32 width;
-  float32 height;
-  float32 depth;
+  float32 width = 0;
+  float32 height = 0;
+  float32 depth = 0;
   vector4 local_rotation;
-  ::std::string input_line;
-  char cuboid_material[MAX_PATH] = {0};
-
-  while (getline(*input_file, input_line)) {
-    if (strchr(input_line.c_str(), '}')) break;
-    sscanf_s(input_line.c_str(), " material %s", cuboid_material, MAX_PATH);
-    sscanf(input_line.c_str(), " position %f %f %f", &position.x, &position.y,
-           &position.z);
-    sscanf(input_line.c_str(), " width %f", &width);
-    sscanf(input_line.c_str(), " height %f", &height);
-    sscanf(input_line.c_str(), " depth %f", &depth);
-    sscanf(input_line.c_str(), " rotation %f %f %f %f", &local_rotation.x,
-           &local_rotation.y, &local_rotation.z, &local_rotation.w);
-  }
-
-  ::std::string object_material(cuboid_material);
+  ::std::shared_ptr<DiffuseMaterial> material;
+  ::std::string_view key;
+
+  while (tokens->NextProperty(&key)) {
+    if (key == "material") {
+      ReadMaterialReference(tokens, material_list, &material);
+    } else if (key == "position") {
+      tokens->ReadVector3(&position);
+    } else if (key == "width") {
+      tokens->ReadFloat(&width);
+    } else if (key == "height") {
+      tokens->ReadFloat(&height);
+    } else if (key == "depth") {
+      tokens->ReadFloat(&depth);
+    } else if (key == "rotation") {
+      tokens->ReadVector4(&local_rotation);
+    } else {
+      SkipUnknownProperty(tokens);
+    }
+  }
+  if (tokens->HasError()) {
+    return false;
+  }
+
   ::base::CuboidObject* cuboid_object =
       AddCuboidObject(position, width, height, depth);
 
   if (cuboid_object) {
-    if (object_material.length() && material_list->count(object_material)) {
-      cuboid_object->SetMaterial((*material_list)[object_material]);
+    if (material) {
+      cuboid_object->SetMaterial(material);
     }
     cuboid_object->Rotate(vector3(local_rotation), local_rotation.w);
   }
+  return true;
 }
 
-void Scene::ParseMesh(
-    ::std::ifstream* input_file,
+bool Scene::ParseMesh(
+    SceneTokenizer* tokens,
     ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
         material_list) {
-  ::std::string input_line;
-  char mesh_filename[MAX_PATH] = {0};
-  char mesh_material[MAX_PATH] = {0};
+  ::std::string mesh_filename;
   vector3 local_translation;
   vector3 local_scale(1, 1, 1);
   vector4 local_rotation;
-
-  while (getline(*input_file, input_line)) {
-    if (strchr(input_line.c_str(), '}')) break;
-
-    sscanf_s(input_line.c_str(), " file %s", mesh_filename, MAX_PATH);
-    sscanf_s(input_line.c_str(), " material %s", mesh_material, MAX_PATH);
-    sscanf(input_line.c_str(), " translation %f %f %f", &local_translation.x,
-           &local_translation.y, &local_translation.z);
-    sscanf(input_line.c_str(), " scale %f %f %f", &local_scale.x,
-           &local_scale.y, &local_scale.z);
-    sscanf(input_line.c_str(), " rotation %f %f %f %f", &local_rotation.x,
-           &local_rotation.y, &local_rotation.z, &local_rotation.w);
-  }
-
-  if (strlen(mesh_filename)) {
-    ::std::string object_material(mesh_material);
-    ::base::Object* mesh_object =
-        AddMeshObject(::std::string(mesh_filename), false, local_translation,
-                      local_scale, local_rotation);
-    if (mesh_object) {
-      if (object_material.length() && material_list->count(object_material)) {
-        mesh_object->SetMaterial((*material_list)[object_material]);
+  MeshStorage storage = kMeshStorageFull;
+  ::std::string storage_name;
+  ::std::shared_ptr<DiffuseMaterial> material;
+  ::std::string_view key;
+
+  while (tokens->NextProperty(&key)) {
+    if (key == "file") {
+      tokens->ReadString(&mesh_filename);
+    } else if (key == "storage") {
+      tokens->ReadString(&storage_name);
+      if (storage_name == "compact") {
+        storage = kMeshStorageCompact;
+      } else if (storage_name == "quantized") {
+        storage = kMeshStorageQuantized;
+      } else if (storage_name == "streamed") {
+        storage = kMeshStorageStreamed;
+      } else if (storage_name != "full") {
+        tokens->ReportWarning("unknown mesh storage");
       }
+    } else if (key == "material") {
+      ReadMaterialReference(tokens, material_list, &material);
+    } else if (key == "translation") {
+      tokens->ReadVector3(&local_translation);
+    } else if (key == "scale") {
+      tokens->ReadVector3(&local_scale);
+    } else if (key == "rotation") {
+      tokens->ReadVector4(&local_rotation);
+    } else {
+      SkipUnknownProperty(tokens);
     }
   }
+  if (tokens->HasError()) {
+    return false;
+  }
+
+  if (mesh_filename.length()) {
+    QueueMeshLoad(mesh_filename, local_translation, local_scale,
+                  local_rotation, storage, material);
+  }
+  return true;
 }
 
-bool Scene::LoadScene(const ::std::string& filename) {
-  ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>> material_list;
-  ::std::ifstream input_file(filename, ::std::ios::in);
+bool Scene::ParseStreaming(SceneTokenizer* tokens) {
+  uint32 cache_size = kDefaultClusterCacheSize >> 20;
+  uint32 read_ahead = kDefaultClusterReadAhead;
+  ::std::string_view key;
+
+  while (tokens->NextProperty(&key)) {
+    if (key == "cache_size") {
+      tokens->ReadUint(&cache_size);
+    } else if (key == "read_ahead") {
+      tokens->ReadUint(&read_ahead);
+    } else {
+      SkipUnknownProperty(tokens);
+    }
+  }
+  if (tokens->HasError()) {
+    return false;
+  }
+
+  // The cache size is given in megabytes.
+  cluster_cache_.Configure(uint64(cache_size) << 20, read_ahead);
+  return true;
+}
+
+bool Scene::ParseVolume(
+    SceneTokenizer* tokens,
+    ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
+        material_list) {
+  vector3 position;
+  vector3 size(1, 1, 1);
+  uint32 grid_width = 0;
+  uint32 grid_height = 0;
+  uint32 grid_depth = 0;
+  ::std::string grid_filename;
+  ::std::shared_ptr<DiffuseMaterial> material;
+  ::std::string_view key;
+
+  while (tokens->NextProperty(&key)) {
+    if (key == "material") {
+      ReadMaterialReference(tokens, material_list, &material);
+    } else if (key == "position") {
+      tokens->ReadVector3(&position);
+    } else if (key == "size") {
+      tokens->ReadVector3(&size);
+    } else if (key == "grid") {
+      // Raw float32 density grid: grid <filename> <width> <height> <depth>.
+      tokens->ReadString(&grid_filename);
+      tokens->ReadUint(&grid_width);
+      tokens->ReadUint(&grid_height);
+      tokens->ReadUint(&grid_depth);
+    } else {
+      SkipUnknownProperty(tokens);
+    }
+  }
+  if (tokens->HasError()) {
+    return false;
+  }
 
-  if (!input_file.is_open()) {
+  ::base::VolumeObject* volume_object = AddVolumeObject(position, size);
+
+  if (volume_object) {
+    if (material) {
+      volume_object->SetMaterial(material);
+    }
+    if (grid_filename.length()) {
+      volume_object->LoadDensityGrid(grid_filename.c_str(), grid_width,
+                                     grid_height, grid_depth);
+    }
+  }
+  return true;
+}
+
+bool Scene::ParseSceneFile(
+    const ::std::string& filename, bool load_objects, uint64* layout_hash,
+    ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
+        material_list) {
+  MappedFile scene_file;
+  if (!scene_file.Open(filename)) {
     printf("Failed to read scene file %s.\n", filename.c_str());
     return false;
   }
@@ -502,36 +1336,204 @@ bool Scene::LoadScene(const ::std::string& filename) {
   // Simple scene importing inspired by the scene loader from:
   // https://github.com/knightcrawler25/GLSL-PathTracer/.
 
-  ::std::string input_line;
-  while (getline(input_file, input_line)) {
-    if (input_line[0] == '#') continue;
+  SceneTokenizer tokens(scene_file.GetData(), scene_file.GetSize(), filename);
+  ::std::string_view keyword;
+  uint64 layout = kHashSeed;
+
+  while (!tokens.HasError() && tokens.Next(&keyword)) {
+    uint64 block_start = tokens.GetTokenOffset();
+
+    if (keyword == "material") {
+      ::std::string material_name;
+      if (tokens.ReadString(&material_name) && tokens.ExpectBlockStart()) {
+        // Material names are part of the layout, since geometry refers to
+        // them, but their parameters are not.
+        layout = HashBytes(layout, keyword.data(), keyword.size());
+        layout = HashBytes(layout, material_name.data(), material_name.size());
+        ParseMaterial(material_name, &tokens, material_list);
+      }
+      continue;
+    }
+
+    if (keyword != "sphere" && keyword != "camera" && keyword != "sky" &&
+        keyword != "quad" && keyword != "cuboid" && keyword != "mesh" &&
+        keyword != "volume" && keyword != "streaming") {
+      tokens.ReportWarning("unknown block");
+      if (tokens.ExpectBlockStart()) {
+        tokens.SkipBlock();
+      }
+      continue;
+    }
+
+    if (!tokens.ExpectBlockStart()) {
+      break;
+    }
+    if (!load_objects) {
+      tokens.SkipBlock();
+    } else if (keyword == "sphere") {
+      ParseSphere(&tokens, material_list);
+    } else if (keyword == "camera") {
+      ParseCamera(&tokens);
+    } else if (keyword == "sky") {
+      ParseSky(&tokens, material_list);
+    } else if (keyword == "quad") {
+      ParseQuad(&tokens, material_list);
+    } else if (keyword == "cuboid") {
+      ParseCuboid(&tokens, material_list);
+    } else if (keyword == "mesh") {
+      ParseMesh(&tokens, material_list);
+    } else if (keyword == "volume") {
+      ParseVolume(&tokens, material_list);
+    } else if (keyword == "streaming") {
+      ParseStreaming(&tokens);
+    }
+
+    // Everything outside of material blocks is compared when the file is
+    // reloaded.
+    layout = HashBytes(layout, scene_file.GetData() + block_start,
+                       tokens.GetOffset() - block_start);
+  }
+
+  if (tokens.HasError()) {
+    printf("Failed to parse scene file %s.\n", filename.c_str());
+    // Drop the object slots that were reserved for queued meshes.
+    object_list_.erase(
+        ::std::remove(object_list_.begin(), object_list_.end(), nullptr),
+        object_list_.end());
+    mesh_load_tasks_.clear();
+    texture_load_tasks_.clear();
+    return false;
+  }
+
+  // Materials parsed for a reload only decode the textures that changed,
+  // which ReloadMaterials decides.
+  if (load_objects) {
+    CollectTextureBindings(*material_list, &material_textures_);
+    RunLoadTasks(&load_report_);
+  }
+  *layout_hash = layout;
+  return true;
+}
+
+void Scene::CollectTextureBindings(
+    const ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>&
+        material_list,
+    ::std::map<::std::string, TextureBinding>* bindings) const {
+  bindings->clear();
+  for (const auto& task : texture_load_tasks_) {
+    // A material redefined later in the file replaces the earlier one.
+    auto entry = material_list.find(task.material_name);
+    if (entry != material_list.end() && entry->second == task.material) {
+      TextureBinding binding = {task.filename, task.tex_scale, task.is_srgb};
+      (*bindings)[task.material_name] = binding;
+    }
+  }
+}
 
-    char material_name[MAX_PATH] = {0};
+bool Scene::ReloadMaterials(const ::std::string& filename,
+                            bool* requires_rebuild) {
+  *requires_rebuild = false;
+
+  ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>> materials;
+  uint64 layout_hash = 0;
+  if (!ParseSceneFile(filename, false, &layout_hash, &materials)) {
+    return false;
+  }
+  ::std::map<::std::string, TextureBinding> textures;
+  CollectTextureBindings(materials, &textures);
+  bool is_layout_changed = layout_hash != scene_layout_hash_ ||
+                           materials.size() != named_materials_.size();
+  for (auto& entry : materials) {
+    if (!named_materials_.count(entry.first)) {
+      is_layout_changed = true;
+    }
+  }
+  if (is_layout_changed) {
+    texture_load_tasks_.clear();
+    *requires_rebuild = true;
+    return false;
+  }
+
+  // Textures are only decoded again if their source or sampling changed,
+  // or if they previously failed to load. The others stay bound to the
+  // existing materials.
+  ::std::set<::std::string> changed_textures;
+  for (auto& entry : materials) {
+    auto previous = material_textures_.find(entry.first);
+    auto current = textures.find(entry.first);
+    bool has_previous = previous != material_textures_.end();
+    bool has_current = current != textures.end();
+    if (has_previous != has_current ||
+        (has_current && !(previous->second == current->second)) ||
+        (has_current && !named_materials_[entry.first]->GetDiffuseTexture())) {
+      changed_textures.insert(entry.first);
+    }
+  }
+  texture_load_tasks_.erase(
+      ::std::remove_if(texture_load_tasks_.begin(), texture_load_tasks_.end(),
+                       [&](const TextureLoadTask& task) {
+                         return !changed_textures.count(task.material_name) ||
+                                materials[task.material_name] != task.material;
+                       }),
+      texture_load_tasks_.end());
+  RunLoadTasks(nullptr);
+
+  // Objects and the sky hold the existing material instances, so the new
+  // parameters are swapped into them rather than replacing the pointers.
+  for (auto& entry : materials) {
+    named_materials_[entry.first]->SwapParams(
+        entry.second.get(), changed_textures.count(entry.first) != 0);
+  }
+  material_textures_ = textures;
+
+  BuildMaterialTable();
+  BuildLightTree();
+  BuildSkyDistribution();
+  return true;
+}
+
+bool Scene::LoadScene(const ::std::string& filename) {
+  ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>> material_list;
+  auto load_start = ::std::chrono::steady_clock::now();
+  load_report_ = SceneLoadReport();
+  load_report_.filename = filename;
+
+  scene_cache_.Open(filename + ".cache");
+  if (!ParseSceneFile(filename, true, &scene_layout_hash_, &material_list)) {
+    return false;
+  }
+  // Assets are loaded at the end of the parse, and reported separately.
+  load_report_.parse_seconds =
+      GetElapsedSeconds(load_start) - load_report_.asset_seconds;
+  named_materials_ = material_list;
+
+  // The sky texture is loaded after the sky block is parsed, so its
+  // sampling distribution is rebuilt now that it is available.
+  if (sky_material_) {
+    BuildSkyDistribution();
+  }
 
-    if (sscanf_s(input_line.c_str(), " material %s", material_name, MAX_PATH) ==
-        1) {
-      ParseMaterial(material_name, &input_file, &material_list);
-    } else if (strstr(input_line.c_str(), "sphere")) {
-      ParseSphere(&input_file, &material_list);
-    } else if (strstr(input_line.c_str(), "camera")) {
-      ParseCamera(&input_file);
-    } else if (strstr(input_line.c_str(), "sky")) {
-      ParseSky(&input_file, &material_list);
-    } else if (strstr(input_line.c_str(), "quad")) {
-      ParseQuad(&input_file, &material_list);
-    } else if (strstr(input_line.c_str(), "cuboid")) {
-      ParseCuboid(&input_file, &material_list);
-    } else if (strstr(input_line.c_str(), "mesh")) {
-      ParseMesh(&input_file, &material_list);
+  // Textures are recorded once the final set of materials is known.
+  for (auto& entry : named_materials_) {
+    const Texture* texture = entry.second->GetDiffuseTexture();
+    uint64 key = 0;
+    if (texture && SceneCache::ComputeTextureKey(texture->filename, &key)) {
+      scene_cache_.AddTexture(key, texture);
     }
   }
-  input_file.close();
+  scene_cache_.Update();
 
+  auto build_start = ::std::chrono::steady_clock::now();
   Optimize();
+  load_report_.build_seconds = GetElapsedSeconds(build_start);
+  load_report_.total_seconds = GetElapsedSeconds(load_start);
+  load_report_.object_count = object_list_.size();
+  load_report_.light_count = light_list_.size();
+  load_report_.cluster_cache_bytes = cluster_cache_.GetCapacity();
 
   printf("Scene file %s loaded successfully.\n", filename.c_str());
 
   return true;
 }
 
-}  // namespace base
\ No newline at end of file
+}  // namespace base
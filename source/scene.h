@@ -37,10 +37,17 @@
 
 #include "camera.h"
 #include "frame.h"
+#include "light_bvh.h"
 #include "material.h"
 #include "math/base.h"
+#include "math/distribution.h"
 #include "mesh.h"
+#include "mesh_stream.h"
 #include "object.h"
+#include "scene_cache.h"
+#include "scene_report.h"
+#include "scene_tokenizer.h"
+#include "volume.h"
 
 namespace base {
 
@@ -53,11 +60,18 @@ class SceneBvhNode
   explicit SceneBvhNode(SceneBvhNode* parent_node);
   // Called by parent nodes to insert objects by index into a node.
   void AddObject(uint32 index);
+  // Adds an object to every leaf overlapped by object_bounds, subdividing
+  // leaves that grow too large.
+  void InsertObject(uint32 index, const bounds& object_bounds);
+  // Removes an object from every leaf overlapped by object_bounds.
+  void RemoveObject(uint32 index, const bounds& object_bounds);
   // Checks if the node requires subdivision and, if necessary, allocates
   // child nodes and initiates recursive subdivision.
   void Subdivide() override;
   // Traces a ray through the node and returns collision information.
   bool Trace(const ray& trajectory, ObjectCollision* hit_info) const override;
+  // Records the node and its descendants.
+  void Inspect(BvhInspector* inspector) const;
 
  protected:
   friend class SceneBvh;
@@ -83,12 +97,36 @@ class SceneBvh {
   // Defines the maximum allowable depth for this tree. This is
   // computed based on the number of objects in the scene.
   uint32 max_tree_depth_;
+  // Bounds of each object when it was inserted, used to find the leaves
+  // that hold it.
+  ::std::vector<bounds> object_bounds_;
+  // Objects inserted after the build that extend past the root bounds.
+  // These are traced individually.
+  ::std::vector<uint32> unbounded_indices_;
+  // Rebuilds the nodes over every object in tree_objects_, using their
+  // recorded bounds, within root_bounds.
+  void BuildNodes(const bounds& root_bounds, uint32 max_tree_depth);
+  // Rebuilds the tree over enlarged root bounds and a depth limit suited to
+  // the current object count.
+  void Rebuild();
 
  public:
+  // Returns the maximum tree depth suited to a number of objects. Trees are
+  // not worth building for scenes with a depth of zero or less.
+  static int32 GetIdealDepth(uint32 object_count);
   const vector3 GetCenter() const;
   void BuildBvh(::std::vector<::std::unique_ptr<Object>>* data_source,
                 uint32 max_tree_depth = kMaxSubdivisionDepth);
+  // Adds the object at index to a built tree, using its current bounds. The
+  // tree is rebuilt once it is too shallow for the object count, or once too
+  // many objects have been placed outside of its bounds.
+  void InsertObject(uint32 index);
+  // Removes the object at index from a built tree.
+  void RemoveObject(uint32 index);
   bool Trace(const ray& trajectory, ObjectCollision* hit_info) const;
+  // Records every node of a built tree. Objects that were inserted outside
+  // of the root bounds are not part of the tree.
+  void Inspect(BvhInspector* inspector) const;
 };
 
 class Scene {
@@ -96,6 +134,13 @@ class Scene {
   Scene();
   // Loads a scene description from a file (.scene format).
   bool LoadScene(const ::std::string& filename);
+  // Re-reads only the material blocks of a previously loaded scene file and
+  // swaps the new parameters into the existing materials, keeping all
+  // geometry and acceleration structures. If anything other than material
+  // parameters changed (geometry, cameras, or the set of material names),
+  // nothing is modified, requires_rebuild is set and false is returned.
+  // Must not be called while the scene is being traced.
+  bool ReloadMaterials(const ::std::string& filename, bool* requires_rebuild);
   // Loads a mesh object from a file and adds it to the scene.
   // Returns a pointer to the newly added object.
   MeshObject* AddMeshObject(const ::std::string& filename,
@@ -103,7 +148,8 @@ class Scene {
                             const vector3& translation = vector3(0, 0, 0),
                             const vector3& scale = vector3(1, 1, 1),
                             // <x, y, z> is the axis, <w> is the angle.
-                            const vector4& rotation = vector4(0, 0, 0, 0));
+                            const vector4& rotation = vector4(0, 0, 0, 0),
+                            MeshStorage storage = kMeshStorageFull);
   // Adds a spherical object to the scene. Returns a pointer to the new object.
   SphericalObject* AddSphericalObject(const vector3& origin, float32 radius);
   // Adds a disc object to the scene. Returns a pointer to the new object.
@@ -121,6 +167,9 @@ class Scene {
   // and a down-v vector.
   QuadObject* AddQuadObject(const vector3& position, const vector3& u,
                             const vector3& v);
+  // Adds a homogeneous volume of participating media, centered at origin.
+  // The density grid may be replaced through the returned object.
+  VolumeObject* AddVolumeObject(const vector3& origin, const vector3& size);
   // Sets the default sky material for the scene.
   void SetSkyMaterial(::std::shared_ptr<LightMaterial> material);
   // Retrieves the sky material.
@@ -129,19 +178,109 @@ class Scene {
   // Traces a ray through the scene and determines collision info.
   // Returns true if a collision was detected. False otherwise.
   bool Trace(const ray& trajectory, ObjectCollision* hit_info);
+  // Returns the union of the bounds of all scene objects.
+  bounds GetBounds() const;
   // Returns the sky color given a view direction.
   const vector3 SampleSky(uint32 depth, const vector3& view);
+  // Returns true if the sky emits light and can be sampled directly.
+  bool IsSkySamplingEnabled() const { return sky_distribution_.is_valid(); }
+  // Maps (u0, u1) in [0, 1)^2 to a sky direction, distributed in proportion
+  // to sky luminance. pdf receives the solid angle density of the direction.
+  // Returns false if the sky cannot be sampled.
+  bool SampleSkyDirection(float32 u0, float32 u1, vector3* direction,
+                          float32* pdf) const;
+  // Returns the solid angle density of SampleSkyDirection for direction.
+  float32 SkyPdf(const vector3& direction) const;
+  // Returns true if the scene contains participating media.
+  bool HasParticipatingMedia() const { return !media_list_.empty(); }
+  // Returns an estimate of the transmittance through all scene media along
+  // segment. Surfaces are ignored.
+  float32 QueryTransmittance(const ray& segment) const;
+  // Returns true if the scene contains emitters that can be sampled directly.
+  bool IsLightSamplingEnabled() const { return !light_tree_.IsEmpty(); }
+  // Selects an emitter for the shading point using u0 and samples a direction
+  // toward it using (u1, u2). pdf receives the solid angle density of the
+  // direction, including the probability of selecting the emitter. Returns
+  // false if no emitter could be sampled.
+  bool SampleLight(const vector3& point, const vector3& normal, float32 u0,
+                   float32 u1, float32 u2, Object** light,
+                   vector3* direction, float32* distance, float32* pdf) const;
+  // Returns the number of emitters that may be sampled directly.
+  uint32 GetLightCount() const { return light_list_.size(); }
+  // Returns an emitter by index, as reported by Object::GetLightIndex().
+  Object* GetLight(uint32 index) const { return light_list_[index]; }
+  // Returns the number of objects in the scene.
+  uint32 GetObjectCount() const { return object_list_.size(); }
+  // Returns a scene object by index.
+  Object* GetSceneObject(uint32 index) const {
+    return object_list_[index].get();
+  }
+  // Returns the solid angle density of SampleLight producing direction
+  // toward light, which lies at distance along direction.
+  float32 LightPdf(const vector3& point, const vector3& normal,
+                   const Object* light, const vector3& direction,
+                   float32 distance) const;
   // Builds a bvh from the list of allocated scene objects. If the scene
   // contains at least 2 objects, the scene bvh will be used for tracing.
+  // Also rebuilds the material table and light tree.
   void Optimize();
+  // Scene editing. Objects added through the Add methods, and the edits
+  // below, update only the bvh nodes that overlap the object, so a built
+  // tree stays valid. Optimize may be called to rebuild a tree that has
+  // degraded over many edits. None of these may be called while the scene
+  // is being traced.
+  // Removes an object from the scene and destroys it. The last object
+  // takes its place in the object list. Returns false if the object is not
+  // part of the scene.
+  bool RemoveObject(Object* object);
+  // Moves an object by offset. Returns false if the object is not part of
+  // the scene.
+  bool TranslateObject(Object* object, const vector3& offset);
+  // Refreshes the bvh and light tree after an object was changed through
+  // its own interface (e.g. CuboidObject::Rotate or SetMaterial). Returns
+  // false if the object is not part of the scene.
+  bool UpdateObject(Object* object);
+  // Packs the parameters of all materials referenced by scene objects into
+  // a contiguous table, and assigns each material its table index.
+  void BuildMaterialTable();
+  // Collects the emissive objects of the scene and builds the light tree
+  // over them. Must be called after BuildMaterialTable.
+  void BuildLightTree();
+  // Returns the shading parameters for a material, preferring the packed
+  // scene table entry. Materials that are not in the table fall back to
+  // their own parameter block.
+  const MaterialParams& GetMaterialParams(const Material* material) const {
+    uint32 index = material->GetTableIndex();
+    if (index < material_table_.size() &&
+        material_table_[index].id == material->GetID()) {
+      return material_table_[index];
+    }
+    return material->GetParams();
+  }
   // Returns the number of cameras preallocated in the scene.
   uint32 GetCameraCount() { return camera_list_.size(); }
   // Returns a pointer to a scene camera by index.
   Camera* GetCamera(uint32 index);
+  // Returns timings and statistics of the last LoadScene, along with any
+  // meshes added since.
+  const SceneLoadReport& GetLoadReport() const { return load_report_; }
+  // Appends quality statistics for the scene bvh, the light tree and the
+  // bvh of every mesh, for the trees that are in use.
+  void InspectTrees(::std::vector<BvhQualityReport>* reports) const;
 
  private:
+  // Mapped cache of mesh and texture data from previous loads. Declared
+  // first so that it outlives the objects and materials that use it.
+  SceneCache scene_cache_;
+  // Resident clusters of streamed meshes. Declared before the objects so
+  // that their streams are closed first.
+  MeshClusterCache cluster_cache_;
   // The sky material.
   ::std::shared_ptr<LightMaterial> sky_material_;
+  // Luminance distribution over sky texcoords, used to sample sky light.
+  distribution_2d sky_distribution_;
+  // Rebuilds sky_distribution_ from the current sky material.
+  void BuildSkyDistribution();
   // List of cameras that enables scene files to define camera sets. The
   // consumer of this class is still responsible for selecting which camera
   // (if any) to use during a trace.
@@ -150,38 +289,157 @@ class Scene {
   ::std::vector<::std::unique_ptr<Object>> object_list_;
   // The acceleration structure for the scene. Used to speed up traces.
   SceneBvh object_tree_;
-  // Indicates whether the object_tree_ should be used for tracing. Adding
-  // or moving objects in the object_list_ will invalidate the tree until
-  // the next call to Optimize().
+  // Indicates whether the object_tree_ should be used for tracing. Queued
+  // mesh loads invalidate the tree until the next call to Optimize().
   bool is_tree_valid_;
+  // Returns the index of object in object_list_, or object_list_.size().
+  uint32 FindObjectIndex(const Object* object) const;
+  // Adds the object at index to the tree, if the tree is in use.
+  void InsertTreeObject(uint32 index);
+  // Rebuilds the light tree if the object is, or has become, a light.
+  void RefreshLightTree(Object* object, bool was_light);
+  // Packed shading parameters for all materials referenced by the scene,
+  // indexed by Material::GetTableIndex().
+  ::std::vector<MaterialParams> material_table_;
+  // Volume objects in the scene. Also present in object_list_.
+  ::std::vector<VolumeObject*> media_list_;
+  // Emissive objects that may be sampled directly, indexed by
+  // Object::GetLightIndex().
+  ::std::vector<Object*> light_list_;
+  // Importance hierarchy over light_list_.
+  LightBvh light_tree_;
+
+  // Named materials from the scene file, retained for reloading.
+  ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>
+      named_materials_;
+  // Hash of every scene file block outside of materials, used to detect
+  // whether a reload can be limited to materials.
+  uint64 scene_layout_hash_;
 
   // Scene file parsing
-  void ParseMaterial(
-      const char* material_name, ::std::ifstream* input_file,
+  // Tokenizes a memory mapped scene file in a single pass. Material blocks
+  // are always parsed into material_list; other blocks are only built into
+  // the scene if load_objects is set, and are otherwise skipped. The text of
+  // every block outside of materials is hashed into layout_hash. Queued
+  // assets are loaded if load_objects is set; otherwise texture loads are
+  // left queued for the caller. Returns false if the file cannot be read or
+  // contains a syntax error.
+  bool ParseSceneFile(
+      const ::std::string& filename, bool load_objects, uint64* layout_hash,
+      ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
+          material_list);
+  // Asset loading
+  // Scene files are parsed into lists of mesh and texture loads, which then
+  // run concurrently once parsing has finished.
+  typedef struct MeshLoadTask {
+    // Slot in object_list_ reserved for the mesh.
+    uint32 object_index;
+    ::std::string filename;
+    bool invert_normals;
+    vector3 translation;
+    vector3 scale;
+    vector4 rotation;
+    MeshStorage storage;
+    ::std::shared_ptr<DiffuseMaterial> material;
+    // Scene cache key for the mesh, valid if has_cache_key is set.
+    uint64 cache_key;
+    bool has_cache_key;
+    // The loaded mesh, and whether it was found in the scene cache.
+    ::std::unique_ptr<MeshObject> object;
+    bool is_cached;
+    float64 load_seconds;
+    MeshLoadTask()
+        : object_index(0),
+          invert_normals(false),
+          storage(kMeshStorageFull),
+          cache_key(0),
+          has_cache_key(false),
+          is_cached(false),
+          load_seconds(0) {}
+  } MeshLoadTask;
+  typedef struct TextureLoadTask {
+    ::std::shared_ptr<DiffuseMaterial> material;
+    ::std::string filename;
+    float32 tex_scale;
+    bool is_srgb;
+    float64 load_seconds;
+    // Name of material in the scene file.
+    ::std::string material_name;
+  } TextureLoadTask;
+  // Source of a material texture, compared on reload to tell whether the
+  // texture must be decoded again.
+  typedef struct TextureBinding {
+    ::std::string filename;
+    float32 tex_scale;
+    bool is_srgb;
+    bool operator==(const TextureBinding& other) const {
+      return filename == other.filename && tex_scale == other.tex_scale &&
+             is_srgb == other.is_srgb;
+    }
+  } TextureBinding;
+  ::std::vector<MeshLoadTask> mesh_load_tasks_;
+  // Statistics of the loads above.
+  SceneLoadReport load_report_;
+  ::std::vector<TextureLoadTask> texture_load_tasks_;
+  // Texture sources of named_materials_, by material name.
+  ::std::map<::std::string, TextureBinding> material_textures_;
+  // Reserves an object slot for a mesh and queues its load.
+  void QueueMeshLoad(const ::std::string& filename, const vector3& translation,
+                     const vector3& scale, const vector4& rotation,
+                     MeshStorage storage,
+                     ::std::shared_ptr<DiffuseMaterial> material);
+  // Loads a mesh, preferring arrays from the cache, parsing with up to
+  // thread_count threads (zero for one per hardware thread). Thread safe.
+  void RunMeshLoad(MeshLoadTask* task, uint32 thread_count);
+  // Loads a material texture, preferring decoded texels from the cache.
+  // Thread safe for distinct materials.
+  void LoadMaterialTexture(DiffuseMaterial* material,
+                           const ::std::string& filename, float32 tex_scale,
+                           bool is_srgb) const;
+  // Runs all queued loads across the available cores, then installs the
+  // loaded meshes into their reserved slots. Records the loads in report
+  // if it is non-null.
+  void RunLoadTasks(SceneLoadReport* report);
+  // Records the queued texture loads of the materials in material_list,
+  // by material name.
+  void CollectTextureBindings(
+      const ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>&
+          material_list,
+      ::std::map<::std::string, TextureBinding>* bindings) const;
+  // Adds a loaded mesh to report.
+  void ReportMeshLoad(const MeshLoadTask& task, SceneLoadReport* report);
+  // Block parsers. Each is called after the opening brace and consumes
+  // the block up to its closing brace, returning false on a syntax error.
+  bool ParseMaterial(
+      const ::std::string& material_name, SceneTokenizer* tokens,
+      ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
+          material_list);
+  bool ParseSphere(
+      SceneTokenizer* tokens,
       ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
           material_list);
-  void ParseSphere(
-      ::std::ifstream* input_file,
+  bool ParseCamera(SceneTokenizer* tokens);
+  bool ParseSky(
+      SceneTokenizer* tokens,
       ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
-      material_list);
-  void ParseCamera(
-      ::std::ifstream* input_file);
-  void ParseSky(
-      ::std::ifstream* input_file,
+          material_list);
+  bool ParseQuad(
+      SceneTokenizer* tokens,
       ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
-      material_list);
-  void ParseQuad(
-      ::std::ifstream* input_file,
+          material_list);
+  bool ParseCuboid(
+      SceneTokenizer* tokens,
       ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
-      material_list);
-  void ParseCuboid(
-      ::std::ifstream* input_file,
+          material_list);
+  bool ParseMesh(
+      SceneTokenizer* tokens,
       ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
-      material_list);
-  void ParseMesh(
-      ::std::ifstream* input_file,
+          material_list);
+  bool ParseVolume(
+      SceneTokenizer* tokens,
       ::std::map<::std::string, ::std::shared_ptr<DiffuseMaterial>>*
-      material_list);
+          material_list);
+  bool ParseStreaming(SceneTokenizer* tokens);
 };
 
 }  // namespace base
@@ -0,0 +1,491 @@
+
+#include "scene_cache.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace base {
+
+namespace {
+
+const char kSceneCacheMagic[4] = {'F', 'S', 'S', 'C'};
+// Payloads start on cache line boundaries, and arrays within them on 16
+// byte boundaries.
+const uint64 kPayloadAlignment = 64;
+const uint64 kArrayAlignment = 16;
+
+enum SceneCacheEntryType : uint32 {
+  kSceneCacheEntryMesh = 1,
+  kSceneCacheEntryTexture = 2,
+};
+
+typedef struct SceneCacheHeader {
+  char magic[4];
+  uint32 version;
+  // Hash of the sizes of the cached structures, which guards against
+  // caches written by builds with a different layout.
+  uint32 layout_hash;
+  uint32 entry_count;
+} SceneCacheHeader;
+
+// Entries follow the header, sorted by key.
+typedef struct SceneCacheEntry {
+  uint64 key;
+  uint32 type;
+  uint32 reserved;
+  uint64 offset;
+  uint64 size;
+} SceneCacheEntry;
+
+// Mesh arrays, in the order of SceneCacheMesh::offsets.
+enum MeshArray : uint32 {
+  kMeshArrayVertices = 0,
+  kMeshArrayNormals,
+  kMeshArrayTexcoords,
+  kMeshArrayFaces,
+  kMeshArrayNodes,
+  kMeshArrayFaceIndices,
+  kMeshArrayShortIndices,
+  kMeshArrayIndices,
+  kMeshArrayPackedNormals,
+  kMeshArrayPackedTexcoords,
+  kMeshArrayCount,
+};
+
+const uint64 kMeshArrayStrides[kMeshArrayCount] = {
+    sizeof(vector3),  sizeof(vector3),           sizeof(vector2),
+    sizeof(MeshFace), sizeof(MeshBvhPackedNode), sizeof(uint32),
+    sizeof(uint16),   sizeof(uint32),            sizeof(uint32),
+    sizeof(uint32)};
+
+typedef struct SceneCacheMesh {
+  bounds aabb;
+  uint32 counts[kMeshArrayCount];
+  // Range of quantized texcoords.
+  vector2 texcoord_origin;
+  vector2 texcoord_extent;
+  // Absolute file offsets of each array.
+  uint64 offsets[kMeshArrayCount];
+} SceneCacheMesh;
+
+typedef struct SceneCacheTexture {
+  uint32 width;
+  uint32 height;
+  uint32 format;
+  uint32 reserved;
+  uint64 texel_offset;
+  uint64 texel_size;
+} SceneCacheTexture;
+
+uint32 ComputeLayoutHash() {
+  const uint64 sizes[] = {sizeof(SceneCacheEntry), sizeof(SceneCacheMesh),
+                          sizeof(SceneCacheTexture), sizeof(bounds),
+                          sizeof(vector2), sizeof(vector3), sizeof(MeshFace),
+                          sizeof(MeshBvhPackedNode)};
+  return static_cast<uint32>(HashBytes(kHashSeed, sizes, sizeof(sizes)));
+}
+
+uint64 AlignOffset(uint64 offset, uint64 alignment) {
+  return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// Hashes an asset's path, size and modification time.
+bool HashFileStamp(const ::std::string& filename, uint64* hash) {
+  struct stat file_info;
+  if (stat(filename.c_str(), &file_info) != 0) {
+    return false;
+  }
+  int64 stamp[2] = {static_cast<int64>(file_info.st_size),
+                    static_cast<int64>(file_info.st_mtime)};
+  *hash = HashBytes(*hash, filename.data(), filename.size());
+  *hash = HashBytes(*hash, stamp, sizeof(stamp));
+  return true;
+}
+
+// Writes zeros until position is a multiple of alignment.
+bool WritePadding(FILE* output, uint64 alignment, uint64* position) {
+  static const uint8 kZeros[kPayloadAlignment] = {0};
+  uint64 padding = AlignOffset(*position, alignment) - *position;
+  *position += padding;
+  return fwrite(kZeros, 1, padding, output) == padding;
+}
+
+bool WriteBytes(FILE* output, const void* data, uint64 size,
+                uint64* position) {
+  *position += size;
+  return !size || fwrite(data, 1, size, output) == size;
+}
+
+}  // namespace
+
+uint64 HashBytes(uint64 hash, const void* data, uint64 size) {
+  const uint64 kPrime = 0x100000001B3ull;
+  const uint8* bytes = static_cast<const uint8*>(data);
+  uint64 offset = 0;
+  for (; offset + 8 <= size; offset += 8) {
+    uint64 word;
+    memcpy(&word, bytes + offset, 8);
+    hash = (hash ^ word) * kPrime;
+    hash ^= hash >> 29;
+  }
+  for (; offset < size; offset++) {
+    hash = (hash ^ bytes[offset]) * kPrime;
+  }
+  return hash;
+}
+
+SceneCache::SceneCache() : entry_count_(0), is_recording_(false) {}
+
+void SceneCache::Open(const ::std::string& filename) {
+  Close();
+  filename_ = filename;
+  is_recording_ = true;
+
+  ::std::string cache_filename = filename;
+#if defined(BASE_PLATFORM_WINDOWS)
+  // A cache written while the previous one was mapped waits beside it. It
+  // replaces the previous one once no mapping holds that, and is used in
+  // place until then.
+  ::std::string next_filename = filename + ".next";
+  struct stat next_info;
+  if (stat(next_filename.c_str(), &next_info) == 0 &&
+      !MoveFileExA(next_filename.c_str(), filename.c_str(),
+                   MOVEFILE_REPLACE_EXISTING)) {
+    cache_filename = next_filename;
+  }
+#endif
+
+  struct stat file_info;
+  if (stat(cache_filename.c_str(), &file_info) != 0 ||
+      !file_.Open(cache_filename)) {
+    return;
+  }
+
+  SceneCacheHeader header;
+  if (file_.GetSize() < sizeof(header)) {
+    file_.Close();
+    return;
+  }
+  memcpy(&header, file_.GetData(), sizeof(header));
+  if (memcmp(header.magic, kSceneCacheMagic, sizeof(header.magic)) ||
+      header.version != kSceneCacheVersion ||
+      header.layout_hash != ComputeLayoutHash() ||
+      sizeof(header) + uint64(header.entry_count) * sizeof(SceneCacheEntry) >
+          file_.GetSize()) {
+    printf("Ignoring out of date scene cache %s.\n", cache_filename.c_str());
+    file_.Close();
+    return;
+  }
+
+  entry_count_ = header.entry_count;
+}
+
+void SceneCache::Close() {
+  file_.Close();
+  entry_count_ = 0;
+  is_recording_ = false;
+  pending_entries_.clear();
+}
+
+bool SceneCache::ComputeMeshKey(const ::std::string& filename,
+                                bool invert_normals,
+                                const vector3& translation,
+                                const vector3& scale, const vector4& rotation,
+                                MeshStorage storage, uint64* key) {
+  uint64 hash = HashBytes(kHashSeed, &kSceneCacheVersion,
+                          sizeof(kSceneCacheVersion));
+  if (!HashFileStamp(filename, &hash)) {
+    return false;
+  }
+  float32 parameters[11] = {translation.x, translation.y, translation.z,
+                            scale.x,       scale.y,       scale.z,
+                            rotation.x,    rotation.y,    rotation.z,
+                            rotation.w,    invert_normals ? 1.0f : 0.0f};
+  hash = HashBytes(hash, &storage, sizeof(storage));
+  *key = HashBytes(hash, parameters, sizeof(parameters));
+  return true;
+}
+
+bool SceneCache::ComputeTextureKey(const ::std::string& filename,
+                                   uint64* key) {
+  *key = HashBytes(kHashSeed, &kSceneCacheVersion, sizeof(kSceneCacheVersion));
+  return HashFileStamp(filename, key);
+}
+
+bool SceneCache::IsInRange(uint64 offset, uint64 size) const {
+  return offset <= file_.GetSize() && size <= file_.GetSize() - offset;
+}
+
+const uint8* SceneCache::FindEntry(uint64 key, uint32 type,
+                                   uint64* size) const {
+  if (!entry_count_) {
+    return nullptr;
+  }
+  const SceneCacheEntry* entries = reinterpret_cast<const SceneCacheEntry*>(
+      file_.GetData() + sizeof(SceneCacheHeader));
+  const SceneCacheEntry* entry = ::std::lower_bound(
+      entries, entries + entry_count_, key,
+      [](const SceneCacheEntry& lhs, uint64 rhs) { return lhs.key < rhs; });
+  if (entry == entries + entry_count_ || entry->key != key ||
+      entry->type != type || !IsInRange(entry->offset, entry->size)) {
+    return nullptr;
+  }
+  *size = entry->size;
+  return reinterpret_cast<const uint8*>(file_.GetData()) + entry->offset;
+}
+
+bool SceneCache::FindMesh(uint64 key, MeshView* view) const {
+  uint64 size = 0;
+  const uint8* payload = FindEntry(key, kSceneCacheEntryMesh, &size);
+  if (!payload || size < sizeof(SceneCacheMesh)) {
+    return false;
+  }
+
+  const SceneCacheMesh* mesh = reinterpret_cast<const SceneCacheMesh*>(payload);
+  const void* arrays[kMeshArrayCount];
+  for (uint32 i = 0; i < kMeshArrayCount; i++) {
+    if (!IsInRange(mesh->offsets[i], mesh->counts[i] * kMeshArrayStrides[i])) {
+      return false;
+    }
+    arrays[i] = file_.GetData() + mesh->offsets[i];
+  }
+
+  view->aabb = mesh->aabb;
+  view->vertices = static_cast<const vector3*>(arrays[kMeshArrayVertices]);
+  view->vertex_count = mesh->counts[kMeshArrayVertices];
+  view->normals = static_cast<const vector3*>(arrays[kMeshArrayNormals]);
+  view->normal_count = mesh->counts[kMeshArrayNormals];
+  view->texcoords = static_cast<const vector2*>(arrays[kMeshArrayTexcoords]);
+  view->texcoord_count = mesh->counts[kMeshArrayTexcoords];
+  view->faces = static_cast<const MeshFace*>(arrays[kMeshArrayFaces]);
+  view->face_count = mesh->counts[kMeshArrayFaces];
+  view->nodes = static_cast<const MeshBvhPackedNode*>(arrays[kMeshArrayNodes]);
+  view->node_count = mesh->counts[kMeshArrayNodes];
+  view->face_indices =
+      static_cast<const uint32*>(arrays[kMeshArrayFaceIndices]);
+  view->face_index_count = mesh->counts[kMeshArrayFaceIndices];
+  view->short_indices =
+      static_cast<const uint16*>(arrays[kMeshArrayShortIndices]);
+  view->short_index_count = mesh->counts[kMeshArrayShortIndices];
+  view->indices = static_cast<const uint32*>(arrays[kMeshArrayIndices]);
+  view->index_count = mesh->counts[kMeshArrayIndices];
+  view->packed_normals =
+      static_cast<const uint32*>(arrays[kMeshArrayPackedNormals]);
+  view->packed_normal_count = mesh->counts[kMeshArrayPackedNormals];
+  view->packed_texcoords =
+      static_cast<const uint32*>(arrays[kMeshArrayPackedTexcoords]);
+  view->packed_texcoord_count = mesh->counts[kMeshArrayPackedTexcoords];
+  view->texcoord_origin = mesh->texcoord_origin;
+  view->texcoord_extent = mesh->texcoord_extent;
+  return true;
+}
+
+bool SceneCache::FindTexture(uint64 key, Texture* texture) const {
+  uint64 size = 0;
+  const uint8* payload = FindEntry(key, kSceneCacheEntryTexture, &size);
+  if (!payload || size < sizeof(SceneCacheTexture)) {
+    return false;
+  }
+
+  const SceneCacheTexture* cached_texture =
+      reinterpret_cast<const SceneCacheTexture*>(payload);
+  TextureFormat format = static_cast<TextureFormat>(cached_texture->format);
+  if (!IsInRange(cached_texture->texel_offset, cached_texture->texel_size) ||
+      cached_texture->texel_size != uint64(cached_texture->width) *
+                                        cached_texture->height *
+                                        Texture::GetTexelSize(format)) {
+    return false;
+  }
+
+  texture->filename.clear();
+  texture->MapTexels(
+      cached_texture->width, cached_texture->height, format,
+      reinterpret_cast<const uint8*>(file_.GetData()) +
+          cached_texture->texel_offset);
+  return true;
+}
+
+void SceneCache::AddMesh(uint64 key, const MeshView& view) {
+  if (!is_recording_ || !view.node_count) {
+    return;
+  }
+  PendingEntry entry = {key, kSceneCacheEntryMesh, view, nullptr};
+  pending_entries_.push_back(entry);
+}
+
+void SceneCache::AddTexture(uint64 key, const Texture* texture) {
+  if (!is_recording_ || !texture->IsValid()) {
+    return;
+  }
+  PendingEntry entry = {key, kSceneCacheEntryTexture, MeshView(), texture};
+  pending_entries_.push_back(entry);
+}
+
+bool SceneCache::Update() {
+  if (!is_recording_) {
+    return true;
+  }
+  is_recording_ = false;
+
+  // Assets used more than once are stored once.
+  ::std::sort(pending_entries_.begin(), pending_entries_.end(),
+              [](const PendingEntry& lhs, const PendingEntry& rhs) {
+                return lhs.key < rhs.key;
+              });
+  pending_entries_.erase(
+      ::std::unique(pending_entries_.begin(), pending_entries_.end(),
+                    [](const PendingEntry& lhs, const PendingEntry& rhs) {
+                      return lhs.key == rhs.key;
+                    }),
+      pending_entries_.end());
+
+  bool is_current = pending_entries_.size() == entry_count_;
+  for (uint32 i = 0; is_current && i < pending_entries_.size(); i++) {
+    uint64 size = 0;
+    is_current = FindEntry(pending_entries_[i].key, pending_entries_[i].type,
+                           &size) != nullptr;
+  }
+
+  bool result = is_current || Write(filename_);
+  // Pending entries may reference objects that do not outlive the load.
+  pending_entries_.clear();
+  return result;
+}
+
+bool SceneCache::Write(const ::std::string& filename) {
+  // The new cache is written beside the old one and then moved over it, so
+  // that a mapping of the old file (including our own, which pending
+  // entries may point into) remains intact.
+  ::std::string temp_filename = filename + ".tmp";
+  FILE* output = fopen(temp_filename.c_str(), "wb");
+  if (!output) {
+    printf("Failed to write scene cache %s.\n", filename.c_str());
+    return false;
+  }
+
+  // Lay out all payloads before writing anything. The records are value
+  // initialized, so no uninitialized bytes reach the file.
+  ::std::vector<SceneCacheEntry> entries(pending_entries_.size());
+  ::std::vector<SceneCacheMesh> meshes(pending_entries_.size());
+  ::std::vector<SceneCacheTexture> textures(pending_entries_.size());
+  uint64 position = sizeof(SceneCacheHeader) +
+                    entries.size() * sizeof(SceneCacheEntry);
+
+  for (uint32 i = 0; i < pending_entries_.size(); i++) {
+    const PendingEntry& pending = pending_entries_[i];
+    position = AlignOffset(position, kPayloadAlignment);
+    entries[i].key = pending.key;
+    entries[i].type = pending.type;
+    entries[i].reserved = 0;
+    entries[i].offset = position;
+
+    if (pending.type == kSceneCacheEntryMesh) {
+      const MeshView& view = pending.mesh;
+      SceneCacheMesh* mesh = &meshes[i];
+      mesh->aabb = view.aabb;
+      mesh->counts[kMeshArrayVertices] = view.vertex_count;
+      mesh->counts[kMeshArrayNormals] = view.normal_count;
+      mesh->counts[kMeshArrayTexcoords] = view.texcoord_count;
+      mesh->counts[kMeshArrayFaces] = view.face_count;
+      mesh->counts[kMeshArrayNodes] = view.node_count;
+      mesh->counts[kMeshArrayFaceIndices] = view.face_index_count;
+      mesh->counts[kMeshArrayShortIndices] = view.short_index_count;
+      mesh->counts[kMeshArrayIndices] = view.index_count;
+      mesh->counts[kMeshArrayPackedNormals] = view.packed_normal_count;
+      mesh->counts[kMeshArrayPackedTexcoords] = view.packed_texcoord_count;
+      mesh->texcoord_origin = view.texcoord_origin;
+      mesh->texcoord_extent = view.texcoord_extent;
+      position += sizeof(SceneCacheMesh);
+      for (uint32 j = 0; j < kMeshArrayCount; j++) {
+        position = AlignOffset(position, kArrayAlignment);
+        mesh->offsets[j] = position;
+        position += mesh->counts[j] * kMeshArrayStrides[j];
+      }
+    } else {
+      const Texture* texture = pending.texture;
+      SceneCacheTexture* cached_texture = &textures[i];
+      cached_texture->width = texture->width;
+      cached_texture->height = texture->height;
+      cached_texture->format = texture->format;
+      cached_texture->texel_size = uint64(texture->width) * texture->height *
+                                   Texture::GetTexelSize(texture->format);
+      position += sizeof(SceneCacheTexture);
+      position = AlignOffset(position, kArrayAlignment);
+      cached_texture->texel_offset = position;
+      position += cached_texture->texel_size;
+    }
+    entries[i].size = position - entries[i].offset;
+  }
+
+  SceneCacheHeader header;
+  memcpy(header.magic, kSceneCacheMagic, sizeof(header.magic));
+  header.version = kSceneCacheVersion;
+  header.layout_hash = ComputeLayoutHash();
+  header.entry_count = entries.size();
+
+  position = 0;
+  bool result = WriteBytes(output, &header, sizeof(header), &position) &&
+                WriteBytes(output, entries.data(),
+                           entries.size() * sizeof(SceneCacheEntry),
+                           &position);
+
+  for (uint32 i = 0; result && i < pending_entries_.size(); i++) {
+    result = WritePadding(output, kPayloadAlignment, &position);
+    if (pending_entries_[i].type == kSceneCacheEntryMesh) {
+      const MeshView& view = pending_entries_[i].mesh;
+      const void* arrays[kMeshArrayCount] = {
+          view.vertices,      view.normals,       view.texcoords,
+          view.faces,         view.nodes,         view.face_indices,
+          view.short_indices, view.indices,       view.packed_normals,
+          view.packed_texcoords};
+      result = result && WriteBytes(output, &meshes[i], sizeof(meshes[i]),
+                                    &position);
+      for (uint32 j = 0; result && j < kMeshArrayCount; j++) {
+        result = WritePadding(output, kArrayAlignment, &position) &&
+                 WriteBytes(output, arrays[j],
+                            meshes[i].counts[j] * kMeshArrayStrides[j],
+                            &position);
+      }
+    } else {
+      result = result &&
+               WriteBytes(output, &textures[i], sizeof(textures[i]),
+                          &position) &&
+               WritePadding(output, kArrayAlignment, &position) &&
+               WriteBytes(output, pending_entries_[i].texture->texels,
+                          textures[i].texel_size, &position);
+    }
+  }
+
+  result = (fclose(output) == 0) && result;
+
+#if defined(BASE_PLATFORM_WINDOWS)
+  // Windows refuses to replace a file that is mapped, which the old cache
+  // is while any scene loaded from it is alive. The new cache then waits
+  // under another name until the next Open.
+  if (result && !MoveFileExA(temp_filename.c_str(), filename.c_str(),
+                             MOVEFILE_REPLACE_EXISTING)) {
+    ::std::string next_filename = filename + ".next";
+    result = MoveFileExA(temp_filename.c_str(), next_filename.c_str(),
+                         MOVEFILE_REPLACE_EXISTING);
+    if (result) {
+      printf("Wrote scene cache %s, used from the next load.\n",
+             next_filename.c_str());
+      return true;
+    }
+  }
+#else
+  result = result && rename(temp_filename.c_str(), filename.c_str()) == 0;
+#endif
+
+  if (!result) {
+    remove(temp_filename.c_str());
+    printf("Failed to write scene cache %s.\n", filename.c_str());
+    return false;
+  }
+  printf("Wrote scene cache %s (%llu bytes).\n", filename.c_str(),
+         static_cast<unsigned long long>(position));
+  return true;
+}
+
+}  // namespace base
@@ -0,0 +1,115 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __SCENE_CACHE_H__
+#define __SCENE_CACHE_H__
+
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "math/base.h"
+#include "math/vector3.h"
+#include "math/vector4.h"
+#include "mesh.h"
+#include "texture.h"
+
+namespace base {
+
+// Bump whenever the layout of any cached structure changes.
+const uint32 kSceneCacheVersion = 2;
+// Initial value for HashBytes.
+const uint64 kHashSeed = 0xCBF29CE484222325ull;
+
+// Folds bytes into a running 64 bit hash, a word at a time.
+uint64 HashBytes(uint64 hash, const void* data, uint64 size);
+
+// Persistent cache of the parts of a scene that are expensive to build:
+// mesh arrays together with their packed bvh, and decoded textures. The
+// cache file is used in place through a read-only mapping, so a warm start
+// only touches the pages that rendering needs and shares them with any
+// other process rendering the same scene.
+//
+// Entries are keyed by a hash of the source asset's path, size and
+// modification time along with the parameters it was loaded with. Each
+// load records the entries the scene uses, and Update rewrites the file
+// only if that set differs from what the file holds.
+class SceneCache {
+ public:
+  SceneCache();
+  // Maps filename if it is a cache written by this version, and begins
+  // recording the entries used by a load. A missing or incompatible file
+  // leaves the cache empty, so every lookup misses.
+  void Open(const ::std::string& filename);
+  // Unmaps the cache. Objects created from it must be released first.
+  void Close();
+  // Computes entry keys. Returns false if the asset cannot be found.
+  static bool ComputeMeshKey(const ::std::string& filename, bool invert_normals,
+                             const vector3& translation, const vector3& scale,
+                             const vector4& rotation, MeshStorage storage,
+                             uint64* key);
+  static bool ComputeTextureKey(const ::std::string& filename, uint64* key);
+  // Looks up an entry. Views and texels point into the mapping and remain
+  // valid until the cache is closed.
+  bool FindMesh(uint64 key, MeshView* view) const;
+  bool FindTexture(uint64 key, Texture* texture) const;
+  // Records an entry used by the current load. The referenced data must
+  // remain valid until Update.
+  void AddMesh(uint64 key, const MeshView& view);
+  void AddTexture(uint64 key, const Texture* texture);
+  // Ends recording and, if the recorded entries differ from the mapped
+  // file, writes them to the cache file. Returns false if writing failed.
+  bool Update();
+
+ private:
+  typedef struct PendingEntry {
+    uint64 key;
+    uint32 type;
+    MeshView mesh;
+    const Texture* texture;
+  } PendingEntry;
+  // Returns the payload of an entry of the given type, or nullptr.
+  const uint8* FindEntry(uint64 key, uint32 type, uint64* size) const;
+  // Returns true if offset and size lie within the mapping.
+  bool IsInRange(uint64 offset, uint64 size) const;
+  // Writes the pending entries to filename.
+  bool Write(const ::std::string& filename);
+  ::std::string filename_;
+  MappedFile file_;
+  uint32 entry_count_;
+  bool is_recording_;
+  ::std::vector<PendingEntry> pending_entries_;
+};
+
+}  // namespace base
+
+#endif  // __SCENE_CACHE_H__
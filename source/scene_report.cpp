@@ -0,0 +1,316 @@
+#include "scene_report.h"
+#include <algorithm>
+#include <cstdio>
+#include "mesh_stream.h"
+
+namespace base {
+
+namespace {
+
+// Assets listed on the console in each category. The JSON report lists
+// all of them.
+const uint32 kMaxPrintedAssets = 8;
+
+// Memory subsystems, in report order.
+enum MemoryCategory : uint32 {
+  kMemoryVertices = 0,
+  kMemoryAttributes,
+  kMemoryFaces,
+  kMemoryBvhNodes,
+  kMemoryBvhIndices,
+  kMemoryTextures,
+  kMemoryFrameBuffers,
+  kMemoryClusterCache,
+  kMemoryCategoryCount,
+};
+
+const char* kMemoryCategoryNames[kMemoryCategoryCount] = {
+    "vertices",    "attributes", "faces",         "bvh_nodes",
+    "bvh_indices", "textures",   "frame_buffers", "cluster_cache"};
+
+const char* kMeshStorageNames[] = {"full", "compact", "quantized",
+                                   "streamed"};
+
+const char* kTextureFormatNames[] = {"rgb32f", "rgb8", "srgb8", "rgb9e5",
+                                     "rgbe"};
+
+float64 ToMegabytes(uint64 bytes) { return bytes / (1024.0 * 1024.0); }
+
+// Sums the memory of all assets by subsystem, and returns the total.
+uint64 SumMemory(const SceneLoadReport& report,
+                 uint64 totals[kMemoryCategoryCount]) {
+  for (uint32 i = 0; i < kMemoryCategoryCount; i++) {
+    totals[i] = 0;
+  }
+  bool has_streamed_meshes = false;
+  for (const MeshLoadReport& mesh : report.meshes) {
+    totals[kMemoryVertices] += mesh.vertex_bytes;
+    totals[kMemoryAttributes] += mesh.attribute_bytes;
+    totals[kMemoryFaces] += mesh.face_bytes;
+    totals[kMemoryBvhNodes] += mesh.bvh_node_bytes;
+    totals[kMemoryBvhIndices] += mesh.bvh_index_bytes;
+    has_streamed_meshes |= mesh.storage == kMeshStorageStreamed;
+  }
+  for (const TextureLoadReport& texture : report.textures) {
+    totals[kMemoryTextures] += texture.bytes;
+  }
+  totals[kMemoryFrameBuffers] = report.frame_bytes;
+  // Streamed meshes may fill the cache up to its budget.
+  if (has_streamed_meshes) {
+    totals[kMemoryClusterCache] = report.cluster_cache_bytes;
+  }
+
+  uint64 total = 0;
+  for (uint32 i = 0; i < kMemoryCategoryCount; i++) {
+    total += totals[i];
+  }
+  return total;
+}
+
+// Returns the indices of assets ordered from slowest to fastest load.
+template <typename T>
+::std::vector<uint32> SortBySlowest(const ::std::vector<T>& assets) {
+  ::std::vector<uint32> order(assets.size());
+  for (uint32 i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  ::std::stable_sort(order.begin(), order.end(),
+                     [&](uint32 lhs, uint32 rhs) {
+                       return assets[lhs].load_seconds >
+                              assets[rhs].load_seconds;
+                     });
+  return order;
+}
+
+// Writes a JSON string literal.
+void WriteJsonString(FILE* output, const ::std::string& value) {
+  fputc('"', output);
+  for (char character : value) {
+    if (character == '"' || character == '\\') {
+      fputc('\\', output);
+      fputc(character, output);
+    } else if (static_cast<uint8>(character) < 0x20) {
+      fprintf(output, "\\u%04x", static_cast<uint8>(character));
+    } else {
+      fputc(character, output);
+    }
+  }
+  fputc('"', output);
+}
+
+}  // namespace
+
+MeshLoadReport::MeshLoadReport()
+    : storage(kMeshStorageFull),
+      is_cached(false),
+      load_seconds(0),
+      bvh_seconds(0),
+      triangle_count(0),
+      vertex_count(0),
+      vertex_bytes(0),
+      attribute_bytes(0),
+      face_bytes(0),
+      bvh_node_bytes(0),
+      bvh_index_bytes(0) {}
+
+TextureLoadReport::TextureLoadReport()
+    : width(0),
+      height(0),
+      format(kTextureFormatRgb32f),
+      bytes(0),
+      is_cached(false),
+      load_seconds(0) {}
+
+SceneLoadReport::SceneLoadReport()
+    : parse_seconds(0),
+      asset_seconds(0),
+      build_seconds(0),
+      total_seconds(0),
+      object_count(0),
+      light_count(0),
+      cluster_cache_bytes(0),
+      frame_bytes(0) {}
+
+void FillMeshLoadReport(const MeshObject& mesh, MeshLoadReport* report) {
+  report->bvh_seconds = mesh.GetBvhBuildSeconds();
+  const MeshClusterStream* stream = mesh.GetClusterStream();
+  if (stream) {
+    report->triangle_count = stream->GetTriangleCount();
+    report->vertex_count = stream->GetVertexCount();
+    report->bvh_node_bytes = stream->GetResidentSize();
+    return;
+  }
+
+  MeshView view = mesh.GetView();
+  report->triangle_count = view.face_count;
+  if (!view.face_count) {
+    report->triangle_count = (view.short_index_count + view.index_count) / 3;
+  }
+  report->vertex_count = view.vertex_count;
+  report->vertex_bytes = uint64(view.vertex_count) * sizeof(vector3);
+  report->attribute_bytes = uint64(view.normal_count) * sizeof(vector3) +
+                            uint64(view.texcoord_count) * sizeof(vector2) +
+                            uint64(view.packed_normal_count) * sizeof(uint32) +
+                            uint64(view.packed_texcoord_count) * sizeof(uint32);
+  report->face_bytes = uint64(view.face_count) * sizeof(MeshFace) +
+                       uint64(view.short_index_count) * sizeof(uint16) +
+                       uint64(view.index_count) * sizeof(uint32);
+  report->bvh_node_bytes =
+      uint64(view.node_count) * sizeof(MeshBvhPackedNode);
+  report->bvh_index_bytes = uint64(view.face_index_count) * sizeof(uint32);
+}
+
+void FillTextureLoadReport(const Texture& texture, TextureLoadReport* report) {
+  report->filename = texture.filename;
+  report->width = texture.width;
+  report->height = texture.height;
+  report->format = texture.format;
+  if (texture.IsValid()) {
+    report->bytes = uint64(texture.width) * texture.height *
+                    Texture::GetTexelSize(texture.format);
+    report->is_cached = texture.buffer.empty();
+  }
+}
+
+void PrintSceneLoadReport(const SceneLoadReport& report) {
+  uint64 triangle_count = 0;
+  for (const MeshLoadReport& mesh : report.meshes) {
+    triangle_count += mesh.triangle_count;
+  }
+
+  printf("Load report for %s:\n", report.filename.c_str());
+  printf("  Parse %.3fs, assets %.3fs, build %.3fs, total %.3fs.\n",
+         report.parse_seconds, report.asset_seconds, report.build_seconds,
+         report.total_seconds);
+  printf("  %i objects, %i lights, %i meshes (%llu triangles), %i "
+         "textures.\n",
+         report.object_count, report.light_count, (uint32)report.meshes.size(),
+         static_cast<unsigned long long>(triangle_count),
+         (uint32)report.textures.size());
+
+  uint64 totals[kMemoryCategoryCount];
+  uint64 total = SumMemory(report, totals);
+  printf("  Memory:\n");
+  for (uint32 i = 0; i < kMemoryCategoryCount; i++) {
+    if (totals[i]) {
+      printf("    %-14s %10.2f MB\n", kMemoryCategoryNames[i],
+             ToMegabytes(totals[i]));
+    }
+  }
+  printf("    %-14s %10.2f MB\n", "total", ToMegabytes(total));
+
+  ::std::vector<uint32> mesh_order = SortBySlowest(report.meshes);
+  if (mesh_order.size()) {
+    printf("  Slowest meshes:\n");
+  }
+  for (uint32 i = 0; i < mesh_order.size() && i < kMaxPrintedAssets; i++) {
+    const MeshLoadReport& mesh = report.meshes[mesh_order[i]];
+    uint64 bytes = mesh.vertex_bytes + mesh.attribute_bytes +
+                   mesh.face_bytes + mesh.bvh_node_bytes +
+                   mesh.bvh_index_bytes;
+    printf("    %8.3fs (bvh %.3fs) %10llu triangles %9.2f MB %s%s\n",
+           mesh.load_seconds, mesh.bvh_seconds,
+           static_cast<unsigned long long>(mesh.triangle_count),
+           ToMegabytes(bytes), mesh.filename.c_str(),
+           mesh.is_cached ? " (cached)" : "");
+  }
+
+  ::std::vector<uint32> texture_order = SortBySlowest(report.textures);
+  if (texture_order.size()) {
+    printf("  Slowest textures:\n");
+  }
+  for (uint32 i = 0; i < texture_order.size() && i < kMaxPrintedAssets;
+       i++) {
+    const TextureLoadReport& texture = report.textures[texture_order[i]];
+    printf("    %8.3fs %5ix%-5i %-6s %9.2f MB %s%s\n", texture.load_seconds,
+           texture.width, texture.height, kTextureFormatNames[texture.format],
+           ToMegabytes(texture.bytes), texture.filename.c_str(),
+           texture.is_cached ? " (cached)" : "");
+  }
+
+  uint32 hidden_count = 0;
+  if (mesh_order.size() > kMaxPrintedAssets) {
+    hidden_count += mesh_order.size() - kMaxPrintedAssets;
+  }
+  if (texture_order.size() > kMaxPrintedAssets) {
+    hidden_count += texture_order.size() - kMaxPrintedAssets;
+  }
+  if (hidden_count) {
+    printf("  %i more assets in the json report.\n", hidden_count);
+  }
+}
+
+bool WriteSceneLoadReport(const SceneLoadReport& report,
+                          const ::std::string& filename) {
+  FILE* output = fopen(filename.c_str(), "w");
+  if (!output) {
+    printf("Failed to write load report %s.\n", filename.c_str());
+    return false;
+  }
+
+  fprintf(output, "{\n  \"scene\": ");
+  WriteJsonString(output, report.filename);
+  fprintf(output,
+          ",\n  \"seconds\": {\"parse\": %.6f, \"assets\": %.6f, "
+          "\"build\": %.6f, \"total\": %.6f},\n",
+          report.parse_seconds, report.asset_seconds, report.build_seconds,
+          report.total_seconds);
+  fprintf(output, "  \"objects\": %i,\n  \"lights\": %i,\n",
+          report.object_count, report.light_count);
+
+  uint64 totals[kMemoryCategoryCount];
+  uint64 total = SumMemory(report, totals);
+  fprintf(output, "  \"memory\": {");
+  for (uint32 i = 0; i < kMemoryCategoryCount; i++) {
+    fprintf(output, "\"%s\": %llu, ", kMemoryCategoryNames[i],
+            static_cast<unsigned long long>(totals[i]));
+  }
+  fprintf(output, "\"total\": %llu},\n",
+          static_cast<unsigned long long>(total));
+
+  fprintf(output, "  \"meshes\": [");
+  for (uint32 i = 0; i < report.meshes.size(); i++) {
+    const MeshLoadReport& mesh = report.meshes[i];
+    fprintf(output, "%s\n    {\"file\": ", i ? "," : "");
+    WriteJsonString(output, mesh.filename);
+    fprintf(output,
+            ", \"storage\": \"%s\", \"cached\": %s, \"load_seconds\": %.6f, "
+            "\"bvh_seconds\": %.6f, \"triangles\": %llu, \"vertices\": %llu, "
+            "\"bytes\": {\"vertices\": %llu, \"attributes\": %llu, "
+            "\"faces\": %llu, \"bvh_nodes\": %llu, \"bvh_indices\": %llu}}",
+            kMeshStorageNames[mesh.storage],
+            mesh.is_cached ? "true" : "false", mesh.load_seconds,
+            mesh.bvh_seconds,
+            static_cast<unsigned long long>(mesh.triangle_count),
+            static_cast<unsigned long long>(mesh.vertex_count),
+            static_cast<unsigned long long>(mesh.vertex_bytes),
+            static_cast<unsigned long long>(mesh.attribute_bytes),
+            static_cast<unsigned long long>(mesh.face_bytes),
+            static_cast<unsigned long long>(mesh.bvh_node_bytes),
+            static_cast<unsigned long long>(mesh.bvh_index_bytes));
+  }
+  fprintf(output, "%s],\n", report.meshes.size() ? "\n  " : "");
+
+  fprintf(output, "  \"textures\": [");
+  for (uint32 i = 0; i < report.textures.size(); i++) {
+    const TextureLoadReport& texture = report.textures[i];
+    fprintf(output, "%s\n    {\"file\": ", i ? "," : "");
+    WriteJsonString(output, texture.filename);
+    fprintf(output,
+            ", \"width\": %i, \"height\": %i, \"format\": \"%s\", "
+            "\"bytes\": %llu, \"cached\": %s, \"load_seconds\": %.6f}",
+            texture.width, texture.height, kTextureFormatNames[texture.format],
+            static_cast<unsigned long long>(texture.bytes),
+            texture.is_cached ? "true" : "false", texture.load_seconds);
+  }
+  fprintf(output, "%s]\n}\n", report.textures.size() ? "\n  " : "");
+
+  bool result = !ferror(output);
+  result = (fclose(output) == 0) && result;
+  if (!result) {
+    printf("Failed to write load report %s.\n", filename.c_str());
+  }
+  return result;
+}
+
+}  // namespace base
@@ -0,0 +1,122 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __SCENE_REPORT_H__
+#define __SCENE_REPORT_H__
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "math/base.h"
+#include "mesh.h"
+#include "texture.h"
+
+namespace base {
+
+// Statistics of a single mesh load.
+typedef struct MeshLoadReport {
+  ::std::string filename;
+  MeshStorage storage;
+  // True if the mesh arrays were mapped from the scene cache.
+  bool is_cached;
+  // Seconds spent on the whole load, and on building the bvh within it.
+  float64 load_seconds;
+  float64 bvh_seconds;
+  uint64 triangle_count;
+  uint64 vertex_count;
+  // Resident bytes by array group. Streamed meshes only hold their cluster
+  // hierarchy, which is counted as bvh nodes.
+  uint64 vertex_bytes;
+  uint64 attribute_bytes;
+  uint64 face_bytes;
+  uint64 bvh_node_bytes;
+  uint64 bvh_index_bytes;
+  MeshLoadReport();
+} MeshLoadReport;
+
+// Statistics of a single texture load.
+typedef struct TextureLoadReport {
+  ::std::string filename;
+  uint32 width;
+  uint32 height;
+  TextureFormat format;
+  uint64 bytes;
+  // True if the texels were mapped from the scene cache.
+  bool is_cached;
+  float64 load_seconds;
+  TextureLoadReport();
+} TextureLoadReport;
+
+// Summary of a scene load, used to find the assets that make a load slow
+// or large before rendering starts.
+typedef struct SceneLoadReport {
+  ::std::string filename;
+  // Seconds spent parsing the scene file, loading its assets (which run
+  // concurrently), building the scene bvh and light tree, and in total.
+  float64 parse_seconds;
+  float64 asset_seconds;
+  float64 build_seconds;
+  float64 total_seconds;
+  uint32 object_count;
+  uint32 light_count;
+  // Budget of the cache shared by streamed meshes.
+  uint64 cluster_cache_bytes;
+  // Frame buffers are allocated by the caller, which fills this in.
+  uint64 frame_bytes;
+  ::std::vector<MeshLoadReport> meshes;
+  ::std::vector<TextureLoadReport> textures;
+  SceneLoadReport();
+} SceneLoadReport;
+
+// Returns the seconds elapsed since start.
+inline float64 GetElapsedSeconds(
+    const ::std::chrono::steady_clock::time_point& start) {
+  return ::std::chrono::duration<float64>(::std::chrono::steady_clock::now() -
+                                          start)
+      .count();
+}
+
+// Fills the geometry and memory statistics of a loaded mesh.
+void FillMeshLoadReport(const MeshObject& mesh, MeshLoadReport* report);
+// Fills the resolution and memory statistics of a loaded texture.
+void FillTextureLoadReport(const Texture& texture, TextureLoadReport* report);
+
+// Prints timings, memory per subsystem and the slowest assets.
+void PrintSceneLoadReport(const SceneLoadReport& report);
+// Writes the complete report as JSON. Returns false if the file cannot be
+// written.
+bool WriteSceneLoadReport(const SceneLoadReport& report,
+                          const ::std::string& filename);
+
+}  // namespace base
+
+#endif  // __SCENE_REPORT_H__
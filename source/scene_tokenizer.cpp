@@ -0,0 +1,261 @@
+
+#include "scene_tokenizer.h"
+#include <charconv>
+#include <cstdio>
+
+namespace base {
+
+namespace {
+
+enum CharacterClass : uint8 {
+  kCharacterToken = 0,
+  kCharacterSpace,
+  kCharacterNewline,
+  kCharacterComment,
+  kCharacterBrace,
+  kCharacterQuote,
+};
+
+// Classifies every byte up front so that the scanning loops are a single
+// table lookup per character.
+struct CharacterTable {
+  uint8 classes[256];
+  CharacterTable() {
+    for (uint32 i = 0; i < 256; i++) {
+      classes[i] = kCharacterToken;
+    }
+    classes[uint8(' ')] = kCharacterSpace;
+    classes[uint8('\t')] = kCharacterSpace;
+    classes[uint8('\r')] = kCharacterSpace;
+    classes[uint8('\f')] = kCharacterSpace;
+    classes[uint8('\v')] = kCharacterSpace;
+    classes[uint8('\n')] = kCharacterNewline;
+    classes[uint8('#')] = kCharacterComment;
+    classes[uint8('{')] = kCharacterBrace;
+    classes[uint8('}')] = kCharacterBrace;
+    classes[uint8('"')] = kCharacterQuote;
+  }
+};
+
+const CharacterTable kCharacterTable;
+
+inline uint8 ClassifyCharacter(char c) {
+  return kCharacterTable.classes[static_cast<uint8>(c)];
+}
+
+}  // namespace
+
+SceneTokenizer::SceneTokenizer(const char* data, uint64 size,
+                               const ::std::string& source_name)
+    : data_(data),
+      cursor_(data),
+      end_(data + size),
+      source_name_(source_name),
+      token_start_(data),
+      token_line_(1),
+      token_column_(1),
+      line_(1),
+      line_start_(data),
+      has_error_(false) {}
+
+void SceneTokenizer::SkipWhitespace() {
+  while (cursor_ < end_) {
+    uint8 type = ClassifyCharacter(*cursor_);
+    if (type == kCharacterSpace) {
+      cursor_++;
+    } else if (type == kCharacterNewline) {
+      line_++;
+      line_start_ = ++cursor_;
+    } else if (type == kCharacterComment) {
+      while (cursor_ < end_ && *cursor_ != '\n') {
+        cursor_++;
+      }
+    } else {
+      break;
+    }
+  }
+}
+
+void SceneTokenizer::SkipLine() {
+  while (cursor_ < end_ && *cursor_ != '\n' &&
+         ClassifyCharacter(*cursor_) != kCharacterBrace) {
+    cursor_++;
+  }
+}
+
+bool SceneTokenizer::Next(::std::string_view* token) {
+  SkipWhitespace();
+  token_start_ = cursor_;
+  token_line_ = line_;
+  token_column_ = static_cast<uint32>(cursor_ - line_start_) + 1;
+  if (cursor_ >= end_) {
+    *token = ::std::string_view();
+    return false;
+  }
+
+  const char* start = cursor_;
+  uint8 type = ClassifyCharacter(*cursor_);
+  if (type == kCharacterBrace) {
+    cursor_++;
+  } else if (type == kCharacterQuote) {
+    // Quoted tokens end at the closing quote or the end of the line.
+    start = ++cursor_;
+    while (cursor_ < end_ && *cursor_ != '"' && *cursor_ != '\n') {
+      cursor_++;
+    }
+    *token = ::std::string_view(start, cursor_ - start);
+    if (cursor_ < end_ && *cursor_ == '"') {
+      cursor_++;
+    } else {
+      ReportError("unterminated quoted string");
+    }
+    return true;
+  } else {
+    while (cursor_ < end_ && ClassifyCharacter(*cursor_) == kCharacterToken) {
+      cursor_++;
+    }
+  }
+  *token = ::std::string_view(start, cursor_ - start);
+  return true;
+}
+
+bool SceneTokenizer::ExpectBlockStart() {
+  ::std::string_view token;
+  if (!Next(&token) || token != "{") {
+    ReportError("expected '{'");
+    return false;
+  }
+  return true;
+}
+
+bool SceneTokenizer::NextProperty(::std::string_view* key) {
+  if (has_error_) {
+    return false;
+  }
+  if (!Next(key)) {
+    ReportError("unexpected end of file inside block");
+    return false;
+  }
+  if (*key == "}") {
+    return false;
+  }
+  if (*key == "{") {
+    ReportError("expected a property name");
+    return false;
+  }
+  return true;
+}
+
+bool SceneTokenizer::SkipBlock() {
+  uint32 depth = 1;
+  ::std::string_view token;
+  while (Next(&token)) {
+    if (token == "{") {
+      depth++;
+    } else if (token == "}" && !--depth) {
+      return true;
+    }
+  }
+  ReportError("unexpected end of file inside block");
+  return false;
+}
+
+bool SceneTokenizer::ReadFloat(float32* value) {
+  ::std::string_view token;
+  if (!Next(&token) || token == "{" || token == "}") {
+    ReportError("expected a number");
+    return false;
+  }
+  // from_chars rejects an explicit plus sign, which sscanf accepted.
+  const char* first = token.data();
+  const char* last = first + token.size();
+  if (first < last && *first == '+') {
+    first++;
+  }
+  auto result = ::std::from_chars(first, last, *value);
+  if (result.ec != ::std::errc() || result.ptr != last) {
+    ReportError("expected a number");
+    return false;
+  }
+  return true;
+}
+
+bool SceneTokenizer::ReadInt(int32* value) {
+  ::std::string_view token;
+  if (!Next(&token) || token == "{" || token == "}") {
+    ReportError("expected an integer");
+    return false;
+  }
+  const char* first = token.data();
+  const char* last = first + token.size();
+  if (first < last && *first == '+') {
+    first++;
+  }
+  auto result = ::std::from_chars(first, last, *value);
+  if (result.ec != ::std::errc() || result.ptr != last) {
+    ReportError("expected an integer");
+    return false;
+  }
+  return true;
+}
+
+bool SceneTokenizer::ReadUint(uint32* value) {
+  int32 signed_value = 0;
+  if (!ReadInt(&signed_value)) {
+    return false;
+  }
+  if (signed_value < 0) {
+    ReportError("expected a non-negative integer");
+    return false;
+  }
+  *value = signed_value;
+  return true;
+}
+
+bool SceneTokenizer::ReadVector3(vector3* value) {
+  return ReadFloat(&value->x) && ReadFloat(&value->y) && ReadFloat(&value->z);
+}
+
+bool SceneTokenizer::ReadVector4(vector4* value) {
+  return ReadFloat(&value->x) && ReadFloat(&value->y) &&
+         ReadFloat(&value->z) && ReadFloat(&value->w);
+}
+
+bool SceneTokenizer::ReadString(::std::string* value) {
+  ::std::string_view token;
+  if (!Next(&token) || token == "{" || token == "}") {
+    ReportError("expected a name");
+    return false;
+  }
+  value->assign(token.data(), token.size());
+  return true;
+}
+
+void SceneTokenizer::Report(const char* severity, const char* message) {
+  ::std::string_view token(token_start_, cursor_ - token_start_);
+  if (token.size() > 32) {
+    token = token.substr(0, 32);
+  }
+  if (token.empty()) {
+    printf("%s:%u:%u: %s: %s.\n", source_name_.c_str(), token_line_,
+           token_column_, severity, message);
+  } else {
+    printf("%s:%u:%u: %s: %s near '%.*s'.\n", source_name_.c_str(),
+           token_line_, token_column_, severity, message,
+           static_cast<int>(token.size()), token.data());
+  }
+}
+
+void SceneTokenizer::ReportError(const char* message) {
+  // Only the first error is reported, since later ones tend to cascade.
+  if (!has_error_) {
+    Report("error", message);
+  }
+  has_error_ = true;
+}
+
+void SceneTokenizer::ReportWarning(const char* message) {
+  Report("warning", message);
+}
+
+}  // namespace base
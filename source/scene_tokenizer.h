@@ -0,0 +1,104 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __SCENE_TOKENIZER_H__
+#define __SCENE_TOKENIZER_H__
+
+#include <string>
+#include <string_view>
+
+#include "math/base.h"
+#include "math/vector3.h"
+#include "math/vector4.h"
+
+namespace base {
+
+// Single pass tokenizer over scene file text. Tokens are separated by
+// whitespace, braces are always tokens of their own, double quotes group a
+// token that contains spaces, and '#' begins a comment that runs to the end
+// of the line. Tokens are views into the source text, which must outlive the
+// tokenizer. Errors are reported with the line and column of the offending
+// token.
+class SceneTokenizer {
+ public:
+  SceneTokenizer(const char* data, uint64 size,
+                 const ::std::string& source_name);
+  // Reads the next token. Returns false at the end of the input.
+  bool Next(::std::string_view* token);
+  // Reads the next token and reports an error if it is not '{'.
+  bool ExpectBlockStart();
+  // Reads the next property name within a block. Returns false once the
+  // closing '}' has been consumed, or on error.
+  bool NextProperty(::std::string_view* key);
+  // Skips tokens up to and including the '}' that closes the current block.
+  bool SkipBlock();
+  // Skips the remainder of the current line, stopping before any brace.
+  void SkipLine();
+  // Value readers. Each reads one token per component and reports an error
+  // if it is missing or malformed.
+  bool ReadFloat(float32* value);
+  bool ReadInt(int32* value);
+  bool ReadUint(uint32* value);
+  bool ReadVector3(vector3* value);
+  bool ReadVector4(vector4* value);
+  bool ReadString(::std::string* value);
+  // Reports a problem at the most recently read token. Errors are sticky,
+  // so callers may check HasError() once a block has been parsed.
+  void ReportError(const char* message);
+  void ReportWarning(const char* message);
+  bool HasError() const { return has_error_; }
+  // Byte offset of the next unread character, and of the start of the
+  // most recently read token.
+  uint64 GetOffset() const { return cursor_ - data_; }
+  uint64 GetTokenOffset() const { return token_start_ - data_; }
+
+ private:
+  // Advances past whitespace and comments, counting lines.
+  void SkipWhitespace();
+  void Report(const char* severity, const char* message);
+  const char* data_;
+  const char* cursor_;
+  const char* end_;
+  ::std::string source_name_;
+  // Location of the most recently read token.
+  const char* token_start_;
+  uint32 token_line_;
+  uint32 token_column_;
+  // Current line and the offset at which it begins.
+  uint32 line_;
+  const char* line_start_;
+  bool has_error_;
+};
+
+}  // namespace base
+
+#endif  // __SCENE_TOKENIZER_H__
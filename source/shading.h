@@ -0,0 +1,458 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __SHADING_H__
+#define __SHADING_H__
+
+#include "math/base.h"
+#include "math/normal.h"
+#include "math/random.h"
+#include "math/vector2.h"
+#include "math/vector3.h"
+#include "texture.h"
+
+namespace base {
+
+// Type tag used to select a shading kernel for a material.
+enum MaterialType : uint32 {
+  kMaterialTypeDiffuse = 0,
+  kMaterialTypeLight,
+  kMaterialTypeMetal,
+  kMaterialTypeMirror,
+  kMaterialTypeGlass,
+  kMaterialTypeLiquid,
+  kMaterialTypeCeramic,
+  kMaterialTypeGlow,
+  kMaterialTypeFog,
+  kMaterialTypeMedium,
+};
+
+const uint32 kInvalidMaterialIndex = 0xFFFFFFFF;
+const float32 kDiffuseContribThreshold = 0.001f;
+// Lambertian reflectance is scaled so that cosine sampled surfaces keep the
+// brightness of the uniform hemisphere sampling that scenes were lit for.
+const float32 kDiffuseReflectanceScale = 0.5f;
+// Reflectance of the white specular coat of ceramic materials.
+const float32 kCeramicSpecularWeight = 0.2f;
+// Probability of sampling the specular lobe of ceramic materials.
+const float32 kCeramicSpecularProbability = 0.5f;
+
+// Plain parameter block for a material. Scenes pack these into a contiguous
+// table so that shading only needs a switch on the type tag instead of a
+// chain of virtual calls.
+typedef struct MaterialParams {
+  // Selects the shading kernel.
+  MaterialType type;
+  // Globally unique id of the owning material.
+  uint32 id;
+  // The diffuse component of reflected light.
+  vector3 diffuse;
+  // Light emission, or the glow color of glow materials.
+  vector3 emissive;
+  // Metal roughness or ceramic shininess.
+  float32 roughness;
+  // Index of refraction for glass and liquid materials.
+  float32 index;
+  // Probability of reflection for glass and liquid materials.
+  float32 reflectivity;
+  // Glass frostiness, or fog and medium density.
+  float32 frost;
+  // Scaling factor applied to texture coordinates during sampling.
+  float32 texture_scale;
+  // Optional diffuse texture map. Owned by the material, nullptr if none.
+  const Texture* diffuse_map;
+  MaterialParams()
+      : type(kMaterialTypeDiffuse),
+        id(0),
+        roughness(0),
+        index(1),
+        reflectivity(0),
+        frost(0),
+        texture_scale(0),
+        diffuse_map(nullptr) {}
+} MaterialParams;
+
+// Surface and lighting state passed to the shading kernels.
+typedef struct ShadingContext {
+  // Current trace depth.
+  uint32 depth;
+  // The point being shaded.
+  vector3 sample_pos;
+  // Origin and direction of the incoming view ray.
+  vector3 view_pos;
+  vector3 view_dir;
+  // Origin, direction, and color of the indirect light sample.
+  vector3 light_pos;
+  vector3 light_dir;
+  vector3 light_color;
+  // Solid angle density with which light_dir was sampled. Zero if the
+  // direction came from a specular (delta) lobe.
+  float32 light_pdf;
+  // Surface attributes at the sample point.
+  vector3 surface_normal;
+  vector2 surface_texcoords;
+  // True if the view ray originated inside the object.
+  bool is_internal;
+  // True if emitter light was estimated by resampling, which then accounts
+  // for all of it, so emitters reached by light_dir add nothing.
+  bool is_light_resampled;
+  ShadingContext()
+      : depth(0),
+        light_pdf(0),
+        is_internal(false),
+        is_light_resampled(false) {}
+} ShadingContext;
+
+// Returns the luminance of a linear RGB color.
+inline float32 ShadeLuminance(const vector3& color) {
+  return 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+}
+
+// Returns true if the material has non-specular lobes that can be evaluated
+// for arbitrary light directions (see ShadeEvaluate).
+inline bool ShadeCanEvaluate(const MaterialParams& material) {
+  return material.type == kMaterialTypeDiffuse ||
+         material.type == kMaterialTypeMetal ||
+         material.type == kMaterialTypeCeramic ||
+         material.type == kMaterialTypeGlow ||
+         material.type == kMaterialTypeMedium;
+}
+
+// Returns the power heuristic weight (beta = 2) of a sampling strategy with
+// density pdf, combined with another strategy of density other_pdf.
+inline float32 ShadePowerHeuristic(float32 pdf, float32 other_pdf) {
+  float32 pdf2 = pdf * pdf;
+  float32 sum = pdf2 + other_pdf * other_pdf;
+  return sum > 0.0f ? pdf2 / sum : 0.0f;
+}
+
+// Returns the diffuse color at texcoords, using the diffuse map if present.
+inline vector3 ShadeDiffuse(const MaterialParams& material,
+                            const vector2& texcoords) {
+  const Texture* map = material.diffuse_map;
+  if (!map) {
+    return material.diffuse;
+  }
+  uint32 x_tex_coord =
+      (texcoords.x * material.texture_scale * map->width + 0.5f) - 1;
+  uint32 y_tex_coord =
+      (texcoords.y * material.texture_scale * map->height + 0.5f) - 1;
+  return map->Fetch(x_tex_coord % map->width, y_tex_coord % map->height);
+}
+
+// Returns true if the material is light emitting.
+inline bool ShadeIsLight(const MaterialParams& material) {
+  return material.type == kMaterialTypeLight;
+}
+
+// Returns true if the material redirects light by reflection or refraction
+// alone, focusing it into caustics on the surfaces it lights.
+inline bool ShadeIsCausticCaster(const MaterialParams& material) {
+  return material.type == kMaterialTypeMirror ||
+         material.type == kMaterialTypeGlass ||
+         material.type == kMaterialTypeLiquid;
+}
+
+// Returns true if the material can potentially use transmitted light.
+inline bool ShadeWillUseTransmittedLight(const MaterialParams& material) {
+  return material.type == kMaterialTypeGlass ||
+         material.type == kMaterialTypeFog;
+}
+
+// Returns true if the material will use indirect light, given the incident
+// light vector and the object surface normal.
+inline bool ShadeWillUseIndirectLight(const MaterialParams& material,
+                                      const vector3& incident_light,
+                                      const vector3& normal) {
+  switch (material.type) {
+    case kMaterialTypeDiffuse:
+    case kMaterialTypeMetal:
+    case kMaterialTypeCeramic:
+    case kMaterialTypeGlow:
+      return incident_light.dot(normal) > kDiffuseContribThreshold;
+    case kMaterialTypeLight:
+      return false;
+    default:
+      return true;
+  }
+}
+
+// Returns the normalized Phong BRDF about axis for direction.
+inline float32 ShadePhong(const vector3& axis, float32 exponent,
+                          const vector3& direction) {
+  return phong_lobe_pdf(axis, exponent, direction) * (exponent + 2.0f) /
+         (exponent + 1.0f);
+}
+
+// Returns the BSDF multiplied by the cosine term for light arriving from
+// light_dir. Only non-specular lobes can be evaluated, so specular and
+// transmissive materials return zero. Media have no surface and return their
+// albedo scaled phase function.
+inline vector3 ShadeEvaluate(const MaterialParams& material,
+                             const vector3& view_dir, const vector3& normal,
+                             const vector3& light_dir,
+                             const vector2& texcoords) {
+  if (material.type == kMaterialTypeMedium) {
+    // Isotropic phase function, scaled by the single scattering albedo.
+    return material.diffuse * uniform_sphere_pdf();
+  }
+  float32 cos_theta = normal.dot(light_dir);
+  if (cos_theta <= 0.0f) {
+    return vector3();
+  }
+  switch (material.type) {
+    case kMaterialTypeDiffuse:
+      return ShadeDiffuse(material, texcoords) *
+             (kDiffuseReflectanceScale / BASE_PI * cos_theta);
+    case kMaterialTypeMetal: {
+      float32 exponent = roughness_to_phong_exponent(material.roughness);
+      float32 lobe =
+          material.roughness * kDiffuseReflectanceScale / BASE_PI +
+          (1.0f - material.roughness) *
+              ShadePhong(view_dir.reflect(normal), exponent, light_dir);
+      return ShadeDiffuse(material, texcoords) * (lobe * cos_theta);
+    }
+    case kMaterialTypeCeramic:
+    case kMaterialTypeGlow: {
+      float32 exponent = roughness_to_phong_exponent(1.0f - material.roughness);
+      float32 specular = kCeramicSpecularWeight *
+                         ShadePhong(view_dir.reflect(normal), exponent,
+                                    light_dir);
+      vector3 diffuse = ShadeDiffuse(material, texcoords) *
+                        ((1.0f - kCeramicSpecularWeight) *
+                         kDiffuseReflectanceScale / BASE_PI);
+      return (diffuse + vector3(specular, specular, specular)) * cos_theta;
+    }
+    default:
+      return vector3();
+  }
+}
+
+// Returns the solid angle density with which ShadeReflection would produce
+// light_dir. Specular lobes have no density and return zero.
+inline float32 ShadePdf(const MaterialParams& material,
+                        const vector3& view_dir, const vector3& normal,
+                        const vector3& light_dir) {
+  switch (material.type) {
+    case kMaterialTypeDiffuse:
+      return cosine_hemisphere_pdf(normal, light_dir);
+    case kMaterialTypeMedium:
+      return uniform_sphere_pdf();
+    case kMaterialTypeMetal: {
+      float32 exponent = roughness_to_phong_exponent(material.roughness);
+      return material.roughness * cosine_hemisphere_pdf(normal, light_dir) +
+             (1.0f - material.roughness) *
+                 phong_lobe_pdf(view_dir.reflect(normal), exponent, light_dir);
+    }
+    case kMaterialTypeCeramic:
+    case kMaterialTypeGlow: {
+      float32 exponent = roughness_to_phong_exponent(1.0f - material.roughness);
+      return (1.0f - kCeramicSpecularProbability) *
+                 cosine_hemisphere_pdf(normal, light_dir) +
+             kCeramicSpecularProbability *
+                 phong_lobe_pdf(view_dir.reflect(normal), exponent, light_dir);
+    }
+    case kMaterialTypeGlass: {
+      if (material.frost <= 0.0f) {
+        return 0.0f;
+      }
+      vector3 outgoing = view_dir * -1.0f;
+      if (normal.dot(light_dir) > 0.0f) {
+        // Reflection: the microfacet normal is the half vector.
+        vector3 half_vec = (outgoing + light_dir).normalize();
+        float32 o_dot_h = fabs(outgoing.dot(half_vec));
+        if (o_dot_h <= 0.0f) {
+          return 0.0f;
+        }
+        return material.reflectivity *
+               ggx_normal_pdf(normal, material.frost, half_vec) /
+               (4.0f * o_dot_h);
+      }
+      // Refraction (Walter et al. 2007), with index = n_incident / n_exit.
+      vector3 half_vec = (outgoing * material.index + light_dir) * -1.0f;
+      half_vec = half_vec.normalize();
+      if (half_vec.dot(normal) < 0.0f) {
+        half_vec = half_vec * -1.0f;
+      }
+      float32 i_dot_h = outgoing.dot(half_vec);
+      float32 l_dot_h = light_dir.dot(half_vec);
+      float32 denom = material.index * i_dot_h + l_dot_h;
+      if (denom * denom <= 0.0f) {
+        return 0.0f;
+      }
+      return (1.0f - material.reflectivity) *
+             ggx_normal_pdf(normal, material.frost, half_vec) * fabs(l_dot_h) /
+             (denom * denom);
+    }
+    default:
+      return 0.0f;
+  }
+}
+
+// Reflects or refracts view through a surface with the given normal,
+// falling back to reflection under total internal reflection.
+inline vector3 ShadeTransmit(const vector3& view, const vector3& normal,
+                             float32 index) {
+  vector3 refraction = view.refract(normal, index);
+  if (refraction.dot(refraction) <= 0.0f) {
+    return view.reflect(normal);
+  }
+  return refraction;
+}
+
+// Samples a reflection (or transmission) vector from the material's
+// scattering lobes. If pdf is non-null it receives the solid angle density
+// of the returned direction, or zero for specular lobes.
+inline vector3 ShadeReflection(const MaterialParams& material,
+                               const vector3& view, const vector3& normal,
+                               float32* pdf = nullptr) {
+  vector3 direction;
+  switch (material.type) {
+    case kMaterialTypeDiffuse:
+      direction =
+          sample_cosine_hemisphere(normal, random_float(), random_float());
+      break;
+    case kMaterialTypeLight:
+      break;
+    case kMaterialTypeMetal:
+      if (random_float() < material.roughness) {
+        direction =
+            sample_cosine_hemisphere(normal, random_float(), random_float());
+      } else {
+        direction = sample_phong_lobe(
+            view.reflect(normal),
+            roughness_to_phong_exponent(material.roughness), random_float(),
+            random_float());
+      }
+      break;
+    case kMaterialTypeMirror:
+      direction = view.reflect(normal);
+      break;
+    case kMaterialTypeGlass: {
+      vector3 microfacet = normal;
+      if (material.frost > 0.0f) {
+        microfacet = sample_ggx_normal(normal, material.frost, random_float(),
+                                       random_float());
+      }
+      if (random_float() < material.reflectivity) {
+        direction = view.reflect(microfacet);
+      } else {
+        direction = ShadeTransmit(view, microfacet, material.index);
+      }
+      break;
+    }
+    case kMaterialTypeLiquid:
+      if (random_float() < material.reflectivity) {
+        direction = view.reflect(normal);
+      } else {
+        direction = view.refract(normal, material.index);
+      }
+      break;
+    case kMaterialTypeCeramic:
+    case kMaterialTypeGlow:
+      if (random_float() < kCeramicSpecularProbability) {
+        direction = sample_phong_lobe(
+            view.reflect(normal),
+            roughness_to_phong_exponent(1.0f - material.roughness),
+            random_float(), random_float());
+      } else {
+        direction =
+            sample_cosine_hemisphere(normal, random_float(), random_float());
+      }
+      break;
+    case kMaterialTypeFog:
+      direction = view;
+      break;
+    case kMaterialTypeMedium:
+      direction = sample_uniform_sphere(random_float(), random_float());
+      break;
+  }
+  if (pdf) {
+    *pdf = ShadePdf(material, view, normal, direction);
+  }
+  return direction;
+}
+
+// Determines the color of reflected light according to the material
+// properties and the shading context. Non-specular lobes are weighted by
+// BSDF * cos / pdf of the sampled light direction.
+inline vector3 ShadeSample(const MaterialParams& material,
+                           const ShadingContext& context) {
+  switch (material.type) {
+    case kMaterialTypeDiffuse:
+    case kMaterialTypeMetal:
+    case kMaterialTypeCeramic:
+    case kMaterialTypeGlow:
+    case kMaterialTypeMedium: {
+      vector3 output;
+      if (context.light_pdf > 0.0f) {
+        output = ShadeEvaluate(material, context.view_dir,
+                               context.surface_normal, context.light_dir,
+                               context.surface_texcoords) *
+                 context.light_color / context.light_pdf;
+      }
+      if (material.type == kMaterialTypeGlow) {
+        output += material.emissive;
+      }
+      return output;
+    }
+    case kMaterialTypeLight:
+      if (material.diffuse_map) {
+        return ShadeDiffuse(material, context.surface_texcoords);
+      }
+      return material.emissive;
+    case kMaterialTypeMirror:
+    case kMaterialTypeGlass:
+    case kMaterialTypeLiquid:
+      return context.light_color * material.diffuse;
+    case kMaterialTypeFog:
+      // For the first bounce we compute a volumetric fog contribution. For
+      // all further bounces we simply propagate the indirect lighting value.
+      // Fog is calculated as the probability of the ray being absorbed by a
+      // fog particle. The further a ray travels through the fog the higher
+      // this probability.
+      if (0 == context.depth) {
+        float32 dist = context.light_pos.distance(context.sample_pos);
+        float32 threshold =
+            saturate(max(0.0f, (dist * dist) * material.frost * 0.00005f));
+        if (random_float() < threshold) {
+          return material.diffuse;
+        }
+      }
+      return context.light_color;
+  }
+  return vector3();
+}
+
+}  // namespace base
+
+#endif  // __SHADING_H__
@@ -0,0 +1,221 @@
+
+#include "texture.h"
+#include "math/scalar.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define BASE_RGBE_USE_SSE2 (1)
+#endif
+
+namespace base {
+
+const int32 kRgb9e5ExponentBias = 15;
+const int32 kRgb9e5MantissaBits = 9;
+const int32 kRgb9e5MaxExponent = 31;
+const float32 kRgb9e5MaxValue = 65408.0f;
+
+static float32 linear_decode_storage[256];
+static float32 srgb_decode_storage[256];
+static float32 rgb9e5_exponent_storage[32];
+static float32 rgbe_exponent_storage[256];
+
+const float32* kLinearDecodeTable = linear_decode_storage;
+const float32* kSrgbDecodeTable = srgb_decode_storage;
+const float32* kRgb9e5ExponentTable = rgb9e5_exponent_storage;
+const float32* kRgbeExponentTable = rgbe_exponent_storage;
+
+// Populates the decode tables during static initialization so that they are
+// ready before any texture is loaded.
+static struct DecodeTableInitializer {
+  DecodeTableInitializer() {
+    for (uint32 i = 0; i < 256; i++) {
+      float32 value = i / 255.0f;
+      linear_decode_storage[i] = value;
+      srgb_decode_storage[i] =
+          (value <= 0.04045f) ? value / 12.92f
+                              : pow((value + 0.055f) / 1.055f, 2.4f);
+    }
+    for (int32 i = 0; i < 32; i++) {
+      rgb9e5_exponent_storage[i] =
+          ldexp(1.0f, i - kRgb9e5ExponentBias - kRgb9e5MantissaBits);
+    }
+    // A zero exponent is reserved for black texels.
+    rgbe_exponent_storage[0] = 0.0f;
+    for (int32 i = 1; i < 256; i++) {
+      rgbe_exponent_storage[i] = ldexp(1.0f, i - 136);
+    }
+  }
+} decode_table_initializer;
+
+uint32 encode_rgb9e5(const vector3& color) {
+  float32 red = clip_range(color.x, 0.0f, kRgb9e5MaxValue);
+  float32 green = clip_range(color.y, 0.0f, kRgb9e5MaxValue);
+  float32 blue = clip_range(color.z, 0.0f, kRgb9e5MaxValue);
+  float32 max_channel = max(red, max(green, blue));
+
+  if (max_channel <= 0.0f) {
+    return 0;
+  }
+
+  // Select the shared exponent from the largest channel, then bump it if
+  // rounding would overflow the 9 bit mantissa.
+  int32 max_exponent = 0;
+  frexp(max_channel, &max_exponent);
+  int32 exponent =
+      max(-kRgb9e5ExponentBias - 1, max_exponent - 1) + 1 + kRgb9e5ExponentBias;
+  float64 scale = ldexp(1.0, exponent - kRgb9e5ExponentBias -
+                                 kRgb9e5MantissaBits);
+
+  if ((int32)floor(max_channel / scale + 0.5) == (1 << kRgb9e5MantissaBits)) {
+    scale *= 2.0;
+    exponent++;
+  }
+
+  exponent = clip_range(exponent, 0, kRgb9e5MaxExponent);
+  uint32 red_bits = (uint32)floor(red / scale + 0.5);
+  uint32 green_bits = (uint32)floor(green / scale + 0.5);
+  uint32 blue_bits = (uint32)floor(blue / scale + 0.5);
+
+  return (min(red_bits, 0x1FFu)) | (min(green_bits, 0x1FFu) << 9) |
+         (min(blue_bits, 0x1FFu) << 18) | ((uint32)exponent << 27);
+}
+
+void decode_rgbe(const uint8* input, uint32 count, float32* output) {
+  uint32 i = 0;
+#if BASE_RGBE_USE_SSE2
+  // Four texels are decoded per iteration. The exponent scale is gathered
+  // from the lookup table, and the mantissas are widened to 32 bit lanes
+  // before conversion.
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 4 <= count; i += 4) {
+    const uint8* texels = input + i * 4;
+    __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(texels));
+    __m128i low = _mm_unpacklo_epi8(packed, zero);
+    __m128i high = _mm_unpackhi_epi8(packed, zero);
+    __m128 values[4] = {
+        _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)),
+        _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)),
+        _mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)),
+        _mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero))};
+    for (uint32 j = 0; j < 4; j++) {
+      __m128 scale = _mm_set1_ps(kRgbeExponentTable[texels[j * 4 + 3]]);
+      values[j] = _mm_mul_ps(_mm_add_ps(values[j], half), scale);
+    }
+    // The first three texels are written with overlapping 4 wide stores
+    // (each stray lane is overwritten by the next texel), and the last one
+    // is written per channel to stay within the output.
+    float32* texel_output = output + i * 3;
+    _mm_storeu_ps(texel_output + 0, values[0]);
+    _mm_storeu_ps(texel_output + 3, values[1]);
+    _mm_storeu_ps(texel_output + 6, values[2]);
+    float32 last[4];
+    _mm_storeu_ps(last, values[3]);
+    texel_output[9] = last[0];
+    texel_output[10] = last[1];
+    texel_output[11] = last[2];
+  }
+#endif
+  for (; i < count; i++) {
+    vector3 color = decode_rgbe(input + i * 4);
+    output[i * 3 + 0] = color.x;
+    output[i * 3 + 1] = color.y;
+    output[i * 3 + 2] = color.z;
+  }
+}
+
+void encode_rgbe(const vector3& color, uint8* rgbe) {
+  float32 max_channel = max(color.x, max(color.y, color.z));
+
+  if (max_channel < 1.0e-32f) {
+    rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+    return;
+  }
+
+  int32 exponent = 0;
+  float32 scale = frexp(max_channel, &exponent) * 256.0f / max_channel;
+  rgbe[0] = (uint8)(max(0.0f, color.x) * scale);
+  rgbe[1] = (uint8)(max(0.0f, color.y) * scale);
+  rgbe[2] = (uint8)(max(0.0f, color.z) * scale);
+  rgbe[3] = (uint8)clip_range(exponent + 128, 0, 255);
+}
+
+Texture::Texture()
+    : width(0), height(0), format(kTextureFormatRgb32f), texels(nullptr) {}
+
+uint32 Texture::GetTexelSize(TextureFormat texel_format) {
+  switch (texel_format) {
+    case kTextureFormatRgb8:
+    case kTextureFormatSrgb8:
+      return 3;
+    case kTextureFormatRgb9e5:
+    case kTextureFormatRgbe:
+      return 4;
+    default:
+      return 12;
+  }
+}
+
+void Texture::Allocate(uint32 new_width, uint32 new_height,
+                       TextureFormat new_format) {
+  width = new_width;
+  height = new_height;
+  format = new_format;
+  buffer.resize(width * height * GetTexelSize(format));
+  buffer.shrink_to_fit();
+  AttachBuffer();
+}
+
+void Texture::MapTexels(uint32 new_width, uint32 new_height,
+                        TextureFormat new_format, const uint8* new_texels) {
+  Clear();
+  width = new_width;
+  height = new_height;
+  format = new_format;
+  texels = new_texels;
+}
+
+void Texture::Clear() {
+  width = 0;
+  height = 0;
+  buffer.clear();
+  buffer.shrink_to_fit();
+  texels = nullptr;
+}
+
+void Texture::Store(uint32 x, uint32 y, const vector3& color) {
+  uint32 texel_index = y * width + x;
+  switch (format) {
+    case kTextureFormatRgb8: {
+      uint8* texel = &buffer[texel_index * 3];
+      texel[0] = 255.0f * saturate(color.x) + 0.5f;
+      texel[1] = 255.0f * saturate(color.y) + 0.5f;
+      texel[2] = 255.0f * saturate(color.z) + 0.5f;
+    } break;
+    case kTextureFormatSrgb8: {
+      uint8* texel = &buffer[texel_index * 3];
+      for (uint32 i = 0; i < 3; i++) {
+        float32 value = saturate(color[i]);
+        value = (value <= 0.0031308f)
+                    ? value * 12.92f
+                    : 1.055f * pow(value, 1.0f / 2.4f) - 0.055f;
+        texel[i] = 255.0f * value + 0.5f;
+      }
+    } break;
+    case kTextureFormatRgb9e5: {
+      uint32 packed = encode_rgb9e5(color);
+      memcpy(&buffer[texel_index * 4], &packed, sizeof(packed));
+    } break;
+    case kTextureFormatRgbe:
+      encode_rgbe(color, &buffer[texel_index * 4]);
+      break;
+    default: {
+      float32* texel = reinterpret_cast<float32*>(&buffer[texel_index * 12]);
+      texel[0] = color.x;
+      texel[1] = color.y;
+      texel[2] = color.z;
+    } break;
+  }
+}
+
+}  // namespace base
@@ -0,0 +1,160 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include "math/base.h"
+#include "math/vector3.h"
+
+namespace base {
+
+// Storage formats supported by textures. The format is chosen at load time
+// according to the source data, and all texels are decoded on fetch.
+typedef enum TextureFormat {
+  // Three float32 channels per texel (12 bytes).
+  kTextureFormatRgb32f = 0,
+  // Three 8 bit linear channels per texel (3 bytes).
+  kTextureFormatRgb8,
+  // Three 8 bit sRGB encoded channels per texel (3 bytes).
+  kTextureFormatSrgb8,
+  // Shared exponent HDR texels with 9 bit mantissas and a 5 bit
+  // exponent packed into 4 bytes.
+  kTextureFormatRgb9e5,
+  // Radiance RGBE texels with 8 bit mantissas and a shared 8 bit
+  // exponent (4 bytes).
+  kTextureFormatRgbe,
+} TextureFormat;
+
+// Lookup tables used to decode 8 bit channels into float values.
+extern const float32* kLinearDecodeTable;
+extern const float32* kSrgbDecodeTable;
+// Lookup table of 2^(e - 24) for decoding RGB9E5 exponents.
+extern const float32* kRgb9e5ExponentTable;
+// Lookup table of 2^(e - 136) for decoding RGBE exponents.
+extern const float32* kRgbeExponentTable;
+
+typedef struct Texture {
+  // Filename that was used to load the texture
+  ::std::string filename;
+  // Width of the texture, in pixels.
+  uint32 width;
+  // Height of the texture, in pixels.
+  uint32 height;
+  // Storage format of the texel data in buffer.
+  TextureFormat format;
+  // Image buffer that contains the (encoded) texel data.
+  ::std::vector<uint8> buffer;
+  // Texel data read by Fetch. Points into buffer, or at external memory for
+  // mapped textures.
+  const uint8* texels;
+
+  Texture();
+  // Allocates storage for a width x height texture of the given format.
+  void Allocate(uint32 new_width, uint32 new_height, TextureFormat new_format);
+  // Points texels at buffer once it has been filled directly.
+  void AttachBuffer() { texels = buffer.size() ? buffer.data() : nullptr; }
+  // Uses texel data held elsewhere (e.g. in a mapped scene cache), which
+  // must outlive the texture.
+  void MapTexels(uint32 new_width, uint32 new_height, TextureFormat new_format,
+                 const uint8* new_texels);
+  // Releases all texel storage.
+  void Clear();
+  // Returns true if the texture contains texel data.
+  bool IsValid() const { return width && height && texels; }
+  // Returns the size of a single texel, in bytes, for a format.
+  static uint32 GetTexelSize(TextureFormat texel_format);
+  // Encodes color into the storage format and writes it at (x, y).
+  void Store(uint32 x, uint32 y, const vector3& color);
+  // Decodes the texel at (x, y).
+  inline vector3 Fetch(uint32 x, uint32 y) const;
+} Texture;
+
+// Encodes a linear HDR color into a packed RGB9E5 value.
+uint32 encode_rgb9e5(const vector3& color);
+
+// Decodes a packed RGB9E5 value into a linear HDR color.
+inline vector3 decode_rgb9e5(uint32 packed) {
+  float32 scale = kRgb9e5ExponentTable[packed >> 27];
+  return vector3((packed & 0x1FF) * scale, ((packed >> 9) & 0x1FF) * scale,
+                 ((packed >> 18) & 0x1FF) * scale);
+}
+
+// Decodes a single RGBE texel into a linear HDR color.
+inline vector3 decode_rgbe(const uint8* rgbe) {
+  float32 scale = kRgbeExponentTable[rgbe[3]];
+  return vector3((rgbe[0] + 0.5f) * scale, (rgbe[1] + 0.5f) * scale,
+                 (rgbe[2] + 0.5f) * scale);
+}
+
+// Encodes a linear HDR color into an RGBE texel.
+void encode_rgbe(const vector3& color, uint8* rgbe);
+
+// Decodes count RGBE texels into packed float RGB triplets. Uses SSE2 when
+// available, decoding four texels per iteration.
+void decode_rgbe(const uint8* input, uint32 count, float32* output);
+
+inline vector3 Texture::Fetch(uint32 x, uint32 y) const {
+  uint32 texel_index = y * width + x;
+  switch (format) {
+    case kTextureFormatRgb8: {
+      const uint8* texel = &texels[texel_index * 3];
+      return vector3(kLinearDecodeTable[texel[0]],
+                     kLinearDecodeTable[texel[1]],
+                     kLinearDecodeTable[texel[2]]);
+    }
+    case kTextureFormatSrgb8: {
+      const uint8* texel = &texels[texel_index * 3];
+      return vector3(kSrgbDecodeTable[texel[0]], kSrgbDecodeTable[texel[1]],
+                     kSrgbDecodeTable[texel[2]]);
+    }
+    case kTextureFormatRgb9e5: {
+      uint32 packed;
+      memcpy(&packed, &texels[texel_index * 4], sizeof(packed));
+      return decode_rgb9e5(packed);
+    }
+    case kTextureFormatRgbe:
+      return decode_rgbe(&texels[texel_index * 4]);
+    default: {
+      const float32* texel =
+          reinterpret_cast<const float32*>(&texels[texel_index * 12]);
+      return vector3(texel[0], texel[1], texel[2]);
+    }
+  }
+}
+
+}  // namespace base
+
+#endif  // __TEXTURE_H__
@@ -0,0 +1,191 @@
+
+// Checks the approximations in math/fast_math.h against double precision
+// references, sweeping the domain that each function documents, and fails
+// if any documented error bound is exceeded. It is built on its own, from
+// the source directory, once for each implementation:
+//
+//   cl /std:c++17 /O2 /EHsc /I. tools\fast_math_check.cpp
+//   cl /std:c++17 /O2 /EHsc /I. /DBASE_FAST_MATH=0 tools\fast_math_check.cpp
+//
+// The program returns zero when every bound holds.
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include "math/fast_math.h"
+
+namespace base {
+
+const uint32 kAccuracySweepCount = 1 << 22;
+const float64 kReferencePi = 3.14159265358979323846;
+// Angles within this many turns of zero are held to the sincos bound.
+const float64 kSinCosTurnCount = 2.0;
+
+// Tracks the largest error of one function over a sweep.
+typedef struct AccuracyCheck {
+  const char* name;
+  // Documented bound, and whether it is relative to the reference.
+  float64 bound;
+  bool is_relative;
+  float64 max_error;
+  // Error divided by the bound allowed at that input, so that bounds that
+  // vary with the input can share a single pass/fail test.
+  float64 max_ratio;
+  float64 worst_input[2];
+  uint64 sample_count;
+} AccuracyCheck;
+
+AccuracyCheck CreateCheck(const char* name, float64 bound, bool is_relative) {
+  AccuracyCheck check = AccuracyCheck();
+  check.name = name;
+  check.bound = bound;
+  check.is_relative = is_relative;
+  return check;
+}
+
+// Records the error of value against reference, allowing up to bound.
+void RecordError(AccuracyCheck* check, float64 value, float64 reference,
+                 float64 bound, float64 input0, float64 input1 = 0.0) {
+  float64 error = fabs(value - reference);
+  if (check->is_relative) {
+    error /= fabs(reference);
+  }
+  float64 ratio = error / bound;
+  check->sample_count++;
+  check->max_error = fmax(check->max_error, error);
+  if (!(ratio <= check->max_ratio)) {
+    check->max_ratio = ratio;
+    check->worst_input[0] = input0;
+    check->worst_input[1] = input1;
+  }
+}
+
+// Returns the i-th of count evenly spaced values in [start, stop].
+inline float64 SweepValue(uint32 i, uint32 count, float64 start,
+                          float64 stop) {
+  return start + (stop - start) * i / (count - 1);
+}
+
+AccuracyCheck CheckAtan2() {
+  AccuracyCheck check = CreateCheck("fast_atan2", 1.0e-5, false);
+  // Every direction, at radii that span the float range.
+  const float64 radii[] = {1.0e-30, 1.0e-3, 1.0, 7.5, 1.0e4, 1.0e30};
+  for (float64 radius : radii) {
+    uint32 count = kAccuracySweepCount / 8;
+    for (uint32 i = 0; i < count; i++) {
+      float64 angle = SweepValue(i, count, -kReferencePi, kReferencePi);
+      float32 y = float32(radius * sin(angle));
+      float32 x = float32(radius * cos(angle));
+      RecordError(&check, fast_atan2(y, x), atan2(float64(y), float64(x)),
+                  check.bound, y, x);
+    }
+  }
+  RecordError(&check, fast_atan2(0.0f, 0.0f), 0.0, check.bound, 0.0, 0.0);
+  return check;
+}
+
+AccuracyCheck CheckAcos() {
+  AccuracyCheck check = CreateCheck("fast_acos", 7.0e-5, false);
+  for (uint32 i = 0; i < kAccuracySweepCount; i++) {
+    float32 x = float32(SweepValue(i, kAccuracySweepCount, -1.0, 1.0));
+    RecordError(&check, fast_acos(x), acos(float64(x)), check.bound, x);
+  }
+  return check;
+}
+
+AccuracyCheck CheckSinCos() {
+  AccuracyCheck check = CreateCheck("fast_sincos", 1.0e-6, false);
+  float64 limit = kSinCosTurnCount * 2.0 * kReferencePi;
+  for (uint32 i = 0; i < kAccuracySweepCount; i++) {
+    float32 angle = float32(SweepValue(i, kAccuracySweepCount, -limit, limit));
+    float32 sine = 0.0f;
+    float32 cosine = 0.0f;
+    fast_sincos(angle, &sine, &cosine);
+    RecordError(&check, sine, sin(float64(angle)), check.bound, angle);
+    RecordError(&check, cosine, cos(float64(angle)), check.bound, angle);
+    RecordError(&check, fast_sin(angle), sin(float64(angle)), check.bound,
+                angle);
+    RecordError(&check, fast_cos(angle), cos(float64(angle)), check.bound,
+                angle);
+  }
+  return check;
+}
+
+AccuracyCheck CheckLog2() {
+  AccuracyCheck check = CreateCheck("fast_log2", 1.0e-6, false);
+  // Every binade of normal floats, each swept across its mantissas.
+  for (int32 exponent = -126; exponent < 128; exponent++) {
+    uint32 count = kAccuracySweepCount / 256;
+    for (uint32 i = 0; i < count; i++) {
+      float32 x = float32(ldexp(SweepValue(i, count, 1.0, 2.0), exponent));
+      if (x > FLT_MAX) {
+        continue;
+      }
+      float64 reference = log2(float64(x));
+      // The result is a float, so it is also allowed its own rounding.
+      float32 rounded = float32(fabs(reference));
+      float64 rounding = 0.5 * (nextafterf(rounded, FLT_MAX) - rounded);
+      RecordError(&check, fast_log2(x), reference, check.bound + rounding, x);
+    }
+  }
+  return check;
+}
+
+AccuracyCheck CheckExp2() {
+  AccuracyCheck check = CreateCheck("fast_exp2", 4.0e-6, true);
+  for (uint32 i = 0; i < kAccuracySweepCount; i++) {
+    float32 x = float32(SweepValue(i, kAccuracySweepCount, -126.0, 127.99));
+    float64 reference = exp2(float64(x));
+    // Results below the normal range are flushed to zero.
+    if (reference < FLT_MIN) {
+      continue;
+    }
+    RecordError(&check, fast_exp2(x), reference, check.bound, x);
+  }
+  return check;
+}
+
+AccuracyCheck CheckPow() {
+  AccuracyCheck check = CreateCheck("fast_pow", 4.0e-6, true);
+  uint32 count = 2048;
+  for (uint32 i = 0; i < count; i++) {
+    float32 x = float32(exp2(SweepValue(i, count, -40.0, 40.0)));
+    for (uint32 j = 0; j < count; j++) {
+      float32 y = float32(SweepValue(j, count, -16.0, 16.0));
+      float64 reference = pow(float64(x), float64(y));
+      if (reference < FLT_MIN || reference > FLT_MAX) {
+        continue;
+      }
+      float64 exponent = fabs(y * log2(float64(x)));
+      RecordError(&check, fast_pow(x, y), reference,
+                  check.bound + 1.0e-6 * fabs(y) + 1.0e-7 * exponent, x, y);
+    }
+  }
+  // Non-positive bases return zero.
+  RecordError(&check, fast_pow(0.0f, 2.0f) + 1.0, 1.0, check.bound, 0.0, 2.0);
+  RecordError(&check, fast_pow(-1.0f, 2.0f) + 1.0, 1.0, check.bound, -1.0,
+              2.0);
+  return check;
+}
+
+}  // namespace base
+
+int main() {
+  base::AccuracyCheck checks[] = {
+      base::CheckAtan2(), base::CheckAcos(), base::CheckSinCos(),
+      base::CheckLog2(),  base::CheckExp2(), base::CheckPow()};
+
+  printf("fast math accuracy (BASE_FAST_MATH = %i)\n", BASE_FAST_MATH);
+  int failure_count = 0;
+  for (const base::AccuracyCheck& check : checks) {
+    bool is_passing = check.max_ratio <= 1.0;
+    failure_count += !is_passing;
+    printf("  %-12s %s max %s error %.3g (base bound %.3g), %.2f of bound at "
+           "(%g, %g), %llu samples\n",
+           check.name, is_passing ? "ok  " : "FAIL",
+           check.is_relative ? "relative" : "absolute", check.max_error,
+           check.bound, check.max_ratio, check.worst_input[0],
+           check.worst_input[1], (unsigned long long)check.sample_count);
+  }
+  return failure_count ? 1 : 0;
+}
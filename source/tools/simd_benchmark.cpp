@@ -0,0 +1,187 @@
+
+// Compares vector3 with the SIMD types in math/simd.h (vector3a and
+// vector3x8) on dot, cross, normalize and multiply-add over large arrays.
+// It is built on its own, from the source directory:
+//
+//   cl /std:c++17 /O2 /EHsc /arch:AVX2 /I. tools\simd_benchmark.cpp
+//
+// Leave out /arch:AVX2 to measure the SSE2 path.
+// Pass an iteration count to change the number of passes over the data.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "math/simd.h"
+
+namespace base {
+
+const uint32 kBenchmarkVectorCount = 1 << 20;
+const uint32 kBenchmarkLaneCount = 8;
+const uint32 kDefaultPassCount = 20;
+
+#if BASE_SIMD_AVX
+const char* kSimdPathName = "avx";
+#elif BASE_SIMD_SSE2
+const char* kSimdPathName = "sse2";
+#else
+const char* kSimdPathName = "scalar";
+#endif
+
+// Input data, held once per layout so that conversion is not timed.
+typedef struct BenchmarkData {
+  ::std::vector<vector3> a, b, c;
+  ::std::vector<float32> s;
+  ::std::vector<vector3a> aligned_a, aligned_b, aligned_c;
+  ::std::vector<vector3x8> packed_a, packed_b, packed_c;
+  ::std::vector<float32x8> packed_s;
+} BenchmarkData;
+
+// Fills the inputs with deterministic values in [-1, 1].
+void InitializeBenchmarkData(BenchmarkData* data) {
+  srand(1);
+  auto next_value = []() { return rand() * 2.0f / RAND_MAX - 1.0f; };
+  uint32 count = kBenchmarkVectorCount;
+  for (::std::vector<vector3>* input : {&data->a, &data->b, &data->c}) {
+    input->resize(count);
+    for (vector3& value : *input) {
+      value = vector3(next_value(), next_value(), next_value());
+    }
+  }
+  data->s.resize(count);
+  for (float32& value : data->s) {
+    value = next_value();
+  }
+
+  data->aligned_a.resize(count);
+  data->aligned_b.resize(count);
+  data->aligned_c.resize(count);
+  for (uint32 i = 0; i < count; i++) {
+    data->aligned_a[i] = vector3a(data->a[i]);
+    data->aligned_b[i] = vector3a(data->b[i]);
+    data->aligned_c[i] = vector3a(data->c[i]);
+  }
+
+  uint32 packed_count = count / kBenchmarkLaneCount;
+  data->packed_a.resize(packed_count);
+  data->packed_b.resize(packed_count);
+  data->packed_c.resize(packed_count);
+  data->packed_s.resize(packed_count);
+  for (uint32 i = 0; i < packed_count; i++) {
+    uint32 first = i * kBenchmarkLaneCount;
+    data->packed_a[i] = vector3x8::load(&data->a[first]);
+    data->packed_b[i] = vector3x8::load(&data->b[first]);
+    data->packed_c[i] = vector3x8::load(&data->c[first]);
+    data->packed_s[i] = float32x8::load(&data->s[first]);
+  }
+}
+
+// Sums a vector3 into a checksum, so that results cannot be optimized away.
+inline float32 Checksum(const vector3& value) {
+  return value.x + value.y + value.z;
+}
+
+inline float32 Checksum(const float32x8& value) {
+  float32 sum = 0.0f;
+  for (uint32 i = 0; i < kBenchmarkLaneCount; i++) {
+    sum += value.v[i];
+  }
+  return sum;
+}
+
+inline float32 Checksum(const vector3x8& value) {
+  return Checksum(value.x + value.y + value.z);
+}
+
+// Runs kernel(i) over every element, pass_count times, and reports the
+// average time per vector.
+template <class Kernel>
+void RunBenchmark(const char* name, uint32 pass_count, uint32 element_count,
+                  uint32 vectors_per_element, Kernel kernel) {
+  float64 checksum = 0.0;
+  auto start = ::std::chrono::steady_clock::now();
+  for (uint32 pass = 0; pass < pass_count; pass++) {
+    for (uint32 i = 0; i < element_count; i++) {
+      checksum += kernel(i);
+    }
+  }
+  ::std::chrono::duration<float64> elapsed =
+      ::std::chrono::steady_clock::now() - start;
+  float64 vector_count =
+      float64(pass_count) * element_count * vectors_per_element;
+  printf("  %-10s %8.3f ns/vector  (checksum %g)\n", name,
+         elapsed.count() * 1.0e9 / vector_count, checksum);
+}
+
+void RunBenchmarks(const BenchmarkData& data, uint32 pass_count) {
+  uint32 count = kBenchmarkVectorCount;
+  uint32 packed_count = count / kBenchmarkLaneCount;
+
+  printf("dot\n");
+  RunBenchmark("vector3", pass_count, count, 1, [&](uint32 i) {
+    return data.a[i].dot(data.b[i]);
+  });
+  RunBenchmark("vector3a", pass_count, count, 1, [&](uint32 i) {
+    return data.aligned_a[i].dot(data.aligned_b[i]);
+  });
+  RunBenchmark("vector3x8", pass_count, packed_count, kBenchmarkLaneCount,
+               [&](uint32 i) {
+                 return Checksum(data.packed_a[i].dot(data.packed_b[i]));
+               });
+
+  printf("cross\n");
+  RunBenchmark("vector3", pass_count, count, 1, [&](uint32 i) {
+    return Checksum(data.a[i].cross(data.b[i]));
+  });
+  RunBenchmark("vector3a", pass_count, count, 1, [&](uint32 i) {
+    return Checksum(data.aligned_a[i].cross(data.aligned_b[i]).to_vector3());
+  });
+  RunBenchmark("vector3x8", pass_count, packed_count, kBenchmarkLaneCount,
+               [&](uint32 i) {
+                 return Checksum(data.packed_a[i].cross(data.packed_b[i]));
+               });
+
+  printf("normalize\n");
+  RunBenchmark("vector3", pass_count, count, 1, [&](uint32 i) {
+    return Checksum(data.a[i].normalize());
+  });
+  RunBenchmark("vector3a", pass_count, count, 1, [&](uint32 i) {
+    return Checksum(data.aligned_a[i].normalize().to_vector3());
+  });
+  RunBenchmark("vector3x8", pass_count, packed_count, kBenchmarkLaneCount,
+               [&](uint32 i) {
+                 return Checksum(data.packed_a[i].normalize());
+               });
+
+  printf("multiply-add (a * s + c)\n");
+  RunBenchmark("vector3", pass_count, count, 1, [&](uint32 i) {
+    return Checksum(data.a[i] * data.s[i] + data.c[i]);
+  });
+  RunBenchmark("vector3a", pass_count, count, 1, [&](uint32 i) {
+    vector3a scale(data.s[i], data.s[i], data.s[i]);
+    return Checksum(
+        madd(data.aligned_a[i], scale, data.aligned_c[i]).to_vector3());
+  });
+  RunBenchmark("vector3x8", pass_count, packed_count, kBenchmarkLaneCount,
+               [&](uint32 i) {
+                 return Checksum(madd(data.packed_a[i], data.packed_s[i],
+                                      data.packed_c[i]));
+               });
+}
+
+}  // namespace base
+
+int main(int argc, char** argv) {
+  base::uint32 pass_count = base::kDefaultPassCount;
+  if (argc > 1) {
+    pass_count = atoi(argv[1]);
+  }
+
+  printf("simd benchmark: %u vectors, %u passes, %s path\n",
+         base::kBenchmarkVectorCount, pass_count, base::kSimdPathName);
+
+  base::BenchmarkData data;
+  base::InitializeBenchmarkData(&data);
+  base::RunBenchmarks(data, pass_count);
+  return 0;
+}
@@ -0,0 +1,371 @@
+
+#include "volume.h"
+#include <cstdio>
+#include "math/random.h"
+#include "material.h"
+
+namespace base {
+
+// Resolution cap of the majorant grid along each axis.
+const uint32 kMaxMajorantGridSize = 16;
+// Ratio tracking applies russian roulette below this transmittance.
+const float32 kTransmittanceRouletteThreshold = 0.1f;
+
+DensityGrid::DensityGrid() : width_(1), height_(1), depth_(1) {
+  densities_.resize(1, 1.0f);
+}
+
+bool DensityGrid::Initialize(const float32* densities, uint32 width,
+                             uint32 height, uint32 depth) {
+  if (BASE_PARAM_CHECK) {
+    if (!densities || !width || !height || !depth) {
+      return false;
+    }
+  }
+
+  densities_.assign(densities, densities + width * height * depth);
+  for (auto& density : densities_) {
+    // Negative densities have no physical meaning and would break the
+    // majorant bound.
+    density = max(density, 0.0f);
+  }
+  width_ = width;
+  height_ = height;
+  depth_ = depth;
+  return true;
+}
+
+bool DensityGrid::Load(const ::std::string& filename, uint32 width,
+                       uint32 height, uint32 depth) {
+  if (!width || !height || !depth) {
+    printf("Invalid density grid dimensions for file %s.\n",
+           filename.c_str());
+    return false;
+  }
+
+  FILE* input_file = fopen(filename.c_str(), "rb");
+  if (!input_file) {
+    printf("Failed to open density grid file %s.\n", filename.c_str());
+    return false;
+  }
+
+  ::std::vector<float32> densities(width * height * depth);
+  size_t read_count =
+      fread(&densities[0], sizeof(float32), densities.size(), input_file);
+  fclose(input_file);
+
+  if (read_count != densities.size()) {
+    printf("Unexpected end of density grid file %s.\n", filename.c_str());
+    return false;
+  }
+
+  return Initialize(&densities[0], width, height, depth);
+}
+
+float32 DensityGrid::Sample(const vector3& local) const {
+  float32 gx = saturate(local.x) * (width_ - 1);
+  float32 gy = saturate(local.y) * (height_ - 1);
+  float32 gz = saturate(local.z) * (depth_ - 1);
+  uint32 x0 = min(uint32(gx), width_ - 1);
+  uint32 y0 = min(uint32(gy), height_ - 1);
+  uint32 z0 = min(uint32(gz), depth_ - 1);
+  uint32 x1 = min(x0 + 1, width_ - 1);
+  uint32 y1 = min(y0 + 1, height_ - 1);
+  uint32 z1 = min(z0 + 1, depth_ - 1);
+  float32 fx = gx - x0;
+  float32 fy = gy - y0;
+  float32 fz = gz - z0;
+
+  float32 d00 = Fetch(x0, y0, z0) * (1.0f - fx) + Fetch(x1, y0, z0) * fx;
+  float32 d10 = Fetch(x0, y1, z0) * (1.0f - fx) + Fetch(x1, y1, z0) * fx;
+  float32 d01 = Fetch(x0, y0, z1) * (1.0f - fx) + Fetch(x1, y0, z1) * fx;
+  float32 d11 = Fetch(x0, y1, z1) * (1.0f - fx) + Fetch(x1, y1, z1) * fx;
+  float32 d0 = d00 * (1.0f - fy) + d10 * fy;
+  float32 d1 = d01 * (1.0f - fy) + d11 * fy;
+  return d0 * (1.0f - fz) + d1 * fz;
+}
+
+float32 DensityGrid::QueryMaxDensity(const vector3& local_min,
+                                     const vector3& local_max) const {
+  // Interpolated values never exceed the vertices that surround them, so
+  // the maximum over all vertices touching the box is a safe bound.
+  uint32 x_begin = min(uint32(saturate(local_min.x) * (width_ - 1)),
+                       width_ - 1);
+  uint32 y_begin = min(uint32(saturate(local_min.y) * (height_ - 1)),
+                       height_ - 1);
+  uint32 z_begin = min(uint32(saturate(local_min.z) * (depth_ - 1)),
+                       depth_ - 1);
+  uint32 x_end = min(uint32(ceilf(saturate(local_max.x) * (width_ - 1))),
+                     width_ - 1);
+  uint32 y_end = min(uint32(ceilf(saturate(local_max.y) * (height_ - 1))),
+                     height_ - 1);
+  uint32 z_end = min(uint32(ceilf(saturate(local_max.z) * (depth_ - 1))),
+                     depth_ - 1);
+
+  float32 max_density = 0.0f;
+  for (uint32 z = z_begin; z <= z_end; z++) {
+    for (uint32 y = y_begin; y <= y_end; y++) {
+      for (uint32 x = x_begin; x <= x_end; x++) {
+        max_density = max(max_density, Fetch(x, y, z));
+      }
+    }
+  }
+  return max_density;
+}
+
+VolumeObject::VolumeObject(const vector3& origin, const vector3& size) {
+  aabb_ += origin - size * 0.5f;
+  aabb_ += origin + size * 0.5f;
+  BuildMajorants();
+}
+
+bool VolumeObject::SetDensityGrid(const float32* densities, uint32 width,
+                                  uint32 height, uint32 depth) {
+  if (!density_grid_.Initialize(densities, width, height, depth)) {
+    return false;
+  }
+  BuildMajorants();
+  return true;
+}
+
+bool VolumeObject::LoadDensityGrid(const ::std::string& filename,
+                                   uint32 width, uint32 height,
+                                   uint32 depth) {
+  if (!density_grid_.Load(filename, width, height, depth)) {
+    return false;
+  }
+  BuildMajorants();
+  return true;
+}
+
+void VolumeObject::BuildMajorants() {
+  uint32 grid_size[3] = {density_grid_.GetWidth(), density_grid_.GetHeight(),
+                         density_grid_.GetDepth()};
+  for (uint32 axis = 0; axis < 3; axis++) {
+    majorant_size_[axis] =
+        min(max(grid_size[axis] - 1, 1u), kMaxMajorantGridSize);
+  }
+
+  majorants_.resize(majorant_size_[0] * majorant_size_[1] *
+                    majorant_size_[2]);
+  vector3 cell_size(1.0f / majorant_size_[0], 1.0f / majorant_size_[1],
+                    1.0f / majorant_size_[2]);
+  for (uint32 z = 0; z < majorant_size_[2]; z++) {
+    for (uint32 y = 0; y < majorant_size_[1]; y++) {
+      for (uint32 x = 0; x < majorant_size_[0]; x++) {
+        vector3 cell_min(x * cell_size.x, y * cell_size.y, z * cell_size.z);
+        majorants_[(z * majorant_size_[1] + y) * majorant_size_[0] + x] =
+            density_grid_.QueryMaxDensity(cell_min, cell_min + cell_size);
+      }
+    }
+  }
+}
+
+float32 VolumeObject::QueryDensityScale() const {
+  if (!material_ || material_->GetParams().type != kMaterialTypeMedium) {
+    return 0.0f;
+  }
+  return material_->GetParams().frost;
+}
+
+float32 VolumeObject::SampleDensity(const vector3& point) const {
+  vector3 extent = aabb_.bounds_max - aabb_.bounds_min;
+  vector3 local = point - aabb_.bounds_min;
+  return density_grid_.Sample(
+      vector3(local.x / extent.x, local.y / extent.y, local.z / extent.z));
+}
+
+bool VolumeObject::ClipRay(const vector3& start, const vector3& direction,
+                           float32* t_near, float32* t_far) const {
+  float32 near_dist = 0.0f;
+  float32 far_dist = BASE_INFINITY;
+  for (int32 axis = 0; axis < 3; axis++) {
+    float32 slab_min = aabb_.bounds_min[axis];
+    float32 slab_max = aabb_.bounds_max[axis];
+    if (fabs(direction[axis]) <= BASE_EPSILON) {
+      // Parallel to the slab, so the start must already lie within it.
+      if (start[axis] < slab_min || start[axis] > slab_max) {
+        return false;
+      }
+      continue;
+    }
+    float32 t0 = (slab_min - start[axis]) / direction[axis];
+    float32 t1 = (slab_max - start[axis]) / direction[axis];
+    if (t0 > t1) {
+      float32 temp = t0;
+      t0 = t1;
+      t1 = temp;
+    }
+    near_dist = max(near_dist, t0);
+    far_dist = min(far_dist, t1);
+    if (near_dist >= far_dist) {
+      return false;
+    }
+  }
+  *t_near = near_dist;
+  *t_far = far_dist;
+  return true;
+}
+
+template <typename Visitor>
+void VolumeObject::TraverseMajorants(const vector3& start,
+                                     const vector3& direction, float32 t_near,
+                                     float32 t_far, Visitor visit) const {
+  vector3 extent = aabb_.bounds_max - aabb_.bounds_min;
+  vector3 entry = start + direction * t_near - aabb_.bounds_min;
+  int32 cell[3];
+  int32 step[3];
+  float32 next_t[3];
+  float32 delta_t[3];
+
+  for (int32 axis = 0; axis < 3; axis++) {
+    float32 cell_size = extent[axis] / majorant_size_[axis];
+    cell[axis] = clip_range(int32(entry[axis] / cell_size), 0,
+                            int32(majorant_size_[axis]) - 1);
+    if (direction[axis] > BASE_EPSILON) {
+      step[axis] = 1;
+      next_t[axis] = t_near + ((cell[axis] + 1) * cell_size - entry[axis]) /
+                                  direction[axis];
+      delta_t[axis] = cell_size / direction[axis];
+    } else if (direction[axis] < -BASE_EPSILON) {
+      step[axis] = -1;
+      next_t[axis] =
+          t_near + (cell[axis] * cell_size - entry[axis]) / direction[axis];
+      delta_t[axis] = -cell_size / direction[axis];
+    } else {
+      step[axis] = 0;
+      next_t[axis] = BASE_INFINITY;
+      delta_t[axis] = BASE_INFINITY;
+    }
+  }
+
+  float32 t = t_near;
+  while (t < t_far) {
+    int32 axis = (next_t[0] < next_t[1]) ? 0 : 1;
+    if (next_t[2] < next_t[axis]) axis = 2;
+    float32 t_exit = min(next_t[axis], t_far);
+
+    float32 majorant =
+        majorants_[(cell[2] * majorant_size_[1] + cell[1]) *
+                       majorant_size_[0] +
+                   cell[0]];
+    if (!visit(t, t_exit, majorant)) {
+      return;
+    }
+
+    t = t_exit;
+    cell[axis] += step[axis];
+    if (cell[axis] < 0 || cell[axis] >= int32(majorant_size_[axis])) {
+      return;
+    }
+    next_t[axis] += delta_t[axis];
+  }
+}
+
+bool VolumeObject::Trace(const ray& trajectory, ObjectCollision* hit_info) {
+  if (hit_info->skip_media) {
+    return false;
+  }
+  float32 density_scale = QueryDensityScale();
+  float32 ray_length = trajectory.length();
+  if (density_scale <= 0.0f || ray_length <= 0.0f) {
+    return false;
+  }
+
+  vector3 direction = trajectory.dir / ray_length;
+  float32 t_near = 0.0f;
+  float32 t_far = 0.0f;
+  if (!ClipRay(trajectory.start, direction, &t_near, &t_far)) {
+    return false;
+  }
+  // Events beyond the ray or a nearer collision can never be reported.
+  t_far = min(t_far, min(hit_info->param, 1.0f) * ray_length);
+
+  float32 event_t = -1.0f;
+  TraverseMajorants(
+      trajectory.start, direction, t_near, t_far,
+      [&](float32 t_enter, float32 t_exit, float32 majorant) {
+        float32 sigma_max = majorant * density_scale;
+        if (sigma_max <= 0.0f) {
+          // Empty space is skipped in a single step.
+          return true;
+        }
+        // Free flights are memoryless, so sampling can restart at each
+        // cell boundary with the new majorant.
+        float32 t = t_enter;
+        while (true) {
+          t -= logf(1.0f - random_float()) / sigma_max;
+          if (t >= t_exit) {
+            return true;
+          }
+          float32 sigma =
+              SampleDensity(trajectory.start + direction * t) * density_scale;
+          if (random_float() * sigma_max < sigma) {
+            event_t = t;
+            return false;
+          }
+        }
+      });
+
+  if (event_t < 0.0f) {
+    return false;
+  }
+
+  hit_info->param = event_t / ray_length;
+  hit_info->point = trajectory.start + direction * event_t;
+  hit_info->surface_normal = vector3();
+  hit_info->surface_material = material_.get();
+  hit_info->surface_object = this;
+  hit_info->surface_texcoords = vector2();
+  return true;
+}
+
+void VolumeObject::Translate(const vector3& offset) {
+  aabb_.translate(offset);
+}
+
+float32 VolumeObject::QueryTransmittance(const ray& segment) const {
+  float32 density_scale = QueryDensityScale();
+  float32 ray_length = segment.length();
+  if (density_scale <= 0.0f || ray_length <= 0.0f) {
+    return 1.0f;
+  }
+
+  vector3 direction = segment.dir / ray_length;
+  float32 t_near = 0.0f;
+  float32 t_far = 0.0f;
+  if (!ClipRay(segment.start, direction, &t_near, &t_far)) {
+    return 1.0f;
+  }
+  t_far = min(t_far, ray_length);
+
+  float32 transmittance = 1.0f;
+  TraverseMajorants(
+      segment.start, direction, t_near, t_far,
+      [&](float32 t_enter, float32 t_exit, float32 majorant) {
+        float32 sigma_max = majorant * density_scale;
+        if (sigma_max <= 0.0f) {
+          return true;
+        }
+        float32 t = t_enter;
+        while (true) {
+          t -= logf(1.0f - random_float()) / sigma_max;
+          if (t >= t_exit) {
+            return true;
+          }
+          float32 sigma =
+              SampleDensity(segment.start + direction * t) * density_scale;
+          transmittance *= 1.0f - sigma / sigma_max;
+          if (transmittance < kTransmittanceRouletteThreshold) {
+            if (random_float() < 0.5f) {
+              transmittance = 0.0f;
+              return false;
+            }
+            transmittance *= 2.0f;
+          }
+        }
+      });
+  return transmittance;
+}
+
+}  // namespace base
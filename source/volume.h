@@ -0,0 +1,127 @@
+/*
+//
+// Copyright (c) 1998-2019 Joe Bertolami. All Right Reserved.
+//
+//   Redistribution and use in source and binary forms, with or without
+//   modification, are permitted provided that the following conditions are met:
+//
+//   * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//   AND ANY EXPRESS OR IMPLIED WARRANTIES, CLUDG, BUT NOT LIMITED TO, THE
+//   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//   ARE DISCLAIMED.  NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//   LIABLE FOR ANY DIRECT, DIRECT, CIDENTAL, SPECIAL, EXEMPLARY, OR
+//   CONSEQUENTIAL DAMAGES (CLUDG, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+//   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSESS TERRUPTION)
+//   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER  CONTRACT, STRICT
+//   LIABILITY, OR TORT (CLUDG NEGLIGENCE OR OTHERWISE) ARISG  ANY WAY  OF THE
+//   USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Additional Information:
+//
+//   For more information, visit http://www.bertolami.com.
+//
+*/
+
+
+#ifndef __VOLUME_H__
+#define __VOLUME_H__
+
+#include <string>
+#include <vector>
+#include "math/base.h"
+#include "object.h"
+
+namespace base {
+
+// Relative densities stored at the vertices of a regular grid that spans
+// the bounds of a volume. Lookups are trilinearly interpolated.
+class DensityGrid {
+ public:
+  DensityGrid();
+  // Copies width * height * depth densities, stored with x varying fastest.
+  bool Initialize(const float32* densities, uint32 width, uint32 height,
+                  uint32 depth);
+  // Loads raw float32 densities, stored with x varying fastest.
+  bool Load(const ::std::string& filename, uint32 width, uint32 height,
+            uint32 depth);
+  // Returns the density at local coordinates in [0, 1]^3.
+  float32 Sample(const vector3& local) const;
+  // Returns an upper bound on Sample over the local box [local_min,
+  // local_max].
+  float32 QueryMaxDensity(const vector3& local_min,
+                          const vector3& local_max) const;
+  uint32 GetWidth() const { return width_; }
+  uint32 GetHeight() const { return height_; }
+  uint32 GetDepth() const { return depth_; }
+
+ private:
+  float32 Fetch(uint32 x, uint32 y, uint32 z) const {
+    return densities_[(z * height_ + y) * width_ + x];
+  }
+  ::std::vector<float32> densities_;
+  uint32 width_;
+  uint32 height_;
+  uint32 depth_;
+};
+
+// An axis aligned box of heterogeneous participating media. The extinction
+// coefficient at a point is the density of the object's MediumMaterial
+// scaled by the density grid. A coarse grid of per cell density maxima
+// (majorants) is traversed with a 3D DDA so that empty regions cost a single
+// step, and free flights are sampled by delta tracking within each cell.
+class VolumeObject : public Object {
+ public:
+  // Creates a homogeneous volume centered at origin.
+  VolumeObject(const vector3& origin, const vector3& size);
+  const vector3 GetCenter() const override { return aabb_.query_center(); }
+  const bounds GetBounds() const override { return aabb_; }
+  // Samples a scattering event along the ray by delta tracking. Rays pass
+  // through unaffected if no event occurs before the nearest collision in
+  // hit_info, or if hit_info requests that media be skipped. Events report
+  // a zero surface normal.
+  bool Trace(const ray& trajectory, ObjectCollision* hit_info) override;
+  // Moves the volume bounds. The density grid moves with them.
+  void Translate(const vector3& offset) override;
+  // Returns an unbiased ratio tracking estimate of the transmittance along
+  // segment.
+  float32 QueryTransmittance(const ray& segment) const;
+  // Replaces the density grid and rebuilds the majorant grid.
+  bool SetDensityGrid(const float32* densities, uint32 width, uint32 height,
+                      uint32 depth);
+  // Loads a raw density grid from a file and rebuilds the majorant grid.
+  bool LoadDensityGrid(const ::std::string& filename, uint32 width,
+                       uint32 height, uint32 depth);
+
+ private:
+  // Returns the extinction coefficient where the density grid is 1.
+  float32 QueryDensityScale() const;
+  // Clips the ray (start, unit direction) to the volume bounds. Returns
+  // false if the ray misses the volume.
+  bool ClipRay(const vector3& start, const vector3& direction,
+               float32* t_near, float32* t_far) const;
+  // Walks the majorant cells overlapping [t_near, t_far] in order, calling
+  // visit(t_enter, t_exit, majorant) for each until it returns false.
+  template <typename Visitor>
+  void TraverseMajorants(const vector3& start, const vector3& direction,
+                         float32 t_near, float32 t_far, Visitor visit) const;
+  // Returns the grid density at a world space point within the volume.
+  float32 SampleDensity(const vector3& point) const;
+  // Rebuilds majorants_ from density_grid_.
+  void BuildMajorants();
+  bounds aabb_;
+  DensityGrid density_grid_;
+  // Maximum relative density within each majorant cell, x fastest.
+  ::std::vector<float32> majorants_;
+  uint32 majorant_size_[3];
+};
+
+}  // namespace base
+
+#endif  // __VOLUME_H__